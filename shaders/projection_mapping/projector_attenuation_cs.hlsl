@@ -7,11 +7,11 @@
 ConstantBuffer<projector_attenuation_cb> cb	: register(b0, space0);
 StructuredBuffer<projector_cb> projectors	: register(t0, space0);
 
-Texture2D<float4> renderResults[32]			: register(t0, space1);
-Texture2D<float2> worldNormals[32]			: register(t0, space2);
-Texture2D<float> depthTextures[32]			: register(t0, space3);
+Texture2D<float4> renderResults[]			: register(t0, space1);
+Texture2D<float2> worldNormals[]			: register(t0, space2);
+Texture2D<float> depthTextures[]			: register(t0, space3);
 
-RWTexture2D<float3> output[32]				: register(u0, space0);
+RWTexture2D<float3> output[]				: register(u0, space0);
 
 SamplerState clampSampler					: register(s0);
 
@@ -6,10 +6,10 @@
 ConstantBuffer<projector_best_mask_cb> cb	: register(b0, space0);
 StructuredBuffer<projector_cb> projectors	: register(t0, space0);
 
-Texture2D<float3> attenuationTextures[32]	: register(t0, space1);
-Texture2D<float> depthTextures[32]			: register(t0, space2);
+Texture2D<float3> attenuationTextures[]	: register(t0, space1);
+Texture2D<float> depthTextures[]			: register(t0, space2);
 
-RWTexture2D<float> outBestMasks[32]			: register(u0, space0);
+RWTexture2D<float> outBestMasks[]			: register(u0, space0);
 
 SamplerState borderSampler					: register(s0);
 SamplerState depthSampler					: register(s1);
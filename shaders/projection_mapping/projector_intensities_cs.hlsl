@@ -4,12 +4,16 @@
 
 ConstantBuffer<projector_intensity_cb> cb		: register(b0, space0);
 StructuredBuffer<projector_cb> allProjectors	: register(t0, space0);
+StructuredBuffer<uint> overlaps					: register(t1, space0);
+StructuredBuffer<uint> tileLists				: register(t2, space0);
+StructuredBuffer<projector_tile_classification> tileClassifications	: register(t3, space0);
 
-Texture2D<float3> attenuationTextures[32]		: register(t0, space1);
-Texture2D<float2> maskTextures[32]				: register(t0, space2);
-Texture2D<float> depthTextures[32]				: register(t0, space3);
+Texture2D<float3> attenuationTextures[]		: register(t0, space1);
+Texture2D<float2> maskTextures[]				: register(t0, space2);
+Texture2D<float> depthTextures[]				: register(t0, space3);
+Texture2D<float> previousIntensities[]			: register(t0, space4);
 
-RWTexture2D<float> outIntensities[32]			: register(u0, space0);
+RWTexture2D<float> outIntensities[]			: register(u0, space0);
 
 SamplerState borderSampler						: register(s0);
 SamplerState depthSampler						: register(s1);
@@ -20,33 +24,153 @@ struct projector_data
 	float attenuation;
 	float E;
 	float maxCompensationFactor;
-	float partialSum;
+	float2 uv; // Where the projector sees the point.
 };
 
-static projector_data fillOutData(float3 atten, float2 masks)
+static projector_data fillOutData(float3 atten, float2 masks, float2 uv)
 {
 	float attenuation = atten.x;
 	float E = atten.y;
 	float hardMask = masks.x;
 	float softMask = masks.y;
 
-	projector_data result = { attenuation, E * softMask, hardMask, 0.f };
+	projector_data result = { attenuation, E * softMask, hardMask, uv };
 	return result;
 }
 
+// Returns false, if the projector does not see P.
+static bool fetchProjectorData(uint projIndex, float3 P, out projector_data result)
+{
+	result = (projector_data)0;
+
+	float4 projected = mul(allProjectors[projIndex].viewProj, float4(P, 1.f));
+	projected.xyz /= projected.w;
+
+	float2 projUV = projected.xy * float2(0.5f, -0.5f) + float2(0.5f, 0.5f);
+	if (!all(projUV >= 0.f && projUV <= 1.f))
+	{
+		return false;
+	}
+
+	float testDepth = projected.z;
+
+	float projDepth = depthTextures[projIndex].SampleLevel(depthSampler, projUV, 0);
+	if (projDepth >= 1.f || testDepth > projDepth + 0.00005f)
+	{
+		return false;
+	}
+
+	result = fillOutData(
+		attenuationTextures[projIndex].SampleLevel(borderSampler, projUV, 0),
+		maskTextures[projIndex].SampleLevel(borderSampler, projUV, 0),
+		projUV);
+	return true;
+}
+
+// Iterates the other projectors, which see the pixel's tile, in ascending order.
+struct overlap_iterator
+{
+	uint base;
+	uint wordIndex;
+	uint word;
+};
+
+static uint getOverlapWord(uint base, uint wordIndex)
+{
+	if (cb.useOverlapCache)
+	{
+		return overlaps[base + wordIndex];
+	}
+
+	uint numProjectorsInWord = min(cb.numProjectors - wordIndex * 32, 32);
+	uint word = (numProjectorsInWord == 32) ? 0xFFFFFFFF : ((1u << numProjectorsInWord) - 1);
+	if (cb.index / 32 == wordIndex)
+	{
+		word &= ~(1u << (cb.index % 32));
+	}
+	return word;
+}
+
+static overlap_iterator beginOverlaps(uint2 tile)
+{
+	overlap_iterator it;
+	it.base = (cb.tileOffset + tile.y * cb.numTilesX + tile.x) * cb.numWords;
+	it.wordIndex = 0;
+	it.word = 0;
+
+	// No other projector sees a single-coverage tile.
+	if (cb.tileClass == projector_tile_single)
+	{
+		it.wordIndex = cb.numWords;
+	}
+	else if (cb.numWords > 0)
+	{
+		it.word = getOverlapWord(it.base, 0);
+	}
+	return it;
+}
+
+static bool nextOverlap(inout overlap_iterator it, out uint projIndex)
+{
+	projIndex = 0;
+	while (it.word == 0)
+	{
+		if (++it.wordIndex >= cb.numWords)
+		{
+			return false;
+		}
+		it.word = getOverlapWord(it.base, it.wordIndex);
+	}
+
+	uint bit = firstbitlow(it.word);
+	it.word &= it.word - 1;
+	projIndex = it.wordIndex * 32 + bit;
+	return true;
+}
+
+// Dispatches over a tile list have one thread group per listed tile. See projector_rs.hlsli for the list layout.
+static uint2 getTile(uint2 groupID)
+{
+	if (cb.tileClass == projector_tile_any)
+	{
+		return groupID;
+	}
+
+	uint listIndex = groupID.x;
+	if (cb.tileClass == projector_tile_empty)
+	{
+		listIndex += tileClassifications[cb.index].single.ThreadGroupCountX;
+	}
+	else if (cb.tileClass == projector_tile_multi)
+	{
+		listIndex = cb.numTiles - 1 - listIndex;
+	}
+
+	uint tile = tileLists[cb.tileOffset + listIndex];
+	return uint2(tile % cb.numTilesX, tile / cb.numTilesX);
+}
+
 [numthreads(PROJECTOR_BLOCK_SIZE, PROJECTOR_BLOCK_SIZE, 1)]
 [RootSignature(PROJECTOR_INTENSITIES_RS)]
 void main(cs_input IN)
 {
 	uint index = cb.index;
 
-	uint2 texCoord = IN.dispatchThreadID.xy;
+	uint2 tile = getTile(IN.groupID.xy);
+
+	uint2 texCoord = tile * PROJECTOR_BLOCK_SIZE + IN.groupThreadID.xy;
 	float2 dimensions = allProjectors[index].screenDims;
 	if (texCoord.x >= (uint)dimensions.x || texCoord.y >= (uint)dimensions.y)
 	{
 		return;
 	}
 
+	if (cb.tileClass == projector_tile_empty)
+	{
+		outIntensities[index][texCoord] = 0.f;
+		return;
+	}
+
 	float depth = depthTextures[index][texCoord];
 	if (depth == 1.f)
 	{
@@ -59,114 +183,114 @@ void main(cs_input IN)
 
 	float3 P = restoreWorldSpacePosition(allProjectors[index].invViewProj, uv, depth);
 
-	projector_data projectors[16];
-
-	float ESum = 0.f;
-
 	float3 attenuationAndTargetIntensity = attenuationTextures[index][texCoord];
-	projectors[0] = fillOutData(attenuationAndTargetIntensity, maskTextures[index][texCoord]);
-	ESum += projectors[0].E;
-
-	uint myProjectorIndex = 0;
-	uint numProjectors = 1;
-
+	projector_data myProj = fillOutData(attenuationAndTargetIntensity, maskTextures[index][texCoord], uv);
 
 	float targetIntensity = max(attenuationAndTargetIntensity.z, 0.001f);
 
 
-	for (uint projIndex = 0; projIndex < cb.numProjectors; ++projIndex)
+	// Single-coverage tiles are solved in one iteration anyway, so they take the regular path.
+	if (cb.warmStart && cb.tileClass != projector_tile_single)
 	{
-		if (projIndex != index)
-		{
-			float4 projected = mul(allProjectors[projIndex].viewProj, float4(P, 1.f));
-			projected.xyz /= projected.w;
+		float myPreviousIntensity = previousIntensities[index][texCoord];
 
-			float2 projUV = projected.xy * float2(0.5f, -0.5f) + float2(0.5f, 0.5f);
-			if (all(projUV >= 0.f && projUV <= 1.f))
-			{
-				float testDepth = projected.z;
+		float previousBrightness = myProj.attenuation * myPreviousIntensity;
+		float ESum = myProj.E;
 
-				float projDepth = depthTextures[projIndex].SampleLevel(depthSampler, projUV, 0);
-				if (projDepth < 1.f && testDepth <= projDepth + 0.00005f)
-				{
-					projectors[numProjectors] = fillOutData(
-						attenuationTextures[projIndex].SampleLevel(borderSampler, projUV, 0),
-						maskTextures[projIndex].SampleLevel(borderSampler, projUV, 0));
-					ESum += projectors[numProjectors].E;
-					++numProjectors;
-				}
+		overlap_iterator it = beginOverlaps(tile);
+		uint projIndex;
+		while (nextOverlap(it, projIndex))
+		{
+			projector_data proj;
+			if (fetchProjectorData(projIndex, P, proj))
+			{
+				float previousIntensity = previousIntensities[projIndex].SampleLevel(borderSampler, proj.uv, 0);
+				previousBrightness += proj.attenuation * previousIntensity;
+				ESum += proj.E;
 			}
 		}
+
+		outIntensities[index][texCoord] = warmStartProjectorIntensity(myPreviousIntensity, previousBrightness, ESum,
+			myProj.attenuation, myProj.E, myProj.maxCompensationFactor, targetIntensity);
+		return;
 	}
 
 
-	float remainingIntensity = targetIntensity;
+	// The projectors seeing P are not stored, but fetched again in every iteration. Only the projectors in the tile's overlap mask are
+	// tested. See projector_rs.hlsli.
+	projector_solver_state state;
+	state.ESum[0] = myProj.E;
+	state.remainingIntensity[0] = targetIntensity;
+	state.numIterations = 0;
 
-	const uint numIterations = 3;
+	uint numActiveProjectors = 1;
 
-	uint iteration = 0;
-	for (; iteration < numIterations && numProjectors > 0; ++iteration)
 	{
-		float nextESum = ESum;
-		float resultingIntensity = 0.f;
-
-
-		for (uint projIndex = 0; projIndex < numProjectors; ++projIndex)
+		overlap_iterator it = beginOverlaps(tile);
+		uint projIndex;
+		while (nextOverlap(it, projIndex))
 		{
-			float maxCompensation = projectors[projIndex].maxCompensationFactor * (1.f - projectors[projIndex].partialSum) / remainingIntensity;
+			projector_data proj;
+			if (fetchProjectorData(projIndex, P, proj))
+			{
+				state.ESum[0] += proj.E;
+				++numActiveProjectors;
+			}
+		}
+	}
 
-			float w = projectors[projIndex].E / ESum;
-			float g = clamp(w / projectors[projIndex].attenuation, 0.f, maxCompensation);
 
-			resultingIntensity += projectors[projIndex].attenuation * g * remainingIntensity;
+	for (uint iteration = 0; iteration < PROJECTOR_SOLVER_NUM_ITERATIONS && numActiveProjectors > 0; ++iteration)
+	{
+		state.numIterations = iteration + 1;
 
-			projectors[projIndex].partialSum += g * remainingIntensity;
+		float resultingIntensity = 0.f;
+		float nextESum = 0.f;
+		numActiveProjectors = 0;
 
-			if (g == maxCompensation)
-			{
-				// Projector intensity is depleted. Remove from list for next iteration.
-				//assert(fuzzyEquals(proj.partialSum, 1.f));
+		// Own projector first, then all others seeing the tile.
+		projector_data proj = myProj;
+		bool visible = true;
 
-				nextESum -= projectors[projIndex].E;
+		overlap_iterator it = beginOverlaps(tile);
+		uint projIndex;
 
+		while (true)
+		{
+			if (visible)
+			{
+				projector_solver_replay replay = replayProjectorSolver(state, iteration + 1, proj.attenuation, proj.E, proj.maxCompensationFactor);
 
+				resultingIntensity += replay.contribution;
 
-				if (myProjectorIndex == projIndex)
-				{
-					myProjectorIndex = numProjectors - 1;
-				}
-				else if (myProjectorIndex == numProjectors - 1)
+				// Depleted projectors are removed from the sum for the next iteration. The sum is rebuilt instead of subtracting the depleted
+				// projectors, which would cancel catastrophically, once only weak projectors remain.
+				if (replay.active)
 				{
-					myProjectorIndex = projIndex;
+					nextESum += proj.E;
+					++numActiveProjectors;
 				}
+			}
 
-				// Swap (don't overwrite), so that we can recover our projector of interest.
-				projector_data temp = projectors[projIndex];
-				projectors[projIndex] = projectors[numProjectors - 1];
-				projectors[numProjectors - 1] = temp;
-
-				--numProjectors;
-				--projIndex;
+			if (!nextOverlap(it, projIndex))
+			{
+				break;
 			}
+			visible = fetchProjectorData(projIndex, P, proj);
 		}
 
-
-
-
-
-		if (resultingIntensity >= remainingIntensity - 0.001f)
+		float remainingIntensity = state.remainingIntensity[iteration];
+		if (resultingIntensity >= remainingIntensity - 0.001f || iteration == PROJECTOR_SOLVER_NUM_ITERATIONS - 1)
 		{
-			++iteration; // Just for debug output.
 			break;
 		}
 
-		remainingIntensity -= resultingIntensity;
-		ESum = nextESum;
+		state.remainingIntensity[iteration + 1] = remainingIntensity - resultingIntensity;
+		state.ESum[iteration + 1] = nextESum;
 	}
 
 
-
-	projector_data myProj = projectors[myProjectorIndex];
-	float solverIntensity = myProj.partialSum / targetIntensity;
+	projector_solver_replay myReplay = replayProjectorSolver(state, state.numIterations, myProj.attenuation, myProj.E, myProj.maxCompensationFactor);
+	float solverIntensity = myReplay.partialSum / targetIntensity;
 	outIntensities[index][texCoord] = max(0.f, solverIntensity);
 }
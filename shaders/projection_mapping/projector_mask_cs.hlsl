@@ -6,12 +6,12 @@ ConstantBuffer<projector_mask_cb> cb				: register(b0, space0);
 ConstantBuffer<projector_mask_common_cb> common		: register(b1, space0);
 StructuredBuffer<projector_cb> projectors			: register(t0, space0);
 
-Texture2D<float> depthTextures[32]					: register(t0, space1);
-Texture2D<float2> discontinuityDistanceFields[32]	: register(t0, space2);
-Texture2D<float> bestMasks[32]						: register(t0, space3);
-Texture2D<float> bestMaskDistanceFields[32]			: register(t0, space4);
+Texture2D<float> depthTextures[]					: register(t0, space1);
+Texture2D<float2> discontinuityDistanceFields[]	: register(t0, space2);
+Texture2D<float> bestMasks[]						: register(t0, space3);
+Texture2D<float> bestMaskDistanceFields[]			: register(t0, space4);
 
-RWTexture2D<float2> output[32]						: register(u0, space0);
+RWTexture2D<float2> output[]						: register(u0, space0);
 
 SamplerState clampSampler							: register(s0);
 
@@ -0,0 +1,133 @@
+#include "cs.hlsli"
+#include "projector_rs.hlsli"
+#include "camera.hlsli"
+
+ConstantBuffer<projector_overlap_cb> cb			: register(b0, space0);
+StructuredBuffer<projector_cb> allProjectors	: register(t0, space0);
+StructuredBuffer<uint> dirtyProjectors			: register(t1, space0);
+
+Texture2D<float> depthTextures[]				: register(t0, space1);
+
+RWStructuredBuffer<uint> overlaps				: register(u0, space0);
+RWStructuredBuffer<uint> tileClasses			: register(u1, space0);
+
+SamplerState depthSampler						: register(s0);
+
+
+groupshared uint visibleProjectors;
+groupshared uint tileHasGeometry;
+
+
+// Same test as in the intensity shader.
+static bool isVisibleInProjector(uint projIndex, float3 P)
+{
+	float4 projected = mul(allProjectors[projIndex].viewProj, float4(P, 1.f));
+	projected.xyz /= projected.w;
+
+	float2 projUV = projected.xy * float2(0.5f, -0.5f) + float2(0.5f, 0.5f);
+	if (!all(projUV >= 0.f && projUV <= 1.f))
+	{
+		return false;
+	}
+
+	float testDepth = projected.z;
+
+	float projDepth = depthTextures[projIndex].SampleLevel(depthSampler, projUV, 0);
+	return projDepth < 1.f && testDepth <= projDepth + 0.00005f;
+}
+
+// One thread group per tile. Recomputes the bits of the dirty projectors (or all bits, if this projector itself is dirty) in the tile's
+// overlap mask, and the tile's class.
+[numthreads(PROJECTOR_BLOCK_SIZE, PROJECTOR_BLOCK_SIZE, 1)]
+[RootSignature(PROJECTOR_OVERLAP_RS)]
+void main(cs_input IN)
+{
+	uint index = cb.index;
+
+	uint2 texCoord = IN.dispatchThreadID.xy;
+	float2 dimensions = allProjectors[index].screenDims;
+
+	// Threads outside of the image or on background pixels still take part in the group synchronization below.
+	bool valid = texCoord.x < (uint)dimensions.x && texCoord.y < (uint)dimensions.y;
+
+	float depth = valid ? depthTextures[index][texCoord] : 1.f;
+	valid = valid && depth < 1.f;
+
+	float2 uv = (float2(texCoord) + float2(0.5f, 0.5f)) * allProjectors[index].invScreenDims;
+	float3 P = restoreWorldSpacePosition(allProjectors[index].invViewProj, uv, depth);
+
+	uint tileIndex = cb.tileOffset + IN.groupID.y * cb.numTilesX + IN.groupID.x;
+
+	if (IN.groupIndex == 0)
+	{
+		tileHasGeometry = 0;
+	}
+	GroupMemoryBarrierWithGroupSync();
+
+	if (valid)
+	{
+		InterlockedOr(tileHasGeometry, 1);
+	}
+	GroupMemoryBarrierWithGroupSync();
+
+	for (uint wordIndex = 0; wordIndex < cb.numWords; ++wordIndex)
+	{
+		uint firstProjector = wordIndex * 32;
+		uint numProjectorsInWord = min(cb.numProjectors - firstProjector, 32);
+		uint allInWord = (numProjectorsInWord == 32) ? 0xFFFFFFFF : ((1u << numProjectorsInWord) - 1);
+
+		uint testMask = cb.rebuildAll ? allInWord : dirtyProjectors[wordIndex];
+		if (index / 32 == wordIndex)
+		{
+			testMask &= ~(1u << (index % 32));
+		}
+
+		if (testMask == 0 && !cb.rebuildAll)
+		{
+			continue; // Uniform across the group. A rebuild still has to write the word.
+		}
+
+		if (IN.groupIndex == 0)
+		{
+			visibleProjectors = 0;
+		}
+		GroupMemoryBarrierWithGroupSync();
+
+		if (valid)
+		{
+			uint mask = testMask;
+			while (mask != 0)
+			{
+				uint bit = firstbitlow(mask);
+				mask &= mask - 1;
+
+				if (isVisibleInProjector(firstProjector + bit, P))
+				{
+					InterlockedOr(visibleProjectors, 1u << bit);
+				}
+			}
+		}
+		GroupMemoryBarrierWithGroupSync();
+
+		if (IN.groupIndex == 0)
+		{
+			uint address = tileIndex * cb.numWords + wordIndex;
+			uint unchanged = cb.rebuildAll ? 0 : (overlaps[address] & ~testMask);
+			overlaps[address] = unchanged | visibleProjectors;
+		}
+		GroupMemoryBarrierWithGroupSync();
+	}
+
+	if (IN.groupIndex == 0)
+	{
+		uint anyOverlap = 0;
+		for (uint wordIndex = 0; wordIndex < cb.numWords; ++wordIndex)
+		{
+			anyOverlap |= overlaps[tileIndex * cb.numWords + wordIndex];
+		}
+
+		tileClasses[tileIndex] = !tileHasGeometry ? projector_tile_empty
+			: (anyOverlap != 0) ? projector_tile_multi
+			: projector_tile_single;
+	}
+}
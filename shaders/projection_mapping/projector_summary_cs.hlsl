@@ -0,0 +1,55 @@
+#include "cs.hlsli"
+#include "projector_rs.hlsli"
+
+ConstantBuffer<projector_summary_cb> cb					: register(b0, space0);
+StructuredBuffer<projector_cb> projectors				: register(t0, space0);
+
+Texture2D<float> depthTextures[]						: register(t0, space1);
+Texture2D<float3> attenuationTextures[]				: register(t0, space2);
+Texture2D<float2> maskTextures[]						: register(t0, space3);
+
+RWStructuredBuffer<projector_summary_texel> summaries	: register(u0, space0);
+
+
+// One thread per summary texel. See projector_rs.hlsli.
+[numthreads(PROJECTOR_BLOCK_SIZE, PROJECTOR_BLOCK_SIZE, 1)]
+[RootSignature(PROJECTOR_SUMMARY_RS)]
+void main(cs_input IN)
+{
+	uint index = cb.index;
+
+	uint2 texel = IN.dispatchThreadID.xy;
+	uint2 summaryDims = uint2(cb.summaryWidth, cb.summaryHeight);
+	if (texel.x >= summaryDims.x || texel.y >= summaryDims.y)
+	{
+		return;
+	}
+
+	// The pixels covered by the texel. Same mapping as when sampling the summary with the projector's UVs.
+	uint2 dimensions = (uint2)projectors[index].screenDims;
+	uint2 begin = texel * dimensions / summaryDims;
+	uint2 end = (texel + 1) * dimensions / summaryDims;
+
+	float maxDepth = 0.f;
+	float4 sum = (float4)0.f;
+	uint count = 0;
+
+	for (uint y = begin.y; y < end.y; ++y)
+	{
+		for (uint x = begin.x; x < end.x; ++x)
+		{
+			float depth = depthTextures[index][uint2(x, y)];
+			if (depth < 1.f)
+			{
+				maxDepth = max(maxDepth, depth);
+				sum += float4(attenuationTextures[index][uint2(x, y)].xy, maskTextures[index][uint2(x, y)]);
+				++count;
+			}
+		}
+	}
+
+	float4 mean = (count > 0) ? (sum / count) : (float4)0.f;
+
+	summaries[cb.summaryOffset + texel.y * summaryDims.x + texel.x] =
+		packProjectorSummary((count > 0) ? maxDepth : 1.f, mean.x, mean.y, mean.z, mean.w);
+}
@@ -0,0 +1,28 @@
+#include "cs.hlsli"
+#include "projector_rs.hlsli"
+
+ConstantBuffer<projector_summary_unpack_cb> cb			: register(b0, space0);
+StructuredBuffer<projector_summary_texel> summary		: register(t0, space0);
+
+RWTexture2D<float> outDepth								: register(u0, space0);
+RWTexture2D<float2> outAttenuation						: register(u1, space0);
+RWTexture2D<float2> outMasks							: register(u2, space0);
+
+
+[numthreads(PROJECTOR_BLOCK_SIZE, PROJECTOR_BLOCK_SIZE, 1)]
+[RootSignature(PROJECTOR_SUMMARY_UNPACK_RS)]
+void main(cs_input IN)
+{
+	uint2 texel = IN.dispatchThreadID.xy;
+	if (texel.x >= cb.summaryWidth || texel.y >= cb.summaryHeight)
+	{
+		return;
+	}
+
+	projector_summary_texel packed = summary[texel.y * cb.summaryWidth + texel.x];
+	projector_summary_values values = unpackProjectorSummary(packed);
+
+	outDepth[texel] = packed.depth;
+	outAttenuation[texel] = float2(values.attenuation, values.E);
+	outMasks[texel] = float2(values.hardMask, values.softMask);
+}
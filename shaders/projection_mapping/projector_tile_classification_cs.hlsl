@@ -0,0 +1,71 @@
+#include "cs.hlsli"
+#include "projector_rs.hlsli"
+
+StructuredBuffer<projector_tile_range> ranges							: register(t0, space0);
+StructuredBuffer<uint> tileClasses										: register(t1, space0);
+
+RWStructuredBuffer<uint> tileLists										: register(u0, space0);
+RWStructuredBuffer<projector_tile_classification> classifications		: register(u1, space0);
+
+
+groupshared uint numTilesPerClass[3];
+groupshared uint writeIndices[3];
+
+
+static D3D12_DISPATCH_ARGUMENTS createArguments(uint numTiles)
+{
+	D3D12_DISPATCH_ARGUMENTS result;
+	result.ThreadGroupCountX = numTiles;
+	result.ThreadGroupCountY = 1;
+	result.ThreadGroupCountZ = 1;
+	return result;
+}
+
+// One thread group per projector. Counts the tiles per class, then sorts them into the projector's tile list (see projector_rs.hlsli).
+[numthreads(PROJECTOR_TILE_CLASSIFICATION_BLOCK_SIZE, 1, 1)]
+[RootSignature(PROJECTOR_TILE_CLASSIFICATION_RS)]
+void main(cs_input IN)
+{
+	projector_tile_range range = ranges[IN.groupID.x];
+
+	if (IN.groupIndex < 3)
+	{
+		numTilesPerClass[IN.groupIndex] = 0;
+	}
+	GroupMemoryBarrierWithGroupSync();
+
+	for (uint tile = IN.groupIndex; tile < range.numTiles; tile += PROJECTOR_TILE_CLASSIFICATION_BLOCK_SIZE)
+	{
+		InterlockedAdd(numTilesPerClass[tileClasses[range.tileOffset + tile]], 1);
+	}
+	GroupMemoryBarrierWithGroupSync();
+
+	if (IN.groupIndex == 0)
+	{
+		writeIndices[projector_tile_single] = 0;
+		writeIndices[projector_tile_empty] = numTilesPerClass[projector_tile_single];
+		writeIndices[projector_tile_multi] = 0; // Counted from the back.
+
+		projector_tile_classification result;
+		result.single = createArguments(numTilesPerClass[projector_tile_single]);
+		result.empty = createArguments(numTilesPerClass[projector_tile_empty]);
+		result.multi = createArguments(numTilesPerClass[projector_tile_multi]);
+		classifications[IN.groupID.x] = result;
+	}
+	GroupMemoryBarrierWithGroupSync();
+
+	for (uint tile = IN.groupIndex; tile < range.numTiles; tile += PROJECTOR_TILE_CLASSIFICATION_BLOCK_SIZE)
+	{
+		uint tileClass = tileClasses[range.tileOffset + tile];
+
+		uint writeIndex;
+		InterlockedAdd(writeIndices[tileClass], 1, writeIndex);
+
+		if (tileClass == projector_tile_multi)
+		{
+			writeIndex = range.numTiles - 1 - writeIndex;
+		}
+
+		tileLists[range.tileOffset + writeIndex] = tile;
+	}
+}
@@ -1,6 +1,8 @@
 #ifndef PROJECTOR_HLSLI
 #define PROJECTOR_HLSLI
 
+#include "indirect.hlsli"
+
 #define PROJECTOR_BLOCK_SIZE 16
 
 
@@ -110,19 +112,172 @@ struct projector_mask_common_cb
 
 
 
+// The intensity solver distributes the remaining target intensity among all projectors seeing a pixel, in a few iterations. Each projector's
+// share in an iteration only depends on its own data and on the per-pixel totals of that iteration. The solver therefore only stores the
+// totals and streams over the projectors once per iteration, replaying a projector's previous iterations when it is visited again. This
+// way there is no per-pixel list of overlapping projectors, and no limit on how many projectors overlap.
+
+#define PROJECTOR_SOLVER_NUM_ITERATIONS 3
+
+struct projector_solver_state
+{
+    float ESum[PROJECTOR_SOLVER_NUM_ITERATIONS];                // Sum of E over the projectors, which are still active.
+    float remainingIntensity[PROJECTOR_SOLVER_NUM_ITERATIONS];
+    uint32 numIterations;
+};
+
+struct projector_solver_replay
+{
+    float partialSum;       // Accumulated over all replayed iterations.
+    float contribution;     // Intensity added in the last replayed iteration.
+    bool active;            // Not depleted after the last replayed iteration.
+};
+
+static projector_solver_replay replayProjectorSolver(projector_solver_state state, uint32 numIterations,
+    float attenuation, float E, float maxCompensationFactor)
+{
+    projector_solver_replay result;
+    result.partialSum = 0.f;
+    result.contribution = 0.f;
+    result.active = true;
+
+    for (uint32 iteration = 0; iteration < numIterations; ++iteration)
+    {
+        if (!result.active)
+        {
+            // Depleted in an earlier iteration. Does not contribute anymore.
+            result.contribution = 0.f;
+            break;
+        }
+
+        float remainingIntensity = state.remainingIntensity[iteration];
+        float maxCompensation = maxCompensationFactor * (1.f - result.partialSum) / remainingIntensity;
+
+        float w = (state.ESum[iteration] > 0.f) ? (E / state.ESum[iteration]) : 0.f;
+        // Like the division by zero in the original solver: Without attenuation, any share of E asks for the maximum compensation.
+        float g = (attenuation > 0.f) ? clamp(w / attenuation, 0.f, maxCompensation) : ((w > 0.f) ? maxCompensation : 0.f);
+
+        result.contribution = attenuation * g * remainingIntensity;
+        result.partialSum += g * remainingIntensity;
+        result.active = (g != maxCompensation);
+    }
+
+    return result;
+}
+
+// Warm start for small motion: Instead of solving from scratch, the last intensities (relative to the target, like the solver's output) of
+// all projectors seeing a point are corrected in one pass. The difference between the target and the brightness they produce with the
+// current attenuations is distributed by E, like in the first solver iteration. What is lost to clamping is left for the next frames.
+static float warmStartProjectorIntensity(float previousIntensity, float previousBrightness, float ESum,
+    float attenuation, float E, float maxCompensationFactor, float targetIntensity)
+{
+    float w = (ESum > 0.f) ? (E / ESum) : 0.f;
+    float correction = (attenuation > 0.f) ? (w * (1.f - previousBrightness) / attenuation) : 0.f;
+    return clamp(previousIntensity + correction, 0.f, maxCompensationFactor / targetIntensity);
+}
+
+
+// Overlap cache: Per tile of PROJECTOR_BLOCK_SIZE x PROJECTOR_BLOCK_SIZE pixels, a bit mask of the other projectors, which see at least one
+// of the tile's points. The intensity shader only visits these projectors. Tiles of all projectors are stored back to back, each with
+// numWords words.
+
+struct projector_overlap_cb
+{
+    uint32 index;
+    uint32 numProjectors;
+    uint32 tileOffset;      // First tile of this projector.
+    uint32 numTilesX;
+    uint32 numWords;        // Words per tile mask.
+    uint32 rebuildAll;      // Test all other projectors. Otherwise only the ones set in the dirty mask.
+};
+
+#define PROJECTOR_OVERLAP_RS \
+    "RootFlags(0), " \
+    "RootConstants(num32BitConstants=6, b0),"  \
+    "SRV(t0, space=0), " \
+    "SRV(t1, space=0), " \
+    "DescriptorTable( SRV(t0, space=1, numDescriptors=unbounded, flags=DESCRIPTORS_VOLATILE) ), " \
+    "UAV(u0, space=0), " \
+    "UAV(u1, space=0), " \
+    "StaticSampler(s0," \
+        "addressU = TEXTURE_ADDRESS_BORDER," \
+        "addressV = TEXTURE_ADDRESS_BORDER," \
+        "addressW = TEXTURE_ADDRESS_BORDER," \
+        "filter = FILTER_MIN_MAG_MIP_POINT," \
+        "borderColor = STATIC_BORDER_COLOR_OPAQUE_WHITE)"
+
+#define PROJECTOR_OVERLAP_RS_CB                     0
+#define PROJECTOR_OVERLAP_RS_PROJECTORS             1
+#define PROJECTOR_OVERLAP_RS_DIRTY_PROJECTORS       2
+#define PROJECTOR_OVERLAP_RS_DEPTH_TEXTURES         3
+#define PROJECTOR_OVERLAP_RS_OVERLAPS               4
+#define PROJECTOR_OVERLAP_RS_TILE_CLASSES           5
+
+
+
+// Tile classes, written by the overlap pass along with the masks: A tile is empty, if none of its pixels shows geometry, and multi-coverage,
+// if any other projector sees it. Only the multi-coverage tiles run the solver over several projectors. The classification pass sorts the
+// tiles of each projector into a list (in the projector's tile range): Single-coverage tiles first, then the empty ones, and the
+// multi-coverage tiles from the back. The intensity pass is dispatched indirectly per class.
+
+#define projector_tile_empty        0
+#define projector_tile_single       1
+#define projector_tile_multi        2
+#define projector_tile_any          3 // Full dispatch over the image, without tile lists.
+
+#define PROJECTOR_TILE_CLASSIFICATION_BLOCK_SIZE 256
+
+struct projector_tile_range
+{
+    uint32 tileOffset;
+    uint32 numTiles;
+};
+
+struct projector_tile_classification
+{
+    D3D12_DISPATCH_ARGUMENTS single;
+    D3D12_DISPATCH_ARGUMENTS empty;
+    D3D12_DISPATCH_ARGUMENTS multi;
+};
+
+#define PROJECTOR_TILE_CLASSIFICATION_RS \
+    "RootFlags(0), " \
+    "SRV(t0, space=0), " \
+    "SRV(t1, space=0), " \
+    "UAV(u0, space=0), " \
+    "UAV(u1, space=0)"
+
+#define PROJECTOR_TILE_CLASSIFICATION_RS_RANGES             0
+#define PROJECTOR_TILE_CLASSIFICATION_RS_TILE_CLASSES       1
+#define PROJECTOR_TILE_CLASSIFICATION_RS_TILE_LISTS         2
+#define PROJECTOR_TILE_CLASSIFICATION_RS_CLASSIFICATIONS    3
+
+
+
 struct projector_intensity_cb
 {
     uint32 index;
     uint32 numProjectors;
+    uint32 tileOffset;      // See projector_overlap_cb.
+    uint32 numTilesX;
+    uint32 numWords;
+    uint32 useOverlapCache; // Otherwise all other projectors are visited.
+    uint32 numTiles;
+    uint32 tileClass;       // Tiles of this dispatch, projector_tile_*.
+    uint32 warmStart;       // Correct the previous intensities instead of solving from scratch.
 };
 
 #define PROJECTOR_INTENSITIES_RS \
     "RootFlags(0), " \
-    "RootConstants(num32BitConstants=2, b0),"  \
+    "RootConstants(num32BitConstants=9, b0),"  \
     "SRV(t0, space=0), " \
+    "SRV(t1, space=0), " \
+    "SRV(t2, space=0), " \
+    "SRV(t3, space=0), " \
     "DescriptorTable( SRV(t0, space=1, numDescriptors=unbounded, flags=DESCRIPTORS_VOLATILE) ), " \
     "DescriptorTable( SRV(t0, space=2, numDescriptors=unbounded, flags=DESCRIPTORS_VOLATILE) ), " \
     "DescriptorTable( SRV(t0, space=3, numDescriptors=unbounded, flags=DESCRIPTORS_VOLATILE) ), " \
+    "DescriptorTable( SRV(t0, space=4, numDescriptors=unbounded, flags=DESCRIPTORS_VOLATILE) ), " \
     "DescriptorTable( UAV(u0, space=0, numDescriptors=unbounded, flags=DESCRIPTORS_VOLATILE) ), " \
     "StaticSampler(s0," \
         "addressU = TEXTURE_ADDRESS_BORDER," \
@@ -139,10 +294,14 @@ struct projector_intensity_cb
 
 #define PROJECTOR_INTENSITIES_RS_CB                 0
 #define PROJECTOR_INTENSITIES_RS_PROJECTORS         1
-#define PROJECTOR_INTENSITIES_RS_ATTENUATIONS       2
-#define PROJECTOR_INTENSITIES_RS_MASKS              3
-#define PROJECTOR_INTENSITIES_RS_DEPTH_TEXTURES     4
-#define PROJECTOR_INTENSITIES_RS_OUT_INTENSITIES    5
+#define PROJECTOR_INTENSITIES_RS_OVERLAPS           2
+#define PROJECTOR_INTENSITIES_RS_TILE_LISTS         3
+#define PROJECTOR_INTENSITIES_RS_CLASSIFICATIONS    4
+#define PROJECTOR_INTENSITIES_RS_ATTENUATIONS       5
+#define PROJECTOR_INTENSITIES_RS_MASKS              6
+#define PROJECTOR_INTENSITIES_RS_DEPTH_TEXTURES     7
+#define PROJECTOR_INTENSITIES_RS_PREVIOUS_INTENSITIES 8
+#define PROJECTOR_INTENSITIES_RS_OUT_INTENSITIES    9
 
 
 
@@ -181,6 +340,97 @@ struct projector_best_mask_cb
 
 
 
+// Distributed solving: Each network node only solves its own projectors. The projectors of other nodes are represented by summaries with
+// one texel per tile of PROJECTOR_BLOCK_SIZE x PROJECTOR_BLOCK_SIZE pixels, which are sampled in place of their depth, attenuation and mask
+// textures. The depth is the farthest geometry in the texel (1 if there is none), so that points on all of the texel's surfaces pass the
+// visibility tests. The other values are averaged over the geometry.
+
+struct projector_summary_texel
+{
+    float depth;
+    uint32 attenuationAndE; // Half floats.
+    uint32 masks;           // Hard and soft mask, 16 bit unorm each.
+};
+
+static projector_summary_texel packProjectorSummary(float depth, float attenuation, float E, float hardMask, float softMask)
+{
+    projector_summary_texel result;
+    result.depth = depth;
+#ifdef HLSL
+    result.attenuationAndE = f32tof16(attenuation) | (f32tof16(E) << 16);
+#else
+    result.attenuationAndE = (uint32)half(attenuation).h | ((uint32)half(E).h << 16);
+#endif
+    result.masks = (uint32)(saturate(hardMask) * 65535.f + 0.5f) | ((uint32)(saturate(softMask) * 65535.f + 0.5f) << 16);
+    return result;
+}
+
+struct projector_summary_values
+{
+    float attenuation;
+    float E;
+    float hardMask;
+    float softMask;
+};
+
+static projector_summary_values unpackProjectorSummary(projector_summary_texel texel)
+{
+    projector_summary_values result;
+#ifdef HLSL
+    result.attenuation = f16tof32(texel.attenuationAndE);
+    result.E = f16tof32(texel.attenuationAndE >> 16);
+#else
+    result.attenuation = half((uint16)(texel.attenuationAndE & 0xFFFF));
+    result.E = half((uint16)(texel.attenuationAndE >> 16));
+#endif
+    result.hardMask = (texel.masks & 0xFFFF) / 65535.f;
+    result.softMask = (texel.masks >> 16) / 65535.f;
+    return result;
+}
+
+struct projector_summary_cb
+{
+    uint32 index;
+    uint32 summaryOffset;   // First texel of the projector in the summary buffer.
+    uint32 summaryWidth;
+    uint32 summaryHeight;
+};
+
+#define PROJECTOR_SUMMARY_RS \
+    "RootFlags(0), " \
+    "RootConstants(num32BitConstants=4, b0),"  \
+    "SRV(t0, space=0), " \
+    "DescriptorTable( SRV(t0, space=1, numDescriptors=unbounded, flags=DESCRIPTORS_VOLATILE) ), " \
+    "DescriptorTable( SRV(t0, space=2, numDescriptors=unbounded, flags=DESCRIPTORS_VOLATILE) ), " \
+    "DescriptorTable( SRV(t0, space=3, numDescriptors=unbounded, flags=DESCRIPTORS_VOLATILE) ), " \
+    "UAV(u0, space=0)"
+
+#define PROJECTOR_SUMMARY_RS_CB                     0
+#define PROJECTOR_SUMMARY_RS_PROJECTORS             1
+#define PROJECTOR_SUMMARY_RS_DEPTH_TEXTURES         2
+#define PROJECTOR_SUMMARY_RS_ATTENUATIONS           3
+#define PROJECTOR_SUMMARY_RS_MASKS                  4
+#define PROJECTOR_SUMMARY_RS_OUTPUT                 5
+
+struct projector_summary_unpack_cb
+{
+    uint32 summaryWidth;
+    uint32 summaryHeight;
+};
+
+// Writes a received summary into the depth, attenuation and mask textures, which stand in for the remote projector's.
+#define PROJECTOR_SUMMARY_UNPACK_RS \
+    "RootFlags(0), " \
+    "RootConstants(num32BitConstants=2, b0),"  \
+    "SRV(t0), " \
+    "DescriptorTable( UAV(u0, numDescriptors = 3) )"
+
+#define PROJECTOR_SUMMARY_UNPACK_RS_CB              0
+#define PROJECTOR_SUMMARY_UNPACK_RS_SUMMARY         1
+#define PROJECTOR_SUMMARY_UNPACK_RS_OUTPUT          2
+
+
+
 
 
 
@@ -44,6 +44,28 @@ struct tracking_correspondence
 	vec4 grad1;
 };
 
+
+// Normal-space sampling of correspondences. Normals, which face the camera, are binned by their x and y components. Each bin then keeps
+// the same number of correspondences, so that the few correspondences on side faces, which constrain the pose in directions the large
+// flat faces don't, are not drowned out.
+#define TRACKING_NORMAL_SPACE_BINS_PER_AXIS 8
+#define TRACKING_NUM_NORMAL_SPACE_BINS (TRACKING_NORMAL_SPACE_BINS_PER_AXIS * TRACKING_NORMAL_SPACE_BINS_PER_AXIS)
+
+static uint32 getNormalSpaceBin(vec3 normal)
+{
+	const float binsPerAxis = TRACKING_NORMAL_SPACE_BINS_PER_AXIS;
+	uint32 x = (uint32)clamp((normal.x * 0.5f + 0.5f) * binsPerAxis, 0.f, binsPerAxis - 1.f);
+	uint32 y = (uint32)clamp((normal.y * 0.5f + 0.5f) * binsPerAxis, 0.f, binsPerAxis - 1.f);
+	return y * TRACKING_NORMAL_SPACE_BINS_PER_AXIS + x;
+}
+
+// Selects the n-th correspondence of a bin (in a fixed order), if this raises floor(n * rate). Of N correspondences, this keeps
+// floor(N * rate), evenly spread over the bin, and needs no random numbers or synchronization beyond the per bin counter.
+static bool selectNormalSpaceSample(uint32 indexInBin, float rate)
+{
+	return (uint32)((indexInBin + 1) * rate) > (uint32)(indexInBin * rate);
+}
+
 struct tracking_indirect
 {
 	D3D12_DISPATCH_ARGUMENTS initialICP;
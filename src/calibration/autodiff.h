@@ -0,0 +1,79 @@
+#pragma once
+
+#include <cmath>
+
+// Forward-mode automatic differentiation.
+// A jet carries a value and its derivatives with respect to N parameters. All storage is fixed size, so evaluating
+// a residual on jets does not allocate.
+
+template <uint32 N>
+struct jet
+{
+	double v;
+	double d[N];
+
+	jet() {}
+	jet(double v) : v(v) { for (uint32 i = 0; i < N; ++i) { d[i] = 0.0; } }
+
+	// Seeds the jet as the i-th parameter.
+	static jet variable(double v, uint32 i) { jet result(v); result.d[i] = 1.0; return result; }
+};
+
+template <uint32 N> static jet<N> operator+(const jet<N>& a, const jet<N>& b) { jet<N> r; r.v = a.v + b.v; for (uint32 i = 0; i < N; ++i) { r.d[i] = a.d[i] + b.d[i]; } return r; }
+template <uint32 N> static jet<N> operator-(const jet<N>& a, const jet<N>& b) { jet<N> r; r.v = a.v - b.v; for (uint32 i = 0; i < N; ++i) { r.d[i] = a.d[i] - b.d[i]; } return r; }
+template <uint32 N> static jet<N> operator*(const jet<N>& a, const jet<N>& b) { jet<N> r; r.v = a.v * b.v; for (uint32 i = 0; i < N; ++i) { r.d[i] = a.d[i] * b.v + a.v * b.d[i]; } return r; }
+template <uint32 N> static jet<N> operator/(const jet<N>& a, const jet<N>& b) { jet<N> r; double inv = 1.0 / b.v; r.v = a.v * inv; for (uint32 i = 0; i < N; ++i) { r.d[i] = (a.d[i] - r.v * b.d[i]) * inv; } return r; }
+template <uint32 N> static jet<N> operator-(const jet<N>& a) { jet<N> r; r.v = -a.v; for (uint32 i = 0; i < N; ++i) { r.d[i] = -a.d[i]; } return r; }
+
+template <uint32 N> static jet<N> operator+(const jet<N>& a, double b) { jet<N> r = a; r.v += b; return r; }
+template <uint32 N> static jet<N> operator+(double a, const jet<N>& b) { return b + a; }
+template <uint32 N> static jet<N> operator-(const jet<N>& a, double b) { jet<N> r = a; r.v -= b; return r; }
+template <uint32 N> static jet<N> operator-(double a, const jet<N>& b) { jet<N> r = -b; r.v += a; return r; }
+template <uint32 N> static jet<N> operator*(const jet<N>& a, double b) { jet<N> r; r.v = a.v * b; for (uint32 i = 0; i < N; ++i) { r.d[i] = a.d[i] * b; } return r; }
+template <uint32 N> static jet<N> operator*(double a, const jet<N>& b) { return b * a; }
+template <uint32 N> static jet<N> operator/(const jet<N>& a, double b) { return a * (1.0 / b); }
+template <uint32 N> static jet<N> operator/(double a, const jet<N>& b) { jet<N> r; r.v = a / b.v; double s = -r.v / b.v; for (uint32 i = 0; i < N; ++i) { r.d[i] = b.d[i] * s; } return r; }
+
+template <uint32 N> static jet<N>& operator+=(jet<N>& a, const jet<N>& b) { a = a + b; return a; }
+template <uint32 N> static jet<N>& operator-=(jet<N>& a, const jet<N>& b) { a = a - b; return a; }
+template <uint32 N> static jet<N>& operator*=(jet<N>& a, const jet<N>& b) { a = a * b; return a; }
+template <uint32 N> static jet<N>& operator/=(jet<N>& a, const jet<N>& b) { a = a / b; return a; }
+
+// Applies the chain rule for a function with value f and derivative df at a.v.
+template <uint32 N>
+static jet<N> chain(const jet<N>& a, double f, double df)
+{
+	jet<N> r;
+	r.v = f;
+	for (uint32 i = 0; i < N; ++i)
+	{
+		r.d[i] = a.d[i] * df;
+	}
+	return r;
+}
+
+template <uint32 N> static jet<N> sin(const jet<N>& a) { return chain(a, std::sin(a.v), std::cos(a.v)); }
+template <uint32 N> static jet<N> cos(const jet<N>& a) { return chain(a, std::cos(a.v), -std::sin(a.v)); }
+template <uint32 N> static jet<N> tan(const jet<N>& a) { double t = std::tan(a.v); return chain(a, t, 1.0 + t * t); }
+template <uint32 N> static jet<N> exp(const jet<N>& a) { double e = std::exp(a.v); return chain(a, e, e); }
+template <uint32 N> static jet<N> log(const jet<N>& a) { return chain(a, std::log(a.v), 1.0 / a.v); }
+template <uint32 N> static jet<N> sqrt(const jet<N>& a) { double s = std::sqrt(a.v); return chain(a, s, 0.5 / s); }
+template <uint32 N> static jet<N> abs(const jet<N>& a) { return (a.v < 0.0) ? -a : a; }
+
+template <uint32 N>
+static jet<N> atan2(const jet<N>& y, const jet<N>& x)
+{
+	jet<N> r;
+	r.v = std::atan2(y.v, x.v);
+	double inv = 1.0 / (x.v * x.v + y.v * y.v);
+	for (uint32 i = 0; i < N; ++i)
+	{
+		r.d[i] = (x.v * y.d[i] - y.v * x.d[i]) * inv;
+	}
+	return r;
+}
+
+// Scalar access, so that templated residual code can branch on values.
+static double scalarValue(double a) { return a; }
+template <uint32 N> static double scalarValue(const jet<N>& a) { return a.v; }
+
@@ -11,9 +11,11 @@
 #include "core/imgui.h"
 #include "core/log.h"
 #include "core/image.h"
+#include "core/async_image_writer.h"
 #include "core/color.h"
 #include "core/cpu_profiling.h"
 #include "core/string.h"
+#include "core/threading.h"
 
 #include "editor/file_dialog.h"
 
@@ -31,6 +33,7 @@
 #include "rendering/render_utils.h"
 #include "rendering/render_resources.h"
 #include "rendering/debug_visualization.h"
+#include "rendering/software_rasterizer.h"
 
 #include "calibration_rs.hlsli"
 
@@ -44,7 +47,7 @@ static dx_pipeline visualizePointCloudPipeline;
 
 
 
-static constexpr uint32 MAX_NUM_PROJECTORS = projector_manager::MAX_NUM_PROJECTORS;
+static constexpr uint32 MAX_NUM_CONCURRENT_PROJECTOR_SOLVES = 4;
 
 bool projector_system_calibration::projectCalibrationPatterns(game_scene& scene)
 {
@@ -62,9 +65,9 @@ bool projector_system_calibration::projectCalibrationPatterns(game_scene& scene)
 	int32 maxNumPixels = 0;
 	uint32 maxNumCalibrationPatterns = 0;
 
-	for (uint32 i = 0; i < MAX_NUM_PROJECTORS; ++i)
+	for (uint32 i = 0; i < (uint32)monitors.size(); ++i)
 	{
-		totalNumProjectors += manager->isProjectorIndex[i];
+		totalNumProjectors += (uint32)manager->isProjectorIndex[i];
 
 		if (manager->isProjectorIndex[i])
 		{
@@ -110,15 +113,16 @@ bool projector_system_calibration::projectCalibrationPatterns(game_scene& scene)
 
 	std::thread thread([=]()
 	{
-		tracker->storeColorFrameCopy = true;
-
 		uint32 colorCameraWidth = tracker->camera.colorSensor.width;
 		uint32 colorCameraHeight = tracker->camera.colorSensor.height;
 
 		uint8* pattern = new uint8[maxNumPixels];
 		uint32 captureStride = colorCameraWidth * colorCameraHeight;
-		color_bgra* captures = new color_bgra[maxNumCalibrationPatterns * captureStride];
-		uint8* grayCaptures = new uint8[maxNumCalibrationPatterns * captureStride];
+		uint8* grayCapture = new uint8[captureStride];
+
+		// Captures are written in the background while the next patterns are projected. There is one slot per pattern, so the capture loop
+		// never waits for the disk. DDS stores the raw pixels, which is lossless and much cheaper to write than PNG.
+		async_image_writer* writer = new async_image_writer(maxNumCalibrationPatterns, captureStride);
 
 		std::string time = getTimeString();
 		fs::path baseDir = calibrationBaseDirectory / time;
@@ -134,7 +138,7 @@ bool projector_system_calibration::projectCalibrationPatterns(game_scene& scene)
 			fclose(file);
 		}
 
-		for (uint32 proj = 0; proj < MAX_NUM_PROJECTORS; ++proj)
+		for (uint32 proj = 0; proj < (uint32)monitors.size(); ++proj)
 		{
 			if (manager->isProjectorIndex[proj])
 			{
@@ -156,46 +160,45 @@ bool projector_system_calibration::projectCalibrationPatterns(game_scene& scene)
 
 				uint32 numGrayCodes = getNumberOfGraycodePatternsRequired(width, height);
 
+				DirectX::Image image;
+				image.width = colorCameraWidth;
+				image.height = colorCameraHeight;
+				image.format = DXGI_FORMAT_R8_UNORM;
+				image.rowPitch = colorCameraWidth * getFormatSize(image.format);
+				image.slicePitch = image.rowPitch * image.height;
+				image.pixels = grayCapture;
+
 				for (uint32 g = 0; g < numGrayCodes; ++g)
 				{
-					color_bgra* colorFrame = captures + captureStride * g;
-
 					generateGraycodePattern(pattern, width, height, g, (uint8)(whiteValue * 255));
 					patternWindow->swapBuffers();
 					Sleep(500);
 
-					memcpy(colorFrame, tracker->colorFrameCopy, colorCameraWidth * colorCameraHeight * sizeof(color_bgra));
-
 					if (cancel)
 					{
 						goto cleanup;
 					}
-				}
-
-				for (uint32 i = 0; i < numGrayCodes * captureStride; ++i)
-				{
-					color_bgra bgra = captures[i];
-					vec3 rgb = { bgra.r / 255.f, bgra.g / 255.f, bgra.b / 255.f };
 
-					rgb = sRGBToLinear(rgb);
-					float gray = clamp01(rgb.r * 0.21f + rgb.g * 0.71f + rgb.b * 0.08f);
-					gray = linearToSRGB(gray);
+					// Converted straight from the camera's frame. The camera thread does not touch it while we hold the reference.
+					rgbd_frame_ref frame = tracker->camera.getLatestFrame();
+					if (!frame || !frame.color)
+					{
+						LOG_ERROR("Camera did not deliver a color frame, aborting calibration");
+						goto cleanup;
+					}
 
-					grayCaptures[i] = (uint8)(gray * 255.f);
-				}
+					for (uint32 i = 0; i < captureStride; ++i)
+					{
+						color_bgra bgra = frame.color[i];
+						vec3 rgb = { bgra.r / 255.f, bgra.g / 255.f, bgra.b / 255.f };
 
-				LOG_MESSAGE("Saving %u calibration images to directory '%ws'", numGrayCodes, currentOutputDir.c_str());
+						rgb = sRGBToLinear(rgb);
+						float gray = clamp01(rgb.r * 0.21f + rgb.g * 0.71f + rgb.b * 0.08f);
+						gray = linearToSRGB(gray);
 
-				DirectX::Image image;
-				image.width = colorCameraWidth;
-				image.height = colorCameraHeight;
-				image.format = DXGI_FORMAT_R8_UNORM;
-				image.rowPitch = colorCameraWidth * getFormatSize(image.format);
-				image.slicePitch = image.rowPitch * image.height;
-
-				for (uint32 g = 0; g < numGrayCodes; ++g)
-				{
-					image.pixels = grayCaptures + captureStride * g;
+						grayCapture[i] = (uint8)(gray * 255.f);
+					}
+					frame.release();
 
 					std::string number = std::to_string(g);
 					int length = (int)number.length();
@@ -205,26 +208,32 @@ bool projector_system_calibration::projectCalibrationPatterns(game_scene& scene)
 						pad += "0";
 					}
 
-					fs::path imagePath = currentOutputDir / ("image" + pad + number + ".png");
-					saveImageToFile(imagePath, image);
-
-					if (cancel)
-					{
-						goto cleanup;
-					}
+					writer->submit(currentOutputDir / ("image" + pad + number + ".dds"), image);
 				}
 
-				LOG_MESSAGE("Saved %u calibration images to directory '%ws'", numGrayCodes, currentOutputDir.c_str());
+				LOG_MESSAGE("Queued %u calibration images for directory '%ws'", numGrayCodes, currentOutputDir.c_str());
 			}
 		}
 
+		if (writer->flush())
+		{
+			LOG_MESSAGE("Saved all calibration images to directory '%ws'", baseDir.c_str());
+		}
+		else
+		{
+			LOG_ERROR("Failed to save some calibration images to directory '%ws'", baseDir.c_str());
+		}
+
 
 		cleanup:
-		
-		tracker->storeColorFrameCopy = false;
 
-		delete[] grayCaptures;
-		delete[] captures;
+		if (cancel)
+		{
+			writer->discardPending();
+		}
+		delete writer;
+
+		delete[] grayCapture;
 		delete[] pattern;
 
 		mutex.lock();
@@ -590,65 +599,90 @@ static vec3d switchCoordinateSystem(const vec3d& v)
 	return vec3d{ v.x, -v.y, -v.z };
 }
 
-static bool testRotationTranslationCombination(const camera_intrinsics& camIntrinsics, uint32 camWidth, uint32 camHeight, 
-	const camera_intrinsics& projIntrinsics, uint32 projWidth, uint32 projHeight, 
-	quat r, vec3 t, const std::vector<pixel_correspondence>& pc)
+// Number of points in front of both camera and projector for the camera-to-projector transform (r, t).
+static uint32 countPointsInFront(const camera_intrinsics& camIntrinsics, const camera_intrinsics& projIntrinsics,
+	quat r, vec3 t, const pixel_correspondence* pc, uint32 count)
 {
 	quat rotation = conjugate(r);
 	vec3 origin = -(rotation * t);
 
-#if 0
-	const uint32 numTests = (uint32)pc.size();
+	uint32 result = 0;
+	uint32 i = 0;
+
+#if defined(SIMD_AVX_2)
+	mat3 projRot = quaternionToMat3(rotation);
+	mat3 camToProj = quaternionToMat3(r);
 
-	bool result = false;
+	w8_int offsets(0, 4, 8, 12, 16, 20, 24, 28);
+	w8_float zero = w8_float::zero();
 
-	for (uint32 i = 0; i < numTests; ++i)
+	for (; i + 8 <= count; i += 8)
 	{
-		vec3 pCS, pPS;
+		const float* base = (const float*)(pc + i);
 
-		vec2 camPixel = pc[i].camera;
-		vec2 projPixel = pc[i].projector;
-		float distance;
+		w8_float camX = (w8_float(base + 0, offsets) - camIntrinsics.cx) * (1.f / camIntrinsics.fx);
+		w8_float camY = (camIntrinsics.cy - w8_float(base + 1, offsets)) * (1.f / camIntrinsics.fy);
+		w8_float camZ = -1.f;
 
-		pCS = triangulateStereo(camIntrinsics, projIntrinsics, origin, rotation, camPixel, projPixel, distance);
-		pPS = r * pCS + t;
+		w8_float px = (w8_float(base + 2, offsets) - projIntrinsics.cx) * (1.f / projIntrinsics.fx);
+		w8_float py = (projIntrinsics.cy - w8_float(base + 3, offsets)) * (1.f / projIntrinsics.fy);
 
-		bool inFront = pCS.z < 0.f && pPS.z < 0.f;
+		// Projector ray in camera space (z of the local ray is -1).
+		w8_float projX = px * projRot.m00 + py * projRot.m01 - projRot.m02;
+		w8_float projY = px * projRot.m10 + py * projRot.m11 - projRot.m12;
+		w8_float projZ = px * projRot.m20 + py * projRot.m21 - projRot.m22;
 
-		if (i > 0 && result != inFront)
-		{
-			std::cerr << "Something is wrong!" << std::endl;
-		}
-		result = inFront;
-	}
-#else
+		// Same closest-point computation as triangulateStereo.
+		w8_float v1tv1 = fmadd(camX, camX, fmadd(camY, camY, 1.f));
+		w8_float v2tv2 = fmadd(projX, projX, fmadd(projY, projY, projZ * projZ));
+		w8_float v1tv2 = fmadd(camX, projX, fmsub(camY, projY, projZ));
+
+		w8_float invDetV = 1.f / fmsub(v1tv1, v2tv2, v1tv2 * v1tv2);
+
+		w8_float Q1 = fmadd(camX, origin.x, fmsub(camY, origin.y, origin.z));
+		w8_float Q2 = -fmadd(projX, origin.x, fmadd(projY, origin.y, projZ * origin.z));
 
-	float distance;
-	vec3 pCS = triangulateStereo(camIntrinsics, projIntrinsics, origin, rotation, vec2(camWidth * 0.5f, camHeight * 0.5f), vec2(projWidth * 0.5f, projHeight * 0.5f), distance, triangulate_center_point);
-	vec3 pPS = r * pCS + t;
+		w8_float lambda1 = fmadd(v2tv2, Q1, v1tv2 * Q2) * invDetV;
+		w8_float lambda2 = fmadd(v1tv2, Q1, v1tv1 * Q2) * invDetV;
 
-	bool result = pCS.z < 0.f && pPS.z < 0.f;
+		w8_float pX = (fmadd(lambda1, camX, fmadd(lambda2, projX, origin.x))) * 0.5f;
+		w8_float pY = (fmadd(lambda1, camY, fmadd(lambda2, projY, origin.y))) * 0.5f;
+		w8_float pZ = (fmadd(lambda1, camZ, fmadd(lambda2, projZ, origin.z))) * 0.5f;
 
+		w8_float projSpaceZ = fmadd(pX, camToProj.m20, fmadd(pY, camToProj.m21, fmadd(pZ, camToProj.m22, t.z)));
+
+		int inFront = toBitMask(pZ < zero) & toBitMask(projSpaceZ < zero);
+		result += __popcnt(inFront);
+	}
 #endif
+
+	for (; i < count; ++i)
+	{
+		float distance;
+		vec3 pCS = triangulateStereo(camIntrinsics, projIntrinsics, origin, rotation, pc[i].camera, pc[i].projector, distance, triangulate_center_point);
+		vec3 pPS = r * pCS + t;
+
+		result += (pCS.z < 0.f && pPS.z < 0.f);
+	}
+
 	return result;
 }
 
-bool projector_system_calibration::computeInitialExtrinsicProjectorCalibrationEstimate(
-	std::vector<pixel_correspondence> pixelCorrespondences,
-	const image_point_cloud& renderedPointCloud,
-	const camera_intrinsics& camIntrinsics, uint32 camWidth, uint32 camHeight, 
-	const camera_intrinsics& projIntrinsics, uint32 projWidth, uint32 projHeight, 
-	vec3& outPosition, quat& outRotation)
+struct extrinsic_hypothesis
 {
-#if 0
-	std::cout << "std::vector<pixel_correspondence> pixelCorrespondences = { \n";
-	for (auto& pc : pixelCorrespondences)
-	{
-		std::cout << "{ { " << pc.camera.x << ", " << pc.camera.y << " }, { " << pc.projector.x << ", " << pc.projector.y << " } }, \n";
-	}
-	std::cout << "};\n";
-#endif
+	quat rotation; // Camera to projector.
+	vec3 translation; // Camera to projector, unit length.
+	uint32 votes;
+	bool valid;
+
+	std::vector<pixel_correspondence> inliers;
+};
 
+// Essential matrix from a random subset. Outputs all four rotation/translation decompositions.
+static bool decomposeEssentialMatrix(std::vector<pixel_correspondence>& pixelCorrespondences,
+	const camera_intrinsics& camIntrinsics, const camera_intrinsics& projIntrinsics,
+	quat outRotations[2], vec3 outTranslations[2])
+{
 	std::vector<uint8> mask;
 	mat3d fundamentalMat = computeFundamentalMatrix(pixelCorrespondences, mask);
 
@@ -687,7 +721,6 @@ bool projector_system_calibration::computeInitialExtrinsicProjectorCalibrationEs
 
 	if ((determinant(rotation1) > 0) != (determinant(rotation2) > 0))
 	{
-		LOG_ERROR("One matrix is mirror and the other is not (determinants don't match)");
 		return false;
 	}
 
@@ -702,52 +735,137 @@ bool projector_system_calibration::computeInitialExtrinsicProjectorCalibrationEs
 	vec3d ourTranslation1d = switchCoordinateSystem(translation1);
 	vec3d ourTranslation2d = switchCoordinateSystem(translation2);
 
-	quat ourRotation1 = { (float)ourRotation1d.x, (float)ourRotation1d.y, (float)ourRotation1d.z, (float)ourRotation1d.w };
-	quat ourRotation2 = { (float)ourRotation2d.x, (float)ourRotation2d.y, (float)ourRotation2d.z, (float)ourRotation2d.w };
-	vec3 ourTranslation1 = { (float)ourTranslation1d.x, (float)ourTranslation1d.y, (float)ourTranslation1d.z };
-	vec3 ourTranslation2 = { (float)ourTranslation2d.x, (float)ourTranslation2d.y, (float)ourTranslation2d.z };
-
-	// Determine correct combination of rotation and translation.
-	int combinationIndex = 0;
-	combinationIndex |= (int)testRotationTranslationCombination(camIntrinsics, camWidth, camHeight, projIntrinsics, projWidth, projHeight, ourRotation1, ourTranslation1, pixelCorrespondences) << 0;
-	combinationIndex |= (int)testRotationTranslationCombination(camIntrinsics, camWidth, camHeight, projIntrinsics, projWidth, projHeight, ourRotation1, ourTranslation2, pixelCorrespondences) << 1;
-	combinationIndex |= (int)testRotationTranslationCombination(camIntrinsics, camWidth, camHeight, projIntrinsics, projWidth, projHeight, ourRotation2, ourTranslation1, pixelCorrespondences) << 2;
-	combinationIndex |= (int)testRotationTranslationCombination(camIntrinsics, camWidth, camHeight, projIntrinsics, projWidth, projHeight, ourRotation2, ourTranslation2, pixelCorrespondences) << 3;
-
-	quat estimatedRot;
-	vec3 estimatedTransDirection;
-	switch (combinationIndex)
+	outRotations[0] = { (float)ourRotation1d.x, (float)ourRotation1d.y, (float)ourRotation1d.z, (float)ourRotation1d.w };
+	outRotations[1] = { (float)ourRotation2d.x, (float)ourRotation2d.y, (float)ourRotation2d.z, (float)ourRotation2d.w };
+	outTranslations[0] = { (float)ourTranslation1d.x, (float)ourTranslation1d.y, (float)ourTranslation1d.z };
+	outTranslations[1] = { (float)ourTranslation2d.x, (float)ourTranslation2d.y, (float)ourTranslation2d.z };
+
+	return true;
+}
+
+static bool hypothesesAgree(const extrinsic_hypothesis& a, const extrinsic_hypothesis& b)
+{
+	const float cosRotationThreshold = cos(deg2rad(2.f) * 0.5f);
+	const float cosTranslationThreshold = cos(deg2rad(5.f));
+
+	return abs(dot(a.rotation.v4, b.rotation.v4)) > cosRotationThreshold
+		&& dot(a.translation, b.translation) > cosTranslationThreshold;
+}
+
+bool projector_system_calibration::computeInitialExtrinsicProjectorCalibrationEstimate(
+	const std::vector<pixel_correspondence>& pixelCorrespondences,
+	const image_point_cloud& renderedPointCloud,
+	const camera_intrinsics& camIntrinsics, uint32 camWidth, uint32 camHeight, 
+	const camera_intrinsics& projIntrinsics, uint32 projWidth, uint32 projHeight, 
+	vec3& outPosition, quat& outRotation)
+{
+	CPU_PROFILE_BLOCK("Initial extrinsic estimate");
+
+	const uint32 numSubsets = 16;
+	const uint32 subsetSize = 128;
+	const uint32 numValidationCorrespondences = 4096;
+
+	if (pixelCorrespondences.size() < 8)
 	{
-		case 1:
-			estimatedRot = ourRotation1;
-			estimatedTransDirection = ourTranslation1;
-			break;
-		case 2:
-			estimatedRot = ourRotation1;
-			estimatedTransDirection = ourTranslation2;
-			break;
-		case 4:
-			estimatedRot = ourRotation2;
-			estimatedTransDirection = ourTranslation1;
-			break;
-		case 8:
-			estimatedRot = ourRotation2;
-			estimatedTransDirection = ourTranslation2;
-			break;
-		default:
-			LOG_ERROR("More or fewer than one combination is valid");
-			return false;
+		LOG_ERROR("Too few correspondences for initial estimate");
+		return false;
 	}
 
+	uint32 seed = std::random_device{}();
+
+	// All hypotheses are scored against the same validation set, so their votes are comparable.
+	std::vector<pixel_correspondence> validation;
+	validation.reserve(numValidationCorrespondences);
+	std::sample(pixelCorrespondences.begin(), pixelCorrespondences.end(), std::back_inserter(validation),
+		numValidationCorrespondences, std::mt19937{ seed });
+
+	extrinsic_hypothesis hypotheses[numSubsets];
 
-	//submitFrustumForVisualization(-(conjugate(ourRotation1) * ourTranslation1), conjugate(ourRotation1), projWidth, projHeight, projIntrinsics, combinationIndex & 1 ? vec4(0.f, 1.f, 0.f, 1.f) : vec4(1.f, 0.f, 0.f, 1.f));
-	//submitFrustumForVisualization(-(conjugate(ourRotation1) * ourTranslation2), conjugate(ourRotation1), projWidth, projHeight, projIntrinsics, combinationIndex & 2 ? vec4(0.f, 1.f, 0.f, 1.f) : vec4(1.f, 0.f, 0.f, 1.f));
-	//submitFrustumForVisualization(-(conjugate(ourRotation2) * ourTranslation1), conjugate(ourRotation2), projWidth, projHeight, projIntrinsics, combinationIndex & 4 ? vec4(0.f, 1.f, 0.f, 1.f) : vec4(1.f, 0.f, 0.f, 1.f));
-	//submitFrustumForVisualization(-(conjugate(ourRotation2) * ourTranslation2), conjugate(ourRotation2), projWidth, projHeight, projIntrinsics, combinationIndex & 8 ? vec4(0.f, 1.f, 0.f, 1.f) : vec4(1.f, 0.f, 0.f, 1.f));
+	thread_job_context context;
 
+	for (uint32 subsetIndex = 0; subsetIndex < numSubsets; ++subsetIndex)
+	{
+		context.addWork([&, subsetIndex]()
+		{
+			extrinsic_hypothesis& h = hypotheses[subsetIndex];
+			h.valid = false;
+			h.votes = 0;
 
-	quat rotation = conjugate(estimatedRot);
-	vec3 origin = -(rotation * estimatedTransDirection);
+			h.inliers.reserve(subsetSize);
+			std::sample(pixelCorrespondences.begin(), pixelCorrespondences.end(), std::back_inserter(h.inliers),
+				subsetSize, std::mt19937{ seed + subsetIndex + 1 });
+
+			quat rotations[2];
+			vec3 translations[2];
+			if (!decomposeEssentialMatrix(h.inliers, camIntrinsics, projIntrinsics, rotations, translations))
+			{
+				return;
+			}
+
+			// Determine correct combination of rotation and translation. Exactly one should place the points in front of both devices.
+			uint32 votes[4];
+			for (uint32 i = 0; i < 4; ++i)
+			{
+				votes[i] = countPointsInFront(camIntrinsics, projIntrinsics, rotations[i >> 1], translations[i & 1], validation.data(), (uint32)validation.size());
+			}
+
+			uint32 best = 0;
+			for (uint32 i = 1; i < 4; ++i)
+			{
+				if (votes[i] > votes[best])
+				{
+					best = i;
+				}
+			}
+
+			h.rotation = rotations[best >> 1];
+			h.translation = translations[best & 1];
+			h.votes = votes[best];
+			h.valid = votes[best] > (uint32)validation.size() / 2;
+		});
+	}
+
+	context.waitForWorkCompletion();
+
+
+	// Consensus: Pick the hypothesis most other subsets agree with. Ties are broken by votes.
+	int32 bestIndex = -1;
+	uint32 bestSupport = 0;
+
+	for (uint32 i = 0; i < numSubsets; ++i)
+	{
+		if (!hypotheses[i].valid)
+		{
+			continue;
+		}
+
+		uint32 support = 0;
+		for (uint32 j = 0; j < numSubsets; ++j)
+		{
+			support += hypotheses[j].valid && hypothesesAgree(hypotheses[i], hypotheses[j]);
+		}
+
+		if (bestIndex == -1 || support > bestSupport || (support == bestSupport && hypotheses[i].votes > hypotheses[bestIndex].votes))
+		{
+			bestIndex = i;
+			bestSupport = support;
+		}
+	}
+
+	if (bestIndex == -1)
+	{
+		LOG_ERROR("No random subset yielded a valid combination of rotation and translation");
+		return false;
+	}
+
+	const extrinsic_hypothesis& winner = hypotheses[bestIndex];
+
+	LOG_MESSAGE("%u of %u random subsets agree on initial extrinsics (%u of %u validation points in front)", 
+		bestSupport, numSubsets, winner.votes, (uint32)validation.size());
+
+
+	quat rotation = conjugate(winner.rotation);
+	vec3 origin = -(rotation * winner.translation);
 
 	LOG_MESSAGE("Initial unscaled estimated projector origin: [%.3f, %.3f, %.3f]", origin.x, origin.y, origin.z);
 	LOG_MESSAGE("Initial estimated projector rotation: [%.3f, %.3f, %.3f, %.3f]", rotation.x, rotation.y, rotation.z, rotation.w);
@@ -762,7 +880,7 @@ bool projector_system_calibration::computeInitialExtrinsicProjectorCalibrationEs
 
 	vec3 normOrigin = normalize(origin);
 
-	for (const auto& pc : pixelCorrespondences)
+	for (const auto& pc : winner.inliers)
 	{
 		vec3 world = renderedPointCloud.entries((int)pc.camera.y, (int)pc.camera.x).position;
 		assert(world.z != 0.f);
@@ -782,7 +900,7 @@ bool projector_system_calibration::computeInitialExtrinsicProjectorCalibrationEs
 		scale += s;
 	}
 
-	scale /= (float)pixelCorrespondences.size();
+	scale /= (float)winner.inliers.size();
 
 	origin *= scale;
 
@@ -823,14 +941,33 @@ bool projector_system_calibration::calibrate(game_scene& scene)
 	scene_entity entity = { *group.begin(), scene };
 	ref<composite_mesh> mesh = entity.getComponent<raster_component>().mesh;
 
+	bool renderOnCPU = renderPointCloudsOnCPU && mesh->handle;
+
+	// Sized here, on the UI thread, which is the only reader.
+	numProjectorsInProgress = 0;
+	projectorProgress = std::make_unique<volatile projector_calibration_stage[]>(projectors.size());
 
 	state = calibration_state_calibrating;
 
 
-	std::thread thread([this, projectors, mesh]()
+	std::thread thread([this, projectors, mesh, renderOnCPU]()
 	{
+		// Importing the asset file can take a while for large scans, so it runs as a job next to the image decoding instead of on the UI thread.
+		ref<cpu_triangle_mesh> cpuMesh = 0;
+		thread_job_context meshLoadContext;
+		if (renderOnCPU)
+		{
+			meshLoadContext.addWork([&cpuMesh, &mesh]()
+			{
+				cpuMesh = loadCPUTriangleMeshFromHandle(mesh->handle);
+			});
+		}
+
 		calibration_input calibInput;
-		if (!loadAndDecodeImageSequences(calibrationBaseDirectory, projectors, calibInput))
+		bool imagesLoaded = loadAndDecodeImageSequences(calibrationBaseDirectory, projectors, calibInput);
+		meshLoadContext.waitForWorkCompletion();
+
+		if (!imagesLoaded)
 		{
 			state = calibration_state_none;
 			return;
@@ -876,8 +1013,17 @@ bool projector_system_calibration::calibrate(game_scene& scene)
 			per_sequence& ps = perSequence[i];
 			calibration_sequence& s = calibInput.sequences[i];
 
-			ps.renderedPointCloud = projectDepthIntoColorFrame(mesh, s.trackingMat, colorCameraViewMat, colorCameraProjMat, camDistortion, depthToColorTexture, depthBuffer,
-				readbackBuffer, colorCameraUnprojectTable);
+			if (cpuMesh)
+			{
+				image<vec4> rendering(camWidth, camHeight);
+				rasterizeViewNormalAndDepth(*cpuMesh, colorCameraViewMat * s.trackingMat, camIntrinsics, camDistortion, 0.01f, rendering);
+				ps.renderedPointCloud.constructFromRendering(rendering, colorCameraUnprojectTable);
+			}
+			else
+			{
+				ps.renderedPointCloud = projectDepthIntoColorFrame(mesh, s.trackingMat, colorCameraViewMat, colorCameraProjMat, camDistortion, depthToColorTexture, depthBuffer,
+					readbackBuffer, colorCameraUnprojectTable);
+			}
 			ps.renderedPointCloud.erode(5);
 
 			//ps.renderedPointCloud.writeToFile(calibrationBaseDirectory / ("test" + std::to_string(i) + ".ply"));
@@ -897,9 +1043,22 @@ bool projector_system_calibration::calibrate(game_scene& scene)
 		vec3 globalTranslation = tracker->globalCameraRotation * tracker->camera.colorSensor.position + tracker->globalCameraPosition;
 
 
-		std::unordered_map<std::string, projector_calibration> finalCalibs;
+		struct per_projector
+		{
+			bool valid = false;
+			projector_calibration calib;
+		};
+
+		uint32 numProjectors = (uint32)calibInput.projectors.size();
+		std::vector<per_projector> perProjector(numProjectors);
+
+		for (uint32 projID = 0; projID < numProjectors; ++projID)
+		{
+			projectorProgress[projID] = projector_calibration_stage_waiting;
+		}
+		numProjectorsInProgress = numProjectors;
 
-		for (uint32 projID = 0; projID < (uint32)calibInput.projectors.size(); ++projID)
+		auto solveProjector = [&](uint32 projID, uint32 numSolverThreads)
 		{
 			calibration_projector& proj = calibInput.projectors[projID];
 
@@ -913,7 +1072,8 @@ bool projector_system_calibration::calibrate(game_scene& scene)
 			vec3 projPosition;
 			quat projRotation;
 
-			
+			projectorProgress[projID] = projector_calibration_stage_initial_estimate;
+
 			// Compute initial extrinsics using first sequence.
 			{
 				calibration_proj_sequence& sequence = proj.sequences[0];
@@ -935,24 +1095,22 @@ bool projector_system_calibration::calibrate(game_scene& scene)
 					}
 				}
 
-				std::vector<pixel_correspondence> pixelCorrespondencesSample;
-				pixelCorrespondencesSample.reserve(128);
-				std::sample(validPixelCorrespondences.begin(), validPixelCorrespondences.end(), std::back_inserter(pixelCorrespondencesSample),
-					128, std::mt19937{ std::random_device{}() });
-
-				if (!computeInitialExtrinsicProjectorCalibrationEstimate(pixelCorrespondencesSample, renderedPointCloud, camIntrinsics, camWidth, camHeight, 
+				if (!computeInitialExtrinsicProjectorCalibrationEstimate(validPixelCorrespondences, renderedPointCloud, camIntrinsics, camWidth, camHeight, 
 					projIntrinsics, width, height, projPosition, projRotation))
 				{
-					continue;
+					projectorProgress[projID] = projector_calibration_stage_failed;
+					return;
 				}
 			}
 
 
 			if (cancel)
 			{
-				break;
+				projectorProgress[projID] = projector_calibration_stage_canceled;
+				return;
 			}
 
+			projectorProgress[projID] = projector_calibration_stage_solving;
 
 			// Solve for all projector parameters.
 			std::vector<calibration_solver_input> solverInput;
@@ -971,7 +1129,7 @@ bool projector_system_calibration::calibrate(game_scene& scene)
 			}
 
 			//solveForCameraToProjectorParameters(solverInput, projPosition, projRotation, projIntrinsics, solverSettings);
-			solveForCameraToProjectorParametersUsingCeres(solverInput, projPosition, projRotation, projIntrinsics, solverSettings);
+			solveForCameraToProjectorParametersUsingCeres(solverInput, projPosition, projRotation, projIntrinsics, solverSettings, &cancel, numSolverThreads);
 
 			//submitFrustumForVisualization(projPosition, projRotation, width, height, projIntrinsics, vec4(1.f, 0.f, 1.f, 1.f));
 
@@ -981,10 +1139,70 @@ bool projector_system_calibration::calibrate(game_scene& scene)
 
 			if (cancel)
 			{
-				break;
+				projectorProgress[projID] = projector_calibration_stage_canceled;
+				return;
+			}
+
+			perProjector[projID].calib = projector_calibration{ projRotation, projPosition, width, height, projIntrinsics };
+			perProjector[projID].valid = true;
+
+			projectorProgress[projID] = projector_calibration_stage_done;
+		};
+
+
+		// Projectors are independent given the rendered point clouds, so they are solved concurrently by a small pool of threads.
+		// The Ceres thread count is split between the concurrent solves.
+		uint32 numHardwareThreads = max(std::thread::hardware_concurrency(), 1u);
+		uint32 numWorkers = min(numProjectors, MAX_NUM_CONCURRENT_PROJECTOR_SOLVES);
+		uint32 numSolverThreads = max(numHardwareThreads / max(numWorkers, 1u), 1u);
+
+		volatile uint32 nextProjector = 0;
+
+		std::vector<std::thread> workers;
+		workers.reserve(numWorkers);
+
+		for (uint32 workerID = 0; workerID < numWorkers; ++workerID)
+		{
+			workers.emplace_back([&]()
+			{
+				while (!cancel)
+				{
+					uint32 projID = atomicIncrement(nextProjector);
+					if (projID >= numProjectors)
+					{
+						break;
+					}
+
+					solveProjector(projID, numSolverThreads);
+				}
+			});
+
+			SetThreadDescription((HANDLE)workers.back().native_handle(), L"Projector solver thread");
+		}
+
+		for (auto& worker : workers)
+		{
+			worker.join();
+		}
+
+		for (uint32 projID = 0; projID < numProjectors; ++projID)
+		{
+			if (projectorProgress[projID] == projector_calibration_stage_waiting)
+			{
+				projectorProgress[projID] = projector_calibration_stage_canceled;
 			}
+		}
 
-			finalCalibs[proj.uniqueID] = projector_calibration{ projRotation, projPosition, width, height, projIntrinsics };
+
+		// Merge in projector order, independent of completion order.
+		std::unordered_map<std::string, projector_calibration> finalCalibs;
+
+		for (uint32 projID = 0; projID < numProjectors; ++projID)
+		{
+			if (perProjector[projID].valid)
+			{
+				finalCalibs[calibInput.projectors[projID].uniqueID] = perProjector[projID].calib;
+			}
 		}
 
 		mutex.lock();
@@ -1050,6 +1268,7 @@ projector_system_calibration::projector_system_calibration(depth_tracker* tracke
 	uint32 width = tracker->camera.colorSensor.width;
 	uint32 height = tracker->camera.colorSensor.height;
 
+	startIntrinsics.resize(win32_window::allConnectedMonitors.size());
 	for (uint32 i = 0; i < (uint32)win32_window::allConnectedMonitors.size(); ++i)
 	{
 		auto& monitor = win32_window::allConnectedMonitors[i];
@@ -1156,6 +1375,7 @@ bool projector_system_calibration::edit(game_scene& scene)
 		ImGui::PropertySlider("White value", whiteValue);
 		ImGui::PropertySlider("Rel. solver correspondence count", solverSettings.percentageOfCorrespondencesToUse);
 		ImGui::PropertyDrag("Max num solver iterations", solverSettings.maxNumIterations);
+		ImGui::PropertyCheckbox("Render point clouds on CPU", renderPointCloudsOnCPU);
 
 		if (!uiActive)
 		{
@@ -1193,6 +1413,14 @@ bool projector_system_calibration::edit(game_scene& scene)
 			calibrate(scene);
 		}
 
+		if (state == calibration_state_calibrating)
+		{
+			for (uint32 i = 0; i < numProjectorsInProgress; ++i)
+			{
+				ImGui::PropertyValue(("    Projector " + std::to_string(i)).c_str(), projectorCalibrationStageNames[projectorProgress[i]]);
+			}
+		}
+
 		ImGui::EndProperties();
 	}
 
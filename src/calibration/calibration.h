@@ -24,7 +24,7 @@ private:
 	void submitFrustumForVisualization(vec3 position, quat rotation, uint32 width, uint32 height, camera_intrinsics intrinsics, vec4 color);
 
 	bool computeInitialExtrinsicProjectorCalibrationEstimate(
-		std::vector<struct pixel_correspondence> pixelCorrespondences,
+		const std::vector<struct pixel_correspondence>& pixelCorrespondences,
 		const struct image_point_cloud& renderedPointCloud,
 		const camera_intrinsics& camIntrinsics, uint32 camWidth, uint32 camHeight,
 		const camera_intrinsics& projIntrinsics, uint32 projWidth, uint32 projHeight,
@@ -38,6 +38,26 @@ private:
 		calibration_state_calibrating,
 	};
 
+	enum projector_calibration_stage
+	{
+		projector_calibration_stage_waiting,
+		projector_calibration_stage_initial_estimate,
+		projector_calibration_stage_solving,
+		projector_calibration_stage_done,
+		projector_calibration_stage_failed,
+		projector_calibration_stage_canceled,
+	};
+
+	static inline const char* projectorCalibrationStageNames[] =
+	{
+		"Waiting",
+		"Initial estimate",
+		"Solving",
+		"Done",
+		"Failed",
+		"Canceled",
+	};
+
 	volatile bool cancel = false;
 
 	calibration_state state = calibration_state_uninitialized;
@@ -46,8 +66,13 @@ private:
 
 	float whiteValue = 0.5f;
 	calibration_solver_settings solverSettings;
+	bool renderPointCloudsOnCPU = true; // Software rasterizer instead of a GPU render and readback. Requires the mesh to be loaded from a file.
+
+	std::vector<camera_intrinsics> startIntrinsics; // One per connected monitor.
 
-	camera_intrinsics startIntrinsics[projector_manager::MAX_NUM_PROJECTORS] = {};
+	// Written by the solver threads, read by the UI. One per calibrated projector.
+	std::unique_ptr<volatile projector_calibration_stage[]> projectorProgress;
+	volatile uint32 numProjectorsInProgress = 0;
 
 
 	ref<dx_texture> depthToColorTexture;
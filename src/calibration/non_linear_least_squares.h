@@ -1,4 +1,5 @@
 #include "core/math.h"
+#include "autodiff.h"
 
 
 struct default_precompute_t
@@ -29,6 +30,121 @@ struct least_squares_residual
 	*/
 };
 
+template <typename T>
+struct default_autodiff_precompute_t
+{
+	template <typename param_set_t>
+	void precompute(const param_set_t&) {}
+};
+
+struct least_squares_autodiff_tag {};
+
+template <typename derived_t, template <typename> typename param_set_t, uint32 numResiduals_ = 1, template <typename> typename precompute_t_ = default_autodiff_precompute_t>
+struct least_squares_autodiff_residual : least_squares_autodiff_tag
+{
+	using param_set = param_set_t<double>;
+	static const uint32 numParams = sizeof(param_set) / sizeof(double);
+	static const uint32 numResiduals = numResiduals_;
+
+	using jet_t = jet<numParams>;
+
+	/*
+	* An autodiff residual only provides a 'value' function, templated on the scalar type:
+	* - template <typename T> void value(const param_set_t<T>& params, const precompute_t<T>& precompute, T out[numResiduals]) const
+	* 
+	* The solver evaluates it with T = double for the value and with T = jet<numParams> for the gradient. 'param_set_t<T>' must consist
+	* of T's only, so that it can be treated as an array of parameters.
+	* 
+	* 'precompute_t<T>' is optional (see least_squares_residual). It is evaluated once per iteration for both scalar types.
+	*/
+
+	struct precompute_t
+	{
+		precompute_t_<double> doublePrecompute;
+		precompute_t_<jet_t> jetPrecompute;
+
+		void precompute(const param_set& params)
+		{
+			param_set_t<jet_t> jetParams;
+			seedJets(params, jetParams);
+
+			doublePrecompute.precompute(params);
+			jetPrecompute.precompute(jetParams);
+		}
+	};
+
+	// Each parameter becomes a jet with the derivative 1 in its own slot.
+	static void seedJets(const param_set& params, param_set_t<jet_t>& outJetParams)
+	{
+		static_assert(sizeof(param_set_t<jet_t>) == sizeof(jet_t) * numParams, "Parameter set must only contain scalars");
+
+		const double* p = (const double*)&params;
+		jet_t* j = (jet_t*)&outJetParams;
+		for (uint32 i = 0; i < numParams; ++i)
+		{
+			j[i] = jet_t::variable(p[i], i);
+		}
+	}
+
+	void autodiffValue(const param_set& params, const precompute_t& precompute, double out[numResiduals]) const
+	{
+		((const derived_t*)this)->value(params, precompute.doublePrecompute, out);
+	}
+
+	void autodiffValueAndGrad(const param_set& params, const precompute_t& precompute, double outValue[numResiduals], double outGrad[numResiduals][numParams]) const
+	{
+		param_set_t<jet_t> jetParams;
+		seedJets(params, jetParams);
+
+		jet_t result[numResiduals];
+		((const derived_t*)this)->value(jetParams, precompute.jetPrecompute, result);
+
+		for (uint32 s = 0; s < numResiduals; ++s)
+		{
+			outValue[s] = result[s].v;
+			memcpy(outGrad[s], result[s].d, sizeof(double) * numParams);
+		}
+	}
+};
+
+template <typename residual_t, typename param_set, typename precompute_t, uint32 numSubResiduals, uint32 numParams>
+static void evaluateResidual(const residual_t& residual, const param_set& params, const precompute_t& precompute,
+	double(&value)[numSubResiduals], double(&grad)[numSubResiduals][numParams])
+{
+	if constexpr (std::is_base_of_v<least_squares_autodiff_tag, residual_t>)
+	{
+		residual.autodiffValueAndGrad(params, precompute, value, grad);
+	}
+	else if constexpr (std::is_same_v<default_precompute_t, precompute_t>)
+	{
+		residual.grad(params, grad);
+		residual.value(params, value);
+	}
+	else
+	{
+		residual.grad(params, precompute, grad);
+		residual.value(params, precompute, value);
+	}
+}
+
+template <typename residual_t, typename param_set, typename precompute_t, uint32 numSubResiduals>
+static void evaluateResidual(const residual_t& residual, const param_set& params, const precompute_t& precompute,
+	double(&value)[numSubResiduals])
+{
+	if constexpr (std::is_base_of_v<least_squares_autodiff_tag, residual_t>)
+	{
+		residual.autodiffValue(params, precompute, value);
+	}
+	else if constexpr (std::is_same_v<default_precompute_t, precompute_t>)
+	{
+		residual.value(params, value);
+	}
+	else
+	{
+		residual.value(params, precompute, value);
+	}
+}
+
 template <typename residual_t, typename param_set = residual_t::param_set, uint32 numResiduals = residual_t::numResiduals>
 struct least_squares_residual_array
 {
@@ -134,16 +250,7 @@ static void gaussNewtonInternal(param_set& params, least_squares_residual_array<
 		double grad[numSubResiduals][numParams];
 		double value[numSubResiduals];
 
-		if constexpr (std::is_same_v<default_precompute_t, residual_t::precompute_t>)
-		{
-			residualArray.residuals[i].grad(params, grad);
-			residualArray.residuals[i].value(params, value);
-		}
-		else
-		{
-			residualArray.residuals[i].grad(params, precompute, grad);
-			residualArray.residuals[i].value(params, precompute, value);
-		}
+		evaluateResidual(residualArray.residuals[i], params, precompute, value, grad);
 
 		for (uint32 s = 0; s < numSubResiduals; ++s)
 		{
@@ -203,14 +310,7 @@ static double chiSquared(param_set& params, least_squares_residual_array<residua
 	{
 		double value[numSubResiduals];
 
-		if constexpr (std::is_same_v<default_precompute_t, residual_t::precompute_t>)
-		{
-			residualArray.residuals[i].value(params, value);
-		}
-		else
-		{
-			residualArray.residuals[i].value(params, precompute, value);
-		}
+		evaluateResidual(residualArray.residuals[i], params, precompute, value);
 
 		for (uint32 s = 0; s < numSubResiduals; ++s)
 		{
@@ -234,15 +334,18 @@ static void levenbergMarquardtInternal(const param_set& params, least_squares_re
 		double grad[numSubResiduals][numParams];
 		double value[numSubResiduals];
 		
-		if constexpr (std::is_same_v<default_precompute_t, residual_t::precompute_t>)
-		{
-			residualArray.residuals[i].grad(params, grad);
-			residualArray.residuals[i].value(params, value);
-		}
-		else
+		evaluateResidual(residualArray.residuals[i], params, precompute, value, grad);
+
+		if constexpr (std::is_base_of_v<least_squares_autodiff_tag, residual_t>)
 		{
-			residualArray.residuals[i].grad(params, precompute, grad);
-			residualArray.residuals[i].value(params, precompute, value);
+			// Hand-written LM residuals provide the derivative of the model, which is the negative derivative of the residual.
+			for (uint32 s = 0; s < numSubResiduals; ++s)
+			{
+				for (uint32 r = 0; r < numParams; ++r)
+				{
+					grad[s][r] = -grad[s][r];
+				}
+			}
 		}
 
 		double oos2 = 1.f; // Squared observation weight.
@@ -9,6 +9,8 @@
 #include "core/random.h"
 #include "core/log.h"
 
+#include <chrono>
+
 struct camera_intrinsicsd
 {
 	double fx, fy, cx, cy;
@@ -186,6 +188,65 @@ struct backprojection_residual : least_squares_residual<param_set, 2, precompute
 	}
 };
 
+// Same parameterization as param_set, but templated on the scalar type for automatic differentiation.
+template <typename T>
+struct param_set_t
+{
+	T fx, fy, cx, cy;
+
+	// View transform, not model!
+	T alpha, beta, gamma;
+	T tx, ty, tz;
+};
+
+static_assert(sizeof(param_set_t<double>) == sizeof(param_set));
+
+template <typename T>
+struct precompute_data_t
+{
+	T r[3][3];
+
+	void precompute(const param_set_t<T>& params)
+	{
+		T c1 = cos(params.alpha);
+		T c2 = cos(params.beta);
+		T c3 = cos(params.gamma);
+
+		T s1 = sin(params.alpha);
+		T s2 = sin(params.beta);
+		T s3 = sin(params.gamma);
+
+		r[0][0] = c1 * c3 - c2 * s1 * s3;
+		r[1][0] = c3 * s1 + c1 * c2 * s3;
+		r[2][0] = s2 * s3;
+		r[0][1] = -c1 * s3 - c2 * c3 * s1;
+		r[1][1] = c1 * c2 * c3 - s1 * s3;
+		r[2][1] = c3 * s2;
+		r[0][2] = s1 * s2;
+		r[1][2] = -c1 * s2;
+		r[2][2] = c2;
+	}
+};
+
+struct backprojection_residual_autodiff : least_squares_autodiff_residual<backprojection_residual_autodiff, param_set_t, 2, precompute_data_t>
+{
+	vec3d camPos;
+	vec2d observedProjPixel;
+
+	template <typename T>
+	void value(const param_set_t<T>& params, const precompute_data_t<T>& precompute, T out[2]) const
+	{
+		T px = precompute.r[0][0] * camPos.x + precompute.r[0][1] * camPos.y + precompute.r[0][2] * camPos.z + params.tx;
+		T py = precompute.r[1][0] * camPos.x + precompute.r[1][1] * camPos.y + precompute.r[1][2] * camPos.z + params.ty;
+		T pz = precompute.r[2][0] * camPos.x + precompute.r[2][1] * camPos.y + precompute.r[2][2] * camPos.z + params.tz;
+
+		T invZ = 1.0 / pz;
+
+		out[0] = observedProjPixel.x - (params.fx * (-px * invZ) + params.cx);
+		out[1] = observedProjPixel.y - (params.fy * (py * invZ) + params.cy);
+	}
+};
+
 void solveForCameraToProjectorParameters(const std::vector<calibration_solver_input>& input,
 	vec3& projPosition, quat& projRotation, camera_intrinsics& projIntrinsics,
 	calibration_solver_settings settings)
@@ -201,10 +262,17 @@ void solveForCameraToProjectorParameters(const std::vector<calibration_solver_in
 	double gamma = atan2(mat.m20, mat.m21);
 
 
-	param_set params;
-	params.intrinsics = { projIntrinsics.fx, projIntrinsics.fy, projIntrinsics.cx, projIntrinsics.cy };
-	params.rotation = { alpha, beta, gamma };
-	params.translation = { t.x, t.y, t.z };
+	param_set_t<double> params;
+	params.fx = projIntrinsics.fx;
+	params.fy = projIntrinsics.fy;
+	params.cx = projIntrinsics.cx;
+	params.cy = projIntrinsics.cy;
+	params.alpha = alpha;
+	params.beta = beta;
+	params.gamma = gamma;
+	params.tx = t.x;
+	params.ty = t.y;
+	params.tz = t.z;
 
 	uint32 expectedNumResiduals = 0;
 	for (const calibration_solver_input& in : input)
@@ -214,7 +282,7 @@ void solveForCameraToProjectorParameters(const std::vector<calibration_solver_in
 
 	expectedNumResiduals = (uint32)(expectedNumResiduals * settings.percentageOfCorrespondencesToUse * 2); // Times 2 just to be safe.
 
-	std::vector<backprojection_residual> residuals;
+	std::vector<backprojection_residual_autodiff> residuals;
 	residuals.reserve(expectedNumResiduals);
 
 	random_number_generator rng = { 61923 };
@@ -232,7 +300,7 @@ void solveForCameraToProjectorParameters(const std::vector<calibration_solver_in
 				{
 					if (rng.randomFloat01() < settings.percentageOfCorrespondencesToUse)
 					{
-						backprojection_residual r;
+						backprojection_residual_autodiff r;
 						r.camPos = { e.position.x, e.position.y, e.position.z };
 						r.observedProjPixel = { proj.x, proj.y };
 
@@ -256,9 +324,9 @@ void solveForCameraToProjectorParameters(const std::vector<calibration_solver_in
 	LOG_MESSAGE("Solver finished");
 
 
-	alpha = params.rotation.x;
-	beta = params.rotation.y;
-	gamma = params.rotation.z;
+	alpha = params.alpha;
+	beta = params.beta;
+	gamma = params.gamma;
 
 	float c1 = (float)cos(alpha);
 	float c2 = (float)cos(beta);
@@ -282,8 +350,8 @@ void solveForCameraToProjectorParameters(const std::vector<calibration_solver_in
 
 
 	projRotation = conjugate(mat3ToQuaternion(r));
-	projPosition = -(projRotation * vec3((float)params.translation.x, (float)params.translation.y, (float)params.translation.z));
-	projIntrinsics = { (float)params.intrinsics.fx, (float)params.intrinsics.fy, (float)params.intrinsics.cx, (float)params.intrinsics.cy };
+	projPosition = -(projRotation * vec3((float)params.tx, (float)params.ty, (float)params.tz));
+	projIntrinsics = { (float)params.fx, (float)params.fy, (float)params.cx, (float)params.cy };
 
 	LOG_MESSAGE("Solver finished after %u iterations. Remaining error: %f (avg %f)", lmResult.numIterations, lmResult.epsilon, lmResult.epsilon / numResiduals);
 	LOG_MESSAGE("Final projector intrinsics: [%.3f, %.3f, %.3f, %.3f]", projIntrinsics.fx, projIntrinsics.fy, projIntrinsics.cx, projIntrinsics.cy);
@@ -291,4 +359,90 @@ void solveForCameraToProjectorParameters(const std::vector<calibration_solver_in
 	LOG_MESSAGE("Final projector rotation: [%.3f, %.3f, %.3f, %.3f]", projRotation.x, projRotation.y, projRotation.z, projRotation.w);
 }
 
+void benchmarkAutodiffResidual()
+{
+	const uint32 numResiduals = 100000;
+	const uint32 numRuns = 10;
+
+	random_number_generator rng = { 1853 };
+
+	std::vector<backprojection_residual> handWritten(numResiduals);
+	std::vector<backprojection_residual_autodiff> autodiff(numResiduals);
 
+	for (uint32 i = 0; i < numResiduals; ++i)
+	{
+		vec3d camPos = { rng.randomFloatBetween(-1.f, 1.f), rng.randomFloatBetween(-1.f, 1.f), rng.randomFloatBetween(-3.f, -1.f) };
+		vec2d observed = { rng.randomFloatBetween(0.f, 1920.f), rng.randomFloatBetween(0.f, 1080.f) };
+
+		handWritten[i].camPos = camPos;
+		handWritten[i].observedProjPixel = observed;
+		autodiff[i].camPos = camPos;
+		autodiff[i].observedProjPixel = observed;
+	}
+
+	param_set params;
+	params.intrinsics = { 1500.0, 1500.0, 960.0, 540.0 };
+	params.rotation = { 0.1, 0.2, 0.3 };
+	params.translation = { 0.2, -0.1, 0.5 };
+
+	precompute_data handPrecompute;
+	handPrecompute.precompute(params);
+
+	const param_set_t<double>& autodiffParams = (const param_set_t<double>&)params;
+
+	backprojection_residual_autodiff::precompute_t autodiffPrecompute;
+	autodiffPrecompute.precompute(autodiffParams);
+
+
+	// Correctness. The hand-written gradient is the derivative of the projection, which is the negative derivative of the residual.
+	double maxAbsDifference = 0.0;
+	for (uint32 i = 0; i < numResiduals; ++i)
+	{
+		double handValue[2], handGrad[2][numParams];
+		double autoValue[2], autoGrad[2][numParams];
+
+		evaluateResidual(handWritten[i], params, handPrecompute, handValue, handGrad);
+		evaluateResidual(autodiff[i], autodiffParams, autodiffPrecompute, autoValue, autoGrad);
+
+		for (uint32 s = 0; s < 2; ++s)
+		{
+			maxAbsDifference = max(maxAbsDifference, abs(handValue[s] - autoValue[s]));
+			for (uint32 p = 0; p < numParams; ++p)
+			{
+				maxAbsDifference = max(maxAbsDifference, abs(handGrad[s][p] + autoGrad[s][p]) / max(abs(handGrad[s][p]), 1.0));
+			}
+		}
+	}
+
+
+	// Performance. The sum keeps the compiler from optimizing the evaluation away.
+	auto time = [](const auto& residuals, const auto& params, const auto& precompute)
+	{
+		double sum = 0.0;
+		double best = DBL_MAX;
+
+		for (uint32 run = 0; run < numRuns; ++run)
+		{
+			auto start = std::chrono::high_resolution_clock::now();
+
+			for (uint32 i = 0; i < numResiduals; ++i)
+			{
+				double value[2], grad[2][numParams];
+				evaluateResidual(residuals[i], params, precompute, value, grad);
+				sum += value[0] + grad[1][numParams - 1];
+			}
+
+			auto end = std::chrono::high_resolution_clock::now();
+			best = min(best, std::chrono::duration<double, std::milli>(end - start).count());
+		}
+
+		return std::make_pair(best, sum);
+	};
+
+	auto [handMS, handSum] = time(handWritten, params, handPrecompute);
+	auto [autoMS, autoSum] = time(autodiff, autodiffParams, autodiffPrecompute);
+
+	LOG_MESSAGE("Backprojection residual value + gradient, %u residuals (best of %u runs)", numResiduals, numRuns);
+	LOG_MESSAGE("Hand-written: %.3f ms, autodiff: %.3f ms (%.2fx). Max relative gradient difference: %g (checksums %f, %f)",
+		handMS, autoMS, autoMS / handMS, maxAbsDifference, handSum, autoSum);
+}
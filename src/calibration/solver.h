@@ -21,3 +21,5 @@ struct calibration_solver_input
 void solveForCameraToProjectorParameters(const std::vector<calibration_solver_input>& input, 
 	vec3& projPosition, quat& projRotation, camera_intrinsics& projIntrinsics,
 	calibration_solver_settings settings);
+
+void benchmarkAutodiffResidual();
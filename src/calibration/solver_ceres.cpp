@@ -237,11 +237,23 @@ struct depth_functor : autodiff_cost_function<depth_functor, 1, 4, 3, 3>
 	}
 };
 
+struct cancel_callback : ceres::IterationCallback
+{
+	cancel_callback(volatile bool* cancel) : cancel(cancel) {}
+
+	ceres::CallbackReturnType operator()(const ceres::IterationSummary& summary) override
+	{
+		return (cancel && *cancel) ? ceres::SOLVER_ABORT : ceres::SOLVER_CONTINUE;
+	}
+
+	volatile bool* cancel;
+};
+
 
 
 void solveForCameraToProjectorParametersUsingCeres(const std::vector<calibration_solver_input>& input, 
 	vec3& projPosition, quat& projRotation, camera_intrinsics& projIntrinsics, 
-	calibration_solver_settings settings)
+	calibration_solver_settings settings, volatile bool* cancel, uint32 numThreads)
 {
 	Eigen::initParallel();
 
@@ -323,11 +335,14 @@ void solveForCameraToProjectorParametersUsingCeres(const std::vector<calibration
 
 	ceres::Solver::Options options;
 	options.linear_solver_type = ceres::DENSE_NORMAL_CHOLESKY;
-	options.num_threads = 8;
+	options.num_threads = (int)numThreads;
 	options.minimizer_progress_to_stdout = true;
 	options.max_num_iterations = (int)settings.maxNumIterations;
 	options.evaluation_callback = 0;
 
+	cancel_callback cancelCallback(cancel);
+	options.callbacks.push_back(&cancelCallback);
+
 
 	ceres::Solver::Summary summary;
 	ceres::Solve(options, &problem, &summary);
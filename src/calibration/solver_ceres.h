@@ -6,5 +6,5 @@
 
 void solveForCameraToProjectorParametersUsingCeres(const std::vector<calibration_solver_input>& input,
 	vec3& projPosition, quat& projRotation, camera_intrinsics& projIntrinsics,
-	calibration_solver_settings settings);
+	calibration_solver_settings settings, volatile bool* cancel = 0, uint32 numThreads = 8);
 
@@ -0,0 +1,149 @@
+#include "pch.h"
+#include "async_image_writer.h"
+#include "log.h"
+
+
+async_image_writer::async_image_writer(uint32 numSlots, uint32 maxImageSizeInBytes, uint32 numWorkers)
+{
+	numSlots = max(numSlots, 1u);
+	numWorkers = max(numWorkers, 1u);
+
+	slotSize = maxImageSizeInBytes;
+	slotMemory.resize((uint64)numSlots * slotSize);
+
+	freeSlots.reserve(numSlots);
+	for (uint32 i = 0; i < numSlots; ++i)
+	{
+		freeSlots.push_back(numSlots - i - 1);
+	}
+
+	for (uint32 i = 0; i < numWorkers; ++i)
+	{
+		workers.emplace_back([this]() { workerProc(); });
+		SetThreadDescription((HANDLE)workers.back().native_handle(), L"Image writer thread");
+	}
+}
+
+async_image_writer::~async_image_writer()
+{
+	flush();
+
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		shutdown = true;
+	}
+	jobAvailable.notify_all();
+
+	for (std::thread& worker : workers)
+	{
+		worker.join();
+	}
+}
+
+void async_image_writer::submit(const fs::path& path, const DirectX::Image& image)
+{
+	uint32 size = (uint32)(image.rowPitch * image.height);
+	if (size > slotSize)
+	{
+		LOG_ERROR("Image '%ws' is larger than the writer's slot size (%u > %u bytes), writing synchronously", path.c_str(), size, slotSize);
+		if (!saveImageToFile(path, image))
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			++numFailed;
+		}
+		return;
+	}
+
+	uint32 slot;
+	{
+		std::unique_lock<std::mutex> lock(mutex);
+		slotAvailable.wait(lock, [this]() { return !freeSlots.empty(); });
+		slot = freeSlots.back();
+		freeSlots.pop_back();
+	}
+
+	uint8* pixels = slotMemory.data() + (uint64)slot * slotSize;
+	memcpy(pixels, image.pixels, size);
+
+	write_job job;
+	job.path = path;
+	job.image = image;
+	job.image.pixels = pixels;
+	job.image.slicePitch = size;
+	job.slot = slot;
+
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		jobs.push_back(std::move(job));
+	}
+	jobAvailable.notify_one();
+}
+
+bool async_image_writer::flush()
+{
+	std::unique_lock<std::mutex> lock(mutex);
+	idle.wait(lock, [this]() { return jobs.empty() && numJobsInFlight == 0; });
+
+	return numFailed.exchange(0) == 0;
+}
+
+void async_image_writer::discardPending()
+{
+	std::unique_lock<std::mutex> lock(mutex);
+	for (const write_job& job : jobs)
+	{
+		freeSlots.push_back(job.slot);
+	}
+	jobs.clear();
+	slotAvailable.notify_all();
+
+	idle.wait(lock, [this]() { return numJobsInFlight == 0; });
+}
+
+void async_image_writer::workerProc()
+{
+	while (true)
+	{
+		write_job job;
+		{
+			std::unique_lock<std::mutex> lock(mutex);
+			jobAvailable.wait(lock, [this]() { return shutdown || !jobs.empty(); });
+
+			if (jobs.empty())
+			{
+				return;
+			}
+
+			job = std::move(jobs.front());
+			jobs.pop_front();
+			++numJobsInFlight;
+		}
+
+		bool success = saveImageToFile(job.path, job.image);
+		if (!success)
+		{
+			LOG_ERROR("Failed to write image '%ws'", job.path.c_str());
+		}
+
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			freeSlots.push_back(job.slot);
+			--numJobsInFlight;
+
+			if (success)
+			{
+				++numWritten;
+			}
+			else
+			{
+				++numFailed;
+			}
+
+			if (jobs.empty() && numJobsInFlight == 0)
+			{
+				idle.notify_all();
+			}
+		}
+		slotAvailable.notify_one();
+	}
+}
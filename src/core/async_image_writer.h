@@ -0,0 +1,55 @@
+#pragma once
+
+#include "image.h"
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <thread>
+
+
+// Encodes and writes images to disk on a small pool of background threads.
+// Images are copied into one of a fixed number of preallocated slots on submission, so the caller can reuse its memory right away.
+// Submission only blocks if all slots are still waiting to be written. Size the writer so that this does not happen in the hot loop.
+struct async_image_writer
+{
+	async_image_writer(uint32 numSlots, uint32 maxImageSizeInBytes, uint32 numWorkers = 4);
+	~async_image_writer(); // Flushes.
+
+	void submit(const fs::path& path, const DirectX::Image& image);
+
+	// Blocks until all submitted images are written. Returns false, if any write failed since the last flush.
+	bool flush();
+
+	// Drops all images, which have not been started yet, and waits for the ones in flight.
+	void discardPending();
+
+	// Updated by the workers, so atomic for readers outside the lock (e.g. UI stats).
+	std::atomic<uint32> numWritten = 0;
+	std::atomic<uint32> numFailed = 0;
+
+private:
+	struct write_job
+	{
+		fs::path path;
+		DirectX::Image image;
+		uint32 slot;
+	};
+
+	void workerProc();
+
+	std::vector<uint8> slotMemory;
+	uint32 slotSize;
+	std::vector<uint32> freeSlots;
+
+	std::deque<write_job> jobs;
+	uint32 numJobsInFlight = 0;
+	bool shutdown = false;
+
+	std::mutex mutex;
+	std::condition_variable slotAvailable;
+	std::condition_variable jobAvailable;
+	std::condition_variable idle;
+
+	std::vector<std::thread> workers;
+};
@@ -134,3 +134,72 @@ ref<composite_mesh> loadMeshFromHandle(asset_handle handle, uint32 flags)
 	mutex.unlock();
 	return sp;
 }
+
+static std::unordered_map<asset_handle, weakref<cpu_triangle_mesh>> cpuMeshCache;
+
+static ref<cpu_triangle_mesh> loadCPUTriangleMeshInternal(asset_handle handle, const fs::path& sceneFilename)
+{
+	Assimp::Importer importer;
+
+	const aiScene* scene = loadAssimpSceneFile(sceneFilename, importer);
+
+	if (!scene)
+	{
+		return 0;
+	}
+
+	ref<cpu_triangle_mesh> result = make_ref<cpu_triangle_mesh>();
+
+	uint32 numVertices = 0;
+	uint32 numTriangles = 0;
+	for (uint32 m = 0; m < scene->mNumMeshes; ++m)
+	{
+		numVertices += scene->mMeshes[m]->mNumVertices;
+		numTriangles += scene->mMeshes[m]->mNumFaces;
+	}
+
+	result->positions.reserve(numVertices);
+	result->normals.reserve(numVertices);
+	result->triangles.reserve(numTriangles);
+
+	for (uint32 m = 0; m < scene->mNumMeshes; ++m)
+	{
+		aiMesh* mesh = scene->mMeshes[m];
+
+		uint32 baseVertex = (uint32)result->positions.size();
+
+		for (uint32 i = 0; i < mesh->mNumVertices; ++i)
+		{
+			result->positions.push_back(vec3(mesh->mVertices[i].x, mesh->mVertices[i].y, mesh->mVertices[i].z));
+			result->normals.push_back(mesh->HasNormals() ? vec3(mesh->mNormals[i].x, mesh->mNormals[i].y, mesh->mNormals[i].z) : vec3(0.f, 0.f, 0.f));
+		}
+
+		for (uint32 i = 0; i < mesh->mNumFaces; ++i)
+		{
+			const aiFace& face = mesh->mFaces[i];
+			if (face.mNumIndices == 3)
+			{
+				result->triangles.push_back({ baseVertex + face.mIndices[0], baseVertex + face.mIndices[1], baseVertex + face.mIndices[2] });
+			}
+		}
+	}
+
+	result->handle = handle;
+	return result;
+}
+
+ref<cpu_triangle_mesh> loadCPUTriangleMeshFromHandle(asset_handle handle)
+{
+	fs::path sceneFilename = getPathFromAssetHandle(handle);
+
+	mutex.lock();
+
+	auto sp = cpuMeshCache[handle].lock();
+	if (!sp)
+	{
+		cpuMeshCache[handle] = sp = loadCPUTriangleMeshInternal(handle, sceneFilename);
+	}
+
+	mutex.unlock();
+	return sp;
+}
@@ -40,6 +40,19 @@ inline ref<composite_mesh> loadAnimatedMeshFromFile(const fs::path& sceneFilenam
 	return loadMeshFromFile(sceneFilename, flags);
 }
 
+// Geometry of all submeshes in CPU memory, for processing without the GPU. Like the vertex buffers of composite_mesh, the positions are
+// in the composite's local space and do not include the submesh transforms.
+struct cpu_triangle_mesh
+{
+	std::vector<vec3> positions;
+	std::vector<vec3> normals;
+	std::vector<indexed_triangle32> triangles;
+
+	asset_handle handle;
+};
+
+ref<cpu_triangle_mesh> loadCPUTriangleMeshFromHandle(asset_handle handle);
+
 struct raster_component
 {
 	ref<composite_mesh> mesh;
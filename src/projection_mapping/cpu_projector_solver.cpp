@@ -0,0 +1,1980 @@
+#include "pch.h"
+#include "cpu_projector_solver.h"
+
+#include "core/simd.h"
+#include "core/threading.h"
+#include "core/cpu_profiling.h"
+#include "core/log.h"
+#include "physics/bounding_volumes.h"
+
+#include "projector_rs.hlsli"
+
+#include <chrono>
+
+
+#define CPU_PROJECTOR_SOLVER_LINES_PER_JOB 16
+
+// Depth tolerance of the visibility test in the best mask and intensity shaders.
+static const float visibilityDepthBias = 0.00005f;
+
+static const float distanceTransformInfinity = 1e20f;
+
+
+template <typename func_t>
+static void addBlockJobs(thread_job_context& context, uint32 numLines, const func_t& func)
+{
+	for (uint32 start = 0; start < numLines; start += CPU_PROJECTOR_SOLVER_LINES_PER_JOB)
+	{
+		uint32 end = min(start + CPU_PROJECTOR_SOLVER_LINES_PER_JOB, numLines);
+		context.addWork([=]() { func(start, end); });
+	}
+}
+
+// The last block of a row is shifted back to end at the row's end, so that no scalar remainder loop is needed. The overlapping pixels
+// are simply computed twice. Rows must be at least 8 pixels wide.
+static uint32 getBlockStart(uint32 blockX, uint32 width)
+{
+	return min(blockX, width - 8);
+}
+
+static w8_float getLaneCenters()
+{
+	return w8_float(0.5f, 1.5f, 2.5f, 3.5f, 4.5f, 5.5f, 6.5f, 7.5f);
+}
+
+static void transformPositionW8(const mat4& m, w8_float x, w8_float y, w8_float z, w8_float& outX, w8_float& outY, w8_float& outZ, w8_float& outW)
+{
+	outX = fmadd(w8_float(m.m00), x, fmadd(w8_float(m.m01), y, fmadd(w8_float(m.m02), z, w8_float(m.m03))));
+	outY = fmadd(w8_float(m.m10), x, fmadd(w8_float(m.m11), y, fmadd(w8_float(m.m12), z, w8_float(m.m13))));
+	outZ = fmadd(w8_float(m.m20), x, fmadd(w8_float(m.m21), y, fmadd(w8_float(m.m22), z, w8_float(m.m23))));
+	outW = fmadd(w8_float(m.m30), x, fmadd(w8_float(m.m31), y, fmadd(w8_float(m.m32), z, w8_float(m.m33))));
+}
+
+// Same as restoreWorldSpacePosition in camera.hlsli.
+static void restoreWorldSpacePositionW8(const mat4& invViewProj, w8_float u, w8_float v, w8_float depth, w8_float& outX, w8_float& outY, w8_float& outZ)
+{
+	w8_float ndcX = fmsub(u, w8_float(2.f), w8_float(1.f));
+	w8_float ndcY = w8_float(1.f) - v * w8_float(2.f); // Screen uvs start at the top left, so flip y.
+
+	w8_float x, y, z, w;
+	transformPositionW8(invViewProj, ndcX, ndcY, depth, x, y, z, w);
+
+	w8_float invW = w8_float(1.f) / w;
+	outX = x * invW;
+	outY = y * invW;
+	outZ = z * invW;
+}
+
+// Projection of world space positions into another projector, as in the best mask and intensity shaders. Returns screen uvs and depth
+// buffer depth.
+static void projectW8(const mat4& viewProj, w8_float x, w8_float y, w8_float z, w8_float& outU, w8_float& outV, w8_float& outDepth)
+{
+	w8_float cx, cy, cz, cw;
+	transformPositionW8(viewProj, x, y, z, cx, cy, cz, cw);
+
+	w8_float invW = w8_float(1.f) / cw;
+	outU = fmadd(cx * invW, w8_float(0.5f), w8_float(0.5f));
+	outV = fmadd(cy * invW, w8_float(-0.5f), w8_float(0.5f));
+	outDepth = cz * invW;
+}
+
+static w8_float smoothstepW8(float lower, float upper, w8_float v)
+{
+	w8_float t = clamp01((v - w8_float(lower)) * w8_float(1.f / max(upper - lower, 1e-6f)));
+	return t * t * (w8_float(3.f) - w8_float(2.f) * t);
+}
+
+// Linear filtering as in SampleLevel with a clamping sampler.
+static w8_float sampleLinearClampW8(const float* image, uint32 width, uint32 height, w8_float u, w8_float v)
+{
+	w8_float tx = fmsub(u, w8_float((float)width), w8_float(0.5f));
+	w8_float ty = fmsub(v, w8_float((float)height), w8_float(0.5f));
+	w8_float x0 = floor(tx);
+	w8_float y0 = floor(ty);
+	w8_float fx = tx - x0;
+	w8_float fy = ty - y0;
+
+	const w8_float zero = w8_float::zero();
+	const w8_float one(1.f);
+	const w8_float maxX((float)(width - 1));
+	const w8_float maxY((float)(height - 1));
+	const w8_float stride((float)width);
+
+	w8_float left = clamp(x0, zero, maxX);
+	w8_float right = clamp(x0 + one, zero, maxX);
+	w8_float top = clamp(y0, zero, maxY) * stride;
+	w8_float bottom = clamp(y0 + one, zero, maxY) * stride;
+
+	// Indices are integers well below 2^24, so they are exact in floats.
+	w8_int i00 = convert(top + left);
+	w8_int i10 = convert(top + right);
+	w8_int i01 = convert(bottom + left);
+	w8_int i11 = convert(bottom + right);
+
+	w8_float t00(image, i00);
+	w8_float t10(image, i10);
+	w8_float t01(image, i01);
+	w8_float t11(image, i11);
+
+	w8_float upper = fmadd(fx, t10 - t00, t00);
+	w8_float lower = fmadd(fx, t11 - t01, t01);
+	return fmadd(fy, lower - upper, upper);
+}
+
+struct bilinear_taps
+{
+	uint32 index[4];
+	float weight[4];
+};
+
+// Linear filtering as in SampleLevel. Texels outside the image get a weight of 0, which matches a sampler with a black border.
+static bilinear_taps getBorderTaps(uint32 width, uint32 height, float u, float v)
+{
+	float tx = u * width - 0.5f;
+	float ty = v * height - 0.5f;
+	float x0 = floor(tx);
+	float y0 = floor(ty);
+	float fx = tx - x0;
+	float fy = ty - y0;
+
+	bilinear_taps result;
+	for (uint32 i = 0; i < 4; ++i)
+	{
+		int32 x = (int32)x0 + (int32)(i & 1);
+		int32 y = (int32)y0 + (int32)(i >> 1);
+		float w = ((i & 1) ? fx : 1.f - fx) * ((i >> 1) ? fy : 1.f - fy);
+
+		bool inside = x >= 0 && y >= 0 && x < (int32)width && y < (int32)height;
+		result.index[i] = inside ? (y * width + x) : 0;
+		result.weight[i] = inside ? w : 0.f;
+	}
+	return result;
+}
+
+static float sample(const float* image, const bilinear_taps& taps)
+{
+	return image[taps.index[0]] * taps.weight[0]
+		+ image[taps.index[1]] * taps.weight[1]
+		+ image[taps.index[2]] * taps.weight[2]
+		+ image[taps.index[3]] * taps.weight[3];
+}
+
+// Point filtering with a white border, as the depth sampler in the best mask and intensity shaders.
+static float sampleDepth(const float* depth, uint32 width, uint32 height, float u, float v)
+{
+	int32 x = (int32)floor(u * width);
+	int32 y = (int32)floor(v * height);
+	if (x < 0 || y < 0 || x >= (int32)width || y >= (int32)height)
+	{
+		return 1.f;
+	}
+	return depth[y * width + x];
+}
+
+static bool isVisible(const float* depth, uint32 width, uint32 height, float u, float v, float testDepth)
+{
+	if (u < 0.f || u > 1.f || v < 0.f || v > 1.f)
+	{
+		return false;
+	}
+
+	float projDepth = sampleDepth(depth, width, height, u, v);
+	return projDepth < 1.f && testDepth <= projDepth + visibilityDepthBias;
+}
+
+// 3x3 Sobel as in the sobel shaders. Taps are row major, starting at the top left.
+static bool isSobelEdge(const float* t, float threshold)
+{
+	float horizontal = abs((t[0] + 2.f * t[1] + t[2]) - (t[6] + 2.f * t[7] + t[8]));
+	float vertical = abs((t[0] + 2.f * t[3] + t[6]) - (t[2] + 2.f * t[5] + t[8]));
+	return horizontal > threshold || vertical > threshold;
+}
+
+// Squared Euclidean distance transform of a sampled function along one line. From Felzenszwalb and Huttenlocher: Distance Transforms of
+// Sampled Functions. v and z are scratch space for n and n + 1 elements.
+static void distanceTransform1D(const float* f, uint32 n, float* d, int32* v, float* z)
+{
+	int32 k = 0;
+	v[0] = 0;
+	z[0] = -distanceTransformInfinity;
+	z[1] = distanceTransformInfinity;
+
+	for (int32 q = 1; q < (int32)n; ++q)
+	{
+		float s;
+		while (true)
+		{
+			int32 p = v[k];
+			s = ((f[q] + (float)(q * q)) - (f[p] + (float)(p * p))) / (float)(2 * q - 2 * p);
+			if (s <= z[k] && k > 0)
+			{
+				--k;
+				continue;
+			}
+			break;
+		}
+		++k;
+		v[k] = q;
+		z[k] = s;
+		z[k + 1] = distanceTransformInfinity;
+	}
+
+	k = 0;
+	for (int32 q = 0; q < (int32)n; ++q)
+	{
+		while (z[k + 1] < (float)q)
+		{
+			++k;
+		}
+		float delta = (float)(q - v[k]);
+		d[q] = delta * delta + f[v[k]];
+	}
+}
+
+struct blur_kernel
+{
+	uint32 numWeights;
+	float offsets[3];
+	float weights[3];
+};
+
+// Same weights and (linear sampling) offsets as the blur shaders.
+static const blur_kernel gaussianBlur5x5 = { 2, { 0.f, 1.33333333333333f }, { 0.29411764705882354f, 0.35294117647058826f } };
+static const blur_kernel gaussianBlur9x9 = { 3, { 0.f, 1.3846153846f, 3.2307692308f }, { 0.2270270270f, 0.3162162162f, 0.0702702703f } };
+
+static float sampleLinearClamp1D(const float* line, uint32 n, uint32 stride, float position)
+{
+	float p0 = floor(position);
+	float f = position - p0;
+	int32 i0 = clamp((int32)p0, 0, (int32)n - 1);
+	int32 i1 = clamp((int32)p0 + 1, 0, (int32)n - 1);
+	return lerp(line[i0 * stride], line[i1 * stride], f);
+}
+
+static float blur1D(const float* line, uint32 n, uint32 stride, uint32 position, const blur_kernel& kernel)
+{
+	float p = (float)position;
+	float result = line[position * stride] * kernel.weights[0];
+	for (uint32 i = 1; i < kernel.numWeights; ++i)
+	{
+		result += sampleLinearClamp1D(line, n, stride, p + kernel.offsets[i]) * kernel.weights[i];
+		result += sampleLinearClamp1D(line, n, stride, p - kernel.offsets[i]) * kernel.weights[i];
+	}
+	return result;
+}
+
+static void prepareImages(cpu_projector_images& images, uint32 width, uint32 height)
+{
+	uint32 halfWidth = width / 2;
+	uint32 halfHeight = height / 2;
+
+	if (images.width == width && images.height == height)
+	{
+		return;
+	}
+
+	images.width = width;
+	images.height = height;
+	images.halfWidth = halfWidth;
+	images.halfHeight = halfHeight;
+
+	uint32 numPixels = width * height;
+	images.possibleWhiteIntensity.resize(numPixels);
+	images.E.resize(numPixels);
+	images.maxComponent.resize(numPixels);
+	images.hardMask.resize(numPixels);
+	images.softMask.resize(numPixels);
+	images.intensities.resize(numPixels);
+	images.previousIntensities.resize(numPixels);
+
+	uint32 numHalfPixels = halfWidth * halfHeight;
+	images.halfDepth.resize(numHalfPixels);
+	images.halfColor.resize(numHalfPixels);
+	images.bestMask.resize(numHalfPixels);
+	images.bestMaskEdges.resize(numHalfPixels);
+	images.depthDiscontinuities.resize(numHalfPixels);
+	images.colorDiscontinuities.resize(numHalfPixels);
+	images.bestMaskDistanceField.resize(numHalfPixels);
+	images.depthDistanceField.resize(numHalfPixels);
+	images.colorDistanceField.resize(numHalfPixels);
+	images.temp.resize(numHalfPixels * 3); // One per distance field.
+}
+
+void cpu_projector_solver::solve(const cpu_projector_input* inputs, uint32 numProjectors, projector_scene_motion motion)
+{
+	CPU_PROFILE_BLOCK("CPU projector solver");
+
+	for (uint32 i = 0; i < numProjectors; ++i)
+	{
+		// The half resolution images are processed 8 pixels at a time as well.
+		if (inputs[i].camera.width < 16 || inputs[i].camera.height < 2)
+		{
+			LOG_ERROR("CPU projector solver needs images of at least 16x2 pixels, projector %u has %ux%u", i, inputs[i].camera.width, inputs[i].camera.height);
+			return;
+		}
+	}
+
+	bool distributed = false;
+	for (uint32 i = 0; i < numProjectors; ++i)
+	{
+		distributed |= inputs[i].summary != 0;
+	}
+
+	images.resize(numProjectors);
+	for (uint32 i = 0; i < numProjectors; ++i)
+	{
+		if (!inputs[i].summary)
+		{
+			prepareImages(images[i], inputs[i].camera.width, inputs[i].camera.height);
+		}
+	}
+
+	// New summaries mean, that the geometry or results of remote projectors have changed.
+	if (distributed && unpackRemoteSummaries(inputs, numProjectors))
+	{
+		motion = projector_scene_large_motion;
+	}
+
+	// Remote projectors are seen through their summary depth.
+	std::vector<cpu_projector_input> resolvedInputs(inputs, inputs + numProjectors);
+	for (uint32 i = 0; i < numProjectors; ++i)
+	{
+		if (inputs[i].summary)
+		{
+			resolvedInputs[i].depth = images[i].summaryDepth.data();
+		}
+	}
+	inputs = resolvedInputs.data();
+
+	std::vector<projector_solver_history::projector_state> states(numProjectors);
+	for (uint32 i = 0; i < numProjectors; ++i)
+	{
+		states[i] = { inputs[i].camera.viewProj, inputs[i].camera.width, inputs[i].camera.height, 0, !inputs[i].summary };
+	}
+
+	projector_solve_mode mode = history.update(settings, states.data(), numProjectors, motion);
+	lastSolveMode = mode;
+
+	if (mode == projector_solve_reuse)
+	{
+		timings = {};
+		return;
+	}
+
+	bool warmStart = mode == projector_solve_warm_start;
+	if (warmStart)
+	{
+		for (uint32 i = 0; i < numProjectors; ++i)
+		{
+			images[i].intensities.swap(images[i].previousIntensities);
+		}
+	}
+
+	auto t0 = std::chrono::high_resolution_clock::now();
+	computeAttenuations(inputs, numProjectors);
+	auto t1 = std::chrono::high_resolution_clock::now();
+	computeBestMasks(inputs, numProjectors);
+	auto t2 = std::chrono::high_resolution_clock::now();
+	computeDistanceFields(inputs, numProjectors);
+	auto t3 = std::chrono::high_resolution_clock::now();
+	computeMasks(inputs, numProjectors);
+	auto t4 = std::chrono::high_resolution_clock::now();
+	updateOverlapCache(inputs, numProjectors, motion != projector_scene_static);
+	auto t5 = std::chrono::high_resolution_clock::now();
+	computeIntensities(inputs, numProjectors, warmStart);
+	auto t6 = std::chrono::high_resolution_clock::now();
+	if (distributed)
+	{
+		computeLocalSummaries(inputs, numProjectors);
+	}
+	auto t7 = std::chrono::high_resolution_clock::now();
+
+	timings.attenuationMS = std::chrono::duration<float, std::milli>(t1 - t0).count();
+	timings.bestMaskMS = std::chrono::duration<float, std::milli>(t2 - t1).count();
+	timings.distanceFieldsMS = std::chrono::duration<float, std::milli>(t3 - t2).count();
+	timings.maskMS = std::chrono::duration<float, std::milli>(t4 - t3).count();
+	timings.overlapMS = std::chrono::duration<float, std::milli>(t5 - t4).count();
+	timings.intensitiesMS = std::chrono::duration<float, std::milli>(t6 - t5).count();
+	timings.summaryMS = std::chrono::duration<float, std::milli>(t7 - t6).count();
+	timings.totalMS = std::chrono::duration<float, std::milli>(t7 - t0).count();
+}
+
+// Writes the summaries of the remote projectors, which have changed since the last call, into their images. Missing summaries are unpacked
+// as empty ones, so that the projectors do not contribute.
+bool cpu_projector_solver::unpackRemoteSummaries(const cpu_projector_input* inputs, uint32 numProjectors)
+{
+	unpackedSummaryVersions.resize(numProjectors, -1);
+
+	bool changed = false;
+	for (uint32 i = 0; i < numProjectors; ++i)
+	{
+		const projector_summary* summary = inputs[i].summary;
+		if (!summary)
+		{
+			unpackedSummaryVersions[i] = -1;
+			continue;
+		}
+
+		cpu_projector_images& out = images[i];
+
+		uint32 width = getProjectorSummaryWidth(inputs[i].camera.width);
+		uint32 height = getProjectorSummaryHeight(inputs[i].camera.height);
+		uint32 numTexels = width * height;
+
+		bool valid = summary->width == width && summary->height == height && (uint32)summary->texels.size() == numTexels;
+		uint32 version = valid ? summary->version : 0;
+
+		if (version == unpackedSummaryVersions[i] && out.summaryDepth.size() == numTexels)
+		{
+			continue;
+		}
+
+		prepareImages(out, width, height);
+		out.summaryDepth.resize(numTexels);
+
+		projector_summary_texel empty = packProjectorSummary(1.f, 0.f, 0.f, 0.f, 0.f);
+		for (uint32 t = 0; t < numTexels; ++t)
+		{
+			projector_summary_texel texel = (version != 0) ? summary->texels[t] : empty;
+			projector_summary_values values = unpackProjectorSummary(texel);
+
+			out.summaryDepth[t] = texel.depth;
+			out.possibleWhiteIntensity[t] = values.attenuation;
+			out.E[t] = values.E;
+			out.hardMask[t] = values.hardMask;
+			out.softMask[t] = values.softMask;
+		}
+
+		unpackedSummaryVersions[i] = version;
+		changed = true;
+	}
+	return changed;
+}
+
+// Same as projector_summary_cs. Only changed summaries get a new version.
+void cpu_projector_solver::computeLocalSummaries(const cpu_projector_input* inputs, uint32 numProjectors)
+{
+	CPU_PROFILE_BLOCK("Summaries");
+
+	localSummaries.resize(numProjectors);
+
+	thread_job_context context;
+
+	std::vector<std::vector<projector_summary_texel>> summaries(numProjectors);
+
+	for (uint32 i = 0; i < numProjectors; ++i)
+	{
+		if (inputs[i].summary)
+		{
+			continue;
+		}
+
+		const cpu_projector_images& own = images[i];
+
+		const uint32 width = own.width;
+		const uint32 height = own.height;
+		const uint32 summaryWidth = getProjectorSummaryWidth(width);
+		const uint32 summaryHeight = getProjectorSummaryHeight(height);
+		const float* depth = inputs[i].depth;
+
+		summaries[i].resize(summaryWidth * summaryHeight);
+		projector_summary_texel* outTexels = summaries[i].data();
+
+		addBlockJobs(context, summaryHeight, [=, &own](uint32 startY, uint32 endY)
+		{
+			for (uint32 texelY = startY; texelY < endY; ++texelY)
+			{
+				for (uint32 texelX = 0; texelX < summaryWidth; ++texelX)
+				{
+					float maxDepth = 0.f;
+					float sums[4] = {};
+					uint32 count = 0;
+
+					for (uint32 y = texelY * height / summaryHeight; y < (texelY + 1) * height / summaryHeight; ++y)
+					{
+						for (uint32 x = texelX * width / summaryWidth; x < (texelX + 1) * width / summaryWidth; ++x)
+						{
+							uint32 index = y * width + x;
+							if (depth[index] < 1.f)
+							{
+								maxDepth = max(maxDepth, depth[index]);
+								sums[0] += own.possibleWhiteIntensity[index];
+								sums[1] += own.E[index];
+								sums[2] += own.hardMask[index];
+								sums[3] += own.softMask[index];
+								++count;
+							}
+						}
+					}
+
+					float invCount = count ? (1.f / count) : 0.f;
+					outTexels[texelY * summaryWidth + texelX] = packProjectorSummary(count ? maxDepth : 1.f,
+						sums[0] * invCount, sums[1] * invCount, sums[2] * invCount, sums[3] * invCount);
+				}
+			}
+		});
+	}
+
+	context.waitForWorkCompletion();
+
+	for (uint32 i = 0; i < numProjectors; ++i)
+	{
+		if (inputs[i].summary)
+		{
+			continue;
+		}
+
+		projector_summary& summary = localSummaries[i];
+		uint32 summaryWidth = getProjectorSummaryWidth(images[i].width);
+		uint32 summaryHeight = getProjectorSummaryHeight(images[i].height);
+
+		bool changed = summary.width != summaryWidth || summary.height != summaryHeight
+			|| memcmp(summary.texels.data(), summaries[i].data(), summaries[i].size() * sizeof(projector_summary_texel)) != 0;
+		if (changed)
+		{
+			summary.width = summaryWidth;
+			summary.height = summaryHeight;
+			summary.texels.swap(summaries[i]);
+			summary.version = ++lastSummaryVersion;
+		}
+	}
+}
+
+void cpu_projector_solver::computeAttenuations(const cpu_projector_input* inputs, uint32 numProjectors)
+{
+	CPU_PROFILE_BLOCK("Attenuations");
+
+	thread_job_context context;
+
+	for (uint32 i = 0; i < numProjectors; ++i)
+	{
+		if (inputs[i].summary)
+		{
+			continue; // Remote projectors are only sampled.
+		}
+
+		const cpu_projector_input& in = inputs[i];
+		cpu_projector_images& out = images[i];
+
+		const uint32 width = out.width;
+		const uint32 height = out.height;
+		const mat4 invViewProj = in.camera.invViewProj;
+		const vec3 position = in.camera.position;
+		const float referenceDistance = settings.referenceDistance;
+		const float invDesiredWhite = 1.f / settings.referenceWhite;
+
+		const float* depth = in.depth;
+		const float* normals = &in.worldNormals->x;
+		const float* colors = &in.color->x;
+
+		float* outPossibleWhite = out.possibleWhiteIntensity.data();
+		float* outE = out.E.data();
+		float* outMaxComponent = out.maxComponent.data();
+
+		addBlockJobs(context, height, [=](uint32 startY, uint32 endY)
+		{
+			const w8_float laneCenters = getLaneCenters();
+			const w8_float invWidth(1.f / width);
+			const w8_float zero = w8_float::zero();
+
+			for (uint32 y = startY; y < endY; ++y)
+			{
+				const w8_float v((y + 0.5f) / height);
+
+				for (uint32 blockX = 0; blockX < width; blockX += 8)
+				{
+					uint32 x = getBlockStart(blockX, width);
+					uint32 index = y * width + x;
+
+					w8_float d(depth + index);
+					auto background = d == w8_float(1.f);
+
+					w8_float u = (w8_float((float)x) + laneCenters) * invWidth;
+
+					w8_float px, py, pz;
+					restoreWorldSpacePositionW8(invViewProj, u, v, d, px, py, pz);
+
+					const float* n = normals + 3 * index;
+					w8_float nx(n, 0, 3, 6, 9, 12, 15, 18, 21);
+					w8_float ny(n + 1, 0, 3, 6, 9, 12, 15, 18, 21);
+					w8_float nz(n + 2, 0, 3, 6, 9, 12, 15, 18, 21);
+					w8_float invNormalLength = w8_float(1.f) / sqrt(nx * nx + ny * ny + nz * nz);
+
+					w8_float vx = w8_float(position.x) - px;
+					w8_float vy = w8_float(position.y) - py;
+					w8_float vz = w8_float(position.z) - pz;
+					w8_float distance = sqrt(vx * vx + vy * vy + vz * vz);
+
+					// getAngleAttenuation and getDistanceAttenuation from projector_rs.hlsli.
+					w8_float angleAttenuation = clamp01((nx * vx + ny * vy + nz * vz) * invNormalLength / distance);
+					w8_float distanceAttenuation = exp2(w8_float(referenceDistance) - distance);
+
+					w8_float possibleWhiteIntensity = angleAttenuation * distanceAttenuation * w8_float(invDesiredWhite);
+					w8_float possibleWhiteIntensity2 = possibleWhiteIntensity * possibleWhiteIntensity;
+					w8_float E = possibleWhiteIntensity2 * possibleWhiteIntensity2; // Exponent k = 4.
+
+					const float* c = colors + 3 * index;
+					w8_float r(c, 0, 3, 6, 9, 12, 15, 18, 21);
+					w8_float g(c + 1, 0, 3, 6, 9, 12, 15, 18, 21);
+					w8_float b(c + 2, 0, 3, 6, 9, 12, 15, 18, 21);
+					w8_float maxComponent = maximum(r, maximum(g, b));
+
+					ifThen(background, zero, possibleWhiteIntensity).store(outPossibleWhite + index);
+					ifThen(background, zero, E).store(outE + index);
+					ifThen(background, zero, maxComponent).store(outMaxComponent + index);
+				}
+			}
+		});
+
+		// Half resolution depth (maximum, like the depth pyramid) and color (average, like the bilinear blit) for the discontinuities.
+		const uint32 halfWidth = out.halfWidth;
+		const uint32 halfHeight = out.halfHeight;
+		const vec3* color = in.color;
+		float* outHalfDepth = out.halfDepth.data();
+		vec3* outHalfColor = out.halfColor.data();
+
+		addBlockJobs(context, halfHeight, [=](uint32 startY, uint32 endY)
+		{
+			for (uint32 y = startY; y < endY; ++y)
+			{
+				uint32 row0 = (2 * y) * width;
+				uint32 row1 = min(2 * y + 1, height - 1) * width;
+
+				for (uint32 x = 0; x < halfWidth; ++x)
+				{
+					uint32 x0 = 2 * x;
+					uint32 x1 = min(2 * x + 1, width - 1);
+
+					outHalfDepth[y * halfWidth + x] = max(max(depth[row0 + x0], depth[row0 + x1]), max(depth[row1 + x0], depth[row1 + x1]));
+					outHalfColor[y * halfWidth + x] = (color[row0 + x0] + color[row0 + x1] + color[row1 + x0] + color[row1 + x1]) * 0.25f;
+				}
+			}
+		});
+	}
+
+	context.waitForWorkCompletion();
+}
+
+void cpu_projector_solver::computeBestMasks(const cpu_projector_input* inputs, uint32 numProjectors)
+{
+	CPU_PROFILE_BLOCK("Best masks");
+
+	thread_job_context context;
+
+	const cpu_projector_images* allImages = images.data();
+
+	for (uint32 i = 0; i < numProjectors; ++i)
+	{
+		if (inputs[i].summary)
+		{
+			continue; // Remote projectors are only sampled.
+		}
+
+		const cpu_projector_input& in = inputs[i];
+		cpu_projector_images& out = images[i];
+
+		const uint32 width = out.width;
+		const uint32 height = out.height;
+		const uint32 halfWidth = out.halfWidth;
+		const uint32 halfHeight = out.halfHeight;
+		const mat4 invViewProj = in.camera.invViewProj;
+		const float* depth = in.depth;
+		const float* E = out.E.data();
+		float* outBestMask = out.bestMask.data();
+
+		addBlockJobs(context, halfHeight, [=](uint32 startY, uint32 endY)
+		{
+			const w8_float laneCenters = getLaneCenters();
+			const w8_float invWidth(1.f / halfWidth);
+
+			for (uint32 y = startY; y < endY; ++y)
+			{
+				const float vScalar = (y + 0.5f) / halfHeight;
+				const w8_float v(vScalar);
+
+				for (uint32 blockX = 0; blockX < halfWidth; blockX += 8)
+				{
+					uint32 x = getBlockStart(blockX, halfWidth);
+					uint32 index = y * halfWidth + x;
+
+					w8_float u = (w8_float((float)x) + laneCenters) * invWidth;
+
+					// The depth is point sampled from the full resolution buffer.
+					w8_float fullX = floor(u * w8_float((float)width));
+					w8_float fullY = floor(v * w8_float((float)height));
+					w8_int depthIndex = convert(fullY * w8_float((float)width) + fullX);
+					w8_float d(depth, depthIndex);
+
+					float depths[8];
+					d.store(depths);
+
+					if (allTrue(d == w8_float(1.f)))
+					{
+						w8_float::zero().store(outBestMask + index);
+						continue;
+					}
+
+					w8_float px, py, pz;
+					restoreWorldSpacePositionW8(invViewProj, u, v, d, px, py, pz);
+
+					float bestE[8] = {};
+
+					for (uint32 j = 0; j < numProjectors; ++j)
+					{
+						if (j == i)
+						{
+							continue;
+						}
+
+						const cpu_projector_images& other = allImages[j];
+
+						w8_float projU, projV, projDepth;
+						projectW8(inputs[j].camera.viewProj, px, py, pz, projU, projV, projDepth);
+
+						float us[8], vs[8], testDepths[8];
+						projU.store(us);
+						projV.store(vs);
+						projDepth.store(testDepths);
+
+						for (uint32 lane = 0; lane < 8; ++lane)
+						{
+							if (depths[lane] < 1.f && isVisible(inputs[j].depth, other.width, other.height, us[lane], vs[lane], testDepths[lane]))
+							{
+								float otherE = sample(other.E.data(), getBorderTaps(other.width, other.height, us[lane], vs[lane]));
+								bestE[lane] = max(bestE[lane], otherE);
+							}
+						}
+					}
+
+					float us[8];
+					u.store(us);
+
+					for (uint32 lane = 0; lane < 8; ++lane)
+					{
+						float ownE = sample(E, getBorderTaps(width, height, us[lane], vScalar));
+						outBestMask[index + lane] = (depths[lane] < 1.f && ownE > bestE[lane]) ? 1.f : 0.f;
+					}
+				}
+			}
+		});
+	}
+
+	context.waitForWorkCompletion();
+}
+
+void cpu_projector_solver::computeDistanceFields(const cpu_projector_input* inputs, uint32 numProjectors)
+{
+	CPU_PROFILE_BLOCK("Distance fields");
+
+	thread_job_context context;
+
+	// Edges of the best masks and of depth and color, at half resolution.
+	for (uint32 i = 0; i < numProjectors; ++i)
+	{
+		if (inputs[i].summary)
+		{
+			continue; // Remote projectors are only sampled.
+		}
+
+		cpu_projector_images& out = images[i];
+
+		const render_camera* camera = &inputs[i].camera;
+		const uint32 width = out.halfWidth;
+		const uint32 height = out.halfHeight;
+		const float depthThreshold = settings.depthDiscontinuityThreshold;
+		const float colorThreshold = settings.colorDiscontinuityThreshold;
+
+		const float* depth = out.halfDepth.data();
+		const vec3* color = out.halfColor.data();
+		const float* bestMask = out.bestMask.data();
+		float* outDepthDiscontinuities = out.depthDiscontinuities.data();
+		float* outColorDiscontinuities = out.colorDiscontinuities.data();
+		float* outBestMaskEdges = out.bestMaskEdges.data();
+
+		addBlockJobs(context, height, [=](uint32 startY, uint32 endY)
+		{
+			for (int32 y = (int32)startY; y < (int32)endY; ++y)
+			{
+				for (int32 x = 0; x < (int32)width; ++x)
+				{
+					float center = depth[y * width + x];
+
+					float depthTaps[9], rTaps[9], gTaps[9], bTaps[9], maskTaps[9];
+					for (int32 t = 0; t < 9; ++t)
+					{
+						int32 tx = x + t % 3 - 1;
+						int32 ty = y + t / 3 - 1;
+						bool inside = tx >= 0 && ty >= 0 && tx < (int32)width && ty < (int32)height;
+						int32 tapIndex = ty * (int32)width + tx;
+
+						// Depth taps outside the image take the center's depth (combined_sobel_cs). Other loads outside the image return 0.
+						depthTaps[t] = camera->depthBufferDepthToEyeDepth(inside ? depth[tapIndex] : center);
+
+						vec3 c = inside ? color[tapIndex] : vec3(0.f, 0.f, 0.f);
+						rTaps[t] = c.x;
+						gTaps[t] = c.y;
+						bTaps[t] = c.z;
+
+						maskTaps[t] = inside ? bestMask[tapIndex] : 0.f;
+					}
+
+					uint32 index = y * width + x;
+					outDepthDiscontinuities[index] = isSobelEdge(depthTaps, depthThreshold) ? 1.f : 0.f;
+					outColorDiscontinuities[index] = (isSobelEdge(rTaps, colorThreshold) || isSobelEdge(gTaps, colorThreshold) || isSobelEdge(bTaps, colorThreshold)) ? 1.f : 0.f;
+					outBestMaskEdges[index] = isSobelEdge(maskTaps, 0.5f) ? 1.f : 0.f;
+				}
+			}
+		});
+	}
+
+	context.waitForWorkCompletion();
+
+
+	struct distance_field_channel
+	{
+		uint32 projector;
+		const float* edges;
+		float* field;
+		float* temp;
+		float truncationDistance;
+		const blur_kernel* kernel;
+	};
+
+	std::vector<distance_field_channel> channels;
+	channels.reserve(numProjectors * 3);
+
+	const float depthTotalDistance = settings.depthHardDistance + settings.depthSmoothDistance;
+	const float colorTotalDistance = settings.colorHardDistance + settings.colorSmoothDistance;
+	const float discontinuityTruncationDistance = ceil(max(depthTotalDistance, colorTotalDistance));
+	const float bestMaskTruncationDistance = ceil(settings.bestMaskHardDistance + settings.bestMaskSmoothDistance);
+
+	for (uint32 i = 0; i < numProjectors; ++i)
+	{
+		if (inputs[i].summary)
+		{
+			continue;
+		}
+
+		cpu_projector_images& out = images[i];
+		uint32 numHalfPixels = out.halfWidth * out.halfHeight;
+
+		channels.push_back({ i, out.depthDiscontinuities.data(), out.depthDistanceField.data(), out.temp.data(), discontinuityTruncationDistance, &gaussianBlur9x9 });
+		channels.push_back({ i, out.colorDiscontinuities.data(), out.colorDistanceField.data(), out.temp.data() + numHalfPixels, discontinuityTruncationDistance, &gaussianBlur9x9 });
+		channels.push_back({ i, out.bestMaskEdges.data(), out.bestMaskDistanceField.data(), out.temp.data() + 2 * numHalfPixels, bestMaskTruncationDistance, &gaussianBlur5x5 });
+	}
+
+	// Exact distance transform in two separable passes. The first writes squared distances along the rows.
+	for (uint32 c = 0; c < (uint32)channels.size(); ++c)
+	{
+		const distance_field_channel channel = channels[c];
+		const uint32 width = images[channel.projector].halfWidth;
+
+		addBlockJobs(context, images[channel.projector].halfHeight, [=](uint32 startY, uint32 endY)
+		{
+			std::vector<float> f(width);
+			std::vector<int32> v(width);
+			std::vector<float> z(width + 1);
+
+			for (uint32 y = startY; y < endY; ++y)
+			{
+				const float* edges = channel.edges + y * width;
+				for (uint32 x = 0; x < width; ++x)
+				{
+					f[x] = (edges[x] != 0.f) ? 0.f : distanceTransformInfinity;
+				}
+				distanceTransform1D(f.data(), width, channel.field + y * width, v.data(), z.data());
+			}
+		});
+	}
+
+	context.waitForWorkCompletion();
+
+	// The second pass combines them along the columns, and truncates like distanceField.
+	for (uint32 c = 0; c < (uint32)channels.size(); ++c)
+	{
+		const distance_field_channel channel = channels[c];
+		const uint32 width = images[channel.projector].halfWidth;
+		const uint32 height = images[channel.projector].halfHeight;
+
+		addBlockJobs(context, width, [=](uint32 startX, uint32 endX)
+		{
+			std::vector<float> f(height);
+			std::vector<float> d(height);
+			std::vector<int32> v(height);
+			std::vector<float> z(height + 1);
+
+			for (uint32 x = startX; x < endX; ++x)
+			{
+				for (uint32 y = 0; y < height; ++y)
+				{
+					f[y] = channel.field[y * width + x];
+				}
+				distanceTransform1D(f.data(), height, d.data(), v.data(), z.data());
+				for (uint32 y = 0; y < height; ++y)
+				{
+					channel.field[y * width + x] = min(sqrt(d[y]), channel.truncationDistance);
+				}
+			}
+		});
+	}
+
+	context.waitForWorkCompletion();
+
+	// Same blurs as after the GPU distance fields. Vertical pass into temp, horizontal pass back.
+	for (uint32 c = 0; c < (uint32)channels.size(); ++c)
+	{
+		const distance_field_channel channel = channels[c];
+		const uint32 width = images[channel.projector].halfWidth;
+		const uint32 height = images[channel.projector].halfHeight;
+
+		addBlockJobs(context, height, [=](uint32 startY, uint32 endY)
+		{
+			for (uint32 y = startY; y < endY; ++y)
+			{
+				for (uint32 x = 0; x < width; ++x)
+				{
+					channel.temp[y * width + x] = blur1D(channel.field + x, height, width, y, *channel.kernel);
+				}
+			}
+		});
+	}
+
+	context.waitForWorkCompletion();
+
+	for (uint32 c = 0; c < (uint32)channels.size(); ++c)
+	{
+		const distance_field_channel channel = channels[c];
+		const uint32 width = images[channel.projector].halfWidth;
+		const uint32 height = images[channel.projector].halfHeight;
+
+		addBlockJobs(context, height, [=](uint32 startY, uint32 endY)
+		{
+			for (uint32 y = startY; y < endY; ++y)
+			{
+				for (uint32 x = 0; x < width; ++x)
+				{
+					channel.field[y * width + x] = blur1D(channel.temp + y * width, width, 1, x, *channel.kernel);
+				}
+			}
+		});
+	}
+
+	context.waitForWorkCompletion();
+}
+
+void cpu_projector_solver::computeMasks(const cpu_projector_input* inputs, uint32 numProjectors)
+{
+	CPU_PROFILE_BLOCK("Masks");
+
+	thread_job_context context;
+
+	for (uint32 i = 0; i < numProjectors; ++i)
+	{
+		if (inputs[i].summary)
+		{
+			continue; // Remote projectors are only sampled.
+		}
+
+		cpu_projector_images& out = images[i];
+
+		const uint32 width = out.width;
+		const uint32 height = out.height;
+		const uint32 halfWidth = out.halfWidth;
+		const uint32 halfHeight = out.halfHeight;
+		const projector_solver_settings s = settings;
+
+		const float* depth = inputs[i].depth;
+		const float* depthDistanceField = out.depthDistanceField.data();
+		const float* colorDistanceField = out.colorDistanceField.data();
+		const float* bestMask = out.bestMask.data();
+		const float* bestMaskDistanceField = out.bestMaskDistanceField.data();
+		float* outHardMask = out.hardMask.data();
+		float* outSoftMask = out.softMask.data();
+
+		addBlockJobs(context, height, [=](uint32 startY, uint32 endY)
+		{
+			const w8_float laneCenters = getLaneCenters();
+			const w8_float invWidth(1.f / width);
+			const w8_float zero = w8_float::zero();
+			const w8_float one(1.f);
+
+			const float edgeWidth = 0.f;
+			const float edgeTransition = 100.f;
+
+			for (uint32 y = startY; y < endY; ++y)
+			{
+				const w8_float v((y + 0.5f) / height);
+				const w8_float distanceFromEdgeY((float)min(y, height - y));
+
+				for (uint32 blockX = 0; blockX < width; blockX += 8)
+				{
+					uint32 x = getBlockStart(blockX, width);
+					uint32 index = y * width + x;
+
+					w8_float d(depth + index);
+					auto background = d == one;
+
+					w8_float u = (w8_float((float)x) + laneCenters) * invWidth;
+					w8_float pixelX = w8_float((float)x) + laneCenters - w8_float(0.5f);
+
+					w8_float depthDistance = sampleLinearClampW8(depthDistanceField, halfWidth, halfHeight, u, v);
+					w8_float colorDistance = sampleLinearClampW8(colorDistanceField, halfWidth, halfHeight, u, v);
+					w8_float depthMask = one - smoothstepW8(s.depthHardDistance, s.depthHardDistance + s.depthSmoothDistance, depthDistance); // 1 at edges, 0 everywhere else.
+					w8_float colorMask = one - smoothstepW8(s.colorHardDistance, s.colorHardDistance + s.colorSmoothDistance, colorDistance); // 1 at edges, 0 everywhere else.
+
+					w8_float best = clamp01(sampleLinearClampW8(bestMask, halfWidth, halfHeight, u, v)); // 1 where best, 0 everywhere else.
+					w8_float bestMaskDistance = sampleLinearClampW8(bestMaskDistanceField, halfWidth, halfHeight, u, v);
+					best *= smoothstepW8(s.bestMaskHardDistance, s.bestMaskHardDistance + s.bestMaskSmoothDistance, bestMaskDistance);
+
+					w8_float distanceFromEdge = minimum(minimum(pixelX, w8_float((float)width) - pixelX), distanceFromEdgeY);
+					w8_float edgeMask = smoothstepW8(edgeWidth, edgeWidth + edgeTransition, distanceFromEdge);
+
+					colorMask = one - colorMask * w8_float(s.colorMaskStrength) * (one - best);
+
+					w8_float softMask = clamp01(minimum(colorMask, edgeMask));
+					w8_float hardMask = clamp01(one - depthMask);
+
+					ifThen(background, zero, hardMask).store(outHardMask + index);
+					ifThen(background, zero, softMask).store(outSoftMask + index);
+				}
+			}
+		});
+	}
+
+	context.waitForWorkCompletion();
+}
+
+void cpu_projector_solver::updateOverlapCache(const cpu_projector_input* inputs, uint32 numProjectors, bool geometryChanged)
+{
+	CPU_PROFILE_BLOCK("Overlap cache");
+
+	static_assert(CPU_PROJECTOR_SOLVER_LINES_PER_JOB % PROJECTOR_BLOCK_SIZE == 0, "Jobs must cover whole tile rows");
+
+	const uint32 numWords = bucketize(numProjectors, 32);
+
+	bool layoutChanged = (uint32)overlaps.projectors.size() != numProjectors || overlaps.numWords != numWords;
+	for (uint32 i = 0; i < numProjectors && !layoutChanged; ++i)
+	{
+		layoutChanged = overlaps.projectors[i].width != images[i].width || overlaps.projectors[i].height != images[i].height;
+	}
+
+	bool rebuildAll = layoutChanged || geometryChanged || !overlaps.valid;
+
+	// A projector is dirty, if its camera and therefore its depth buffer has changed. This invalidates all its pairs, so its own tiles test
+	// all other projectors, and all other tiles test it.
+	std::vector<uint32> dirtyMask(numWords, 0);
+	std::vector<bool> isDirty(numProjectors, false);
+	overlaps.numDirtyProjectors = 0;
+
+	uint32 numTiles = 0;
+
+	overlaps.projectors.resize(numProjectors);
+	for (uint32 i = 0; i < numProjectors; ++i)
+	{
+		cpu_projector_overlap_cache::cached_projector& cached = overlaps.projectors[i];
+
+		if (rebuildAll || memcmp(&cached.viewProj, &inputs[i].camera.viewProj, sizeof(mat4)) != 0)
+		{
+			dirtyMask[i / 32] |= 1u << (i % 32);
+			isDirty[i] = true;
+			++overlaps.numDirtyProjectors;
+		}
+
+		cached.viewProj = inputs[i].camera.viewProj;
+		cached.width = images[i].width;
+		cached.height = images[i].height;
+		cached.numTilesX = bucketize(cached.width, PROJECTOR_BLOCK_SIZE);
+		cached.numTilesY = bucketize(cached.height, PROJECTOR_BLOCK_SIZE);
+		cached.tileOffset = numTiles;
+
+		numTiles += cached.numTilesX * cached.numTilesY;
+	}
+
+	overlaps.numWords = numWords;
+	if (layoutChanged)
+	{
+		overlaps.masks.assign(numTiles * numWords, 0);
+		overlaps.tileClasses.assign(numTiles, projector_tile_empty);
+	}
+
+	if (!settings.useOverlapCache)
+	{
+		// The intensities visit all projectors. Rebuild everything, once the cache is enabled again.
+		overlaps.valid = false;
+		overlaps.numEmptyTiles = overlaps.numSingleTiles = overlaps.numMultiTiles = 0;
+		return;
+	}
+
+	overlaps.valid = true;
+
+	if (overlaps.numDirtyProjectors == 0)
+	{
+		return;
+	}
+
+	thread_job_context context;
+
+	for (uint32 i = 0; i < numProjectors; ++i)
+	{
+		if (inputs[i].summary)
+		{
+			continue; // Remote projectors are only sampled.
+		}
+
+		const cpu_projector_input& in = inputs[i];
+		const cpu_projector_overlap_cache::cached_projector& cached = overlaps.projectors[i];
+
+		// Own tiles test all others, if this projector is dirty. Otherwise only the dirty ones.
+		std::vector<uint32> testProjectors;
+		for (uint32 j = 0; j < numProjectors; ++j)
+		{
+			if (j != i && (isDirty[i] || isDirty[j]))
+			{
+				testProjectors.push_back(j);
+			}
+		}
+
+		std::vector<uint32> clearMask = dirtyMask;
+		if (isDirty[i])
+		{
+			clearMask.assign(numWords, 0xFFFFFFFF);
+		}
+
+		const uint32 width = cached.width;
+		const uint32 height = cached.height;
+		const mat4 invViewProj = in.camera.invViewProj;
+		const float* depth = in.depth;
+		const cpu_projector_images* allImages = images.data();
+		uint32* masks = overlaps.masks.data() + cached.tileOffset * numWords;
+		uint8* tileClasses = overlaps.tileClasses.data() + cached.tileOffset;
+
+		addBlockJobs(context, height, [=, testProjectors = std::move(testProjectors), clearMask = std::move(clearMask)](uint32 startY, uint32 endY)
+		{
+			const w8_float laneCenters = getLaneCenters();
+			const w8_float invWidth(1.f / width);
+
+			// Points of one tile, 8 at a time. Blocks, which would reach into the next tile, are shifted back, with the lanes outside of the
+			// tile masked out.
+			const uint32 maxNumBlocks = PROJECTOR_BLOCK_SIZE * PROJECTOR_BLOCK_SIZE / 8;
+			w8_float px[maxNumBlocks], py[maxNumBlocks], pz[maxNumBlocks];
+			uint32 laneMasks[maxNumBlocks];
+
+			for (uint32 tileY = startY / PROJECTOR_BLOCK_SIZE; tileY < bucketize(endY, PROJECTOR_BLOCK_SIZE); ++tileY)
+			{
+				uint32 tileStartY = tileY * PROJECTOR_BLOCK_SIZE;
+				uint32 tileEndY = min(tileStartY + PROJECTOR_BLOCK_SIZE, height);
+
+				for (uint32 tileX = 0; tileX < cached.numTilesX; ++tileX)
+				{
+					uint32 tileStartX = tileX * PROJECTOR_BLOCK_SIZE;
+					uint32 tileEndX = min(tileStartX + PROJECTOR_BLOCK_SIZE, width);
+
+					uint32 numBlocks = 0;
+					for (uint32 y = tileStartY; y < tileEndY; ++y)
+					{
+						const w8_float v((y + 0.5f) / height);
+
+						for (uint32 blockX = tileStartX; blockX < tileEndX; blockX += 8)
+						{
+							uint32 x = min(blockX, tileEndX >= 8 ? tileEndX - 8 : 0);
+
+							w8_float d(depth + y * width + x);
+
+							uint32 laneMask = 0;
+							for (uint32 lane = 0; lane < 8; ++lane)
+							{
+								uint32 laneX = x + lane;
+								if (laneX >= blockX && laneX < tileEndX && depth[y * width + laneX] < 1.f)
+								{
+									laneMask |= 1u << lane;
+								}
+							}
+
+							if (laneMask == 0)
+							{
+								continue;
+							}
+
+							w8_float u = (w8_float((float)x) + laneCenters) * invWidth;
+							restoreWorldSpacePositionW8(invViewProj, u, v, d, px[numBlocks], py[numBlocks], pz[numBlocks]);
+							laneMasks[numBlocks] = laneMask;
+							++numBlocks;
+						}
+					}
+
+					uint32* mask = masks + (tileY * cached.numTilesX + tileX) * numWords;
+					for (uint32 w = 0; w < numWords; ++w)
+					{
+						mask[w] &= ~clearMask[w];
+					}
+
+					for (uint32 j : testProjectors)
+					{
+						const cpu_projector_input& other = inputs[j];
+						const uint32 otherWidth = allImages[j].width;
+						const uint32 otherHeight = allImages[j].height;
+
+						bool visible = false;
+						for (uint32 block = 0; block < numBlocks && !visible; ++block)
+						{
+							w8_float projU, projV, projDepth;
+							projectW8(other.camera.viewProj, px[block], py[block], pz[block], projU, projV, projDepth);
+
+							float us[8], vs[8], testDepths[8];
+							projU.store(us);
+							projV.store(vs);
+							projDepth.store(testDepths);
+
+							for (uint32 lane = 0; lane < 8 && !visible; ++lane)
+							{
+								visible = ((laneMasks[block] >> lane) & 1)
+									&& isVisible(other.depth, otherWidth, otherHeight, us[lane], vs[lane], testDepths[lane]);
+							}
+						}
+
+						if (visible)
+						{
+							mask[j / 32] |= 1u << (j % 32);
+						}
+					}
+
+					uint32 anyOverlap = 0;
+					for (uint32 w = 0; w < numWords; ++w)
+					{
+						anyOverlap |= mask[w];
+					}
+
+					tileClasses[tileY * cached.numTilesX + tileX] = (numBlocks == 0) ? projector_tile_empty
+						: (anyOverlap != 0) ? projector_tile_multi
+						: projector_tile_single;
+				}
+			}
+		});
+	}
+
+	context.waitForWorkCompletion();
+
+	overlaps.numEmptyTiles = overlaps.numSingleTiles = overlaps.numMultiTiles = 0;
+	for (uint8 tileClass : overlaps.tileClasses)
+	{
+		overlaps.numEmptyTiles += (tileClass == projector_tile_empty);
+		overlaps.numSingleTiles += (tileClass == projector_tile_single);
+		overlaps.numMultiTiles += (tileClass == projector_tile_multi);
+	}
+}
+
+struct projector_data
+{
+	float attenuation;
+	float E;
+	float maxCompensationFactor;
+	float previousIntensity; // Only used when warm starting.
+};
+
+// Iterative distribution of the target intensity over all projectors seeing a point. Uses the same streaming replay as
+// projector_intensities_cs (see projector_rs.hlsli), only that the list of projectors is available here. The projector of interest is at
+// index 0. Returns its intensity.
+static float solvePixel(const projector_data* projectors, uint32 numProjectors, float ESum, float targetIntensity)
+{
+	projector_solver_state state;
+	state.ESum[0] = ESum;
+	state.remainingIntensity[0] = targetIntensity;
+	state.numIterations = 0;
+
+	uint32 numActiveProjectors = numProjectors;
+
+	for (uint32 iteration = 0; iteration < PROJECTOR_SOLVER_NUM_ITERATIONS && numActiveProjectors > 0; ++iteration)
+	{
+		state.numIterations = iteration + 1;
+
+		float resultingIntensity = 0.f;
+		float nextESum = 0.f;
+		numActiveProjectors = 0;
+
+		for (uint32 projIndex = 0; projIndex < numProjectors; ++projIndex)
+		{
+			const projector_data& proj = projectors[projIndex];
+
+			projector_solver_replay replay = replayProjectorSolver(state, iteration + 1, proj.attenuation, proj.E, proj.maxCompensationFactor);
+
+			resultingIntensity += replay.contribution;
+
+			if (replay.active)
+			{
+				nextESum += proj.E;
+				++numActiveProjectors;
+			}
+		}
+
+		float remainingIntensity = state.remainingIntensity[iteration];
+		if (resultingIntensity >= remainingIntensity - 0.001f || iteration == PROJECTOR_SOLVER_NUM_ITERATIONS - 1)
+		{
+			break;
+		}
+
+		state.remainingIntensity[iteration + 1] = remainingIntensity - resultingIntensity;
+		state.ESum[iteration + 1] = nextESum;
+	}
+
+	const projector_data& myProj = projectors[0];
+	projector_solver_replay myReplay = replayProjectorSolver(state, state.numIterations, myProj.attenuation, myProj.E, myProj.maxCompensationFactor);
+	return max(0.f, myReplay.partialSum / targetIntensity);
+}
+
+// Same as the warm start path of projector_intensities_cs. The projector of interest is at index 0.
+static float warmStartPixel(const projector_data* projectors, uint32 numProjectors, float ESum, float targetIntensity)
+{
+	float previousBrightness = 0.f;
+	for (uint32 projIndex = 0; projIndex < numProjectors; ++projIndex)
+	{
+		previousBrightness += projectors[projIndex].attenuation * projectors[projIndex].previousIntensity;
+	}
+
+	const projector_data& myProj = projectors[0];
+	return warmStartProjectorIntensity(myProj.previousIntensity, previousBrightness, ESum,
+		myProj.attenuation, myProj.E, myProj.maxCompensationFactor, targetIntensity);
+}
+
+void cpu_projector_solver::computeIntensities(const cpu_projector_input* inputs, uint32 numProjectors, bool warmStart)
+{
+	CPU_PROFILE_BLOCK("Intensities");
+
+	thread_job_context context;
+
+	const cpu_projector_images* allImages = images.data();
+
+	for (uint32 i = 0; i < numProjectors; ++i)
+	{
+		if (inputs[i].summary)
+		{
+			continue; // Remote projectors are only sampled.
+		}
+
+		const cpu_projector_input& in = inputs[i];
+		cpu_projector_images& out = images[i];
+
+		const uint32 width = out.width;
+		const uint32 height = out.height;
+		const mat4 invViewProj = in.camera.invViewProj;
+		const float* depth = in.depth;
+		float* outIntensities = out.intensities.data();
+
+		const cpu_projector_overlap_cache& overlapCache = overlaps;
+		const bool useOverlapCache = settings.useOverlapCache;
+
+		addBlockJobs(context, height, [=, &overlapCache](uint32 startY, uint32 endY)
+		{
+			const w8_float laneCenters = getLaneCenters();
+			const w8_float invWidth(1.f / width);
+
+			const cpu_projector_images& own = allImages[i];
+
+			// Per lane list of the projectors seeing the pixel's point, own projector first.
+			std::vector<projector_data> candidates(8 * numProjectors);
+
+			// Other projectors seeing the block's tile(s).
+			const uint32 numWords = bucketize(numProjectors, 32);
+			std::vector<uint32> blockMask(numWords);
+
+			for (uint32 y = startY; y < endY; ++y)
+			{
+				const w8_float v((y + 0.5f) / height);
+
+				for (uint32 blockX = 0; blockX < width; blockX += 8)
+				{
+					uint32 x = getBlockStart(blockX, width);
+					uint32 index = y * width + x;
+
+					// The last block of a row may reach into the previous tile. The class order makes the maximum the class of the block.
+					uint32 firstTileX = x / PROJECTOR_BLOCK_SIZE;
+					uint32 lastTileX = (x + 7) / PROJECTOR_BLOCK_SIZE;
+					uint32 tileY = y / PROJECTOR_BLOCK_SIZE;
+
+					uint32 tileClass = useOverlapCache
+						? max(overlapCache.getTileClass(i, firstTileX, tileY), overlapCache.getTileClass(i, lastTileX, tileY))
+						: projector_tile_multi;
+
+					w8_float d(depth + index);
+					if (tileClass == projector_tile_empty || allTrue(d == w8_float(1.f)))
+					{
+						w8_float::zero().store(outIntensities + index);
+						continue;
+					}
+
+					float depths[8];
+					d.store(depths);
+
+					uint32 counts[8];
+					float ESums[8];
+
+					for (uint32 lane = 0; lane < 8; ++lane)
+					{
+						uint32 pixel = index + lane;
+						candidates[lane * numProjectors] = { own.possibleWhiteIntensity[pixel], own.E[pixel] * own.softMask[pixel], own.hardMask[pixel], own.previousIntensities[pixel] };
+						ESums[lane] = candidates[lane * numProjectors].E;
+						counts[lane] = 1;
+					}
+
+					// Only multi-coverage blocks visit the other projectors.
+					if (tileClass == projector_tile_multi)
+					{
+						w8_float u = (w8_float((float)x) + laneCenters) * invWidth;
+
+						w8_float px, py, pz;
+						restoreWorldSpacePositionW8(invViewProj, u, v, d, px, py, pz);
+
+						if (useOverlapCache)
+						{
+							const uint32* first = overlapCache.getTileMask(i, firstTileX, tileY);
+							const uint32* last = overlapCache.getTileMask(i, lastTileX, tileY);
+							for (uint32 w = 0; w < numWords; ++w)
+							{
+								blockMask[w] = first[w] | last[w];
+							}
+						}
+						else
+						{
+							for (uint32 w = 0; w < numWords; ++w)
+							{
+								uint32 numProjectorsInWord = min(numProjectors - w * 32, 32u);
+								blockMask[w] = (numProjectorsInWord == 32) ? 0xFFFFFFFF : ((1u << numProjectorsInWord) - 1);
+							}
+							blockMask[i / 32] &= ~(1u << (i % 32));
+						}
+
+						for (uint32 w = 0; w < numWords; ++w)
+						{
+							for (uint32 word = blockMask[w]; word != 0; word &= word - 1)
+							{
+								uint32 j = w * 32 + indexOfLeastSignificantSetBit(word);
+
+								const cpu_projector_images& other = allImages[j];
+
+								w8_float projU, projV, projDepth;
+								projectW8(inputs[j].camera.viewProj, px, py, pz, projU, projV, projDepth);
+
+								float us[8], vs[8], testDepths[8];
+								projU.store(us);
+								projV.store(vs);
+								projDepth.store(testDepths);
+
+								for (uint32 lane = 0; lane < 8; ++lane)
+								{
+									if (depths[lane] < 1.f && isVisible(inputs[j].depth, other.width, other.height, us[lane], vs[lane], testDepths[lane]))
+									{
+										bilinear_taps taps = getBorderTaps(other.width, other.height, us[lane], vs[lane]);
+
+										projector_data& p = candidates[lane * numProjectors + counts[lane]++];
+										p.attenuation = sample(other.possibleWhiteIntensity.data(), taps);
+										p.E = sample(other.E.data(), taps) * sample(other.softMask.data(), taps);
+										p.maxCompensationFactor = sample(other.hardMask.data(), taps);
+										p.previousIntensity = warmStart ? sample(other.previousIntensities.data(), taps) : 0.f;
+
+										ESums[lane] += p.E;
+									}
+								}
+							}
+						}
+					}
+
+					for (uint32 lane = 0; lane < 8; ++lane)
+					{
+						uint32 pixel = index + lane;
+						float targetIntensity = max(own.maxComponent[pixel], 0.001f);
+
+						// Single coverage blocks take the regular path, like on the GPU.
+						if (depths[lane] == 1.f)
+						{
+							outIntensities[pixel] = 0.f;
+						}
+						else if (warmStart && tileClass == projector_tile_multi)
+						{
+							outIntensities[pixel] = warmStartPixel(&candidates[lane * numProjectors], counts[lane], ESums[lane], targetIntensity);
+						}
+						else
+						{
+							outIntensities[pixel] = solvePixel(&candidates[lane * numProjectors], counts[lane], ESums[lane], targetIntensity);
+						}
+					}
+				}
+			}
+		});
+	}
+
+	context.waitForWorkCompletion();
+}
+
+
+
+
+
+
+// Sphere on a checkered floor.
+static void renderSyntheticScene(const render_camera& camera, std::vector<float>& depth, std::vector<vec3>& normals, std::vector<vec3>& colors,
+	float floorExtent = 1.5f, vec3 sphereOffset = vec3(0.f, 0.f, 0.f))
+{
+	const uint32 width = camera.width;
+	const uint32 height = camera.height;
+
+	depth.resize(width * height);
+	normals.resize(width * height);
+	colors.resize(width * height);
+
+	const vec3 sphereCenter = vec3(0.f, 0.3f, 0.f) + sphereOffset;
+	const float sphereRadius = 0.3f;
+
+	thread_job_context context;
+
+	addBlockJobs(context, height, [&](uint32 startY, uint32 endY)
+	{
+		for (uint32 y = startY; y < endY; ++y)
+		{
+			for (uint32 x = 0; x < width; ++x)
+			{
+				uint32 index = y * width + x;
+				ray r = camera.generateWorldSpaceRay((x + 0.5f) / width, (y + 0.5f) / height);
+
+				float t = FLT_MAX;
+				vec3 normal(0.f, 1.f, 0.f);
+				vec3 color(0.f, 0.f, 0.f);
+
+				float floorT;
+				if (r.intersectPlane(vec3(0.f, 1.f, 0.f), 0.f, floorT) && floorT > 0.f)
+				{
+					vec3 p = r.origin + floorT * r.direction;
+					if (abs(p.x) <= floorExtent && abs(p.z) <= floorExtent)
+					{
+						t = floorT;
+						bool checker = (((int32)floor(p.x * 4.f) + (int32)floor(p.z * 4.f)) & 1) != 0;
+						color = checker ? vec3(0.8f, 0.8f, 0.8f) : vec3(0.4f, 0.4f, 0.4f);
+					}
+				}
+
+				float sphereT;
+				if (r.intersectSphere(sphereCenter, sphereRadius, sphereT) && sphereT < t)
+				{
+					t = sphereT;
+					normal = normalize(r.origin + t * r.direction - sphereCenter);
+					color = vec3(0.9f, 0.5f, 0.2f);
+				}
+
+				if (t == FLT_MAX)
+				{
+					depth[index] = 1.f;
+					normals[index] = vec3(0.f, 1.f, 0.f);
+					colors[index] = vec3(0.f, 0.f, 0.f);
+					continue;
+				}
+
+				vec4 clip = camera.viewProj * vec4(r.origin + t * r.direction, 1.f);
+				depth[index] = clip.z / clip.w;
+				normals[index] = normal;
+				colors[index] = color;
+			}
+		}
+	});
+
+	context.waitForWorkCompletion();
+}
+
+// Sum of the light all projectors put onto the points seen by projector 0, relative to the target (1 is perfect).
+static void measureBrightness(const cpu_projector_solver& solver, const cpu_projector_input* inputs, uint32 numProjectors, float& outMean, float& outWithin5Percent)
+{
+	const cpu_projector_images& own = solver.images[0];
+	const render_camera& camera = inputs[0].camera;
+
+	double sum = 0.0;
+	uint32 numWithin = 0;
+	uint32 numPoints = 0;
+
+	for (uint32 y = 0; y < own.height; y += 4)
+	{
+		for (uint32 x = 0; x < own.width; x += 4)
+		{
+			uint32 index = y * own.width + x;
+			float d = inputs[0].depth[index];
+			if (d == 1.f)
+			{
+				continue;
+			}
+
+			vec3 p = camera.restoreWorldSpacePosition(vec2((x + 0.5f) / own.width, (y + 0.5f) / own.height), d);
+
+			float brightness = own.possibleWhiteIntensity[index] * own.intensities[index];
+			for (uint32 j = 1; j < numProjectors; ++j)
+			{
+				const cpu_projector_images& other = solver.images[j];
+
+				vec4 clip = inputs[j].camera.viewProj * vec4(p, 1.f);
+				float u = clip.x / clip.w * 0.5f + 0.5f;
+				float v = clip.y / clip.w * -0.5f + 0.5f;
+				if (isVisible(inputs[j].depth, other.width, other.height, u, v, clip.z / clip.w))
+				{
+					bilinear_taps taps = getBorderTaps(other.width, other.height, u, v);
+					brightness += sample(other.possibleWhiteIntensity.data(), taps) * sample(other.intensities.data(), taps);
+				}
+			}
+
+			sum += brightness;
+			numWithin += abs(brightness - 1.f) <= 0.05f;
+			++numPoints;
+		}
+	}
+
+	outMean = numPoints ? (float)(sum / numPoints) : 0.f;
+	outWithin5Percent = numPoints ? (float)numWithin / numPoints : 0.f;
+}
+
+// Projectors on a circle around the synthetic scene, all looking at its center.
+struct circle_projector_scene
+{
+	std::vector<render_camera> cameras;
+	std::vector<std::vector<float>> depths;
+	std::vector<std::vector<vec3>> normals;
+	std::vector<std::vector<vec3>> colors;
+	std::vector<cpu_projector_input> inputs;
+
+	// Renders the scene for all projectors, with the sphere moved by the offset.
+	void render(vec3 sphereOffset = vec3(0.f, 0.f, 0.f))
+	{
+		for (uint32 i = 0; i < (uint32)cameras.size(); ++i)
+		{
+			renderSyntheticScene(cameras[i], depths[i], normals[i], colors[i], 1.5f, sphereOffset);
+			inputs[i] = { cameras[i], depths[i].data(), normals[i].data(), colors[i].data() };
+		}
+	}
+};
+
+static const float circleProjectorReferenceDistance = 2.f; // Roughly the distance of the projectors to the scene.
+
+static circle_projector_scene createCircleProjectors(uint32 numProjectors, uint32 width, uint32 height)
+{
+	circle_projector_scene result;
+	result.cameras.resize(numProjectors);
+	result.depths.resize(numProjectors);
+	result.normals.resize(numProjectors);
+	result.colors.resize(numProjectors);
+	result.inputs.resize(numProjectors);
+
+	for (uint32 i = 0; i < numProjectors; ++i)
+	{
+		float angle = 2.f * M_PI * i / numProjectors;
+		vec3 position(cos(angle) * 1.6f, 1.4f, sin(angle) * 1.6f);
+		vec3 target(0.f, 0.2f, 0.f);
+
+		render_camera& camera = result.cameras[i];
+		camera.initializeIngame(position, lookAtQuaternion(target - position, vec3(0.f, 1.f, 0.f)), deg2rad(40.f), 0.1f);
+		camera.setViewport(width, height);
+		camera.updateMatrices();
+	}
+
+	result.render();
+	return result;
+}
+
+void benchmarkCPUProjectorSolver(uint32 maxNumProjectors, uint32 width, uint32 height)
+{
+	if (maxNumProjectors == 0)
+	{
+		return;
+	}
+
+	// Adding projectors does not move the existing ones.
+	circle_projector_scene scene = createCircleProjectors(maxNumProjectors, width, height);
+	const std::vector<cpu_projector_input>& inputs = scene.inputs;
+
+	const uint32 numRuns = 5;
+
+	cpu_projector_solver solver;
+	solver.settings.referenceDistance = circleProjectorReferenceDistance;
+
+	for (uint32 numProjectors = 1; numProjectors <= maxNumProjectors; ++numProjectors)
+	{
+		cpu_projector_solver_timings sum = {};
+		for (uint32 run = 0; run < numRuns; ++run)
+		{
+			solver.solve(inputs.data(), numProjectors);
+
+			sum.attenuationMS += solver.timings.attenuationMS;
+			sum.bestMaskMS += solver.timings.bestMaskMS;
+			sum.distanceFieldsMS += solver.timings.distanceFieldsMS;
+			sum.maskMS += solver.timings.maskMS;
+			sum.overlapMS += solver.timings.overlapMS;
+			sum.intensitiesMS += solver.timings.intensitiesMS;
+			sum.totalMS += solver.timings.totalMS;
+		}
+
+		float meanBrightness, within5Percent;
+		measureBrightness(solver, inputs.data(), numProjectors, meanBrightness, within5Percent);
+
+		LOG_MESSAGE("CPU projector solver, %u projectors at %ux%u: %.2fms total (attenuation %.2fms, best masks %.2fms, distance fields %.2fms, masks %.2fms, overlaps %.2fms, intensities %.2fms). "
+			"Mean brightness relative to target %.3f, %.1f%% of points within 5%%",
+			numProjectors, width, height, sum.totalMS / numRuns,
+			sum.attenuationMS / numRuns, sum.bestMaskMS / numRuns, sum.distanceFieldsMS / numRuns, sum.maskMS / numRuns, sum.overlapMS / numRuns, sum.intensitiesMS / numRuns,
+			meanBrightness, within5Percent * 100.f);
+	}
+}
+
+void benchmarkProjectorOverlapCache(uint32 maxNumProjectors, uint32 width, uint32 height)
+{
+	for (uint32 numProjectors = 4; numProjectors <= maxNumProjectors; numProjectors *= 2)
+	{
+		// Projectors in a grid 2m above the floor, 1m apart, each looking down and slightly outwards. Neighbors overlap, but most pairs
+		// don't.
+		uint32 numColumns = (uint32)ceil(sqrt((float)numProjectors));
+		uint32 numRows = bucketize(numProjectors, numColumns);
+		float floorExtent = max(numColumns, numRows) * 0.5f + 1.f;
+
+		std::vector<render_camera> cameras(numProjectors);
+		std::vector<std::vector<float>> depths(numProjectors);
+		std::vector<std::vector<vec3>> normals(numProjectors);
+		std::vector<std::vector<vec3>> colors(numProjectors);
+		std::vector<cpu_projector_input> inputs(numProjectors);
+
+		auto placeProjector = [&](uint32 i, vec3 offset)
+		{
+			vec3 position((i % numColumns - (numColumns - 1) * 0.5f), 2.f, (i / numColumns - (numRows - 1) * 0.5f));
+			position += offset;
+			vec3 target(position.x * 1.1f, 0.f, position.z * 1.1f + 0.2f);
+
+			render_camera& camera = cameras[i];
+			camera.initializeIngame(position, lookAtQuaternion(target - position, vec3(0.f, 0.f, -1.f)), deg2rad(40.f), 0.1f);
+			camera.setViewport(width, height);
+			camera.updateMatrices();
+
+			renderSyntheticScene(camera, depths[i], normals[i], colors[i], floorExtent);
+
+			inputs[i] = { camera, depths[i].data(), normals[i].data(), colors[i].data() };
+		};
+
+		for (uint32 i = 0; i < numProjectors; ++i)
+		{
+			placeProjector(i, vec3(0.f, 0.f, 0.f));
+		}
+
+		cpu_projector_solver solver;
+		solver.settings.referenceDistance = 2.f;
+		solver.settings.temporalReuse = false; // Would skip the unchanged solve below.
+
+		solver.settings.useOverlapCache = false;
+		solver.solve(inputs.data(), numProjectors);
+		float uncachedIntensitiesMS = solver.timings.intensitiesMS;
+
+		std::vector<std::vector<float>> reference(numProjectors);
+		for (uint32 i = 0; i < numProjectors; ++i)
+		{
+			reference[i] = solver.images[i].intensities;
+		}
+
+		solver.settings.useOverlapCache = true;
+		solver.solve(inputs.data(), numProjectors);
+		float rebuildMS = solver.timings.overlapMS;
+		float cachedIntensitiesMS = solver.timings.intensitiesMS;
+
+		// Visiting only the cached projectors must not change the result.
+		float maxDifference = 0.f;
+		for (uint32 i = 0; i < numProjectors; ++i)
+		{
+			for (uint32 p = 0; p < (uint32)reference[i].size(); ++p)
+			{
+				maxDifference = max(maxDifference, abs(reference[i][p] - solver.images[i].intensities[p]));
+			}
+		}
+
+		uint64 numSetBits = 0;
+		for (uint32 word : solver.overlaps.masks)
+		{
+			numSetBits += __popcnt(word);
+		}
+		float overlapsPerTile = (float)numSetBits / (solver.overlaps.masks.size() / solver.overlaps.numWords);
+
+		uint32 numEmptyTiles = solver.overlaps.numEmptyTiles;
+		uint32 numSingleTiles = solver.overlaps.numSingleTiles;
+		uint32 numMultiTiles = solver.overlaps.numMultiTiles;
+
+		solver.solve(inputs.data(), numProjectors, projector_scene_static);
+		float unchangedMS = solver.timings.overlapMS;
+
+		placeProjector(0, vec3(0.05f, 0.f, 0.f));
+		solver.solve(inputs.data(), numProjectors, projector_scene_static);
+		float oneMovedMS = solver.timings.overlapMS;
+
+		LOG_MESSAGE("Projector overlap cache, %u projectors at %ux%u: Intensities %.2fms without cache, %.2fms with cache (max difference %f). "
+			"Cache: %.1f other projectors per tile, full rebuild %.2fms, unchanged %.2fms, one projector moved %.2fms. "
+			"Tiles: %u empty, %u single coverage, %u multi coverage",
+			numProjectors, width, height, uncachedIntensitiesMS, cachedIntensitiesMS, maxDifference,
+			overlapsPerTile, rebuildMS, unchangedMS, oneMovedMS,
+			numEmptyTiles, numSingleTiles, numMultiTiles);
+	}
+}
+
+void benchmarkProjectorTemporalReuse(uint32 numProjectors, uint32 width, uint32 height, uint32 numFrames)
+{
+	if (numProjectors == 0)
+	{
+		return;
+	}
+
+	circle_projector_scene scene = createCircleProjectors(numProjectors, width, height);
+	const std::vector<cpu_projector_input>& inputs = scene.inputs;
+
+	// The warm started solver follows the sphere. The other one solves every frame from scratch.
+	cpu_projector_solver warmSolver;
+	warmSolver.settings.referenceDistance = circleProjectorReferenceDistance;
+
+	cpu_projector_solver fullSolver;
+	fullSolver.settings.referenceDistance = circleProjectorReferenceDistance;
+	fullSolver.settings.temporalReuse = false;
+
+	warmSolver.solve(inputs.data(), numProjectors);
+
+	const vec3 step(0.004f, 0.f, 0.002f); // Below the default small motion distance.
+
+	uint32 numWarmStarts = 0;
+	float warmIntensitiesMS = 0.f, fullIntensitiesMS = 0.f;
+	float warmTotalMS = 0.f, fullTotalMS = 0.f;
+	float worstBrightnessDifference = 0.f, worstWithin5PercentDifference = 0.f;
+	float lastWarmBrightness = 0.f, lastFullBrightness = 0.f;
+
+	for (uint32 frame = 1; frame <= numFrames; ++frame)
+	{
+		scene.render(step * (float)frame);
+
+		warmSolver.solve(inputs.data(), numProjectors, projector_scene_small_motion);
+		numWarmStarts += warmSolver.lastSolveMode == projector_solve_warm_start;
+		warmIntensitiesMS += warmSolver.timings.intensitiesMS;
+		warmTotalMS += warmSolver.timings.totalMS;
+
+		fullSolver.solve(inputs.data(), numProjectors);
+		fullIntensitiesMS += fullSolver.timings.intensitiesMS;
+		fullTotalMS += fullSolver.timings.totalMS;
+
+		float warmBrightness, warmWithin5Percent;
+		measureBrightness(warmSolver, inputs.data(), numProjectors, warmBrightness, warmWithin5Percent);
+
+		float fullBrightness, fullWithin5Percent;
+		measureBrightness(fullSolver, inputs.data(), numProjectors, fullBrightness, fullWithin5Percent);
+
+		worstBrightnessDifference = max(worstBrightnessDifference, abs(warmBrightness - fullBrightness));
+		worstWithin5PercentDifference = max(worstWithin5PercentDifference, fullWithin5Percent - warmWithin5Percent);
+		lastWarmBrightness = warmBrightness;
+		lastFullBrightness = fullBrightness;
+	}
+
+	// The sphere stops. The first solve removes what the warm starts have accumulated, after that the results are reused.
+	warmSolver.solve(inputs.data(), numProjectors, projector_scene_static);
+	projector_solve_mode settleMode = warmSolver.lastSolveMode;
+	float settleMS = warmSolver.timings.totalMS;
+
+	auto t0 = std::chrono::high_resolution_clock::now();
+	warmSolver.solve(inputs.data(), numProjectors, projector_scene_static);
+	auto t1 = std::chrono::high_resolution_clock::now();
+	projector_solve_mode idleMode = warmSolver.lastSolveMode;
+	float idleMS = std::chrono::duration<float, std::milli>(t1 - t0).count();
+
+	LOG_MESSAGE("Projector temporal reuse, %u projectors at %ux%u, %u frames of small motion (%u warm started): "
+		"Intensities %.2fms warm started, %.2fms full. Total %.2fms warm started, %.2fms full. "
+		"Mean brightness %.3f warm started, %.3f full at the last frame, worst difference %.3f, worst loss of points within 5%% %.1f%%. "
+		"After stopping: %s %.2fms, then %s %.3fms",
+		numProjectors, width, height, numFrames, numWarmStarts,
+		warmIntensitiesMS / numFrames, fullIntensitiesMS / numFrames, warmTotalMS / numFrames, fullTotalMS / numFrames,
+		lastWarmBrightness, lastFullBrightness, worstBrightnessDifference, worstWithin5PercentDifference * 100.f,
+		projectorSolveModeNames[settleMode], settleMS, projectorSolveModeNames[idleMode], idleMS);
+}
+
+void benchmarkDistributedProjectorSolver(uint32 numProjectors, uint32 width, uint32 height)
+{
+	if (numProjectors < 2)
+	{
+		return;
+	}
+
+	circle_projector_scene scene = createCircleProjectors(numProjectors, width, height);
+	const std::vector<cpu_projector_input>& inputs = scene.inputs;
+
+	cpu_projector_solver fullSolver;
+	fullSolver.settings.referenceDistance = circleProjectorReferenceDistance;
+	fullSolver.solve(inputs.data(), numProjectors);
+	float fullMS = fullSolver.timings.totalMS;
+
+	float fullBrightness, fullWithin5Percent;
+	measureBrightness(fullSolver, inputs.data(), numProjectors, fullBrightness, fullWithin5Percent);
+
+	// Node 0 owns the first half of the projectors, node 1 the rest. Each node sees the other's projectors through the summaries it has
+	// received after the last round of solves.
+	auto getOwner = [=](uint32 i) { return (i < numProjectors / 2) ? 0u : 1u; };
+
+	cpu_projector_solver nodes[2];
+	std::vector<projector_summary> received[2];
+	std::vector<cpu_projector_input> nodeInputs[2];
+
+	for (uint32 k = 0; k < 2; ++k)
+	{
+		nodes[k].settings.referenceDistance = circleProjectorReferenceDistance;
+		received[k].resize(numProjectors);
+		nodeInputs[k] = inputs;
+
+		for (uint32 i = 0; i < numProjectors; ++i)
+		{
+			if (getOwner(i) != k)
+			{
+				nodeInputs[k][i].summary = &received[k][i];
+			}
+		}
+	}
+
+	// The first round has no summaries yet. Solve until both nodes reuse their results.
+	const uint32 maxNumRounds = 10;
+	uint32 numRounds = 0;
+	float nodeMS = 0.f, summaryMS = 0.f;
+	uint32 numSummaryBytes = 0;
+
+	for (uint32 round = 0; round < maxNumRounds; ++round)
+	{
+		bool allReused = true;
+		for (uint32 k = 0; k < 2; ++k)
+		{
+			nodes[k].solve(nodeInputs[k].data(), numProjectors, projector_scene_static);
+			allReused &= nodes[k].lastSolveMode == projector_solve_reuse;
+
+			if (round == 1)
+			{
+				nodeMS = max(nodeMS, nodes[k].timings.totalMS);
+				summaryMS = max(summaryMS, nodes[k].timings.summaryMS);
+			}
+		}
+
+		if (allReused)
+		{
+			break;
+		}
+		++numRounds;
+
+		for (uint32 i = 0; i < numProjectors; ++i)
+		{
+			uint32 owner = getOwner(i);
+			received[1 - owner][i] = nodes[owner].localSummaries[i];
+
+			if (round == 0)
+			{
+				numSummaryBytes += (uint32)(received[1 - owner][i].texels.size() * sizeof(projector_summary_texel));
+			}
+		}
+	}
+
+	// Combine the results of both nodes.
+	cpu_projector_solver combined;
+	combined.images.resize(numProjectors);
+	for (uint32 i = 0; i < numProjectors; ++i)
+	{
+		combined.images[i] = nodes[getOwner(i)].images[i];
+	}
+
+	float distributedBrightness, distributedWithin5Percent;
+	measureBrightness(combined, inputs.data(), numProjectors, distributedBrightness, distributedWithin5Percent);
+
+	LOG_MESSAGE("Distributed projector solver, %u projectors at %ux%u on 2 nodes: %.2fms per node (summaries %.2fms) vs. %.2fms on one node, %u bytes of summaries per exchange. "
+		"Settled after %u rounds. Mean brightness %.3f distributed, %.3f on one node, %.1f%% vs. %.1f%% of points within 5%%",
+		numProjectors, width, height, nodeMS, summaryMS, fullMS, numSummaryBytes,
+		numRounds, distributedBrightness, fullBrightness, distributedWithin5Percent * 100.f, fullWithin5Percent * 100.f);
+}
@@ -0,0 +1,156 @@
+#pragma once
+
+#include "core/camera.h"
+#include "projector_solver.h"
+
+
+// Rendered images of one projector at its render resolution. Rows start at the top, like the textures of the projector renderer.
+struct cpu_projector_input
+{
+	render_camera camera; // Matrices must be up to date.
+
+	const float* depth;			// Depth buffer values. 1 is background.
+	const vec3* worldNormals;	// Normalized.
+	const vec3* color;			// Linear color (the projector renderer's LDR post processing result).
+
+	// Set for projectors of other network nodes. Their images are not used then, only the summary, which may be empty or stale.
+	const projector_summary* summary = 0;
+};
+
+// Results and intermediate images of one projector. These hold the same values as the projector renderer's textures, but as separate
+// channels for vector loads.
+struct cpu_projector_images
+{
+	uint32 width = 0, height = 0;
+	uint32 halfWidth = 0, halfHeight = 0;
+
+	// Full resolution.
+	std::vector<float> possibleWhiteIntensity;	// Attenuation texture x.
+	std::vector<float> E;						// Attenuation texture y.
+	std::vector<float> maxComponent;			// Attenuation texture z.
+	std::vector<float> hardMask;				// Mask texture x.
+	std::vector<float> softMask;				// Mask texture y.
+	std::vector<float> intensities;				// Solver intensity texture.
+	std::vector<float> previousIntensities;		// Solver intensity temp texture. Last intensities, when warm starting.
+
+	// Half resolution.
+	std::vector<float> halfDepth;
+	std::vector<vec3> halfColor;
+	std::vector<float> bestMask;
+	std::vector<float> bestMaskEdges;
+	std::vector<float> depthDiscontinuities;
+	std::vector<float> colorDiscontinuities;
+	std::vector<float> bestMaskDistanceField;
+	std::vector<float> depthDistanceField;
+	std::vector<float> colorDistanceField;
+
+	std::vector<float> temp;
+
+	std::vector<float> summaryDepth; // Remote projectors only. Their other full resolution images are at summary resolution.
+};
+
+// Same layout as the GPU overlap cache (see projector_rs.hlsli): Per tile of PROJECTOR_BLOCK_SIZE x PROJECTOR_BLOCK_SIZE pixels, a bit mask of
+// the other projectors, which see at least one of the tile's points, and the tile's class.
+struct cpu_projector_overlap_cache
+{
+	struct cached_projector
+	{
+		mat4 viewProj;
+		uint32 width, height;
+		uint32 numTilesX, numTilesY;
+		uint32 tileOffset;
+	};
+
+	std::vector<cached_projector> projectors; // State of the projectors at the last update.
+	std::vector<uint32> masks;
+	std::vector<uint8> tileClasses; // projector_tile_*.
+	uint32 numWords = 0;
+	bool valid = false;
+
+	// At the last update.
+	uint32 numDirtyProjectors = 0;
+	uint32 numEmptyTiles = 0;
+	uint32 numSingleTiles = 0;
+	uint32 numMultiTiles = 0;
+
+	const uint32* getTileMask(uint32 projectorIndex, uint32 tileX, uint32 tileY) const
+	{
+		const cached_projector& p = projectors[projectorIndex];
+		return masks.data() + (p.tileOffset + tileY * p.numTilesX + tileX) * numWords;
+	}
+
+	uint32 getTileClass(uint32 projectorIndex, uint32 tileX, uint32 tileY) const
+	{
+		const cached_projector& p = projectors[projectorIndex];
+		return tileClasses[p.tileOffset + tileY * p.numTilesX + tileX];
+	}
+};
+
+struct cpu_projector_solver_timings
+{
+	float attenuationMS;
+	float bestMaskMS;
+	float distanceFieldsMS;
+	float maskMS;
+	float overlapMS;
+	float intensitiesMS;
+	float summaryMS;
+	float totalMS;
+};
+
+/*
+	Headless reference of projector_solver::solve. Runs the same stages as the compute shaders (attenuation, best mask, discontinuity and
+	best mask distance fields, masks and intensities), with the same sampling rules, on the job system and 8 pixels at a time with AVX2.
+	Differences to the GPU: The distance fields are exact (separable Euclidean distance transform) instead of jump flooded, the images are
+	not quantized to the texture formats, and intensities are computed for all projectors, headless or not. The overlap cache stops testing
+	a projector for a tile at the first visible point. Instead of tile lists, the intensity pass looks up the class of each block's tiles.
+	Temporal reuse follows the same history as the GPU solver, only that there is no viewer or sun to check.
+	If any input has a summary, the solve is distributed like on the GPU: Projectors with summaries are only sampled, the others are solved
+	and their summaries written to localSummaries.
+*/
+struct cpu_projector_solver
+{
+	// motion describes, how far the rendered scene has moved since the last call. Projector cameras and settings are checked by the solver.
+	void solve(const cpu_projector_input* inputs, uint32 numProjectors, projector_scene_motion motion = projector_scene_large_motion);
+
+	projector_solver_settings settings;
+	projector_solver_history history;
+	projector_solve_mode lastSolveMode = projector_solve_full;
+
+	std::vector<cpu_projector_images> images; // One per projector.
+	std::vector<projector_summary> localSummaries; // One per projector. Only written in distributed solves.
+	cpu_projector_overlap_cache overlaps;
+	cpu_projector_solver_timings timings;
+
+private:
+	bool unpackRemoteSummaries(const cpu_projector_input* inputs, uint32 numProjectors); // Returns true, if any has changed.
+	void computeLocalSummaries(const cpu_projector_input* inputs, uint32 numProjectors);
+
+	void computeAttenuations(const cpu_projector_input* inputs, uint32 numProjectors);
+	void computeBestMasks(const cpu_projector_input* inputs, uint32 numProjectors);
+	void computeDistanceFields(const cpu_projector_input* inputs, uint32 numProjectors);
+	void computeMasks(const cpu_projector_input* inputs, uint32 numProjectors);
+	void updateOverlapCache(const cpu_projector_input* inputs, uint32 numProjectors, bool geometryChanged);
+	void computeIntensities(const cpu_projector_input* inputs, uint32 numProjectors, bool warmStart);
+
+	std::vector<uint32> unpackedSummaryVersions;
+	uint32 lastSummaryVersion = 0;
+};
+
+// Renders a synthetic scene (a sphere on a checkered floor) for 1 to maxNumProjectors projectors arranged in a circle, solves it and
+// logs the stage timings per projector count, as well as how close the simulated brightness comes to the target.
+void benchmarkCPUProjectorSolver(uint32 maxNumProjectors = 8, uint32 width = 1280, uint32 height = 800);
+
+// Projectors in a grid above a large floor, each overlapping its neighbors, for 4 up to maxNumProjectors projectors (doubling). Logs the
+// intensity pass with and without the overlap cache (and tile classification), the cost of a full cache rebuild and of an update after one
+// projector moved, as well as the number of tiles per class.
+void benchmarkProjectorOverlapCache(uint32 maxNumProjectors = 64, uint32 width = 320, uint32 height = 200);
+
+// Moves the sphere of the synthetic scene in small steps in front of numProjectors projectors, warm starting each solve from the last. Logs
+// the timings and brightness of the warm starts against full solves of the same frames, as well as the cost of the solves once the sphere
+// has stopped.
+void benchmarkProjectorTemporalReuse(uint32 numProjectors = 4, uint32 width = 1280, uint32 height = 800, uint32 numFrames = 30);
+
+// Splits numProjectors projectors of the synthetic scene between two nodes, which solve their halves and exchange summaries after each solve,
+// like over the network. Logs the timings and brightness of the distributed solves against a solve of all projectors on one node.
+void benchmarkDistributedProjectorSolver(uint32 numProjectors = 4, uint32 width = 1280, uint32 height = 800);
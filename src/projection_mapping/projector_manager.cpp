@@ -5,6 +5,7 @@
 #include "rendering/debug_visualization.h"
 #include "core/yaml.h"
 #include "tracking/tracking.h"
+#include "tracking/motion_to_photon.h"
 
 #include "post_processing_rs.hlsli"
 
@@ -14,6 +15,10 @@ projector_manager::projector_manager(game_scene& scene, depth_tracker* tracker)
 	this->scene = &scene;
 	solver.initialize();
 
+	uint32 numMonitors = (uint32)win32_window::allConnectedMonitors.size();
+	isProjectorIndex.resize(numMonitors, false);
+	blackWindows = std::vector<software_window>(numMonitors);
+
 	loadSetup();
 
 	static uint8 black = 0;
@@ -66,7 +71,12 @@ void projector_manager::updateAndRender(float dt)
 					}
 
 					ImGui::TableNextColumn();
-					setupDirty |= ImGui::Checkbox("##isProj", &isProjectorIndex[i]);
+					bool isProj = isProjectorIndex[i];
+					if (ImGui::Checkbox("##isProj", &isProj))
+					{
+						isProjectorIndex[i] = isProj;
+						setupDirty = true;
+					}
 
 					ImGui::PopID();
 				}
@@ -114,6 +124,10 @@ void projector_manager::updateAndRender(float dt)
 			}
 			ImGui::PropertyCheckbox("Apply solver intensity", solver.settings.applySolverIntensity);
 			ImGui::PropertyCheckbox("Simulate all projectors", solver.settings.simulateAllProjectors);
+			ImGui::PropertyCheckbox("Overlap cache", solver.settings.useOverlapCache);
+			ImGui::PropertyCheckbox("Temporal reuse", solver.settings.temporalReuse);
+			ImGui::PropertyCheckbox("Distributed solving", solver.settings.distributedSolve);
+			ImGui::PropertyValue("Last solve", "%s", projectorSolveModeNames[solver.lastSolveMode]);
 
 			ImGui::PropertyCheckbox("Synthetic environment", simulationMode);
 
@@ -373,7 +387,10 @@ void projector_manager::updateAndRender(float dt)
 
 
 	uint32 numProjectors = scene->numberOfComponentsOfType<projector_component>();
-	render_camera projectorCameras[32];
+	projectorCameras.resize(numProjectors);
+
+	// Simulating needs the full results of all projectors, so only networked setups, which present their local projectors, are distributed.
+	bool distributed = solver.settings.distributedSolve && protocol.initialized && !solver.settings.simulateAllProjectors && !simulationMode;
 
 	uint32 projectorIndex = numProjectors - 1; // EnTT iterates back to front.
 	// We use a view here, because we need the projectors sorted the same way as the raw array. An alternative would be to group projectors with position_rotation_components,
@@ -389,14 +406,21 @@ void projector_manager::updateAndRender(float dt)
 
 		projector.renderer.setProjectorCamera(camera);
 
-		projector.renderer.endFrame();
+		// Remote projectors are rendered by their own node. The solver only uses their summaries.
+		if (!(distributed && projector.headless))
+		{
+			projector.renderer.endFrame();
+		}
 	}
 
 
-	solver.solve(scene->raw<projector_component>(), projectorCameras, numProjectors);
+	projector_scene_motion objectMotion = updateObjectTransforms();
+	solver.solve(scene->raw<projector_component>(), projectorCameras.data(), numProjectors, objectMotion, distributed);
 
 
 
+	bool anyPresented = false;
+
 	projectorIndex = numProjectors - 1; // EnTT iterates back to front.
 	for (auto [entityHandle, projector] : scene->view<projector_component>().each())
 	{
@@ -444,14 +468,51 @@ void projector_manager::updateAndRender(float dt)
 			if (shouldPresent)
 			{
 				projector.window.swapBuffers();
+				anyPresented = true;
 			}
 		}
 	}
 
+	if (anyPresented)
+	{
+		motionToPhotonLatency.framePresented();
+	}
+	motionToPhotonLatency.reportStats();
+
 	if (simulationMode)
 	{
-		solver.resetCameras(scene->raw<projector_component>(), projectorCameras, numProjectors);
+		solver.resetCameras(scene->raw<projector_component>(), projectorCameras.data(), numProjectors);
+	}
+}
+
+projector_scene_motion projector_manager::updateObjectTransforms()
+{
+	auto objectGroup = scene->group(entt::get<raster_component, transform_component>);
+
+	bool added = objectGroup.size() != lastObjectTransforms.size();
+	lastObjectTransforms.resize(objectGroup.size());
+
+	projector_scene_motion motion = added ? projector_scene_large_motion : projector_scene_static;
+
+	uint32 index = 0;
+	for (auto [entityHandle, raster, transform] : objectGroup.each())
+	{
+		trs& last = lastObjectTransforms[index++];
+		if (!(last.position == transform.position && last.rotation == transform.rotation && last.scale == transform.scale))
+		{
+			float distance = length(transform.position - last.position);
+			float angle = 2.f * acos(clamp(abs(dot(last.rotation.v4, transform.rotation.v4)), 0.f, 1.f));
+
+			projector_scene_motion objectMotion = (last.scale == transform.scale)
+				? classifyMotion(distance, angle, solver.settings)
+				: projector_scene_large_motion;
+			motion = max(motion, objectMotion);
+
+			last = transform;
+		}
 	}
+
+	return motion;
 }
 
 void projector_manager::onSceneLoad()
@@ -642,7 +703,7 @@ void projector_manager::saveSetup()
 	out << YAML::BeginMap;
 	for (uint32 i = 0; i < (uint32)win32_window::allConnectedMonitors.size(); ++i)
 	{
-		out << YAML::Key << win32_window::allConnectedMonitors[i].uniqueID << YAML::Value << isProjectorIndex[i];
+		out << YAML::Key << win32_window::allConnectedMonitors[i].uniqueID << YAML::Value << (bool)isProjectorIndex[i];
 	}
 
 	out << YAML::Key << "Server" << YAML::Value << isServerCheckbox;
@@ -670,6 +731,11 @@ void projector_manager::createProjectors(const std::vector<projector_instantiati
 
 	scene->registry.destroy(projectorGroup.begin(), projectorGroup.end());
 
+	// Summaries are indexed like the projectors.
+	solver.localSummaries.clear();
+	solver.remoteSummaries.clear();
+	protocol.resetProjectorSummaries();
+
 	uint32 myClientID = protocol.client_getID();
 
 	for (auto& inst : instantiations)
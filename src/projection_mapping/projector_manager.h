@@ -24,8 +24,7 @@ struct projector_manager
 	void reportLocalCalibration(const std::unordered_map<std::string, projector_calibration>& calib);
 
 
-	static constexpr uint32 MAX_NUM_PROJECTORS = 4;
-	bool isProjectorIndex[MAX_NUM_PROJECTORS] = {};
+	std::vector<bool> isProjectorIndex; // One bit per connected monitor.
 
 	bool isNetworkServer();
 
@@ -76,7 +75,14 @@ private:
 	void loadSetup();
 	void saveSetup();
 
-	software_window blackWindows[MAX_NUM_PROJECTORS];
+	std::vector<software_window> blackWindows; // One per connected monitor.
+
+	std::vector<render_camera> projectorCameras; // One per projector component, in the order of the raw component array.
+
+	// Transforms of all rendered objects at the last solve. The solver's overlap cache only needs a full rebuild, if any of them changed,
+	// and the solver only reuses its last results, if none of them moved far.
+	std::vector<trs> lastObjectTransforms;
+	projector_scene_motion updateObjectTransforms();
 
 	void createProjectorsAndNotify();
 	std::vector<projector_instantiation> createInstantiations();
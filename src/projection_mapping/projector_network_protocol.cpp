@@ -2,12 +2,16 @@
 #include "projector_network_protocol.h"
 #include "projector_manager.h"
 #include "tracking/tracking.h"
+#include "tracking/motion_to_photon.h"
 
 #include "network/socket.h"
 
 #include "core/log.h"
 #include "window/window.h"
 #include "core/file_registry.h"
+#include "core/random.h"
+
+#include <chrono>
 
 
 enum message_type : uint16
@@ -15,6 +19,7 @@ enum message_type : uint16
 	message_client_hello,
 	message_client_request_calibration_mode,
 	message_client_local_calibration,
+	message_client_projector_summary,
 
 
 
@@ -29,6 +34,7 @@ enum message_type : uint16
 	message_server_viewer_camera_update,
 
 	message_server_projector_instantiation,
+	message_server_projector_summary, // Summaries of the server's projectors, and relayed ones of other clients.
 };
 
 struct message_header
@@ -132,6 +138,10 @@ struct server_object_update_message
 	float rotation[4];
 	float position[3];
 	uint32 id;
+
+	// Camera frame, which the pose was tracked from, and its age when sent (see motion_to_photon.h). The age is 0 if unknown.
+	uint32 poseFrameID;
+	uint32 poseAgeInMicroseconds;
 };
 
 struct server_spot_light_message
@@ -161,6 +171,18 @@ struct server_viewer_camera_update_message
 	float position[3];
 };
 
+// Followed by the texels. All but the last message of a summary hold maxTexelsPerSummaryMessage texels.
+struct projector_summary_message
+{
+	uint32 projectorIndex;
+	uint32 session;
+	uint32 version;
+	uint16 width, height;
+	uint32 firstTexel;
+};
+
+static const uint32 maxTexelsPerSummaryMessage = (NETWORK_BUFFER_SIZE - sizeof(message_header) - sizeof(projector_summary_message)) / sizeof(projector_summary_texel);
+
 
 
 bool projector_network_protocol::start(game_scene& scene, projector_manager* manager, bool isServer)
@@ -201,7 +223,7 @@ bool projector_network_protocol::update(float dt)
 	}
 	else
 	{
-		return client.update();
+		return client.update(dt);
 	}
 }
 
@@ -260,6 +282,23 @@ uint32 projector_network_protocol::client_getID()
 	return client.clientID;
 }
 
+void projector_network_protocol::resetProjectorSummaries()
+{
+	if (!initialized)
+	{
+		return;
+	}
+
+	if (isServer)
+	{
+		server.resetProjectorSummaries();
+	}
+	else
+	{
+		client.resetProjectorSummaries();
+	}
+}
+
 bool projector_network_server::initialize(game_scene& scene, projector_manager* manager, uint32 port, char* outIP)
 {
 	network_socket socket;
@@ -300,6 +339,8 @@ bool projector_network_client::initialize(game_scene& scene, projector_manager*
 	this->oldSolverSettings = manager->solver.settings;
 	connected = true;
 
+	summaryExchange.reset();
+
 	char clientAddress[128];
 	getLocalIPAddress(clientAddress);
 	LOG_MESSAGE("Client created, IP: %s", clientAddress);
@@ -310,13 +351,193 @@ bool projector_network_client::initialize(game_scene& scene, projector_manager*
 
 
 
+projector_summary_exchange::projector_summary_exchange()
+{
+	// Random, so that the summaries of a restarted sender are not mistaken for delayed ones of its previous run. 0 means no session.
+	random_number_generator rng = { (uint64)std::chrono::high_resolution_clock::now().time_since_epoch().count() | 1 };
+	do
+	{
+		session = (uint32)rng.randomUint64();
+	} while (session == 0);
+}
+
+void projector_summary_exchange::reset()
+{
+	sentVersions.clear();
+	incoming.clear();
+}
+
+std::vector<uint32> projector_summary_exchange::getSummariesToSend(game_scene& scene, const projector_solver& solver, float dt)
+{
+	std::vector<uint32> result;
+
+	if (!solver.settings.distributedSolve)
+	{
+		return result;
+	}
+
+	timeSinceResend += dt;
+	bool resend = timeSinceResend >= resendTime;
+	if (resend)
+	{
+		timeSinceResend = 0.f;
+	}
+
+	const projector_component* projectors = scene.raw<projector_component>();
+	uint32 numProjectors = min(scene.numberOfComponentsOfType<projector_component>(), (uint32)solver.localSummaries.size());
+
+	sentVersions.resize(numProjectors, 0);
+
+	for (uint32 i = 0; i < numProjectors; ++i)
+	{
+		const projector_summary& summary = solver.localSummaries[i];
+		if (projectors[i].headless || summary.version == 0)
+		{
+			continue;
+		}
+
+		if (summary.version != sentVersions[i] || resend)
+		{
+			result.push_back(i);
+			sentVersions[i] = summary.version;
+		}
+	}
+
+	return result;
+}
+
+uint32 projector_summary_exchange::getNumMessages(const projector_summary& summary)
+{
+	return bucketize(summary.width * summary.height, maxTexelsPerSummaryMessage);
+}
+
+bool projector_summary_exchange::createMessage(send_buffer& buffer, uint16 messageType, uint32 projectorIndex, const projector_summary& summary, uint32 messageIndex)
+{
+	buffer.reset();
+
+	buffer.header.type = (message_type)messageType;
+
+	uint32 numTexels = summary.width * summary.height;
+	uint32 firstTexel = messageIndex * maxTexelsPerSummaryMessage;
+	uint32 count = min(numTexels - firstTexel, maxTexelsPerSummaryMessage);
+
+	projector_summary_message msg;
+	msg.projectorIndex = projectorIndex;
+	msg.session = session;
+	msg.version = summary.version;
+	msg.width = (uint16)summary.width;
+	msg.height = (uint16)summary.height;
+	msg.firstTexel = firstTexel;
+
+	if (!buffer.pushValue(msg))
+	{
+		return false;
+	}
+
+	projector_summary_texel* texels = buffer.push<projector_summary_texel>(count);
+	memcpy(texels, summary.texels.data() + firstTexel, count * sizeof(projector_summary_texel));
+
+	return true;
+}
+
+bool projector_summary_exchange::receive(receive_buffer& buffer, game_scene& scene, projector_solver& solver)
+{
+	const projector_summary_message* msg = buffer.get<projector_summary_message>();
+	if (!msg)
+	{
+		LOG_ERROR("Message is smaller than sizeof(projector_summary_message). Expected at least %u bytes after header, got %u", (uint32)sizeof(projector_summary_message), buffer.sizeRemaining);
+		return false;
+	}
+
+	if (buffer.sizeRemaining % sizeof(projector_summary_texel) != 0)
+	{
+		LOG_ERROR("Message size is not evenly divisible by sizeof(projector_summary_texel). Expected multiple of %u, got %u", (uint32)sizeof(projector_summary_texel), buffer.sizeRemaining);
+		return false;
+	}
+
+	uint32 count = buffer.sizeRemaining / (uint32)sizeof(projector_summary_texel);
+	const projector_summary_texel* texels = buffer.get<projector_summary_texel>(count);
+
+	uint32 index = msg->projectorIndex;
+	uint32 numProjectors = scene.numberOfComponentsOfType<projector_component>();
+	if (index >= numProjectors || !scene.raw<projector_component>()[index].headless)
+	{
+		// The projectors are not yet (or have just been re-) created, or this is a relayed summary of a local projector.
+		return false;
+	}
+
+	uint32 numTexels = (uint32)msg->width * msg->height;
+	uint32 numMessages = bucketize(numTexels, maxTexelsPerSummaryMessage);
+	uint32 messageIndex = msg->firstTexel / maxTexelsPerSummaryMessage;
+	if (msg->firstTexel % maxTexelsPerSummaryMessage != 0 || messageIndex >= numMessages
+		|| count != min(numTexels - msg->firstTexel, maxTexelsPerSummaryMessage))
+	{
+		LOG_ERROR("Received malformed summary message for projector %u", index);
+		return false;
+	}
+
+	solver.remoteSummaries.resize(max((uint32)solver.remoteSummaries.size(), numProjectors));
+	incoming.resize(numProjectors);
+
+	incoming_summary& in = incoming[index];
+	projector_summary& summary = in.summary;
+	std::vector<bool>& received = in.receivedMessages;
+
+	// Everything assembled in an earlier session of the sender is stale. Its last completed summary stays in use until the new one is complete.
+	if (in.session != msg->session)
+	{
+		in.session = msg->session;
+		in.completedVersion = 0;
+		summary = projector_summary();
+		received.clear();
+	}
+
+	projector_summary& remote = solver.remoteSummaries[index];
+	if (in.completedVersion == msg->version && remote.width == msg->width && remote.height == msg->height)
+	{
+		return true; // Resent.
+	}
+
+	// Within a session, versions of a projector only grow. A delayed message of an older version must neither replace the summary nor the
+	// one being assembled.
+	if (msg->version < in.completedVersion || msg->version < summary.version)
+	{
+		return true;
+	}
+
+	// A new version replaces any partially assembled one.
+	if (summary.version != msg->version || summary.width != msg->width || summary.height != msg->height)
+	{
+		summary.width = msg->width;
+		summary.height = msg->height;
+		summary.version = msg->version;
+		summary.texels.resize(numTexels);
+		received.assign(numMessages, false);
+	}
+
+	memcpy(summary.texels.data() + msg->firstTexel, texels, count * sizeof(projector_summary_texel));
+	received[messageIndex] = true;
+
+	if (std::find(received.begin(), received.end(), false) == received.end())
+	{
+		in.completedVersion = summary.version;
+		remote = summary;
+		remote.version = ++numCompletedSummaries;
+	}
+
+	return true;
+}
+
+
+
+
 bool projector_network_server::update(float dt)
 {
 	timeSinceLastUpdate += dt;
 
 	if (timeSinceLastUpdate >= updateTime)
 	{
-		if (memcmp(&manager->solver.settings, &oldSolverSettings, sizeof(oldSolverSettings)) != 0)
+		if (manager->solver.settings != oldSolverSettings)
 		{
 			oldSolverSettings = manager->solver.settings;
 			
@@ -334,6 +555,10 @@ bool projector_network_server::update(float dt)
 			if (createObjectUpdateMessage(messageBuffer))
 			{
 				sendToAllClients(messageBuffer);
+				if (!clientConnections.empty())
+				{
+					motionToPhotonLatency.posesSent();
+				}
 			}
 		}
 
@@ -353,6 +578,8 @@ bool projector_network_server::update(float dt)
 			}
 		}
 
+		sendProjectorSummaries();
+
 		timeSinceLastUpdate -= updateTime;
 	}
 
@@ -410,6 +637,9 @@ bool projector_network_server::update(float dt)
 				client_connection connection = { clientID, clientAddress };
 				clientConnections.push_back(connection);
 
+				// The new client has none of the summaries yet, and may be a restarted one, whose old summaries are still being assembled.
+				summaryExchange.reset();
+
 				std::vector<std::string> descriptions;
 				std::vector<std::string> uniqueIDs;
 				for (uint32 i = 0; i < numMonitors; ++i)
@@ -490,6 +720,12 @@ bool projector_network_server::update(float dt)
 				manager->network_clientCalibration(header->clientID, calibrations);
 
 			} break;
+
+			case message_client_projector_summary:
+			{
+				relayProjectorSummary(messageBuffer, header->clientID);
+				summaryExchange.receive(messageBuffer, *scene, manager->solver);
+			} break;
 		}
 	}
 
@@ -509,6 +745,11 @@ bool projector_network_server::broadcastProjectors(const std::vector<projector_i
 	return createProjectorInstantiationMessage(messageBuffer, instantiations) && sendToAllClients(messageBuffer);
 }
 
+void projector_network_server::resetProjectorSummaries()
+{
+	summaryExchange.reset();
+}
+
 static auto getObjectGroup(game_scene* scene)
 {
 	auto objectGroup = scene->group(entt::get<raster_component, transform_component>);
@@ -590,6 +831,9 @@ bool projector_network_server::createObjectUpdateMessage(send_buffer& buffer)
 		return false;
 	}
 
+	uint32 poseFrameID = motionToPhotonLatency.getLatestPoseFrameID();
+	uint32 poseAge = motionToPhotonLatency.getLatestPoseAge();
+
 	uint32 id = 0;
 	for (auto [entityHandle, raster, transform] : objectGroup.each())
 	{
@@ -598,6 +842,8 @@ bool projector_network_server::createObjectUpdateMessage(send_buffer& buffer)
 		memcpy(msg.rotation, transform.rotation.v4.data, sizeof(quat));
 		memcpy(msg.position, transform.position.data, sizeof(vec3));
 		msg.id = (uint32)entityHandle;
+		msg.poseFrameID = poseFrameID;
+		msg.poseAgeInMicroseconds = poseAge;
 
 		++id;
 	}
@@ -716,6 +962,46 @@ bool projector_network_server::createProjectorInstantiationMessage(struct send_b
 	return true;
 }
 
+bool projector_network_server::sendProjectorSummaries()
+{
+	bool result = true;
+
+	for (uint32 index : summaryExchange.getSummariesToSend(*scene, manager->solver, updateTime))
+	{
+		const projector_summary& summary = manager->solver.localSummaries[index];
+
+		uint32 numMessages = summaryExchange.getNumMessages(summary);
+		for (uint32 i = 0; i < numMessages; ++i)
+		{
+			send_buffer messageBuffer;
+			result &= summaryExchange.createMessage(messageBuffer, message_server_projector_summary, index, summary, i)
+				&& sendToAllClients(messageBuffer);
+		}
+	}
+
+	return result;
+}
+
+// Forwards a client's summary message to all other clients. Expects the buffer to be positioned right after the header.
+bool projector_network_server::relayProjectorSummary(receive_buffer& buffer, uint16 senderID)
+{
+	send_buffer messageBuffer;
+	messageBuffer.header.type = message_server_projector_summary;
+
+	char* payload = messageBuffer.push<char>(buffer.sizeRemaining);
+	memcpy(payload, buffer.buffer + buffer.offset, buffer.sizeRemaining);
+
+	bool result = true;
+	for (const client_connection& connection : clientConnections)
+	{
+		if (connection.clientID != senderID)
+		{
+			result &= sendToClient(messageBuffer, connection);
+		}
+	}
+	return result;
+}
+
 bool projector_network_server::sendToAllClients(send_buffer& buffer)
 {
 	bool result = true;
@@ -739,15 +1025,24 @@ bool projector_network_server::sendToClient(send_buffer& buffer, const client_co
 	return serverSocket.send(connection.address, buffer.buffer, buffer.size);
 }
 
-bool projector_network_client::update()
+bool projector_network_client::update(float dt)
 {
 	if (!connected)
 	{
 		return false;
 	}
 
+	timeSinceLastUpdate += dt;
 
-	if (memcmp(&manager->solver.settings, &oldSolverSettings, sizeof(oldSolverSettings)) != 0)
+	if (timeSinceLastUpdate >= updateTime)
+	{
+		sendProjectorSummaries();
+
+		timeSinceLastUpdate -= updateTime;
+	}
+
+
+	if (manager->solver.settings != oldSolverSettings)
 	{
 		oldSolverSettings = manager->solver.settings;
 
@@ -919,6 +1214,11 @@ bool projector_network_client::update()
 					}
 				}
 
+				if (numObjects)
+				{
+					motionToPhotonLatency.remotePoseReceived(objects[0].poseFrameID, objects[0].poseAgeInMicroseconds);
+				}
+
 			} break;
 
 			case message_server_spot_light_info:
@@ -1053,6 +1353,11 @@ bool projector_network_client::update()
 
 			} break;
 
+			case message_server_projector_summary:
+			{
+				summaryExchange.receive(messageBuffer, *scene, manager->solver);
+			} break;
+
 		};
 	}
 
@@ -1127,9 +1432,34 @@ bool projector_network_client::reportLocalCalibration(const std::unordered_map<s
 	return sendToServer(messageBuffer);
 }
 
+void projector_network_client::resetProjectorSummaries()
+{
+	summaryExchange.reset();
+}
+
+bool projector_network_client::sendProjectorSummaries()
+{
+	bool result = true;
+
+	for (uint32 index : summaryExchange.getSummariesToSend(*scene, manager->solver, updateTime))
+	{
+		const projector_summary& summary = manager->solver.localSummaries[index];
+
+		uint32 numMessages = summaryExchange.getNumMessages(summary);
+		for (uint32 i = 0; i < numMessages; ++i)
+		{
+			send_buffer messageBuffer;
+			result &= summaryExchange.createMessage(messageBuffer, message_client_projector_summary, index, summary, i)
+				&& sendToServer(messageBuffer);
+		}
+	}
+
+	return result;
+}
+
 bool projector_network_client::sendToServer(send_buffer& buffer)
 {
 	buffer.header.clientID = clientID;
-	buffer.header.messageID = 0;
+	buffer.header.messageID = runningMessageID++;
 	return clientSocket.send(serverAddress, buffer.buffer, buffer.size);
 }
@@ -20,6 +20,45 @@ struct client_calibration_message
 	projector_calibration calibration;
 };
 
+// Distributed solving: Each node sends the summaries of its local projectors (see projector_solver.h) and receives the others'. Summaries are
+// split into multiple messages, which are assembled on arrival. Versions only grow within one session of the sender. A restarted sender
+// starts a new session and counts from 1 again.
+struct projector_summary_exchange
+{
+	projector_summary_exchange();
+
+	// Indices of the local projectors, whose summaries have changed since they were last sent, or which are due to be sent again (to make up
+	// for lost messages).
+	std::vector<uint32> getSummariesToSend(game_scene& scene, const projector_solver& solver, float dt);
+
+	uint32 getNumMessages(const projector_summary& summary);
+	bool createMessage(struct send_buffer& buffer, uint16 messageType, uint32 projectorIndex, const projector_summary& summary, uint32 messageIndex);
+
+	// Writes completed summaries to the solver's remote summaries.
+	bool receive(struct receive_buffer& buffer, game_scene& scene, projector_solver& solver);
+
+	// Drops all partially assembled summaries and sends all local ones again. Call when the projectors are recreated or a peer (re)connects.
+	void reset();
+
+private:
+	struct incoming_summary
+	{
+		uint32 session = 0;
+		uint32 completedVersion = 0; // Sender's version of the summary last written to the solver.
+		projector_summary summary; // Being assembled. Carries the sender's version.
+		std::vector<bool> receivedMessages;
+	};
+
+	uint32 session;
+	std::vector<uint32> sentVersions;
+
+	std::vector<incoming_summary> incoming;
+	uint32 numCompletedSummaries = 0; // Versions of the solver's remote summaries. Unique across sessions, so that every new one is uploaded.
+
+	float timeSinceResend = 0.f;
+	const float resendTime = 1.f;
+};
+
 struct projector_network_server
 {
 	bool initialize(game_scene& scene, projector_manager* manager, uint32 port, char* outIP);
@@ -28,6 +67,8 @@ struct projector_network_server
 	bool broadcastObjectInfo();
 	bool broadcastProjectors(const std::vector<projector_instantiation>& instantiations);
 
+	void resetProjectorSummaries();
+
 private:
 	
 	struct client_connection
@@ -47,6 +88,9 @@ private:
 	bool createViewerCameraUpdateMessage(struct send_buffer& buffer);
 	bool createProjectorInstantiationMessage(struct send_buffer& buffer, const std::vector<projector_instantiation>& instantiations);
 
+	bool sendProjectorSummaries();
+	bool relayProjectorSummary(struct receive_buffer& buffer, uint16 senderID);
+
 	bool sendToAllClients(struct send_buffer& buffer);
 	bool sendToClient(struct send_buffer& buffer, const client_connection& connection);
 
@@ -62,19 +106,24 @@ private:
 	game_scene* scene;
 	projector_manager* manager;
 	projector_solver_settings oldSolverSettings;
+
+	projector_summary_exchange summaryExchange;
 };
 
 struct projector_network_client
 {
 	bool initialize(game_scene& scene, projector_manager* manager, const char* serverIP, uint32 serverPort);
-	bool update();
+	bool update(float dt);
 
 	bool sendHello();
 	bool reportLocalCalibration(const std::unordered_map<std::string, projector_calibration>& calibs);
 
+	void resetProjectorSummaries();
+
 	uint32 clientID = -1;
 
 private:
+	bool sendProjectorSummaries();
 	bool sendToServer(struct send_buffer& buffer);
 
 	game_scene* scene;
@@ -85,6 +134,7 @@ private:
 
 	bool connected = false;
 
+	uint32 runningMessageID = 1;
 
 	uint32 latestSettingsMessageID = 0;
 	uint32 latestObjectMessageID = 0;
@@ -96,6 +146,11 @@ private:
 
 	projector_solver_settings oldSolverSettings;
 
+	float timeSinceLastUpdate = 0.f;
+	const float updateTime = 1.f / 30.f;
+
+	projector_summary_exchange summaryExchange;
+
 
 	std::unordered_map<uint32, scene_entity> objectIDToEntity;
 	std::unordered_map<uint32, scene_entity> spotLightIDToEntity;
@@ -114,6 +169,9 @@ struct projector_network_protocol
 	bool client_reportLocalCalibration(const std::unordered_map<std::string, projector_calibration>& calibs);
 	uint32 client_getID();
 
+	// Call when the projectors are recreated.
+	void resetProjectorSummaries();
+
 	bool initialized = false;
 
 	bool isServer;
@@ -58,7 +58,7 @@ private:
 	ref<dx_texture> depthStencilBuffer;
 
 	ref<dx_texture> solverIntensityTexture;
-	ref<dx_texture> solverIntensityTempTexture;
+	ref<dx_texture> solverIntensityTempTexture; // Last intensities, when the solver warm starts.
 
 	ref<dx_texture> attenuationTexture;
 	ref<dx_texture> maskTexture;
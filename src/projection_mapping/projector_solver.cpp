@@ -14,6 +14,10 @@ static dx_pipeline attenuationPipeline;
 static dx_pipeline maskPipeline;
 static dx_pipeline bestMaskPipeline;
 static dx_pipeline intensitiesPipeline;
+static dx_pipeline overlapPipeline;
+static dx_pipeline tileClassificationPipeline;
+static dx_pipeline summaryPipeline;
+static dx_pipeline summaryUnpackPipeline;
 
 static dx_pipeline simulationPipeline;
 
@@ -24,6 +28,10 @@ void projector_solver::initialize()
 	maskPipeline = createReloadablePipeline("projector_mask_cs");
 	bestMaskPipeline = createReloadablePipeline("projector_best_mask_cs");
 	intensitiesPipeline = createReloadablePipeline("projector_intensities_cs");
+	overlapPipeline = createReloadablePipeline("projector_overlap_cs");
+	tileClassificationPipeline = createReloadablePipeline("projector_tile_classification_cs");
+	summaryPipeline = createReloadablePipeline("projector_summary_cs");
+	summaryUnpackPipeline = createReloadablePipeline("projector_summary_unpack_cs");
 
 	{
 		auto desc = CREATE_GRAPHICS_PIPELINE
@@ -36,7 +44,8 @@ void projector_solver::initialize()
 
 	for (uint32 i = 0; i < NUM_BUFFERED_FRAMES; ++i)
 	{
-		heaps[i].initialize(1024);
+		heapSizes[i] = arraysize(descriptors) * 64;
+		heaps[i].initialize(heapSizes[i]);
 	}
 }
 
@@ -54,13 +63,130 @@ static void projectorToCB(const render_camera& camera, projector_cb& proj)
 	proj.depthRange = 0.1f;
 }
 
-void projector_solver::solve(const projector_component* projectors, const render_camera* cameras, uint32 numProjectors)
+projector_solve_mode projector_solver_history::update(const projector_solver_settings& settings, const projector_state* states, uint32 numProjectors, projector_scene_motion motion)
+{
+	bool changed = !valid
+		|| !settings.temporalReuse
+		|| (uint32)projectors.size() != numProjectors
+		|| this->settings != settings;
+
+	bool allSolved = true;
+	for (uint32 i = 0; i < (uint32)projectors.size() && i < numProjectors; ++i)
+	{
+		const projector_state& last = projectors[i];
+		const projector_state& current = states[i];
+
+		changed = changed
+			|| memcmp(&last.viewProj, &current.viewProj, sizeof(mat4)) != 0
+			|| last.width != current.width
+			|| last.height != current.height
+			|| last.intensitiesID != current.intensitiesID
+			|| last.solved != current.solved;
+
+		allSolved &= last.solved;
+	}
+
+	projector_solve_mode mode;
+	if (changed || motion == projector_scene_large_motion)
+	{
+		mode = projector_solve_full;
+	}
+	else if (motion == projector_scene_small_motion)
+	{
+		mode = allSolved ? projector_solve_warm_start : projector_solve_full;
+	}
+	else
+	{
+		mode = (lastMode == projector_solve_warm_start) ? projector_solve_full : projector_solve_reuse;
+	}
+
+	projectors.assign(states, states + numProjectors);
+	this->settings = settings;
+	lastMode = mode;
+	valid = true;
+
+	return mode;
+}
+
+// The projectors render the scene as seen from the viewer, so viewer and sun changes alter their images like moving objects do.
+projector_scene_motion projector_solver::detectLightingMotion()
+{
+	vec3 viewerPosition = projector_renderer::viewerCamera.position.xyz;
+	vec3 sunDirection = projector_renderer::sun.direction;
+	vec3 sunRadiance = projector_renderer::sun.radiance;
+
+	projector_scene_motion motion = classifyMotion(length(viewerPosition - lastViewerPosition), 0.f, settings);
+	if (!(sunDirection == lastSunDirection && sunRadiance == lastSunRadiance))
+	{
+		motion = projector_scene_large_motion;
+	}
+
+	lastViewerPosition = viewerPosition;
+	lastSunDirection = sunDirection;
+	lastSunRadiance = sunRadiance;
+
+	return motion;
+}
+
+void projector_solver::solve(const projector_component* projectors, const render_camera* cameras, uint32 numProjectors, projector_scene_motion objectMotion,
+	bool distributed)
 {
 	this->numProjectors = numProjectors;
 
+	projector_scene_motion motion = max(objectMotion, detectLightingMotion());
+
+	localSummaries.resize(numProjectors);
+	remoteSummaries.resize(numProjectors);
+	remoteSummaryTextures.resize(numProjectors);
+
+	// New summaries mean, that the geometry or results of remote projectors have changed.
+	bool remoteSummariesChanged = distributed && prepareRemoteSummaries(projectors);
+	if (remoteSummariesChanged)
+	{
+		motion = projector_scene_large_motion;
+	}
+
+	readbackLocalSummaries();
+
+	// During motion, the intensities of all projectors are kept up to date, so that the next solve can warm start from them. In
+	// distributed mode, the remote projectors' intensities are never available, so there are no warm starts.
+	bool solveAllProjectors = settings.simulateAllProjectors || (settings.temporalReuse && motion == projector_scene_small_motion && !distributed);
+
+	// Stages, which write a projector's own images, skip the remote projectors.
+	auto isLocal = [distributed, projectors](uint32 i) { return !(distributed && projectors[i].headless); };
+
+	std::vector<projector_solver_history::projector_state> states(numProjectors);
+	for (uint32 i = 0; i < numProjectors; ++i)
+	{
+		states[i].viewProj = cameras[i].viewProj;
+		states[i].width = projectors[i].renderer.renderWidth;
+		states[i].height = projectors[i].renderer.renderHeight;
+		states[i].intensitiesID = (uint64)projectors[i].renderer.solverIntensityTexture.get();
+		states[i].solved = isLocal(i) && (!projectors[i].headless || solveAllProjectors);
+	}
+
+	projector_solve_mode mode = history.update(settings, states.data(), numProjectors, motion);
+	lastSolveMode = mode;
+
+	CPU_PROFILE_STAT("Projector solve mode", projectorSolveModeNames[mode]);
+
 	dx_pushable_descriptor_heap& heap = heaps[dxContext.bufferedFrameID];
+
+	// Each descriptor table holds one descriptor per projector. Grow the heap, if there are more projectors than it has space for.
+	uint32 requiredHeapSize = arraysize(descriptors) * numProjectors;
+	uint32& heapSize = heapSizes[dxContext.bufferedFrameID];
+	if (requiredHeapSize > heapSize)
+	{
+		heapSize = max(requiredHeapSize, heapSize * 2);
+
+		dxContext.retire(heap.descriptorHeap);
+		heap.initialize(heapSize);
+	}
+
 	heap.reset();
 
+	readbackTileStats();
+
 	dx_allocation alloc = dxContext.allocateDynamicBuffer(numProjectors * sizeof(projector_cb));
 	projector_cb* projectorCBs = (projector_cb*)alloc.cpuPtr;
 	projectorsGPUAddress = alloc.gpuPtr;
@@ -94,8 +220,26 @@ void projector_solver::solve(const projector_component* projectors, const render
 		(attenuationUAVBaseDescriptor + i).create2DTextureUAV(p.renderer.attenuationTexture);
 		(maskSRVBaseDescriptor + i).create2DTextureSRV(p.renderer.maskTexture);
 		(maskUAVBaseDescriptor + i).create2DTextureUAV(p.renderer.maskTexture);
+
+		if (!isLocal(i))
+		{
+			// Remote projectors are only known through their summaries.
+			const remote_summary_textures& remote = remoteSummaryTextures[i];
+			(depthTexturesBaseDescriptor + i).create2DTextureSRV(remote.depth);
+			(attenuationSRVBaseDescriptor + i).create2DTextureSRV(remote.attenuation);
+			(maskSRVBaseDescriptor + i).create2DTextureSRV(remote.masks);
+		}
 	}
 
+	if (mode == projector_solve_reuse)
+	{
+		// All textures still hold the last solve's results. The descriptors and projector constants above are still needed by the
+		// simulation.
+		tileClassificationReadbackNumProjectors[dxContext.bufferedFrameID] = 0;
+		return;
+	}
+
+	bool warmStart = mode == projector_solve_warm_start;
 
 
 
@@ -106,6 +250,11 @@ void projector_solver::solve(const projector_component* projectors, const render
 	{
 		PROFILE_ALL(cl, "Projector solver");
 
+		if (remoteSummariesChanged)
+		{
+			uploadRemoteSummaries(cl, projectors);
+		}
+
 
 		cl->setDescriptorHeap(D3D12_DESCRIPTOR_HEAP_TYPE_CBV_SRV_UAV, heap.descriptorHeap);
 
@@ -133,6 +282,11 @@ void projector_solver::solve(const projector_component* projectors, const render
 
 			for (uint32 i = 0; i < numProjectors; ++i)
 			{
+				if (!isLocal(i))
+				{
+					continue;
+				}
+
 				PROFILE_ALL(cl, "Attenuation");
 
 				uint32 width = projectors[i].renderer.renderWidth;
@@ -163,6 +317,11 @@ void projector_solver::solve(const projector_component* projectors, const render
 
 			for (uint32 i = 0; i < numProjectors; ++i)
 			{
+				if (!isLocal(i))
+				{
+					continue;
+				}
+
 				PROFILE_ALL(cl, "Mask");
 
 				uint32 width = projectors[i].renderer.bestMaskTexture->width;
@@ -199,6 +358,11 @@ void projector_solver::solve(const projector_component* projectors, const render
 
 			for (uint32 i = 0; i < numProjectors; ++i)
 			{
+				if (!isLocal(i))
+				{
+					continue;
+				}
+
 				const ref<dx_texture>& discontinuitiesTexture = projectors[i].renderer.discontinuitiesTexture;
 				const ref<dx_texture>& bestMaskTexture = projectors[i].renderer.bestMaskTexture;
 
@@ -246,6 +410,11 @@ void projector_solver::solve(const projector_component* projectors, const render
 
 			for (uint32 i = 0; i < numProjectors; ++i)
 			{
+				if (!isLocal(i))
+				{
+					continue;
+				}
+
 				const ref<dx_texture>& depthStencilBuffer = projectors[i].renderer.depthStencilBuffer;
 				const ref<dx_texture>& halfResolutionDepthBuffer = projectors[i].renderer.halfResolutionDepthBuffer;
 				const ref<dx_texture>& ldrPostProcessingTexture = projectors[i].renderer.ldrPostProcessingTexture;
@@ -328,6 +497,11 @@ void projector_solver::solve(const projector_component* projectors, const render
 
 			for (uint32 i = 0; i < numProjectors; ++i)
 			{
+				if (!isLocal(i))
+				{
+					continue;
+				}
+
 				uint32 width = projectors[i].renderer.renderWidth;
 				uint32 height = projectors[i].renderer.renderHeight;
 
@@ -345,14 +519,43 @@ void projector_solver::solve(const projector_component* projectors, const render
 			{
 				batch.transition(projectors[i].renderer.attenuationTexture, D3D12_RESOURCE_STATE_UNORDERED_ACCESS, D3D12_RESOURCE_STATE_GENERIC_READ);
 				batch.transition(projectors[i].renderer.maskTexture, D3D12_RESOURCE_STATE_UNORDERED_ACCESS, D3D12_RESOURCE_STATE_GENERIC_READ);
-				batch.transition(projectors[i].renderer.solverIntensityTexture, D3D12_RESOURCE_STATE_GENERIC_READ, D3D12_RESOURCE_STATE_UNORDERED_ACCESS);
+				batch.transition(projectors[i].renderer.solverIntensityTexture, D3D12_RESOURCE_STATE_GENERIC_READ, warmStart ? D3D12_RESOURCE_STATE_COPY_SOURCE : D3D12_RESOURCE_STATE_UNORDERED_ACCESS);
 				batch.transition(projectors[i].renderer.bestMaskTexture, D3D12_RESOURCE_STATE_NON_PIXEL_SHADER_RESOURCE, D3D12_RESOURCE_STATE_UNORDERED_ACCESS);
 				batch.transition(projectors[i].renderer.discontinuityDistanceFieldTexture, D3D12_RESOURCE_STATE_NON_PIXEL_SHADER_RESOURCE, D3D12_RESOURCE_STATE_UNORDERED_ACCESS);
 				batch.transition(projectors[i].renderer.bestMaskDistanceFieldTexture, D3D12_RESOURCE_STATE_NON_PIXEL_SHADER_RESOURCE, D3D12_RESOURCE_STATE_UNORDERED_ACCESS);
 				batch.transition(projectors[i].renderer.ldrPostProcessingTexture, D3D12_RESOURCE_STATE_NON_PIXEL_SHADER_RESOURCE, D3D12_RESOURCE_STATE_UNORDERED_ACCESS);
+
+				if (warmStart)
+				{
+					batch.transition(projectors[i].renderer.solverIntensityTempTexture, D3D12_RESOURCE_STATE_GENERIC_READ, D3D12_RESOURCE_STATE_COPY_DEST);
+				}
+			}
+		}
+
+		if (distributed)
+		{
+			computeLocalSummaries(cl, projectors);
+		}
+
+		if (warmStart)
+		{
+			PROFILE_ALL(cl, "Copy previous intensities");
+
+			for (uint32 i = 0; i < numProjectors; ++i)
+			{
+				cl->copyResource(projectors[i].renderer.solverIntensityTexture->resource, projectors[i].renderer.solverIntensityTempTexture->resource);
+			}
+
+			barrier_batcher batch(cl);
+			for (uint32 i = 0; i < numProjectors; ++i)
+			{
+				batch.transition(projectors[i].renderer.solverIntensityTexture, D3D12_RESOURCE_STATE_COPY_SOURCE, D3D12_RESOURCE_STATE_UNORDERED_ACCESS);
+				batch.transition(projectors[i].renderer.solverIntensityTempTexture, D3D12_RESOURCE_STATE_COPY_DEST, D3D12_RESOURCE_STATE_GENERIC_READ);
 			}
 		}
 
+		updateOverlapCache(cl, projectors, cameras, objectMotion != projector_scene_static || remoteSummariesChanged, distributed);
+
 		{
 			PROFILE_ALL(cl, "Intensities");
 
@@ -360,25 +563,62 @@ void projector_solver::solve(const projector_component* projectors, const render
 			cl->setComputeRootSignature(*intensitiesPipeline.rootSignature);
 
 			cl->setRootComputeSRV(PROJECTOR_INTENSITIES_RS_PROJECTORS, projectorsGPUAddress);
+			cl->setRootComputeSRV(PROJECTOR_INTENSITIES_RS_OVERLAPS, overlapBuffer);
+			cl->setRootComputeSRV(PROJECTOR_INTENSITIES_RS_TILE_LISTS, tileListBuffer);
+			cl->setRootComputeSRV(PROJECTOR_INTENSITIES_RS_CLASSIFICATIONS, tileClassificationBuffer);
 			cl->setComputeDescriptorTable(PROJECTOR_INTENSITIES_RS_ATTENUATIONS, attenuationSRVBaseDescriptor);
 			cl->setComputeDescriptorTable(PROJECTOR_INTENSITIES_RS_MASKS, maskSRVBaseDescriptor);
 			cl->setComputeDescriptorTable(PROJECTOR_INTENSITIES_RS_DEPTH_TEXTURES, depthTexturesBaseDescriptor);
+			cl->setComputeDescriptorTable(PROJECTOR_INTENSITIES_RS_PREVIOUS_INTENSITIES, tempIntensitiesSRVBaseDescriptor);
 			cl->setComputeDescriptorTable(PROJECTOR_INTENSITIES_RS_OUT_INTENSITIES, intensitiesUAVBaseDescriptor);
 
 			for (uint32 i = 0; i < numProjectors; ++i)
 			{
-				if (!projectors[i].headless || settings.simulateAllProjectors)
+				if (states[i].solved)
 				{
 					uint32 width = projectors[i].renderer.renderWidth;
 					uint32 height = projectors[i].renderer.renderHeight;
 
+					overlap_cache_projector& cached = overlapCacheProjectors[i];
+
 					projector_intensity_cb cb;
 					cb.index = i;
 					cb.numProjectors = numProjectors;
+					cb.tileOffset = cached.tileOffset;
+					cb.numTilesX = bucketize(width, PROJECTOR_BLOCK_SIZE);
+					cb.numWords = bucketize(numProjectors, 32);
+					cb.useOverlapCache = settings.useOverlapCache;
+					cb.numTiles = cached.numTiles;
+					cb.warmStart = warmStart;
+
+					if (!settings.useOverlapCache)
+					{
+						cb.tileClass = projector_tile_any;
+						cl->setCompute32BitConstants(PROJECTOR_INTENSITIES_RS_CB, cb);
+
+						cl->dispatch(bucketize(width, PROJECTOR_BLOCK_SIZE), bucketize(height, PROJECTOR_BLOCK_SIZE));
+						continue;
+					}
+
+					// One thread group per listed tile. The group counts are written by the classification pass.
+					uint32 classificationOffset = i * sizeof(projector_tile_classification);
+
+					cb.tileClass = projector_tile_single;
+					cl->setCompute32BitConstants(PROJECTOR_INTENSITIES_RS_CB, cb);
+					cl->dispatchIndirect(1, tileClassificationBuffer, classificationOffset + offsetof(projector_tile_classification, single));
 
+					cb.tileClass = projector_tile_multi;
 					cl->setCompute32BitConstants(PROJECTOR_INTENSITIES_RS_CB, cb);
+					cl->dispatchIndirect(1, tileClassificationBuffer, classificationOffset + offsetof(projector_tile_classification, multi));
+
+					if (!cached.emptyTilesCleared)
+					{
+						cb.tileClass = projector_tile_empty;
+						cl->setCompute32BitConstants(PROJECTOR_INTENSITIES_RS_CB, cb);
+						cl->dispatchIndirect(1, tileClassificationBuffer, classificationOffset + offsetof(projector_tile_classification, empty));
 
-					cl->dispatch(bucketize(width, PROJECTOR_BLOCK_SIZE), bucketize(height, PROJECTOR_BLOCK_SIZE));
+						cached.emptyTilesCleared = true;
+					}
 				}
 			}
 		}
@@ -399,6 +639,470 @@ void projector_solver::solve(const projector_component* projectors, const render
 	dxContext.executeCommandList(cl);
 }
 
+void projector_solver::updateOverlapCache(dx_command_list* cl, const projector_component* projectors, const render_camera* cameras, bool geometryChanged, bool distributed)
+{
+	uint32 numWords = bucketize(numProjectors, 32);
+
+	bool layoutChanged = (uint32)overlapCacheProjectors.size() != numProjectors;
+	for (uint32 i = 0; i < numProjectors && !layoutChanged; ++i)
+	{
+		layoutChanged = overlapCacheProjectors[i].width != projectors[i].renderer.renderWidth
+			|| overlapCacheProjectors[i].height != projectors[i].renderer.renderHeight;
+	}
+
+	// Tiles of projectors, which were remote, have not been kept up to date.
+	bool remoteChanged = false;
+	for (uint32 i = 0; i < numProjectors && !layoutChanged; ++i)
+	{
+		remoteChanged |= overlapCacheProjectors[i].remote != (distributed && projectors[i].headless);
+	}
+
+	bool rebuildAll = layoutChanged || remoteChanged || geometryChanged || !overlapCacheValid;
+
+	// A projector is dirty, if its camera and therefore its depth buffer has changed. This invalidates all its pairs, so its own tiles test
+	// all other projectors, and all other tiles test it.
+	dx_allocation dirtyAlloc = dxContext.allocateDynamicBuffer(max(numWords, 1u) * sizeof(uint32));
+	uint32* dirtyMask = (uint32*)dirtyAlloc.cpuPtr;
+	memset(dirtyMask, 0, numWords * sizeof(uint32));
+
+	bool anyDirty = false;
+	uint32 numTiles = 0;
+
+	overlapCacheProjectors.resize(numProjectors);
+	for (uint32 i = 0; i < numProjectors; ++i)
+	{
+		overlap_cache_projector& cached = overlapCacheProjectors[i];
+
+		uint32 width = projectors[i].renderer.renderWidth;
+		uint32 height = projectors[i].renderer.renderHeight;
+
+		if (rebuildAll || memcmp(&cached.viewProj, &cameras[i].viewProj, sizeof(mat4)) != 0)
+		{
+			dirtyMask[i / 32] |= 1u << (i % 32);
+			anyDirty = true;
+		}
+
+		cached.viewProj = cameras[i].viewProj;
+		cached.width = width;
+		cached.height = height;
+		cached.tileOffset = numTiles;
+		cached.numTiles = bucketize(width, PROJECTOR_BLOCK_SIZE) * bucketize(height, PROJECTOR_BLOCK_SIZE);
+		cached.remote = distributed && projectors[i].headless;
+
+		// A recreated intensity texture does not contain the cleared tiles.
+		uint64 intensitiesID = (uint64)projectors[i].renderer.solverIntensityTexture.get();
+		if (cached.intensitiesID != intensitiesID)
+		{
+			cached.emptyTilesCleared = false;
+		}
+		cached.intensitiesID = intensitiesID;
+
+		numTiles += cached.numTiles;
+	}
+
+	uint32 numElements = max(numTiles * numWords, 1u);
+	if (!overlapBuffer)
+	{
+		overlapBuffer = createBuffer(sizeof(uint32), numElements, 0, true);
+		tileClassBuffer = createBuffer(sizeof(uint32), max(numTiles, 1u), 0, true);
+		tileListBuffer = createBuffer(sizeof(uint32), max(numTiles, 1u), 0, true);
+		tileClassificationBuffer = createBuffer(sizeof(projector_tile_classification), max(numProjectors, 1u), 0, true);
+		SET_NAME(overlapBuffer->resource, "Projector overlaps");
+		SET_NAME(tileClassBuffer->resource, "Projector tile classes");
+		SET_NAME(tileListBuffer->resource, "Projector tile lists");
+		SET_NAME(tileClassificationBuffer->resource, "Projector tile classification");
+	}
+	else if (layoutChanged)
+	{
+		resizeBuffer(overlapBuffer, numElements);
+		resizeBuffer(tileClassBuffer, max(numTiles, 1u));
+		resizeBuffer(tileListBuffer, max(numTiles, 1u));
+		resizeBuffer(tileClassificationBuffer, max(numProjectors, 1u));
+	}
+
+	if (!settings.useOverlapCache)
+	{
+		// The intensity shader visits all projectors. Rebuild everything, once the cache is enabled again.
+		overlapCacheValid = false;
+		tileClassificationReadbackNumProjectors[dxContext.bufferedFrameID] = 0;
+		return;
+	}
+
+	overlapCacheValid = true;
+
+	if (anyDirty)
+	{
+		PROFILE_ALL(cl, "Overlap cache");
+
+		cl->setPipelineState(*overlapPipeline.pipeline);
+		cl->setComputeRootSignature(*overlapPipeline.rootSignature);
+
+		cl->setRootComputeSRV(PROJECTOR_OVERLAP_RS_PROJECTORS, projectorsGPUAddress);
+		cl->setRootComputeSRV(PROJECTOR_OVERLAP_RS_DIRTY_PROJECTORS, dirtyAlloc.gpuPtr);
+		cl->setComputeDescriptorTable(PROJECTOR_OVERLAP_RS_DEPTH_TEXTURES, depthTexturesBaseDescriptor);
+		cl->setRootComputeUAV(PROJECTOR_OVERLAP_RS_OVERLAPS, overlapBuffer);
+		cl->setRootComputeUAV(PROJECTOR_OVERLAP_RS_TILE_CLASSES, tileClassBuffer);
+
+		for (uint32 i = 0; i < numProjectors; ++i)
+		{
+			if (overlapCacheProjectors[i].remote)
+			{
+				continue;
+			}
+
+			uint32 width = projectors[i].renderer.renderWidth;
+			uint32 height = projectors[i].renderer.renderHeight;
+
+			projector_overlap_cb cb;
+			cb.index = i;
+			cb.numProjectors = numProjectors;
+			cb.tileOffset = overlapCacheProjectors[i].tileOffset;
+			cb.numTilesX = bucketize(width, PROJECTOR_BLOCK_SIZE);
+			cb.numWords = numWords;
+			cb.rebuildAll = (dirtyMask[i / 32] >> (i % 32)) & 1;
+
+			cl->setCompute32BitConstants(PROJECTOR_OVERLAP_RS_CB, cb);
+
+			cl->dispatch(bucketize(width, PROJECTOR_BLOCK_SIZE), bucketize(height, PROJECTOR_BLOCK_SIZE));
+		}
+
+		barrier_batcher(cl)
+			.transition(overlapBuffer, D3D12_RESOURCE_STATE_UNORDERED_ACCESS, D3D12_RESOURCE_STATE_NON_PIXEL_SHADER_RESOURCE)
+			.transition(tileClassBuffer, D3D12_RESOURCE_STATE_UNORDERED_ACCESS, D3D12_RESOURCE_STATE_NON_PIXEL_SHADER_RESOURCE);
+
+		classifyTiles(cl);
+	}
+	else
+	{
+		// Buffers decay to the common state after each command list.
+		barrier_batcher(cl)
+			.transition(tileClassificationBuffer, D3D12_RESOURCE_STATE_COMMON, D3D12_RESOURCE_STATE_GENERIC_READ);
+	}
+
+	// Tile counts for the profiler, read back NUM_BUFFERED_FRAMES later.
+	if (tileClassificationReadbackCapacity < numProjectors)
+	{
+		tileClassificationReadbackCapacity = numProjectors;
+		tileClassificationReadbackBuffer = createReadbackBuffer(sizeof(projector_tile_classification), tileClassificationReadbackCapacity * NUM_BUFFERED_FRAMES);
+		memset(tileClassificationReadbackNumProjectors, 0, sizeof(tileClassificationReadbackNumProjectors));
+	}
+
+	if (numProjectors > 0)
+	{
+		cl->copyBufferRegionToBuffer(tileClassificationBuffer, tileClassificationReadbackBuffer, 0, dxContext.bufferedFrameID * tileClassificationReadbackCapacity, numProjectors);
+	}
+	tileClassificationReadbackNumProjectors[dxContext.bufferedFrameID] = numProjectors;
+}
+
+// Sorts the tiles of each projector into its tile list and writes the indirect arguments of the intensity pass.
+void projector_solver::classifyTiles(dx_command_list* cl)
+{
+	PROFILE_ALL(cl, "Classify tiles");
+
+	dx_allocation rangeAlloc = dxContext.allocateDynamicBuffer(numProjectors * sizeof(projector_tile_range));
+	projector_tile_range* ranges = (projector_tile_range*)rangeAlloc.cpuPtr;
+
+	for (uint32 i = 0; i < numProjectors; ++i)
+	{
+		overlap_cache_projector& cached = overlapCacheProjectors[i];
+		ranges[i].tileOffset = cached.tileOffset;
+		ranges[i].numTiles = cached.remote ? 0 : cached.numTiles;
+
+		// Tiles may have become empty.
+		cached.emptyTilesCleared = false;
+	}
+
+	cl->setPipelineState(*tileClassificationPipeline.pipeline);
+	cl->setComputeRootSignature(*tileClassificationPipeline.rootSignature);
+
+	cl->setRootComputeSRV(PROJECTOR_TILE_CLASSIFICATION_RS_RANGES, rangeAlloc.gpuPtr);
+	cl->setRootComputeSRV(PROJECTOR_TILE_CLASSIFICATION_RS_TILE_CLASSES, tileClassBuffer);
+	cl->setRootComputeUAV(PROJECTOR_TILE_CLASSIFICATION_RS_TILE_LISTS, tileListBuffer);
+	cl->setRootComputeUAV(PROJECTOR_TILE_CLASSIFICATION_RS_CLASSIFICATIONS, tileClassificationBuffer);
+
+	cl->dispatch(numProjectors);
+
+	barrier_batcher(cl)
+		.transition(tileListBuffer, D3D12_RESOURCE_STATE_UNORDERED_ACCESS, D3D12_RESOURCE_STATE_NON_PIXEL_SHADER_RESOURCE)
+		.transition(tileClassificationBuffer, D3D12_RESOURCE_STATE_UNORDERED_ACCESS, D3D12_RESOURCE_STATE_GENERIC_READ);
+}
+
+// Logs the tile counts of the classification, which was copied NUM_BUFFERED_FRAMES ago, as profiler stats.
+void projector_solver::readbackTileStats()
+{
+	uint32 numClassifiedProjectors = tileClassificationReadbackNumProjectors[dxContext.bufferedFrameID];
+	if (numClassifiedProjectors == 0)
+	{
+		return;
+	}
+
+	uint32 firstElement = dxContext.bufferedFrameID * tileClassificationReadbackCapacity;
+
+	projector_tile_classification* mapped = (projector_tile_classification*)mapBuffer(tileClassificationReadbackBuffer, true, map_range{ firstElement, numClassifiedProjectors });
+
+	uint32 numEmptyTiles = 0, numSingleTiles = 0, numMultiTiles = 0;
+	for (uint32 i = 0; i < numClassifiedProjectors; ++i)
+	{
+		const projector_tile_classification& c = mapped[firstElement + i];
+		numEmptyTiles += c.empty.ThreadGroupCountX;
+		numSingleTiles += c.single.ThreadGroupCountX;
+		numMultiTiles += c.multi.ThreadGroupCountX;
+	}
+
+	unmapBuffer(tileClassificationReadbackBuffer, false);
+
+	CPU_PROFILE_STAT("Projector tiles empty", numEmptyTiles);
+	CPU_PROFILE_STAT("Projector tiles single coverage", numSingleTiles);
+	CPU_PROFILE_STAT("Projector tiles multi coverage", numMultiTiles);
+}
+
+// Creates the stand-in textures of the remote projectors. Returns true, if any of them needs new contents.
+bool projector_solver::prepareRemoteSummaries(const projector_component* projectors)
+{
+	bool changed = false;
+	for (uint32 i = 0; i < numProjectors; ++i)
+	{
+		if (!projectors[i].headless)
+		{
+			continue;
+		}
+
+		uint32 width = getProjectorSummaryWidth(projectors[i].renderer.renderWidth);
+		uint32 height = getProjectorSummaryHeight(projectors[i].renderer.renderHeight);
+
+		remote_summary_textures& remote = remoteSummaryTextures[i];
+		if (!remote.depth || remote.depth->width != width || remote.depth->height != height)
+		{
+			remote.depth = createTexture(0, width, height, DXGI_FORMAT_R32_FLOAT, false, false, true, D3D12_RESOURCE_STATE_GENERIC_READ);
+			remote.attenuation = createTexture(0, width, height, DXGI_FORMAT_R16G16_FLOAT, false, false, true, D3D12_RESOURCE_STATE_GENERIC_READ);
+			remote.masks = createTexture(0, width, height, DXGI_FORMAT_R16G16_UNORM, false, false, true, D3D12_RESOURCE_STATE_GENERIC_READ);
+			SET_NAME(remote.depth->resource, "Remote projector summary depth");
+			SET_NAME(remote.attenuation->resource, "Remote projector summary attenuation");
+			SET_NAME(remote.masks->resource, "Remote projector summary masks");
+
+			remote.uploadedVersion = -1;
+		}
+
+		// Summaries, which do not match the projector's resolution, are treated like missing ones.
+		const projector_summary& summary = remoteSummaries[i];
+		bool valid = summary.width == width && summary.height == height && (uint32)summary.texels.size() == width * height;
+		uint32 version = valid ? summary.version : 0;
+
+		changed |= remote.uploadedVersion != version;
+	}
+	return changed;
+}
+
+// Unpacks the remote summaries, which have changed since the last upload, into their stand-in textures. Projectors without a summary get an
+// empty one, so that they do not contribute.
+void projector_solver::uploadRemoteSummaries(dx_command_list* cl, const projector_component* projectors)
+{
+	PROFILE_ALL(cl, "Unpack remote summaries");
+
+	{
+		barrier_batcher batch(cl);
+		for (uint32 i = 0; i < numProjectors; ++i)
+		{
+			if (projectors[i].headless)
+			{
+				const remote_summary_textures& remote = remoteSummaryTextures[i];
+				batch.transition(remote.depth, D3D12_RESOURCE_STATE_GENERIC_READ, D3D12_RESOURCE_STATE_UNORDERED_ACCESS);
+				batch.transition(remote.attenuation, D3D12_RESOURCE_STATE_GENERIC_READ, D3D12_RESOURCE_STATE_UNORDERED_ACCESS);
+				batch.transition(remote.masks, D3D12_RESOURCE_STATE_GENERIC_READ, D3D12_RESOURCE_STATE_UNORDERED_ACCESS);
+			}
+		}
+	}
+
+	cl->setPipelineState(*summaryUnpackPipeline.pipeline);
+	cl->setComputeRootSignature(*summaryUnpackPipeline.rootSignature);
+
+	for (uint32 i = 0; i < numProjectors; ++i)
+	{
+		if (!projectors[i].headless)
+		{
+			continue;
+		}
+
+		remote_summary_textures& remote = remoteSummaryTextures[i];
+
+		uint32 width = remote.depth->width;
+		uint32 height = remote.depth->height;
+		uint32 numTexels = width * height;
+
+		const projector_summary& summary = remoteSummaries[i];
+		bool valid = summary.width == width && summary.height == height && (uint32)summary.texels.size() == numTexels;
+		uint32 version = valid ? summary.version : 0;
+
+		if (remote.uploadedVersion == version)
+		{
+			continue;
+		}
+
+		dx_allocation alloc = dxContext.allocateDynamicBuffer(numTexels * sizeof(projector_summary_texel));
+		projector_summary_texel* texels = (projector_summary_texel*)alloc.cpuPtr;
+
+		if (version != 0)
+		{
+			memcpy(texels, summary.texels.data(), numTexels * sizeof(projector_summary_texel));
+		}
+		else
+		{
+			projector_summary_texel empty = packProjectorSummary(1.f, 0.f, 0.f, 0.f, 0.f);
+			for (uint32 t = 0; t < numTexels; ++t)
+			{
+				texels[t] = empty;
+			}
+		}
+
+		cl->setCompute32BitConstants(PROJECTOR_SUMMARY_UNPACK_RS_CB, projector_summary_unpack_cb{ width, height });
+		cl->setRootComputeSRV(PROJECTOR_SUMMARY_UNPACK_RS_SUMMARY, alloc.gpuPtr);
+		cl->setDescriptorHeapUAV(PROJECTOR_SUMMARY_UNPACK_RS_OUTPUT, 0, remote.depth);
+		cl->setDescriptorHeapUAV(PROJECTOR_SUMMARY_UNPACK_RS_OUTPUT, 1, remote.attenuation);
+		cl->setDescriptorHeapUAV(PROJECTOR_SUMMARY_UNPACK_RS_OUTPUT, 2, remote.masks);
+
+		cl->dispatch(bucketize(width, PROJECTOR_BLOCK_SIZE), bucketize(height, PROJECTOR_BLOCK_SIZE));
+
+		remote.uploadedVersion = version;
+	}
+
+	{
+		barrier_batcher batch(cl);
+		for (uint32 i = 0; i < numProjectors; ++i)
+		{
+			if (projectors[i].headless)
+			{
+				const remote_summary_textures& remote = remoteSummaryTextures[i];
+				batch.transition(remote.depth, D3D12_RESOURCE_STATE_UNORDERED_ACCESS, D3D12_RESOURCE_STATE_GENERIC_READ);
+				batch.transition(remote.attenuation, D3D12_RESOURCE_STATE_UNORDERED_ACCESS, D3D12_RESOURCE_STATE_GENERIC_READ);
+				batch.transition(remote.masks, D3D12_RESOURCE_STATE_UNORDERED_ACCESS, D3D12_RESOURCE_STATE_GENERIC_READ);
+			}
+		}
+	}
+}
+
+// Packs the depth, attenuation and masks of the local projectors into their summaries, and copies them for readback NUM_BUFFERED_FRAMES
+// later. Expects the solver's descriptor heap to be set and the attenuation and mask textures to be readable.
+void projector_solver::computeLocalSummaries(dx_command_list* cl, const projector_component* projectors)
+{
+	std::vector<summary_readback_projector>& readbackProjectors = summaryReadbackProjectors[dxContext.bufferedFrameID];
+	readbackProjectors.clear();
+
+	uint32 numTexels = 0;
+	for (uint32 i = 0; i < numProjectors; ++i)
+	{
+		if (!projectors[i].headless)
+		{
+			uint32 width = getProjectorSummaryWidth(projectors[i].renderer.renderWidth);
+			uint32 height = getProjectorSummaryHeight(projectors[i].renderer.renderHeight);
+
+			readbackProjectors.push_back({ i, numTexels, width, height });
+			numTexels += width * height;
+		}
+	}
+
+	if (numTexels == 0)
+	{
+		return;
+	}
+
+	if (!summaryBuffer)
+	{
+		summaryBuffer = createBuffer(sizeof(projector_summary_texel), numTexels, 0, true);
+		SET_NAME(summaryBuffer->resource, "Projector summaries");
+	}
+	else if (summaryBuffer->elementCount < numTexels)
+	{
+		resizeBuffer(summaryBuffer, numTexels);
+	}
+
+	if (summaryReadbackCapacity < numTexels)
+	{
+		summaryReadbackCapacity = numTexels;
+		summaryReadbackBuffer = createReadbackBuffer(sizeof(projector_summary_texel), summaryReadbackCapacity * NUM_BUFFERED_FRAMES);
+
+		// Pending readbacks refer to the old buffer.
+		for (uint32 i = 0; i < NUM_BUFFERED_FRAMES; ++i)
+		{
+			if (i != dxContext.bufferedFrameID)
+			{
+				summaryReadbackProjectors[i].clear();
+			}
+		}
+	}
+
+	PROFILE_ALL(cl, "Local summaries");
+
+	cl->setPipelineState(*summaryPipeline.pipeline);
+	cl->setComputeRootSignature(*summaryPipeline.rootSignature);
+
+	cl->setRootComputeSRV(PROJECTOR_SUMMARY_RS_PROJECTORS, projectorsGPUAddress);
+	cl->setComputeDescriptorTable(PROJECTOR_SUMMARY_RS_DEPTH_TEXTURES, depthTexturesBaseDescriptor);
+	cl->setComputeDescriptorTable(PROJECTOR_SUMMARY_RS_ATTENUATIONS, attenuationSRVBaseDescriptor);
+	cl->setComputeDescriptorTable(PROJECTOR_SUMMARY_RS_MASKS, maskSRVBaseDescriptor);
+	cl->setRootComputeUAV(PROJECTOR_SUMMARY_RS_OUTPUT, summaryBuffer);
+
+	for (const summary_readback_projector& p : readbackProjectors)
+	{
+		projector_summary_cb cb;
+		cb.index = p.index;
+		cb.summaryOffset = p.offset;
+		cb.summaryWidth = p.width;
+		cb.summaryHeight = p.height;
+
+		cl->setCompute32BitConstants(PROJECTOR_SUMMARY_RS_CB, cb);
+
+		cl->dispatch(bucketize(p.width, PROJECTOR_BLOCK_SIZE), bucketize(p.height, PROJECTOR_BLOCK_SIZE));
+	}
+
+	barrier_batcher(cl)
+		.transition(summaryBuffer, D3D12_RESOURCE_STATE_UNORDERED_ACCESS, D3D12_RESOURCE_STATE_COPY_SOURCE);
+
+	cl->copyBufferRegionToBuffer(summaryBuffer, summaryReadbackBuffer, 0, dxContext.bufferedFrameID * summaryReadbackCapacity, numTexels);
+}
+
+// Copies the summaries, which were computed NUM_BUFFERED_FRAMES ago, to localSummaries. Only changed summaries get a new version, so that
+// they are only sent again, if necessary.
+void projector_solver::readbackLocalSummaries()
+{
+	std::vector<summary_readback_projector>& readbackProjectors = summaryReadbackProjectors[dxContext.bufferedFrameID];
+	if (readbackProjectors.empty())
+	{
+		return;
+	}
+
+	const summary_readback_projector& last = readbackProjectors.back();
+	uint32 numTexels = last.offset + last.width * last.height;
+	uint32 firstElement = dxContext.bufferedFrameID * summaryReadbackCapacity;
+
+	projector_summary_texel* mapped = (projector_summary_texel*)mapBuffer(summaryReadbackBuffer, true, map_range{ firstElement, numTexels });
+
+	for (const summary_readback_projector& p : readbackProjectors)
+	{
+		if (p.index >= (uint32)localSummaries.size())
+		{
+			continue; // Projectors have been recreated in the meantime.
+		}
+
+		projector_summary& summary = localSummaries[p.index];
+		const projector_summary_texel* texels = mapped + firstElement + p.offset;
+		uint32 count = p.width * p.height;
+
+		bool changed = summary.width != p.width || summary.height != p.height
+			|| memcmp(summary.texels.data(), texels, count * sizeof(projector_summary_texel)) != 0;
+		if (changed)
+		{
+			summary.width = p.width;
+			summary.height = p.height;
+			summary.texels.assign(texels, texels + count);
+			summary.version = ++lastSummaryVersion;
+		}
+	}
+
+	unmapBuffer(summaryReadbackBuffer, false);
+
+	readbackProjectors.clear();
+}
+
 void projector_solver::resetCameras(const projector_component* projectors, const render_camera* cameras, uint32 numProjectors)
 {
 	dx_allocation alloc = dxContext.allocateDynamicBuffer(numProjectors * sizeof(projector_cb));
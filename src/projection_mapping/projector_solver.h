@@ -7,6 +7,8 @@
 #include "rendering/material.h"
 #include "projector.h"
 
+#include "projector_rs.hlsli"
+
 
 enum projector_mode
 {
@@ -22,10 +24,41 @@ static const char* projectorModeNames[] =
 	"Demo",
 };
 
+// How much the scene the projectors render has changed since the last solve.
+enum projector_scene_motion
+{
+	projector_scene_static,
+	projector_scene_small_motion,
+	projector_scene_large_motion,
+};
+
+enum projector_solve_mode
+{
+	projector_solve_full,		// All stages, intensities from scratch.
+	projector_solve_warm_start,	// All stages, but the intensities only correct the last solve's (see projector_rs.hlsli).
+	projector_solve_reuse,		// Nothing has changed. All results of the last solve are kept.
+};
+
+static const char* projectorSolveModeNames[] =
+{
+	"Full",
+	"Warm start",
+	"Reuse",
+};
+
 struct projector_solver_settings
 {
 	bool applySolverIntensity = false;
 	bool simulateAllProjectors = false;
+	bool useOverlapCache = true;
+
+	// Each network node only solves its own projectors and sees the others through their summaries (see projector_rs.hlsli).
+	bool distributedSolve = true;
+
+	// Reuse or warm start from the last solve, if the scene has not or only slightly changed. Thresholds are per frame.
+	bool temporalReuse = true;
+	float smallMotionDistance = 0.01f;	// In meters.
+	float smallMotionAngle = 0.02f;		// In radians.
 
 	float referenceDistance = 0.5f;
 	float referenceWhite = 0.7f;
@@ -50,14 +83,94 @@ struct projector_solver_settings
 	uint32 demoMonitor = 0;
 };
 
+// Field by field, since the padding between the bools and floats is not initialized.
+static bool operator==(const projector_solver_settings& a, const projector_solver_settings& b)
+{
+	return a.applySolverIntensity == b.applySolverIntensity
+		&& a.simulateAllProjectors == b.simulateAllProjectors
+		&& a.useOverlapCache == b.useOverlapCache
+		&& a.distributedSolve == b.distributedSolve
+		&& a.temporalReuse == b.temporalReuse
+		&& a.smallMotionDistance == b.smallMotionDistance
+		&& a.smallMotionAngle == b.smallMotionAngle
+		&& a.referenceDistance == b.referenceDistance
+		&& a.referenceWhite == b.referenceWhite
+		&& a.depthDiscontinuityThreshold == b.depthDiscontinuityThreshold
+		&& a.colorDiscontinuityThreshold == b.colorDiscontinuityThreshold
+		&& a.depthHardDistance == b.depthHardDistance
+		&& a.depthSmoothDistance == b.depthSmoothDistance
+		&& a.colorHardDistance == b.colorHardDistance
+		&& a.colorSmoothDistance == b.colorSmoothDistance
+		&& a.bestMaskHardDistance == b.bestMaskHardDistance
+		&& a.bestMaskSmoothDistance == b.bestMaskSmoothDistance
+		&& a.colorMaskStrength == b.colorMaskStrength
+		&& a.mode == b.mode
+		&& a.demoPC == b.demoPC
+		&& a.demoMonitor == b.demoMonitor;
+}
+
+static bool operator!=(const projector_solver_settings& a, const projector_solver_settings& b) { return !(a == b); }
+
+static projector_scene_motion classifyMotion(float distance, float angle, const projector_solver_settings& settings)
+{
+	if (distance == 0.f && angle == 0.f)
+	{
+		return projector_scene_static;
+	}
+	return (distance <= settings.smallMotionDistance && angle <= settings.smallMotionAngle) ? projector_scene_small_motion : projector_scene_large_motion;
+}
+
+// Change detection between solves. Shared by the solver and its CPU reference.
+struct projector_solver_history
+{
+	struct projector_state
+	{
+		mat4 viewProj;
+		uint32 width, height;
+		uint64 intensitiesID;	// Identity of the projector's intensity image. Changes, if it has been recreated.
+		bool solved;			// Intensities are computed for this projector.
+	};
+
+	// Call once per solve. Any change to the projectors or settings requires a full solve. Otherwise the mode follows the scene motion. A
+	// warm start needs the last intensities of all projectors. After motion has stopped, one more full solve removes what the warm starts
+	// have accumulated, before the results are reused.
+	projector_solve_mode update(const projector_solver_settings& settings, const projector_state* states, uint32 numProjectors, projector_scene_motion motion);
+
+	std::vector<projector_state> projectors;
+	projector_solver_settings settings;
+	projector_solve_mode lastMode = projector_solve_full;
+	bool valid = false;
+};
+
+// Coarse depth, attenuation and masks of one projector, as exchanged between network nodes. See projector_rs.hlsli.
+struct projector_summary
+{
+	uint32 width = 0, height = 0;
+	uint32 version = 0; // Changes, whenever the texels change. 0 means there is no summary yet.
+	std::vector<projector_summary_texel> texels;
+};
+
+static uint32 getProjectorSummaryWidth(uint32 renderWidth) { return bucketize(renderWidth, PROJECTOR_BLOCK_SIZE); }
+static uint32 getProjectorSummaryHeight(uint32 renderHeight) { return bucketize(renderHeight, PROJECTOR_BLOCK_SIZE); }
+
 struct projector_solver
 {
 	void initialize();
 
-	void solve(const projector_component* projectors, const render_camera* cameras, uint32 numProjectors);
+	// objectMotion describes, how far the rendered objects have moved since the last call. Projector calibrations, the viewer, the sun and
+	// the settings are checked by the solver itself. Animated materials are not detected.
+	// If distributed is set, only the local projectors are solved. Headless projectors belong to other nodes and are represented by
+	// remoteSummaries. The summaries of the local projectors are written to localSummaries, NUM_BUFFERED_FRAMES after their solve.
+	void solve(const projector_component* projectors, const render_camera* cameras, uint32 numProjectors, projector_scene_motion objectMotion = projector_scene_large_motion,
+		bool distributed = false);
 	void resetCameras(const projector_component* projectors, const render_camera* cameras, uint32 numProjectors);
 
 	projector_solver_settings settings;
+	projector_solve_mode lastSolveMode = projector_solve_full;
+
+	// Indexed like the projectors. Only the entries of local, respectively remote projectors are used.
+	std::vector<projector_summary> localSummaries;
+	std::vector<projector_summary> remoteSummaries;
 
 	void simulateProjectors(opaque_render_pass* opaqueRenderPass,
 		const mat4& transform,
@@ -104,6 +217,77 @@ private:
 	uint32 numProjectors;
 
 	dx_pushable_descriptor_heap heaps[NUM_BUFFERED_FRAMES];
+	uint32 heapSizes[NUM_BUFFERED_FRAMES]; // Grown on demand, see solve.
+
+
+	// Temporal reuse.
+	projector_scene_motion detectLightingMotion();
+
+	projector_solver_history history;
+	vec3 lastViewerPosition = vec3(0.f);
+	vec3 lastSunDirection = vec3(0.f);
+	vec3 lastSunRadiance = vec3(0.f);
+
+
+	// Overlap cache, see projector_rs.hlsli.
+	void updateOverlapCache(dx_command_list* cl, const projector_component* projectors, const render_camera* cameras, bool geometryChanged, bool distributed);
+
+	struct overlap_cache_projector
+	{
+		mat4 viewProj;
+		uint32 width, height;
+		uint32 tileOffset;
+		uint32 numTiles;
+		uint64 intensitiesID; // Like projector_solver_history::projector_state.
+		bool remote; // Only tested against. Its own tiles are neither updated nor classified.
+		bool emptyTilesCleared; // Intensities of empty tiles only need to be written once after each reclassification, and into each new intensity texture.
+	};
+
+	std::vector<overlap_cache_projector> overlapCacheProjectors; // State of the projectors at the last update.
+	ref<dx_buffer> overlapBuffer;
+	bool overlapCacheValid = false;
+
+	// Tile classification, see projector_rs.hlsli. Rebuilt along with the overlap cache.
+	void classifyTiles(dx_command_list* cl);
+	void readbackTileStats();
+
+	ref<dx_buffer> tileClassBuffer;
+	ref<dx_buffer> tileListBuffer;
+	ref<dx_buffer> tileClassificationBuffer;
+
+	ref<dx_buffer> tileClassificationReadbackBuffer; // NUM_BUFFERED_FRAMES slots of tileClassificationReadbackCapacity projectors.
+	uint32 tileClassificationReadbackCapacity = 0;
+	uint32 tileClassificationReadbackNumProjectors[NUM_BUFFERED_FRAMES] = {};
+
+
+	// Distributed solving, see projector_rs.hlsli.
+	bool prepareRemoteSummaries(const projector_component* projectors); // Returns true, if any remote summary has changed.
+	void uploadRemoteSummaries(dx_command_list* cl, const projector_component* projectors);
+	void computeLocalSummaries(dx_command_list* cl, const projector_component* projectors);
+	void readbackLocalSummaries();
+
+	struct remote_summary_textures
+	{
+		ref<dx_texture> depth;			// Stand-ins for the remote projector's depth buffer, attenuation and mask textures.
+		ref<dx_texture> attenuation;
+		ref<dx_texture> masks;
+		uint32 uploadedVersion = -1;
+	};
+
+	struct summary_readback_projector
+	{
+		uint32 index;
+		uint32 offset; // In texels.
+		uint32 width, height;
+	};
+
+	std::vector<remote_summary_textures> remoteSummaryTextures;
+	ref<dx_buffer> summaryBuffer;
+
+	ref<dx_buffer> summaryReadbackBuffer; // NUM_BUFFERED_FRAMES slots of summaryReadbackCapacity texels.
+	uint32 summaryReadbackCapacity = 0;
+	std::vector<summary_readback_projector> summaryReadbackProjectors[NUM_BUFFERED_FRAMES];
+	uint32 lastSummaryVersion = 0; // Not reset with the summaries, so that receivers never confuse summaries of recreated projectors with old ones.
 
 
 	friend struct visualize_intensities_pipeline;
@@ -0,0 +1,237 @@
+#include "pch.h"
+#include "software_rasterizer.h"
+#include "geometry/mesh.h"
+
+#include "core/threading.h"
+#include "core/cpu_profiling.h"
+
+#include "camera.hlsli"
+
+
+#define SOFTWARE_RASTERIZER_TILE_SIZE 64
+#define SOFTWARE_RASTERIZER_TRIANGLES_PER_JOB 4096
+
+struct raster_triangle
+{
+	// Barycentric weight i at pixel (x, y) is a[i] * x + b[i] * y + c[i].
+	vec3 a, b, c;
+
+	// Attributes divided by view depth for perspective correct interpolation.
+	vec3 invDepth;
+	vec3 normalX, normalY, normalZ;
+
+	int32 minX, minY, maxX, maxY; // Inclusive pixel bounds.
+};
+
+void rasterizeViewNormalAndDepth(const cpu_triangle_mesh& mesh, const mat4& modelView,
+	const camera_intrinsics& intrinsics, const camera_distortion& distortion, float nearPlane, image<vec4>& output)
+{
+	CPU_PROFILE_BLOCK("Software rasterizer");
+
+	const int32 width = (int32)output.width;
+	const int32 height = (int32)output.height;
+
+	const uint32 numTilesX = (output.width + SOFTWARE_RASTERIZER_TILE_SIZE - 1) / SOFTWARE_RASTERIZER_TILE_SIZE;
+	const uint32 numTilesY = (output.height + SOFTWARE_RASTERIZER_TILE_SIZE - 1) / SOFTWARE_RASTERIZER_TILE_SIZE;
+	const uint32 numTiles = numTilesX * numTilesY;
+
+	const uint32 numVertices = (uint32)mesh.positions.size();
+	const uint32 numTriangles = (uint32)mesh.triangles.size();
+	const uint32 numSetupJobs = max((numTriangles + SOFTWARE_RASTERIZER_TRIANGLES_PER_JOB - 1) / SOFTWARE_RASTERIZER_TRIANGLES_PER_JOB, 1u);
+
+	struct transformed_vertex
+	{
+		vec2 screen;
+		float depth;
+		vec3 normal;
+	};
+
+	std::vector<transformed_vertex> vertices(numVertices);
+	std::vector<raster_triangle> triangles(numTriangles);
+
+	// Triangle indices per setup job and tile. Rasterizing the jobs' bins in order keeps the result deterministic.
+	std::vector<std::vector<std::vector<uint32>>> bins(numSetupJobs, std::vector<std::vector<uint32>>(numTiles));
+
+	thread_job_context context;
+
+
+	// Vertex stage.
+	{
+		CPU_PROFILE_BLOCK("Transform vertices");
+
+		const uint32 verticesPerJob = SOFTWARE_RASTERIZER_TRIANGLES_PER_JOB * 2;
+		for (uint32 start = 0; start < numVertices; start += verticesPerJob)
+		{
+			context.addWork([&, start]()
+			{
+				uint32 end = min(start + verticesPerJob, numVertices);
+				for (uint32 i = start; i < end; ++i)
+				{
+					vec3 viewPosition = (modelView * vec4(mesh.positions[i], 1.f)).xyz;
+
+					transformed_vertex& v = vertices[i];
+					v.depth = -viewPosition.z;
+					v.normal = (modelView * vec4(mesh.normals[i], 0.f)).xyz;
+					v.screen = (v.depth >= nearPlane) ? project(viewPosition, intrinsics, distortion) : vec2(0.f, 0.f);
+				}
+			});
+		}
+
+		context.waitForWorkCompletion();
+	}
+
+
+	// Triangle setup and binning.
+	{
+		CPU_PROFILE_BLOCK("Setup and bin triangles");
+
+		for (uint32 jobIndex = 0; jobIndex < numSetupJobs; ++jobIndex)
+		{
+			context.addWork([&, jobIndex]()
+			{
+				auto& jobBins = bins[jobIndex];
+
+				uint32 start = jobIndex * SOFTWARE_RASTERIZER_TRIANGLES_PER_JOB;
+				uint32 end = min(start + SOFTWARE_RASTERIZER_TRIANGLES_PER_JOB, numTriangles);
+
+				for (uint32 t = start; t < end; ++t)
+				{
+					indexed_triangle32 tri = mesh.triangles[t];
+					const transformed_vertex& v0 = vertices[tri.a];
+					const transformed_vertex& v1 = vertices[tri.b];
+					const transformed_vertex& v2 = vertices[tri.c];
+
+					if (v0.depth < nearPlane || v1.depth < nearPlane || v2.depth < nearPlane)
+					{
+						continue;
+					}
+
+					// Counter-clockwise front faces have negative area, because pixel coordinates point down.
+					float area = cross(v1.screen - v0.screen, v2.screen - v0.screen);
+					if (!(area < 0.f))
+					{
+						continue;
+					}
+
+					float minXf = min(v0.screen.x, min(v1.screen.x, v2.screen.x));
+					float minYf = min(v0.screen.y, min(v1.screen.y, v2.screen.y));
+					float maxXf = max(v0.screen.x, max(v1.screen.x, v2.screen.x));
+					float maxYf = max(v0.screen.y, max(v1.screen.y, v2.screen.y));
+
+					// Pixel centers are at +0.5.
+					int32 minX = max((int32)ceil(minXf - 0.5f), 0);
+					int32 minY = max((int32)ceil(minYf - 0.5f), 0);
+					int32 maxX = min((int32)floor(maxXf - 0.5f), width - 1);
+					int32 maxY = min((int32)floor(maxYf - 0.5f), height - 1);
+
+					if (minX > maxX || minY > maxY)
+					{
+						continue;
+					}
+
+					raster_triangle& r = triangles[t];
+
+					float invArea = 1.f / area;
+					vec2 p[3] = { v0.screen, v1.screen, v2.screen };
+					for (uint32 i = 0; i < 3; ++i)
+					{
+						vec2 from = p[(i + 1) % 3];
+						vec2 to = p[(i + 2) % 3];
+
+						r.a.data[i] = -(to.y - from.y) * invArea;
+						r.b.data[i] = (to.x - from.x) * invArea;
+						r.c.data[i] = -(r.a.data[i] * from.x + r.b.data[i] * from.y);
+					}
+
+					r.invDepth = vec3(1.f / v0.depth, 1.f / v1.depth, 1.f / v2.depth);
+					r.normalX = vec3(v0.normal.x, v1.normal.x, v2.normal.x) * r.invDepth;
+					r.normalY = vec3(v0.normal.y, v1.normal.y, v2.normal.y) * r.invDepth;
+					r.normalZ = vec3(v0.normal.z, v1.normal.z, v2.normal.z) * r.invDepth;
+
+					r.minX = minX;
+					r.minY = minY;
+					r.maxX = maxX;
+					r.maxY = maxY;
+
+					for (int32 ty = minY / SOFTWARE_RASTERIZER_TILE_SIZE; ty <= maxY / SOFTWARE_RASTERIZER_TILE_SIZE; ++ty)
+					{
+						for (int32 tx = minX / SOFTWARE_RASTERIZER_TILE_SIZE; tx <= maxX / SOFTWARE_RASTERIZER_TILE_SIZE; ++tx)
+						{
+							jobBins[ty * numTilesX + tx].push_back(t);
+						}
+					}
+				}
+			});
+		}
+
+		context.waitForWorkCompletion();
+	}
+
+
+	// Rasterization. Each tile is owned by exactly one job, so no synchronization is needed on the output.
+	{
+		CPU_PROFILE_BLOCK("Rasterize tiles");
+
+		for (uint32 tileIndex = 0; tileIndex < numTiles; ++tileIndex)
+		{
+			context.addWork([&, tileIndex]()
+			{
+				int32 tileMinX = (int32)(tileIndex % numTilesX) * SOFTWARE_RASTERIZER_TILE_SIZE;
+				int32 tileMinY = (int32)(tileIndex / numTilesX) * SOFTWARE_RASTERIZER_TILE_SIZE;
+				int32 tileMaxX = min(tileMinX + SOFTWARE_RASTERIZER_TILE_SIZE, width) - 1;
+				int32 tileMaxY = min(tileMinY + SOFTWARE_RASTERIZER_TILE_SIZE, height) - 1;
+
+				for (int32 y = tileMinY; y <= tileMaxY; ++y)
+				{
+					for (int32 x = tileMinX; x <= tileMaxX; ++x)
+					{
+						output(y, x) = vec4(0.f, 0.f, 0.f, 0.f);
+					}
+				}
+
+				for (uint32 jobIndex = 0; jobIndex < numSetupJobs; ++jobIndex)
+				{
+					for (uint32 t : bins[jobIndex][tileIndex])
+					{
+						const raster_triangle& r = triangles[t];
+
+						int32 minX = max(r.minX, tileMinX);
+						int32 minY = max(r.minY, tileMinY);
+						int32 maxX = min(r.maxX, tileMaxX);
+						int32 maxY = min(r.maxY, tileMaxY);
+
+						for (int32 y = minY; y <= maxY; ++y)
+						{
+							float py = y + 0.5f;
+							vec3 rowWeights = r.b * py + r.c;
+
+							for (int32 x = minX; x <= maxX; ++x)
+							{
+								float px = x + 0.5f;
+								vec3 w = r.a * px + rowWeights;
+
+								if (w.x < 0.f || w.y < 0.f || w.z < 0.f)
+								{
+									continue;
+								}
+
+								float invDepth = dot(w, r.invDepth);
+								float depth = 1.f / invDepth;
+
+								vec4& out = output(y, x);
+								if (out.w == 0.f || depth < out.w)
+								{
+									vec3 normal(dot(w, r.normalX), dot(w, r.normalY), dot(w, r.normalZ));
+									out = vec4(normalize(normal), depth);
+								}
+							}
+						}
+					}
+				}
+			});
+		}
+
+		context.waitForWorkCompletion();
+	}
+}
+
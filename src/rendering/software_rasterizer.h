@@ -0,0 +1,14 @@
+#pragma once
+
+#include "core/image.h"
+#include "core/camera.h"
+
+struct cpu_triangle_mesh;
+
+// Renders the view-space normal (xyz) and the positive view depth (w) of the closest front face into each pixel. Uncovered pixels are zero.
+// This produces the same image as the depth-to-color pipeline in calibration, but runs on the CPU (tiled and multithreaded), so it works
+// without a GPU. Like the vertex shader, vertices are projected with the distortion model and triangles are rasterized linearly in between.
+// Triangles crossing the near plane are skipped instead of clipped.
+void rasterizeViewNormalAndDepth(const cpu_triangle_mesh& mesh, const mat4& modelView,
+	const camera_intrinsics& intrinsics, const camera_distortion& distortion, float nearPlane, image<vec4>& output);
+
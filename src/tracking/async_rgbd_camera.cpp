@@ -1,17 +1,38 @@
 #include "pch.h"
 #include "async_rgbd_camera.h"
 
-#include "dx/dx_profiling.h"
-#include "dx/dx_command_list.h"
-#include "dx/dx_context.h"
+#include "core/threading.h"
+#include "core/cpu_profiling.h"
 
-void async_rgbd_camera::shutdown()
+
+rgbd_frame_ref& rgbd_frame_ref::operator=(rgbd_frame_ref&& o) noexcept
+{
+    release();
+
+    depth = o.depth;
+    color = o.color;
+    frameID = o.frameID;
+    deviceTimestampInMicroseconds = o.deviceTimestampInMicroseconds;
+    hostTimestampInMicroseconds = o.hostTimestampInMicroseconds;
+    refCount = o.refCount;
+
+    o.depth = 0;
+    o.color = 0;
+    o.refCount = 0;
+
+    return *this;
+}
+
+void rgbd_frame_ref::release()
 {
-    if (colorFrame)
+    if (refCount)
     {
-        delete[] colorFrame;
-        colorFrame = 0;
+        atomicDecrement(*refCount);
+        refCount = 0;
     }
+
+    depth = 0;
+    color = 0;
 }
 
 bool async_rgbd_camera::initializeAs(rgbd_camera_type type, uint32 deviceIndex, bool alignDepthToColor)
@@ -22,6 +43,16 @@ bool async_rgbd_camera::initializeAs(rgbd_camera_type type, uint32 deviceIndex,
             return initializeAzure(deviceIndex, alignDepthToColor);
         case rgbd_camera_type_realsense:
             return initializeRealsense(deviceIndex, alignDepthToColor);
+        case rgbd_camera_type_recording:
+        {
+            shutdown();
+            if (!rgbd_camera::initializeAs(type, deviceIndex, alignDepthToColor))
+            {
+                return false;
+            }
+            startPolling();
+            return true;
+        }
         default:
             return false;
     }
@@ -29,95 +60,152 @@ bool async_rgbd_camera::initializeAs(rgbd_camera_type type, uint32 deviceIndex,
 
 bool async_rgbd_camera::initializeAzure(uint32 deviceIndex, bool alignDepthToColor)
 {
+    shutdown();
+
     if (!rgbd_camera::initializeAzure(deviceIndex, alignDepthToColor))
     {
         return false;
     }
 
-    initializeInternal();
+    startPolling();
 
-	return true;
+    return true;
 }
 
 bool async_rgbd_camera::initializeRealsense(uint32 deviceIndex, bool alignDepthToColor)
 {
+    shutdown();
+
     if (!rgbd_camera::initializeRealsense(deviceIndex, alignDepthToColor))
     {
         return false;
     }
 
-    initializeInternal();
+    startPolling();
 
     return true;
 }
 
-void async_rgbd_camera::initializeInternal()
+bool async_rgbd_camera::initializeRecording(const fs::path& path, bool realTimePlayback, bool loop)
 {
-    colorFrame = new color_bgra[colorSensor.width * colorSensor.height];
-
-    depthTexture = createTexture(0, depthSensor.width, depthSensor.height, trackingDepthFormat, false, false, false, D3D12_RESOURCE_STATE_GENERIC_READ);
-    uint32 requiredSize = (uint32)GetRequiredIntermediateSize(depthTexture->resource.Get(), 0, 1);
-    depthUploadBuffer = createUploadBuffer(requiredSize, 1, 0);
+    shutdown();
 
-    if (colorSensor.active)
+    if (!rgbd_camera::initializeRecording(path, realTimePlayback, loop))
     {
-        colorTexture = createTexture(0, colorSensor.width, colorSensor.height, trackingColorFormat, false, false, false, D3D12_RESOURCE_STATE_GENERIC_READ);
-        uint32 requiredSize = (uint32)GetRequiredIntermediateSize(colorTexture->resource.Get(), 0, 1);
-        colorUploadBuffer = createUploadBuffer(requiredSize, 1, 0);
+        return false;
     }
 
-    depthUnprojectTableTexture = createTexture(depthSensor.unprojectTable, depthSensor.width, depthSensor.height, DXGI_FORMAT_R32G32_FLOAT);
+    startPolling();
 
-    SET_NAME(depthTexture->resource, "Camera depth");
-    SET_NAME(depthUnprojectTableTexture->resource, "Unproject table");
+    return true;
+}
 
+void async_rgbd_camera::shutdown()
+{
+    if (pollingThread.joinable())
+    {
+        running = false;
+        pollingThread.join();
+    }
 
-    pollingThread = std::thread([this]()
+    // Consumers must not hold on to frames across a shutdown.
+    for (frame_slot& slot : slots)
     {
-        // Upload new frame if available.
-        rgbd_frame frame;
-        if (getFrame(frame, 0))
+        assert(slot.refCount == 0);
+        if (slot.occupied)
         {
-            dx_command_list* cl = dxContext.getFreeRenderCommandList();
+            releaseFrame(slot.frame);
+            slot.occupied = false;
+        }
+    }
+    latestSlot = -1;
 
-            if (depthSensor.active)
-            {
-                PROFILE_ALL(cl, "Upload depth image");
+    rgbd_camera::shutdown();
+}
 
-                uint32 formatSize = getFormatSize(trackingDepthFormat);
+void async_rgbd_camera::startPolling()
+{
+    running = true;
+    pollingThread = std::thread([this]() { pollingThreadProc(); });
+    SetThreadDescription((HANDLE)pollingThread.native_handle(), L"RGBD camera thread");
+}
 
-                D3D12_SUBRESOURCE_DATA subresource;
-                subresource.RowPitch = depthSensor.width * formatSize;
-                subresource.SlicePitch = depthSensor.width * depthSensor.height * formatSize;
-                subresource.pData = frame.depth;
+void async_rgbd_camera::pollingThreadProc()
+{
+    uint64 frameID = 0;
 
-                cl->transitionBarrier(depthTexture, D3D12_RESOURCE_STATE_GENERIC_READ, D3D12_RESOURCE_STATE_COPY_DEST);
-                UpdateSubresources<1>(cl->commandList.Get(), depthTexture->resource.Get(), depthUploadBuffer->resource.Get(), 0, 0, 1, &subresource);
-                cl->transitionBarrier(depthTexture, D3D12_RESOURCE_STATE_COPY_DEST, D3D12_RESOURCE_STATE_GENERIC_READ);
-            }
+    while (running)
+    {
+        // The timeout only bounds how long shutdown has to wait.
+        rgbd_frame frame;
+        if (!getFrame(frame, 100))
+        {
+            continue;
+        }
 
-            if (colorSensor.active)
+        CPU_PROFILE_BLOCK("Publish RGBD frame");
+
+        // Find a slot, which is neither published nor referenced. A consumer might still increment the reference count of a slot, which it
+        // saw published earlier. It then sees that the slot is no longer the latest one and backs off before touching the frame.
+        uint32 latest = latestSlot;
+        uint32 slotIndex = -1;
+        for (uint32 i = 0; i < ASYNC_RGBD_CAMERA_NUM_FRAME_SLOTS; ++i)
+        {
+            if (i != latest && slots[i].refCount == 0)
             {
-                PROFILE_ALL(cl, "Upload color image");
+                slotIndex = i;
+                break;
+            }
+        }
 
-                uint32 formatSize = getFormatSize(trackingColorFormat);
+        if (slotIndex == -1)
+        {
+            releaseFrame(frame);
+            atomicIncrement(numDroppedFrames);
+            continue;
+        }
 
-                D3D12_SUBRESOURCE_DATA subresource;
-                subresource.RowPitch = colorSensor.width * formatSize;
-                subresource.SlicePitch = colorSensor.width * colorSensor.height * formatSize;
-                subresource.pData = frame.color;
+        frame_slot& slot = slots[slotIndex];
+        if (slot.occupied)
+        {
+            releaseFrame(slot.frame);
+        }
 
-                cl->transitionBarrier(colorTexture, D3D12_RESOURCE_STATE_GENERIC_READ, D3D12_RESOURCE_STATE_COPY_DEST);
-                UpdateSubresources<1>(cl->commandList.Get(), colorTexture->resource.Get(), colorUploadBuffer->resource.Get(), 0, 0, 1, &subresource);
-                cl->transitionBarrier(colorTexture, D3D12_RESOURCE_STATE_COPY_DEST, D3D12_RESOURCE_STATE_GENERIC_READ);
+        slot.frame = frame;
+        slot.frameID = ++frameID;
+        slot.occupied = true;
 
-                memcpy(colorFrame, frame.color, colorSensor.width * colorSensor.height * sizeof(color_bgra));
-            }
+        atomicExchange(latestSlot, slotIndex);
+    }
+}
 
-            releaseFrame(frame);
+rgbd_frame_ref async_rgbd_camera::getLatestFrame()
+{
+    rgbd_frame_ref result;
 
-            dxContext.executeCommandList(cl);
+    while (true)
+    {
+        uint32 index = latestSlot;
+        if (index == -1)
+        {
+            return result;
         }
-    });
 
+        frame_slot& slot = slots[index];
+        atomicIncrement(slot.refCount);
+
+        // If the slot is still the latest one, the camera thread will not touch it until the reference is released.
+        if (latestSlot == index)
+        {
+            result.refCount = &slot.refCount;
+            result.depth = slot.frame.depth;
+            result.color = slot.frame.color;
+            result.frameID = slot.frameID;
+            result.deviceTimestampInMicroseconds = slot.frame.deviceTimestampInMicroseconds;
+            result.hostTimestampInMicroseconds = slot.frame.hostTimestampInMicroseconds;
+            return result;
+        }
+
+        atomicDecrement(slot.refCount);
+    }
 }
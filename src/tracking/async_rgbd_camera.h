@@ -1,38 +1,81 @@
 #pragma once
 
 #include "rgbd_camera.h"
-#include "dx/dx_texture.h"
-#include "dx/dx_buffer.h"
 
+#include <thread>
 
-static const DXGI_FORMAT trackingDepthFormat = DXGI_FORMAT_R16_UINT;
-static const DXGI_FORMAT trackingColorFormat = DXGI_FORMAT_B8G8R8A8_UNORM_SRGB;
 
+// Enough for the frame being written, the latest published frame and one frame held by each of two consumers (e.g. tracking and calibration).
+#define ASYNC_RGBD_CAMERA_NUM_FRAME_SLOTS 4
+
+// Reference to a frame published by the camera thread. The frame's memory is neither released nor overwritten while the reference lives.
+struct rgbd_frame_ref
+{
+	rgbd_frame_ref() {}
+	rgbd_frame_ref(const rgbd_frame_ref&) = delete;
+	rgbd_frame_ref(rgbd_frame_ref&& o) noexcept { *this = std::move(o); }
+	~rgbd_frame_ref() { release(); }
+
+	void operator=(const rgbd_frame_ref&) = delete;
+	rgbd_frame_ref& operator=(rgbd_frame_ref&& o) noexcept;
+
+	void release();
+
+	explicit operator bool() const { return refCount != 0; }
+
+	const uint16* depth = 0;
+	const color_bgra* color = 0;
+	uint64 frameID = 0; // Increments with every frame delivered by the camera.
+
+	uint64 deviceTimestampInMicroseconds = 0; // See rgbd_frame.
+	int64 hostTimestampInMicroseconds = 0;
+
+private:
+	volatile uint32* refCount = 0;
+
+	friend struct async_rgbd_camera;
+};
+
+/*
+	Polls the camera on a background thread and hands out the newest complete frame to any number of consumers.
+	Frames are not copied. The camera thread keeps the SDK frames in a small set of reference counted slots. Publishing is a single atomic
+	exchange, and the camera thread only ever writes to a slot which is neither the latest one nor referenced by a consumer. If no such slot
+	is available, the new frame is dropped, so the camera thread never waits for consumers.
+*/
 struct async_rgbd_camera : rgbd_camera
 {
 	async_rgbd_camera() {}
+	async_rgbd_camera(const async_rgbd_camera&) = delete;
 	~async_rgbd_camera() { shutdown(); }
 
-	void shutdown();
+	void operator=(const async_rgbd_camera&) = delete;
 
 	bool initializeAs(rgbd_camera_type type, uint32 deviceIndex = 0, bool alignDepthToColor = true);
 	bool initializeAzure(uint32 deviceIndex = 0, bool alignDepthToColor = true);
 	bool initializeRealsense(uint32 deviceIndex = 0, bool alignDepthToColor = true);
+	bool initializeRecording(const fs::path& path, bool realTimePlayback = true, bool loop = true);
+	void shutdown();
 
+	// Never blocks. The returned reference is empty, if no frame has arrived yet.
+	rgbd_frame_ref getLatestFrame();
 
-	color_bgra* colorFrame = 0;
-
-
-	ref<dx_texture> depthTexture;
-	ref<dx_texture> depthUnprojectTableTexture;
-	ref<dx_texture> colorTexture;
-	ref<dx_buffer> depthUploadBuffer;
-	ref<dx_buffer> colorUploadBuffer;
-
+	uint32 numDroppedFrames = 0;
 
 private:
+	struct frame_slot
+	{
+		rgbd_frame frame;
+		uint64 frameID;
+		volatile uint32 refCount = 0;
+		bool occupied = false;
+	};
+
+	void startPolling();
+	void pollingThreadProc();
 
-	void initializeInternal();
+	frame_slot slots[ASYNC_RGBD_CAMERA_NUM_FRAME_SLOTS];
+	volatile uint32 latestSlot = -1;
 
+	volatile bool running = false;
 	std::thread pollingThread;
 };
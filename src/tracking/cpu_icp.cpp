@@ -0,0 +1,1068 @@
+#include "pch.h"
+#include "cpu_icp.h"
+#include "tracking.h"
+#include "tracking_math.h"
+#include "synthetic_depth_camera.h"
+
+#include "geometry/mesh.h"
+#include "rendering/software_rasterizer.h"
+
+#include "core/threading.h"
+#include "core/memory.h"
+#include "core/cpu_profiling.h"
+#include "core/log.h"
+
+#include <chrono>
+
+
+#define CPU_ICP_ROWS_PER_BLOCK 16
+
+
+// Sums the outer products of all correspondences in the block. The count must be padded to a multiple of 8 with zero gradients, which
+// don't contribute to the sums.
+static tracking_ata_atb reduceCorrespondences(const float* correspondences, uint32 stride, uint32 paddedCount)
+{
+	const float* g0x = correspondences + 0 * stride;
+	const float* g0y = correspondences + 1 * stride;
+	const float* g0z = correspondences + 2 * stride;
+	const float* g0w = correspondences + 3 * stride;
+	const float* g1x = correspondences + 4 * stride;
+	const float* g1y = correspondences + 5 * stride;
+	const float* g1z = correspondences + 6 * stride;
+
+	w8_float a00 = w8_float::zero(), a01 = w8_float::zero(), a02 = w8_float::zero(), a03 = w8_float::zero(), a04 = w8_float::zero(), a05 = w8_float::zero();
+	w8_float a11 = w8_float::zero(), a12 = w8_float::zero(), a13 = w8_float::zero(), a14 = w8_float::zero(), a15 = w8_float::zero();
+	w8_float a22 = w8_float::zero(), a23 = w8_float::zero(), a24 = w8_float::zero(), a25 = w8_float::zero();
+	w8_float a33 = w8_float::zero(), a34 = w8_float::zero(), a35 = w8_float::zero();
+	w8_float a44 = w8_float::zero(), a45 = w8_float::zero();
+	w8_float a55 = w8_float::zero();
+
+	w8_float b0 = w8_float::zero(), b1 = w8_float::zero(), b2 = w8_float::zero(), b3 = w8_float::zero(), b4 = w8_float::zero(), b5 = w8_float::zero();
+
+	for (uint32 i = 0; i < paddedCount; i += 8)
+	{
+		w8_float x0(g0x + i), x1(g0y + i), x2(g0z + i);
+		w8_float x3(g1x + i), x4(g1y + i), x5(g1z + i);
+		w8_float r(g0w + i);
+
+		a00 = fmadd(x0, x0, a00); a01 = fmadd(x0, x1, a01); a02 = fmadd(x0, x2, a02); a03 = fmadd(x0, x3, a03); a04 = fmadd(x0, x4, a04); a05 = fmadd(x0, x5, a05);
+		a11 = fmadd(x1, x1, a11); a12 = fmadd(x1, x2, a12); a13 = fmadd(x1, x3, a13); a14 = fmadd(x1, x4, a14); a15 = fmadd(x1, x5, a15);
+		a22 = fmadd(x2, x2, a22); a23 = fmadd(x2, x3, a23); a24 = fmadd(x2, x4, a24); a25 = fmadd(x2, x5, a25);
+		a33 = fmadd(x3, x3, a33); a34 = fmadd(x3, x4, a34); a35 = fmadd(x3, x5, a35);
+		a44 = fmadd(x4, x4, a44); a45 = fmadd(x4, x5, a45);
+		a55 = fmadd(x5, x5, a55);
+
+		b0 = fmadd(x0, r, b0); b1 = fmadd(x1, r, b1); b2 = fmadd(x2, r, b2);
+		b3 = fmadd(x3, r, b3); b4 = fmadd(x4, r, b4); b5 = fmadd(x5, r, b5);
+	}
+
+	tracking_ata_atb result;
+	result.ata.m[ata_m00] = addElements(a00); result.ata.m[ata_m01] = addElements(a01); result.ata.m[ata_m02] = addElements(a02);
+	result.ata.m[ata_m03] = addElements(a03); result.ata.m[ata_m04] = addElements(a04); result.ata.m[ata_m05] = addElements(a05);
+	result.ata.m[ata_m11] = addElements(a11); result.ata.m[ata_m12] = addElements(a12); result.ata.m[ata_m13] = addElements(a13);
+	result.ata.m[ata_m14] = addElements(a14); result.ata.m[ata_m15] = addElements(a15);
+	result.ata.m[ata_m22] = addElements(a22); result.ata.m[ata_m23] = addElements(a23); result.ata.m[ata_m24] = addElements(a24);
+	result.ata.m[ata_m25] = addElements(a25);
+	result.ata.m[ata_m33] = addElements(a33); result.ata.m[ata_m34] = addElements(a34); result.ata.m[ata_m35] = addElements(a35);
+	result.ata.m[ata_m44] = addElements(a44); result.ata.m[ata_m45] = addElements(a45);
+	result.ata.m[ata_m55] = addElements(a55);
+
+	result.atb.m[0] = addElements(b0); result.atb.m[1] = addElements(b1); result.atb.m[2] = addElements(b2);
+	result.atb.m[3] = addElements(b3); result.atb.m[4] = addElements(b4); result.atb.m[5] = addElements(b5);
+
+	return result;
+}
+
+// Pads the block's correspondences with zero gradients to a multiple of 8 and reduces them.
+static tracking_ata_atb padAndReduceCorrespondences(float* correspondences, uint32 stride, uint32 count)
+{
+	uint32 paddedCount = alignTo(count, 8);
+	for (uint32 s = 0; s < 7; ++s)
+	{
+		float* stream = correspondences + s * stride;
+		for (uint32 i = count; i < paddedCount; ++i)
+		{
+			stream[i] = 0.f;
+		}
+	}
+
+	return reduceCorrespondences(correspondences, stride, paddedCount);
+}
+
+void computeNormalSpaceSamplingRates(const uint32* binCounts, uint32 numSamples, float* outRates)
+{
+	bool full[TRACKING_NUM_NORMAL_SPACE_BINS];
+	uint32 numOpenBins = 0;
+	for (uint32 b = 0; b < TRACKING_NUM_NORMAL_SPACE_BINS; ++b)
+	{
+		full[b] = binCounts[b] == 0;
+		numOpenBins += !full[b];
+		outRates[b] = full[b] ? 0.f : 1.f;
+	}
+
+	float remaining = (float)numSamples;
+
+	bool changed = true;
+	while (changed && numOpenBins > 0)
+	{
+		changed = false;
+		float share = remaining / numOpenBins;
+		for (uint32 b = 0; b < TRACKING_NUM_NORMAL_SPACE_BINS; ++b)
+		{
+			if (!full[b] && binCounts[b] <= share)
+			{
+				full[b] = true;
+				remaining -= binCounts[b];
+				--numOpenBins;
+				changed = true;
+			}
+		}
+	}
+
+	if (numOpenBins > 0)
+	{
+		float share = remaining / numOpenBins;
+		for (uint32 b = 0; b < TRACKING_NUM_NORMAL_SPACE_BINS; ++b)
+		{
+			if (!full[b])
+			{
+				outRates[b] = share / binCounts[b];
+			}
+		}
+	}
+}
+
+// Applies the solution of the normal equations to the model view, the same way the depth tracker applies the GPU result.
+static mat4 applyICPUpdate(const vec6& x, uint32 correspondenceMode, const mat4& modelView)
+{
+	rotation_translation delta = lieExp(x);
+
+	quat rotation = mat3ToQuaternion(delta.rotation);
+	vec3 translation = delta.translation;
+
+	if (correspondenceMode == tracking_correspondence_mode_camera_to_render)
+	{
+		rotation = conjugate(rotation);
+		translation = -(rotation * translation);
+	}
+
+	return createModelMatrix(translation, rotation) * modelView;
+}
+
+cpu_icp_result cpu_icp::computeStep(const cpu_icp_frame& frame, const cpu_triangle_mesh& mesh, const mat4& modelView, const create_correspondences_ps_cb& settings,
+	uint32 maxNumSamples)
+{
+	CPU_PROFILE_BLOCK("CPU ICP step");
+
+	const rgbd_camera_sensor& sensor = *frame.sensor;
+	rendered.resize(sensor.width, sensor.height);
+
+	rasterizeViewNormalAndDepth(mesh, modelView, sensor.intrinsics, sensor.distortion, cpuICPNearPlane, rendered);
+
+	return accumulateCorrespondences(frame, rendered, settings, maxNumSamples);
+}
+
+cpu_icp_result cpu_icp::accumulateCorrespondences(const cpu_icp_frame& frame, const image<vec4>& rendered, const create_correspondences_ps_cb& settings,
+	uint32 maxNumSamples)
+{
+	CPU_PROFILE_BLOCK("Accumulate correspondences");
+
+	const rgbd_camera_sensor& sensor = *frame.sensor;
+	const uint32 width = sensor.width;
+	const uint32 height = sensor.height;
+
+	assert(rendered.width == width && rendered.height == height);
+
+	const uint32 numBlocks = bucketize(height, CPU_ICP_ROWS_PER_BLOCK);
+	const uint32 blockStride = alignTo(CPU_ICP_ROWS_PER_BLOCK * width, 8);
+
+	correspondenceMemory.resize(numBlocks * blockStride * 7);
+	blockResults.resize(numBlocks);
+
+	const bool sampling = maxNumSamples > 0;
+	if (sampling)
+	{
+		correspondenceBins.resize(numBlocks * blockStride);
+		blockBinCounts.assign(numBlocks * TRACKING_NUM_NORMAL_SPACE_BINS, 0);
+	}
+
+	const uint16* depth = frame.depth;
+	const vec2* unprojectTable = sensor.unprojectTable;
+	const float depthScale = frame.depthScale;
+
+	auto cameraPosition = [=](uint32 index)
+	{
+		return vec3(unprojectTable[index], -1.f) * (depth[index] * depthScale);
+	};
+
+	thread_job_context context;
+
+	for (uint32 block = 0; block < numBlocks; ++block)
+	{
+		context.addWork([&, block]()
+		{
+			float* correspondences = correspondenceMemory.data() + block * blockStride * 7;
+			float* g0x = correspondences + 0 * blockStride;
+			float* g0y = correspondences + 1 * blockStride;
+			float* g0z = correspondences + 2 * blockStride;
+			float* g0w = correspondences + 3 * blockStride;
+			float* g1x = correspondences + 4 * blockStride;
+			float* g1y = correspondences + 5 * blockStride;
+			float* g1z = correspondences + 6 * blockStride;
+
+			// The normal reconstruction needs all four neighbors, so the border is skipped. The GPU reads zeros there, which never pass the thresholds anyway.
+			uint32 startY = max(block * CPU_ICP_ROWS_PER_BLOCK, 1u);
+			uint32 endY = min((block + 1) * CPU_ICP_ROWS_PER_BLOCK, height - 1);
+
+			uint32 count = 0;
+
+			for (uint32 y = startY; y < endY; ++y)
+			{
+				for (uint32 x = 1; x < width - 1; ++x)
+				{
+					vec4 r = rendered(y, x);
+					if (r.w == 0.f)
+					{
+						continue;
+					}
+
+					uint32 index = y * width + x;
+
+					vec3 ray(unprojectTable[index], -1.f);
+					vec3 renderedPosition = ray * r.w;
+					vec3 camPosition = ray * (depth[index] * depthScale);
+					vec3 offset = camPosition - renderedPosition;
+
+					// Negated comparisons also reject invalid (NaN) rays.
+					if (!(dot(offset, offset) <= settings.squaredPositionThreshold))
+					{
+						continue;
+					}
+
+					vec3 ver = cameraPosition(index + width) - cameraPosition(index - width);
+					vec3 hor = cameraPosition(index + 1) - cameraPosition(index - 1);
+					vec3 cameraNormal = normalize(cross(ver, hor));
+
+					vec3 normal = r.xyz;
+					float cosAngle = dot(normal, cameraNormal);
+
+					if (!(cosAngle >= settings.cosAngleThreshold))
+					{
+						continue;
+					}
+
+					vec3 grad0, grad1;
+					float residual;
+					if (settings.correspondenceMode == tracking_correspondence_mode_camera_to_render)
+					{
+						grad0 = cross(camPosition, normal);
+						residual = dot(-offset, normal);
+						grad1 = normal;
+					}
+					else
+					{
+						grad0 = cross(renderedPosition, cameraNormal);
+						residual = dot(offset, cameraNormal);
+						grad1 = cameraNormal;
+					}
+
+					if (sampling)
+					{
+						// grad1 is the normal, which the residual is measured along.
+						uint32 bin = getNormalSpaceBin(grad1);
+						correspondenceBins[block * blockStride + count] = (uint8)bin;
+						++blockBinCounts[block * TRACKING_NUM_NORMAL_SPACE_BINS + bin];
+					}
+
+					g0x[count] = grad0.x; g0y[count] = grad0.y; g0z[count] = grad0.z; g0w[count] = residual;
+					g1x[count] = grad1.x; g1y[count] = grad1.y; g1z[count] = grad1.z;
+					++count;
+				}
+			}
+
+			block_result& result = blockResults[block];
+			result.numCorrespondences = count;
+			result.numReducedCorrespondences = count;
+
+			if (!sampling)
+			{
+				// Reduce within the block while the correspondences are still in cache.
+				result.ataAtb = padAndReduceCorrespondences(correspondences, blockStride, count);
+			}
+		});
+	}
+
+	context.waitForWorkCompletion();
+
+	if (sampling)
+	{
+		CPU_PROFILE_BLOCK("Normal-space sampling");
+
+		// Turn the counts into each block's first index per bin, in block order.
+		uint32 binTotals[TRACKING_NUM_NORMAL_SPACE_BINS] = {};
+		for (uint32 block = 0; block < numBlocks; ++block)
+		{
+			uint32* counts = blockBinCounts.data() + block * TRACKING_NUM_NORMAL_SPACE_BINS;
+			for (uint32 b = 0; b < TRACKING_NUM_NORMAL_SPACE_BINS; ++b)
+			{
+				uint32 c = counts[b];
+				counts[b] = binTotals[b];
+				binTotals[b] += c;
+			}
+		}
+
+		float rates[TRACKING_NUM_NORMAL_SPACE_BINS];
+		computeNormalSpaceSamplingRates(binTotals, maxNumSamples, rates);
+
+		for (uint32 block = 0; block < numBlocks; ++block)
+		{
+			context.addWork([&, block]()
+			{
+				block_result& result = blockResults[block];
+
+				float* correspondences = correspondenceMemory.data() + block * blockStride * 7;
+				const uint8* bins = correspondenceBins.data() + block * blockStride;
+
+				uint32 indexInBin[TRACKING_NUM_NORMAL_SPACE_BINS];
+				memcpy(indexInBin, blockBinCounts.data() + block * TRACKING_NUM_NORMAL_SPACE_BINS, sizeof(indexInBin));
+
+				// Compact the selected correspondences in place. The write index never passes the read index.
+				uint32 count = 0;
+				for (uint32 i = 0; i < result.numCorrespondences; ++i)
+				{
+					uint32 bin = bins[i];
+					if (selectNormalSpaceSample(indexInBin[bin]++, rates[bin]))
+					{
+						for (uint32 s = 0; s < 7; ++s)
+						{
+							correspondences[s * blockStride + count] = correspondences[s * blockStride + i];
+						}
+						++count;
+					}
+				}
+
+				result.ataAtb = padAndReduceCorrespondences(correspondences, blockStride, count);
+				result.numReducedCorrespondences = count;
+			});
+		}
+
+		context.waitForWorkCompletion();
+	}
+
+	// Sum in block order, so the result does not depend on scheduling.
+	cpu_icp_result result = {};
+	for (const block_result& block : blockResults)
+	{
+		for (uint32 i = 0; i < 21; ++i)
+		{
+			result.ataAtb.ata.m[i] += block.ataAtb.ata.m[i];
+		}
+		for (uint32 i = 0; i < 6; ++i)
+		{
+			result.ataAtb.atb.m[i] += block.ataAtb.atb.m[i];
+		}
+		result.numCorrespondences += block.numCorrespondences;
+		result.numReducedCorrespondences += block.numReducedCorrespondences;
+	}
+
+	return result;
+}
+
+void cpu_icp_pyramid::build(const uint16* depth, const rgbd_camera_sensor& sensor, float depthScale, uint32 numLevels)
+{
+	CPU_PROFILE_BLOCK("Build depth pyramid");
+
+	numLevels = clamp(numLevels, 1u, (uint32)CPU_ICP_MAX_NUM_PYRAMID_LEVELS);
+
+	// The unproject tables only change with the camera.
+	bool rebuildTables = sourceUnprojectTable != sensor.unprojectTable
+		|| levels[0].sensor.width != sensor.width || levels[0].sensor.height != sensor.height || this->numLevels < numLevels;
+
+	this->numLevels = numLevels;
+	this->depthScale = depthScale;
+
+	level& finest = levels[0];
+	finest.sensor = sensor;
+	finest.depth.assign(depth, depth + sensor.width * sensor.height);
+
+	thread_job_context context;
+
+	for (uint32 l = 1; l < numLevels; ++l)
+	{
+		const level& src = levels[l - 1];
+		level& dst = levels[l];
+
+		uint32 srcWidth = src.sensor.width;
+		uint32 width = srcWidth / 2;
+		uint32 height = src.sensor.height / 2;
+
+		if (rebuildTables)
+		{
+			dst.sensor = src.sensor;
+			dst.sensor.width = width;
+			dst.sensor.height = height;
+
+			// Pixel coordinates are halved, the distortion acts on normalized coordinates and stays the same.
+			dst.sensor.intrinsics.fx *= 0.5f;
+			dst.sensor.intrinsics.fy *= 0.5f;
+			dst.sensor.intrinsics.cx *= 0.5f;
+			dst.sensor.intrinsics.cy *= 0.5f;
+
+			dst.unprojectTable.resize(width * height);
+			for (uint32 y = 0; y < height; ++y)
+			{
+				for (uint32 x = 0; x < width; ++x)
+				{
+					const vec2* s = src.sensor.unprojectTable + (2 * y) * srcWidth + 2 * x;
+					dst.unprojectTable[y * width + x] = (s[0] + s[1] + s[srcWidth] + s[srcWidth + 1]) * 0.25f;
+				}
+			}
+			dst.sensor.unprojectTable = dst.unprojectTable.data();
+		}
+
+		dst.depth.resize(width * height);
+
+		for (uint32 startY = 0; startY < height; startY += 32)
+		{
+			context.addWork([&src, &dst, srcWidth, width, height, startY]()
+			{
+				uint32 endY = min(startY + 32, height);
+				for (uint32 y = startY; y < endY; ++y)
+				{
+					for (uint32 x = 0; x < width; ++x)
+					{
+						const uint16* s = src.depth.data() + (2 * y) * srcWidth + 2 * x;
+						uint16 d[4] = { s[0], s[1], s[srcWidth], s[srcWidth + 1] };
+
+						uint32 sum = 0, count = 0;
+						for (uint32 i = 0; i < 4; ++i)
+						{
+							sum += d[i];
+							count += d[i] != 0;
+						}
+						dst.depth[y * width + x] = count ? (uint16)((sum + count / 2) / count) : 0;
+					}
+				}
+			});
+		}
+
+		// Each level depends on the previous one.
+		context.waitForWorkCompletion();
+	}
+
+	sourceUnprojectTable = sensor.unprojectTable;
+}
+
+// The sample budget is shared by all views. A positive budget stays positive on coarse levels, since 0 disables sampling.
+static uint32 getMaxNumSamplesOnLevel(const cpu_icp_tracking_settings& settings, uint32 level, uint32 numViews)
+{
+	if (settings.maxNumSampledCorrespondences == 0)
+	{
+		return 0;
+	}
+	return max((settings.maxNumSampledCorrespondences >> (2 * level)) / numViews, 64u);
+}
+
+cpu_icp_tracking_result cpu_icp::track(const cpu_icp_pyramid& pyramid, const cpu_triangle_mesh& mesh, const mat4& modelView, const cpu_icp_tracking_settings& settings)
+{
+	CPU_PROFILE_BLOCK("CPU ICP tracking");
+
+	cpu_icp_tracking_result result;
+	result.modelView = modelView;
+	result.numIterations = 0;
+	result.numCorrespondences = 0;
+	result.valid = false;
+
+	mat4 current = modelView;
+
+	for (int32 l = (int32)pyramid.numLevels - 1; l >= 0; --l)
+	{
+		cpu_icp_frame frame = pyramid.getLevel(l);
+		uint32 minNumCorrespondences = settings.minNumCorrespondences >> (2 * l);
+		uint32 maxNumSamples = getMaxNumSamplesOnLevel(settings, l, 1);
+
+		for (uint32 iteration = 0; iteration < settings.maxNumIterationsPerLevel; ++iteration)
+		{
+			cpu_icp_result step = computeStep(frame, mesh, current, settings.thresholds, maxNumSamples);
+			++result.numIterations;
+
+			if (l == 0)
+			{
+				result.numCorrespondences = step.numCorrespondences;
+			}
+
+			if (step.numCorrespondences < minNumCorrespondences)
+			{
+				// Too few correspondences on this level. A finer level might still have enough.
+				break;
+			}
+
+			vec6 x = solve(step.ataAtb.ata, step.ataAtb.atb);
+			current = applyICPUpdate(x, settings.thresholds.correspondenceMode, current);
+
+			if (l == 0)
+			{
+				result.modelView = current;
+				result.valid = true;
+			}
+
+			float rotation = length(vec3(x.m[0], x.m[1], x.m[2]));
+			float translation = length(vec3(x.m[3], x.m[4], x.m[5]));
+			if (rotation < settings.rotationConvergenceThreshold && translation < settings.translationConvergenceThreshold)
+			{
+				break;
+			}
+		}
+	}
+
+	return result;
+}
+
+static uint32 packedATAIndex(uint32 row, uint32 col)
+{
+	if (row > col)
+	{
+		std::swap(row, col);
+	}
+	return row * 6 - row * (row - 1) / 2 + (col - row);
+}
+
+tracking_ata_atb transformICPSystem(const tracking_ata_atb& system, const mat4& referenceToCamera)
+{
+	// A motion (w, v) in reference space is the motion (R w, R v + t x R w) in camera space. With this 6x6 adjoint A, the camera space
+	// system J x = r becomes J A x' = r, so the normal equations transform to A^T (J^T J) A and A^T (J^T r).
+	float R[3][3] =
+	{
+		{ referenceToCamera.m00, referenceToCamera.m01, referenceToCamera.m02 },
+		{ referenceToCamera.m10, referenceToCamera.m11, referenceToCamera.m12 },
+		{ referenceToCamera.m20, referenceToCamera.m21, referenceToCamera.m22 },
+	};
+	vec3 t(referenceToCamera.m03, referenceToCamera.m13, referenceToCamera.m23);
+	float T[3][3] =
+	{
+		{ 0.f, -t.z, t.y },
+		{ t.z, 0.f, -t.x },
+		{ -t.y, t.x, 0.f },
+	};
+
+	float A[6][6] = {};
+	for (uint32 i = 0; i < 3; ++i)
+	{
+		for (uint32 j = 0; j < 3; ++j)
+		{
+			A[i][j] = R[i][j];
+			A[i + 3][j + 3] = R[i][j];
+
+			float tr = 0.f;
+			for (uint32 k = 0; k < 3; ++k)
+			{
+				tr += T[i][k] * R[k][j];
+			}
+			A[i + 3][j] = tr;
+		}
+	}
+
+	float M[6][6];
+	for (uint32 i = 0; i < 6; ++i)
+	{
+		for (uint32 j = 0; j < 6; ++j)
+		{
+			M[i][j] = system.ata.m[packedATAIndex(i, j)];
+		}
+	}
+
+	float MA[6][6];
+	for (uint32 i = 0; i < 6; ++i)
+	{
+		for (uint32 j = 0; j < 6; ++j)
+		{
+			float sum = 0.f;
+			for (uint32 k = 0; k < 6; ++k)
+			{
+				sum += M[i][k] * A[k][j];
+			}
+			MA[i][j] = sum;
+		}
+	}
+
+	tracking_ata_atb result;
+	for (uint32 i = 0; i < 6; ++i)
+	{
+		for (uint32 j = i; j < 6; ++j)
+		{
+			float sum = 0.f;
+			for (uint32 k = 0; k < 6; ++k)
+			{
+				sum += A[k][i] * MA[k][j];
+			}
+			result.ata.m[packedATAIndex(i, j)] = sum;
+		}
+
+		float sum = 0.f;
+		for (uint32 k = 0; k < 6; ++k)
+		{
+			sum += A[k][i] * system.atb.m[k];
+		}
+		result.atb.m[i] = sum;
+	}
+
+	return result;
+}
+
+cpu_icp_tracking_result cpu_multi_view_icp::track(const cpu_icp_view* views, uint32 numViews, const cpu_triangle_mesh& mesh, const mat4& modelView, const cpu_icp_tracking_settings& settings)
+{
+	CPU_PROFILE_BLOCK("CPU multi-view ICP tracking");
+
+	if ((uint32)icps.size() < numViews)
+	{
+		icps.resize(numViews);
+		steps.resize(numViews);
+	}
+
+	cpu_icp_tracking_result result;
+	result.modelView = modelView;
+	result.numIterations = 0;
+	result.numCorrespondences = 0;
+	result.valid = false;
+
+	uint32 numLevels = CPU_ICP_MAX_NUM_PYRAMID_LEVELS;
+	for (uint32 v = 0; v < numViews; ++v)
+	{
+		numLevels = min(numLevels, views[v].pyramid->numLevels);
+	}
+
+	mat4 current = modelView;
+
+	for (int32 l = (int32)numLevels - 1; l >= 0; --l)
+	{
+		uint32 minNumCorrespondences = settings.minNumCorrespondences >> (2 * l);
+		uint32 maxNumSamples = getMaxNumSamplesOnLevel(settings, l, numViews);
+
+		for (uint32 iteration = 0; iteration < settings.maxNumIterationsPerLevel; ++iteration)
+		{
+			thread_job_context context;
+			for (uint32 v = 0; v < numViews; ++v)
+			{
+				context.addWork([&, v, l]()
+				{
+					cpu_icp_frame frame = views[v].pyramid->getLevel(l);
+					steps[v] = icps[v].computeStep(frame, mesh, views[v].referenceToCamera * current, settings.thresholds, maxNumSamples);
+				});
+			}
+			context.waitForWorkCompletion();
+
+			// Summed in view order, so the result does not depend on scheduling.
+			tracking_ata_atb system = {};
+			uint32 numCorrespondences = 0;
+			for (uint32 v = 0; v < numViews; ++v)
+			{
+				if (steps[v].numCorrespondences == 0)
+				{
+					continue;
+				}
+
+				tracking_ata_atb s = transformICPSystem(steps[v].ataAtb, views[v].referenceToCamera);
+				for (uint32 i = 0; i < arraysize(system.ata.m); ++i) { system.ata.m[i] += s.ata.m[i]; }
+				for (uint32 i = 0; i < arraysize(system.atb.m); ++i) { system.atb.m[i] += s.atb.m[i]; }
+				numCorrespondences += steps[v].numCorrespondences;
+			}
+
+			++result.numIterations;
+
+			if (l == 0)
+			{
+				result.numCorrespondences = numCorrespondences;
+			}
+
+			if (numCorrespondences < minNumCorrespondences)
+			{
+				break;
+			}
+
+			vec6 x = solve(system.ata, system.atb);
+			current = applyICPUpdate(x, settings.thresholds.correspondenceMode, current);
+
+			if (l == 0)
+			{
+				result.modelView = current;
+				result.valid = true;
+			}
+
+			float rotation = length(vec3(x.m[0], x.m[1], x.m[2]));
+			float translation = length(vec3(x.m[3], x.m[4], x.m[5]));
+			if (rotation < settings.rotationConvergenceThreshold && translation < settings.translationConvergenceThreshold)
+			{
+				break;
+			}
+		}
+	}
+
+	return result;
+}
+
+// Fast motion: Up to 3 degrees and 4% of the object's size between two camera frames.
+static std::vector<mat4> createBenchmarkTrajectory(const mat4& base, float radius, uint32 numFrames)
+{
+	std::vector<mat4> trajectory(numFrames);
+	for (uint32 i = 0; i < numFrames; ++i)
+	{
+		float t = (float)i / numFrames * 2.f * M_PI;
+		quat rotation(normalize(vec3(0.2f, 1.f, 0.1f)), deg2rad(60.f) * sin(t));
+		vec3 offset = vec3(sin(t), 0.5f * sin(2.f * t), 0.25f * cos(t) - 0.25f) * (0.8f * radius);
+		trajectory[i] = createModelMatrix(offset, rotation) * base;
+	}
+	return trajectory;
+}
+
+// Frames and ground truth (or reference) trajectory of the tracking benchmarks, either rendered synthetically or from a recording.
+struct tracking_benchmark_input
+{
+	synthetic_depth_camera synthetic;
+
+	rgbd_camera recording;
+	std::vector<std::vector<uint16>> recordedDepth;
+
+	std::vector<mat4> trajectory;
+	float radius;
+
+	bool isRecorded() const { return !recordedDepth.empty(); }
+	const char* name() const { return isRecorded() ? "recorded" : "synthetic"; }
+
+	// initialModelView is the object's pose relative to the depth camera in the first recorded frame. Ignored without a recording.
+	bool initialize(const cpu_triangle_mesh& mesh, const fs::path& recordingPath, const mat4& initialModelView, uint32 numSyntheticFrames)
+	{
+		if (recordingPath.empty())
+		{
+			mat4 base;
+			if (!synthetic.placeInView(mesh, quat(normalize(vec3(1.f, 2.f, 0.5f)), deg2rad(30.f)), base, radius))
+			{
+				return false;
+			}
+
+			trajectory = createBenchmarkTrajectory(base, radius, numSyntheticFrames);
+			return true;
+		}
+
+		radius = getMeshRadius(mesh);
+		if (radius == 0.f)
+		{
+			LOG_ERROR("Mesh for CPU ICP benchmark is empty");
+			return false;
+		}
+
+		if (!recording.initializeRecording(recordingPath, false, false))
+		{
+			return false;
+		}
+
+		uint32 numPixels = recording.depthSensor.width * recording.depthSensor.height;
+
+		rgbd_frame frame;
+		while (recording.getFrame(frame, 0))
+		{
+			// Copy out of the memory mapped file first, so that page faults are not timed.
+			recordedDepth.emplace_back(frame.depth, frame.depth + numPixels);
+			recording.releaseFrame(frame);
+		}
+
+		if (recordedDepth.empty())
+		{
+			LOG_ERROR("Recording '%ws' contains no frames", recordingPath.c_str());
+			return false;
+		}
+
+		cpu_icp_tracking_settings settings;
+		settings.thresholds = thresholds();
+		settings.maxNumIterationsPerLevel = 20;
+
+		cpu_icp icp;
+		cpu_icp_pyramid pyramid;
+
+		trajectory.resize(recordedDepth.size());
+
+		mat4 pose = initialModelView;
+		for (uint32 i = 0; i < (uint32)recordedDepth.size(); ++i)
+		{
+			pyramid.build(recordedDepth[i].data(), recording.depthSensor, recording.depthScale, CPU_ICP_MAX_NUM_PYRAMID_LEVELS);
+			cpu_icp_tracking_result result = icp.track(pyramid, mesh, pose, settings);
+			if (result.valid)
+			{
+				pose = result.modelView;
+			}
+			trajectory[i] = pose;
+		}
+
+		return true;
+	}
+
+	cpu_icp_frame capture(const cpu_triangle_mesh& mesh, uint32 frameIndex)
+	{
+		if (isRecorded())
+		{
+			return { recordedDepth[frameIndex].data(), &recording.depthSensor, recording.depthScale };
+		}
+		return synthetic.capture(mesh, trajectory[frameIndex]);
+	}
+
+	create_correspondences_ps_cb thresholds() const
+	{
+		create_correspondences_ps_cb result = synthetic.defaultThresholds();
+		if (isRecorded())
+		{
+			result.depthScale = recording.depthScale;
+		}
+		return result;
+	}
+};
+
+void benchmarkCPUICP(const cpu_triangle_mesh& mesh)
+{
+	const uint32 numFrames = 100;
+
+	synthetic_depth_camera camera;
+	const rgbd_camera_sensor& sensor = camera.sensor;
+
+	mat4 groundTruth;
+	float radius;
+	if (!camera.placeInView(mesh, quat(normalize(vec3(1.f, 2.f, 0.5f)), deg2rad(30.f)), groundTruth, radius))
+	{
+		return;
+	}
+
+	cpu_icp_frame frame = camera.capture(mesh, groundTruth);
+
+	// Start from a slightly perturbed pose, well within the default thresholds.
+	quat perturbation(normalize(vec3(-0.3f, 1.f, 0.2f)), deg2rad(2.f));
+	vec3 offset = vec3(0.4f, -0.3f, 0.2f) * (0.02f * radius);
+	mat4 start = createModelMatrix(offset, perturbation) * groundTruth;
+
+	create_correspondences_ps_cb settings = camera.defaultThresholds();
+
+	cpu_icp icp;
+	cpu_icp_result result = icp.computeStep(frame, mesh, start, settings); // Warm up, allocates the buffers.
+
+	double rasterMS = 0.0;
+	double accumulateMS = 0.0;
+
+	for (uint32 i = 0; i < numFrames; ++i)
+	{
+		auto rasterStart = std::chrono::high_resolution_clock::now();
+		rasterizeViewNormalAndDepth(mesh, start, sensor.intrinsics, sensor.distortion, cpuICPNearPlane, icp.rendered);
+		auto accumulateStart = std::chrono::high_resolution_clock::now();
+		result = icp.accumulateCorrespondences(frame, icp.rendered, settings);
+		auto end = std::chrono::high_resolution_clock::now();
+
+		rasterMS += std::chrono::duration<double, std::milli>(accumulateStart - rasterStart).count();
+		accumulateMS += std::chrono::duration<double, std::milli>(end - accumulateStart).count();
+	}
+
+	rasterMS /= numFrames;
+	accumulateMS /= numFrames;
+
+
+	mat4 updated = applyICPUpdate(solve(result.ataAtb.ata, result.ataAtb.atb), settings.correspondenceMode, start);
+
+	auto [startPositionError, startAngleError] = poseError(start, groundTruth);
+	auto [updatedPositionError, updatedAngleError] = poseError(updated, groundTruth);
+
+	LOG_MESSAGE("CPU ICP benchmark (%ux%u, %u triangles, %u frames): %u correspondences, rasterization %.3fms, association and reduction %.3fms, %.1f FPS",
+		sensor.width, sensor.height, (uint32)mesh.triangles.size(), numFrames, result.numCorrespondences, rasterMS, accumulateMS, 1000.0 / (rasterMS + accumulateMS));
+	LOG_MESSAGE("CPU ICP benchmark: One step reduces the pose error from %.2fmm/%.3f deg to %.2fmm/%.3f deg",
+		startPositionError * 1000.f, startAngleError, updatedPositionError * 1000.f, updatedAngleError);
+}
+
+void benchmarkCPUICPTracking(const cpu_triangle_mesh& mesh, const fs::path& recordingPath, const mat4& initialModelView)
+{
+	tracking_benchmark_input input;
+	if (!input.initialize(mesh, recordingPath, initialModelView, 120))
+	{
+		return;
+	}
+
+	const std::vector<mat4>& trajectory = input.trajectory;
+	uint32 numFrames = (uint32)trajectory.size();
+
+	struct configuration
+	{
+		const char* name;
+		uint32 numLevels;
+		uint32 maxNumIterationsPerLevel;
+	};
+
+	configuration configurations[] =
+	{
+		{ "Single step", 1, 1 },
+		{ "Coarse to fine", 3, 5 },
+	};
+
+	for (const configuration& config : configurations)
+	{
+		cpu_icp_tracking_settings settings;
+		settings.thresholds = input.thresholds();
+		settings.maxNumIterationsPerLevel = config.maxNumIterationsPerLevel;
+
+		cpu_icp icp;
+		cpu_icp_pyramid pyramid;
+		cpu_icp_frame frame;
+
+		tracking_benchmark_stats stats = runTrackingBenchmark(trajectory,
+			[&](uint32 i)
+			{
+				frame = input.capture(mesh, i);
+			},
+			[&](const mat4& pose)
+			{
+				pyramid.build(frame.depth, *frame.sensor, frame.depthScale, config.numLevels);
+				return icp.track(pyramid, mesh, pose, settings);
+			});
+
+		LOG_MESSAGE("CPU ICP tracking benchmark, %s, %s (%u levels, up to %u iterations per level, %u frames): %.2f iterations on average (max %u), %.3fms per frame, "
+			"position error %.2fmm on average (max %.2fmm), angle error %.3f deg on average (max %.3f deg), %u frames without enough correspondences",
+			input.name(), config.name, config.numLevels, config.maxNumIterationsPerLevel, numFrames, stats.averageIterations(), stats.maxIterations, stats.averageMS(),
+			stats.error.meanPositionError() * 1000.f, stats.error.maxPositionError * 1000.f, stats.error.meanAngleError(), stats.error.maxAngleError, stats.numLost);
+	}
+}
+
+void benchmarkCPUICPSampling(const cpu_triangle_mesh& mesh, const fs::path& recordingPath, const mat4& initialModelView)
+{
+	const uint32 numAccumulateRuns = 50;
+
+	tracking_benchmark_input input;
+	if (!input.initialize(mesh, recordingPath, initialModelView, 120))
+	{
+		return;
+	}
+
+	const std::vector<mat4>& trajectory = input.trajectory;
+	uint32 numFrames = (uint32)trajectory.size();
+
+	// Single step on the first frame from a perturbed pose, for the cost of association and reduction alone.
+	const mat4& base = trajectory[0];
+	quat perturbation(normalize(vec3(-0.3f, 1.f, 0.2f)), deg2rad(2.f));
+	vec3 offset = vec3(0.4f, -0.3f, 0.2f) * (0.02f * input.radius);
+	mat4 stepStart = createModelMatrix(offset, perturbation) * base;
+
+	uint32 budgets[] = { 0, 16000, 8000, 4000, 2000, 1000 };
+
+	for (uint32 budget : budgets)
+	{
+		cpu_icp_tracking_settings settings;
+		settings.thresholds = input.thresholds();
+		settings.maxNumSampledCorrespondences = budget;
+
+		cpu_icp icp;
+
+		cpu_icp_frame frame = input.capture(mesh, 0);
+		icp.rendered.resize(frame.sensor->width, frame.sensor->height);
+		rasterizeViewNormalAndDepth(mesh, stepStart, frame.sensor->intrinsics, frame.sensor->distortion, cpuICPNearPlane, icp.rendered);
+		cpu_icp_result step = icp.accumulateCorrespondences(frame, icp.rendered, settings.thresholds, budget); // Warm up.
+
+		auto accumulateStart = std::chrono::high_resolution_clock::now();
+		for (uint32 i = 0; i < numAccumulateRuns; ++i)
+		{
+			step = icp.accumulateCorrespondences(frame, icp.rendered, settings.thresholds, budget);
+		}
+		double accumulateMS = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - accumulateStart).count() / numAccumulateRuns;
+
+		mat4 stepped = applyICPUpdate(solve(step.ataAtb.ata, step.ataAtb.atb), settings.thresholds.correspondenceMode, stepStart);
+		auto [stepPositionError, stepAngleError] = poseError(stepped, base);
+
+		// Coarse to fine tracking along the trajectory.
+		cpu_icp_pyramid pyramid;
+		cpu_icp_frame trajectoryFrame;
+
+		tracking_benchmark_stats stats = runTrackingBenchmark(trajectory,
+			[&](uint32 i)
+			{
+				trajectoryFrame = input.capture(mesh, i);
+			},
+			[&](const mat4& pose)
+			{
+				pyramid.build(trajectoryFrame.depth, *trajectoryFrame.sensor, trajectoryFrame.depthScale, 3);
+				return icp.track(pyramid, mesh, pose, settings);
+			});
+
+		char label[32];
+		if (budget)
+		{
+			snprintf(label, sizeof(label), "%u samples", budget);
+		}
+		else
+		{
+			snprintf(label, sizeof(label), "all correspondences");
+		}
+
+		LOG_MESSAGE("CPU ICP sampling benchmark, %s, %s: %u of %u correspondences reduced, association and reduction %.3fms, one step error %.2fmm/%.3f deg",
+			input.name(), label, step.numReducedCorrespondences, step.numCorrespondences, accumulateMS, stepPositionError * 1000.f, stepAngleError);
+		LOG_MESSAGE("CPU ICP sampling benchmark, %s, %s, tracking (%u frames): %.3fms per frame, position error %.2fmm on average (max %.2fmm), "
+			"angle error %.3f deg on average (max %.3f deg), %u frames without enough correspondences",
+			input.name(), label, numFrames, stats.averageMS(), stats.error.meanPositionError() * 1000.f, stats.error.maxPositionError * 1000.f,
+			stats.error.meanAngleError(), stats.error.maxAngleError, stats.numLost);
+	}
+}
+
+void benchmarkCPUMultiViewICP(const cpu_triangle_mesh& mesh, const fs::path& recordingPath, const mat4& initialModelView)
+{
+	const uint32 numLevels = 3;
+
+	// A recording only has one viewpoint. Its reference trajectory moves the object in front of the synthetic cameras instead.
+	tracking_benchmark_input input;
+	if (!input.initialize(mesh, recordingPath, initialModelView, 120))
+	{
+		return;
+	}
+
+	const std::vector<mat4>& trajectory = input.trajectory;
+	uint32 numFrames = (uint32)trajectory.size();
+
+	synthetic_depth_camera cameras[2];
+
+	// The second camera looks at the object from 60 degrees to the side.
+	vec3 pivot = transformPosition(trajectory[0], getMeshCenter(mesh));
+	mat4 secondCameraToReference = createModelMatrix(pivot, quat(vec3(0.f, 1.f, 0.f), deg2rad(60.f))) * createModelMatrix(-pivot, quat::identity);
+
+	cpu_icp_pyramid pyramids[2];
+	cpu_icp_view views[2] =
+	{
+		{ &pyramids[0], mat4::identity },
+		{ &pyramids[1], invertAffine(secondCameraToReference) },
+	};
+
+	cpu_icp_tracking_settings settings;
+	settings.thresholds = cameras[0].defaultThresholds();
+
+	for (uint32 numViews = 1; numViews <= 2; ++numViews)
+	{
+		cpu_multi_view_icp icp;
+
+		tracking_benchmark_stats stats = runTrackingBenchmark(trajectory,
+			[&](uint32 i)
+			{
+				for (uint32 v = 0; v < numViews; ++v)
+				{
+					cpu_icp_frame frame = cameras[v].capture(mesh, views[v].referenceToCamera * trajectory[i]);
+
+					if (v == 0)
+					{
+						// Someone stands in front of the reference camera and hides three quarters of the image.
+						const rgbd_camera_sensor& sensor = cameras[v].sensor;
+						for (uint32 y = 0; y < sensor.height; ++y)
+						{
+							memset(cameras[v].depth.data() + y * sensor.width, 0, (sensor.width * 3 / 4) * sizeof(uint16));
+						}
+					}
+
+					pyramids[v].build(frame.depth, *frame.sensor, frame.depthScale, numLevels);
+				}
+			},
+			[&](const mat4& pose)
+			{
+				return icp.track(views, numViews, mesh, pose, settings);
+			});
+
+		LOG_MESSAGE("CPU multi-view ICP benchmark, %s motion, %u camera(s), reference camera 75%% occluded (%u frames): %.3fms per frame, "
+			"position error %.2fmm on average (max %.2fmm), angle error %.3f deg on average (max %.3f deg), %u frames without enough correspondences",
+			input.name(), numViews, numFrames, stats.averageMS(),
+			stats.error.meanPositionError() * 1000.f, stats.error.maxPositionError * 1000.f, stats.error.meanAngleError(), stats.error.maxAngleError, stats.numLost);
+	}
+}
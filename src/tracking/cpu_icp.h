@@ -0,0 +1,172 @@
+#pragma once
+
+#include "rgbd_camera.h"
+#include "core/image.h"
+
+#include "tracking_rs.hlsli"
+
+struct cpu_triangle_mesh;
+
+// Must match the near plane of the tracking pipelines.
+static const float cpuICPNearPlane = 0.1f;
+
+struct cpu_icp_frame
+{
+	const uint16* depth;
+	const rgbd_camera_sensor* sensor; // Depth sensor. Provides resolution, intrinsics, distortion and unproject table.
+	float depthScale;
+};
+
+struct cpu_icp_result
+{
+	tracking_ata_atb ataAtb;
+	uint32 numCorrespondences;
+	uint32 numReducedCorrespondences; // Fewer than the correspondences, if these were subsampled.
+};
+
+
+#define CPU_ICP_MAX_NUM_PYRAMID_LEVELS 4
+
+// Depth frame at successively halved resolutions. Each level has its own sensor description, so it can be passed to the ICP like a frame
+// of a real camera. A coarse pixel's depth is the average of the valid depths in its 2x2 footprint.
+struct cpu_icp_pyramid
+{
+	void build(const uint16* depth, const rgbd_camera_sensor& sensor, float depthScale, uint32 numLevels);
+
+	cpu_icp_frame getLevel(uint32 level) const { return { levels[level].depth.data(), &levels[level].sensor, depthScale }; }
+
+	uint32 numLevels = 0;
+	float depthScale;
+
+private:
+	struct level
+	{
+		rgbd_camera_sensor sensor;
+		std::vector<uint16> depth;
+		std::vector<vec2> unprojectTable;
+	};
+
+	level levels[CPU_ICP_MAX_NUM_PYRAMID_LEVELS];
+	const vec2* sourceUnprojectTable = 0;
+};
+
+struct cpu_icp_tracking_settings
+{
+	create_correspondences_ps_cb thresholds;
+	uint32 minNumCorrespondences = 5000; // At full resolution. Scaled down with the pixel count on coarser levels.
+	uint32 maxNumIterationsPerLevel = 5;
+
+	// If there are more correspondences than this, a subset of this size is selected with normal-space sampling and reduced. 0 reduces all.
+	// At full resolution. Scaled down with the pixel count on coarser levels.
+	uint32 maxNumSampledCorrespondences = 0;
+
+	// A level is converged, once an update rotates less than this (radians) and translates less than this (meters).
+	float rotationConvergenceThreshold = deg2rad(0.01f);
+	float translationConvergenceThreshold = 0.0001f;
+};
+
+struct cpu_icp_tracking_result
+{
+	mat4 modelView;
+	uint32 numIterations;
+	uint32 numCorrespondences; // Of the last iteration on the finest level.
+	bool valid; // False, if the finest level never had enough correspondences. The model view is unchanged in that case.
+};
+
+/*
+	CPU implementation of one linearized point-to-plane ICP step, as done by the tracking shaders on the GPU:
+	The model is rendered from the depth camera (see software_rasterizer.h), every covered pixel is associated with the camera pixel
+	at the same location, and correspondences within the position and normal angle thresholds are reduced into the 6x6 normal equations.
+
+	The thresholds are given exactly like the ones of the GPU path, and the result has the same layout as the buffer the depth tracker
+	reads back, so both can be compared and solved with the same code (see tracking_math.h).
+	Association and reduction are split into row blocks, which run on the job system. Each block is reduced with AVX.
+
+	Optionally, only a subset of the correspondences is reduced (normal-space sampling, see tracking_rs.hlsli). The association then also
+	counts the correspondences per normal bin, the per bin sampling rates are computed from the totals, and each block reduces only its
+	selected correspondences. Blocks know where their correspondences start in each bin, so the selection is the same as a sequential one.
+*/
+
+struct cpu_icp
+{
+	cpu_icp_result computeStep(const cpu_icp_frame& frame, const cpu_triangle_mesh& mesh, const mat4& modelView, const create_correspondences_ps_cb& settings,
+		uint32 maxNumSamples = 0);
+
+	// The rendered image must contain the view-space normal (xyz) and view depth (w), as output by rasterizeViewNormalAndDepth.
+	cpu_icp_result accumulateCorrespondences(const cpu_icp_frame& frame, const image<vec4>& rendered, const create_correspondences_ps_cb& settings,
+		uint32 maxNumSamples = 0);
+
+	// Runs several steps per camera frame, from the coarsest pyramid level to the finest, and moves on to the next level once the updates
+	// become small. The returned model view is the converged pose for this frame, so there is no lag of buffered frames like on the GPU.
+	cpu_icp_tracking_result track(const cpu_icp_pyramid& pyramid, const cpu_triangle_mesh& mesh, const mat4& modelView, const cpu_icp_tracking_settings& settings);
+
+	image<vec4> rendered;
+
+private:
+	struct block_result
+	{
+		tracking_ata_atb ataAtb;
+		uint32 numCorrespondences;
+		uint32 numReducedCorrespondences;
+	};
+
+	std::vector<float> correspondenceMemory; // Per block, 7 padded SoA streams: grad0.xyzw, grad1.xyz.
+	std::vector<block_result> blockResults;
+
+	// Only used for sampling.
+	std::vector<uint8> correspondenceBins; // Per block, the normal bin of each correspondence.
+	std::vector<uint32> blockBinCounts; // Per block and bin. Turned into each block's first index in the bin.
+};
+
+// Distributes the samples equally over the bins. Bins with fewer correspondences than their share keep all of them, and the rest is shared
+// among the others. The resulting rates are between 0 and 1, and are used with selectNormalSpaceSample.
+void computeNormalSpaceSamplingRates(const uint32* binCounts, uint32 numSamples, float* outRates);
+
+// One depth camera of a multi-camera rig.
+struct cpu_icp_view
+{
+	const cpu_icp_pyramid* pyramid;
+	mat4 referenceToCamera; // From the reference camera's depth sensor space into this camera's. Identity for the reference camera.
+};
+
+/*
+	Tracks with several depth cameras at once. Each camera associates and reduces its correspondences in its own space, all cameras in
+	parallel. The resulting normal equations are then moved into the reference camera's space with the adjoint of the extrinsics and summed.
+	The solve stays a single 6x6 system per iteration, no matter how many cameras see the object. The correspondences of all cameras count
+	towards the minimum, so an object which is occluded in one camera keeps being tracked as long as the others see enough of it.
+*/
+struct cpu_multi_view_icp
+{
+	// The model view is relative to the reference camera. All pyramids are used down to the coarsest level they have in common.
+	cpu_icp_tracking_result track(const cpu_icp_view* views, uint32 numViews, const cpu_triangle_mesh& mesh, const mat4& modelView, const cpu_icp_tracking_settings& settings);
+
+private:
+	// One per view, grown to the largest number of views seen.
+	std::vector<cpu_icp> icps;
+	std::vector<cpu_icp_result> steps;
+};
+
+// Transforms the normal equations of a small rigid motion in camera space into the equivalent ones in reference space.
+tracking_ata_atb transformICPSystem(const tracking_ata_atb& system, const mat4& referenceToCamera);
+
+// Renders the mesh into a synthetic depth frame, then measures how fast the CPU path tracks a perturbed pose and how close one step gets
+// to the ground truth. Needs no camera and no GPU.
+void benchmarkCPUICP(const cpu_triangle_mesh& mesh);
+
+// The tracking benchmarks below run on the depth frames of a recording (see rgbd_recorder). initialModelView is the object's pose
+// relative to the depth camera in the first frame. The recording has no ground truth, so the errors are measured against a reference
+// trajectory, which is tracked through it coarse to fine with many iterations. Without a recording, the mesh is rendered along a fast
+// synthetic trajectory, which is its own ground truth.
+
+// Tracks once with a single step per frame (like the GPU path, but without its latency) and once coarse to fine. Logs iterations to
+// converge, per-frame cost and the remaining pose error.
+void benchmarkCPUICPTracking(const cpu_triangle_mesh& mesh, const fs::path& recordingPath = "", const mat4& initialModelView = mat4::identity);
+
+// Tracks coarse to fine, reducing all correspondences and normal-space samples of decreasing size. Logs the reduction cost and the
+// pose error of each.
+void benchmarkCPUICPSampling(const cpu_triangle_mesh& mesh, const fs::path& recordingPath = "", const mat4& initialModelView = mat4::identity);
+
+// Tracks with a reference camera, which is mostly occluded, once alone and once together with a second camera looking from the side.
+// Both cameras are synthetic. A recording only provides the motion, through its reference trajectory. Logs the pose error and the
+// number of frames, which did not have enough correspondences.
+void benchmarkCPUMultiViewICP(const cpu_triangle_mesh& mesh, const fs::path& recordingPath = "", const mat4& initialModelView = mat4::identity);
@@ -0,0 +1,318 @@
+#include "pch.h"
+#include "depth_codec.h"
+#include "rgbd_camera.h"
+
+#include "core/simd.h"
+#include "core/log.h"
+
+#include <chrono>
+
+
+#define DEPTH_CODEC_DELTA_BLOCK_SIZE 256
+
+struct nibble_writer
+{
+	uint32* out;
+	uint32 word = 0;
+	uint32 numNibbles = 0;
+
+	void write(uint32 nibble)
+	{
+		word = (word << 4) | nibble;
+		if (++numNibbles == 8)
+		{
+			*out++ = word;
+			word = 0;
+			numNibbles = 0;
+		}
+	}
+
+	void writeVLE(uint32 value)
+	{
+		while (true)
+		{
+			uint32 nibble = value & 0x7;
+			value >>= 3;
+			if (!value)
+			{
+				write(nibble);
+				break;
+			}
+			write(nibble | 0x8);
+		}
+	}
+
+	void flush()
+	{
+		if (numNibbles)
+		{
+			*out++ = word << (4 * (8 - numNibbles));
+			word = 0;
+			numNibbles = 0;
+		}
+	}
+};
+
+struct nibble_reader
+{
+	const uint32* in;
+	const uint32* end;
+	uint32 word = 0;
+	uint32 numNibbles = 0;
+	bool overrun = false;
+
+	uint32 read()
+	{
+		if (!numNibbles)
+		{
+			if (in == end)
+			{
+				overrun = true;
+				return 0;
+			}
+			word = *in++;
+			numNibbles = 8;
+		}
+
+		uint32 nibble = word >> 28;
+		word <<= 4;
+		--numNibbles;
+		return nibble;
+	}
+
+	uint32 readVLE()
+	{
+		uint32 value = 0;
+		uint32 shift = 0;
+		uint32 nibble;
+		do
+		{
+			nibble = read();
+			value |= (nibble & 0x7) << shift;
+			shift += 3;
+		} while ((nibble & 0x8) && shift < 32);
+		return value;
+	}
+};
+
+static uint32 zigZag(int32 v)
+{
+	return ((uint32)v << 1) ^ (uint32)(v >> 31);
+}
+
+static int32 unZigZag(uint32 v)
+{
+	return (int32)(v >> 1) ^ -(int32)(v & 1);
+}
+
+// Number of consecutive pixels starting at 'start', which are all zero (or all non-zero).
+static uint32 countRun(const uint16* depth, uint32 start, uint32 end, bool zeros)
+{
+	const __m256i zero = _mm256_setzero_si256();
+
+	uint32 i = start;
+	for (; i + 16 <= end; i += 16)
+	{
+		__m256i v = _mm256_loadu_si256((const __m256i*)(depth + i));
+
+		// Two bits per pixel.
+		uint32 mask = (uint32)_mm256_movemask_epi8(_mm256_cmpeq_epi16(v, zero));
+		if (!zeros)
+		{
+			mask = ~mask;
+		}
+
+		if (mask != 0xFFFFFFFF)
+		{
+			return i - start + (_tzcnt_u32(~mask) >> 1);
+		}
+	}
+
+	for (; i < end && ((depth[i] == 0) == zeros); ++i) {}
+
+	return i - start;
+}
+
+static void computeZigZagDeltas(const uint16* depth, uint32 count, int32 previous, uint32* out)
+{
+	if (!count)
+	{
+		return;
+	}
+
+	out[0] = zigZag((int32)depth[0] - previous);
+
+	uint32 i = 1;
+	for (; i + 8 <= count; i += 8)
+	{
+		__m256i current = _mm256_cvtepu16_epi32(_mm_loadu_si128((const __m128i*)(depth + i)));
+		__m256i before = _mm256_cvtepu16_epi32(_mm_loadu_si128((const __m128i*)(depth + i - 1)));
+		__m256i delta = _mm256_sub_epi32(current, before);
+		__m256i z = _mm256_xor_si256(_mm256_slli_epi32(delta, 1), _mm256_srai_epi32(delta, 31));
+		_mm256_storeu_si256((__m256i*)(out + i), z);
+	}
+
+	for (; i < count; ++i)
+	{
+		out[i] = zigZag((int32)depth[i] - (int32)depth[i - 1]);
+	}
+}
+
+uint64 getMaxCompressedDepthSize(uint32 numPixels)
+{
+	// A valid pixel costs at most 6 nibbles for its difference plus 2 nibbles for short run lengths. Longer runs are cheaper per pixel.
+	return sizeof(uint32) + (uint64)numPixels * 4 + 64;
+}
+
+uint64 compressDepth(const uint16* depth, uint32 numPixels, uint8* output)
+{
+	*(uint32*)output = numPixels;
+
+	nibble_writer writer = { (uint32*)(output + sizeof(uint32)) };
+
+	uint32 deltas[DEPTH_CODEC_DELTA_BLOCK_SIZE];
+	int32 previous = 0;
+
+	uint32 i = 0;
+	while (i < numPixels)
+	{
+		uint32 numZeros = countRun(depth, i, numPixels, true);
+		i += numZeros;
+		uint32 numValid = countRun(depth, i, numPixels, false);
+
+		writer.writeVLE(numZeros);
+		writer.writeVLE(numValid);
+
+		uint32 end = i + numValid;
+		while (i < end)
+		{
+			uint32 count = min(end - i, (uint32)DEPTH_CODEC_DELTA_BLOCK_SIZE);
+			computeZigZagDeltas(depth + i, count, previous, deltas);
+
+			for (uint32 j = 0; j < count; ++j)
+			{
+				writer.writeVLE(deltas[j]);
+			}
+
+			previous = depth[i + count - 1];
+			i += count;
+		}
+	}
+
+	writer.flush();
+
+	return (uint8*)writer.out - output;
+}
+
+bool decompressDepth(const uint8* compressed, uint64 compressedSize, uint16* depth, uint32 numPixels)
+{
+	if (compressedSize < sizeof(uint32) || *(const uint32*)compressed != numPixels)
+	{
+		return false;
+	}
+
+	nibble_reader reader;
+	reader.in = (const uint32*)(compressed + sizeof(uint32));
+	reader.end = reader.in + (compressedSize - sizeof(uint32)) / sizeof(uint32);
+
+	int32 previous = 0;
+
+	uint32 i = 0;
+	while (i < numPixels)
+	{
+		uint32 numZeros = reader.readVLE();
+		uint32 numValid = reader.readVLE();
+
+		if (reader.overrun || numZeros > numPixels - i || numValid > numPixels - i - numZeros)
+		{
+			return false;
+		}
+
+		memset(depth + i, 0, numZeros * sizeof(uint16));
+		i += numZeros;
+
+		for (uint32 end = i + numValid; i < end; ++i)
+		{
+			previous += unZigZag(reader.readVLE());
+			depth[i] = (uint16)previous;
+		}
+
+		if (reader.overrun)
+		{
+			return false;
+		}
+	}
+
+	return true;
+}
+
+void benchmarkDepthCodec(const fs::path& recordingPath)
+{
+	rgbd_camera camera;
+	if (!camera.initializeRecording(recordingPath, false, false))
+	{
+		return;
+	}
+
+	uint32 width = camera.depthSensor.width;
+	uint32 height = camera.depthSensor.height;
+	uint32 numPixels = width * height;
+
+	std::vector<uint16> raw(numPixels);
+	std::vector<uint16> decompressed(numPixels);
+	std::vector<uint8> compressed(getMaxCompressedDepthSize(numPixels));
+
+	uint64 compressedBytes = 0;
+	double encodeMS = 0.0;
+	double decodeMS = 0.0;
+	uint32 numFrames = 0;
+	uint32 numMismatches = 0;
+
+	rgbd_frame frame;
+	while (camera.getFrame(frame, 0))
+	{
+		// Copy out of the memory mapped file first, so that page faults are not timed.
+		memcpy(raw.data(), frame.depth, numPixels * sizeof(uint16));
+		camera.releaseFrame(frame);
+
+		auto encodeStart = std::chrono::high_resolution_clock::now();
+		uint64 size = compressDepth(raw.data(), numPixels, compressed.data());
+		auto decodeStart = std::chrono::high_resolution_clock::now();
+		bool success = decompressDepth(compressed.data(), size, decompressed.data(), numPixels);
+		auto end = std::chrono::high_resolution_clock::now();
+
+		encodeMS += std::chrono::duration<double, std::milli>(decodeStart - encodeStart).count();
+		decodeMS += std::chrono::duration<double, std::milli>(end - decodeStart).count();
+
+		if (!success || memcmp(raw.data(), decompressed.data(), numPixels * sizeof(uint16)) != 0)
+		{
+			++numMismatches;
+		}
+
+		compressedBytes += size;
+		++numFrames;
+	}
+
+	if (!numFrames)
+	{
+		LOG_ERROR("Recording '%ws' contains no frames", recordingPath.c_str());
+		return;
+	}
+
+	double rawMB = (double)numPixels * sizeof(uint16) * numFrames / (1024.0 * 1024.0);
+	double ratio = (double)numPixels * sizeof(uint16) * numFrames / (double)compressedBytes;
+
+	encodeMS /= numFrames;
+	decodeMS /= numFrames;
+
+	LOG_MESSAGE("Depth codec benchmark (%ux%u, %u frames): Ratio %.2f:1 (%.1f KB per frame)",
+		width, height, numFrames, ratio, compressedBytes / (1024.0 * numFrames));
+	LOG_MESSAGE("Depth codec benchmark: Encode %.3fms (%.0f MB/s, %.0f FPS), decode %.3fms (%.0f MB/s, %.0f FPS)",
+		encodeMS, rawMB / numFrames / (encodeMS * 0.001), 1000.0 / encodeMS,
+		decodeMS, rawMB / numFrames / (decodeMS * 0.001), 1000.0 / decodeMS);
+
+	if (numMismatches)
+	{
+		LOG_ERROR("Depth codec benchmark: %u of %u frames did not survive the round trip", numMismatches, numFrames);
+	}
+}
@@ -0,0 +1,30 @@
+#pragma once
+
+/*
+	Lossless compression for 16 bit depth images, based on RVL (Wilson, "Fast Lossless Depth Image Compression", 2017).
+
+	The image is scanned as alternating runs of invalid (zero) and valid pixels. Each run pair stores the two run lengths, followed by the
+	zig-zag encoded differences between consecutive valid depths. All numbers are written as variable length codes of 4 bit nibbles
+	(3 data bits and a continuation bit), packed into 32 bit words. Neighboring depths differ little, so most valid pixels take one or two nibbles.
+
+	Compressed layout:
+	uint32 numPixels
+	uint32 nibbles[]
+
+	The encoder finds run boundaries 16 pixels at a time and computes the differences 8 pixels at a time with AVX2. The nibble stream itself is
+	inherently serial. The decoder reads it a word at a time and fills invalid runs with memset.
+	A 640x576 depth frame compresses by a factor of about 4 and takes around two milliseconds to encode or decode on one core, so this is cheap
+	enough for recording and for sending depth over the network.
+*/
+
+// Upper bound for the compressed size. The output buffer passed to compressDepth must be at least this large.
+uint64 getMaxCompressedDepthSize(uint32 numPixels);
+
+// Returns the number of bytes written.
+uint64 compressDepth(const uint16* depth, uint32 numPixels, uint8* output);
+
+// Returns false if the data is truncated or does not have the expected number of pixels.
+bool decompressDepth(const uint8* compressed, uint64 compressedSize, uint16* depth, uint32 numPixels);
+
+// Compresses every frame of a recording (see rgbd_recording.h), verifies the round trip and logs compression ratio and throughput.
+void benchmarkDepthCodec(const fs::path& recordingPath);
@@ -0,0 +1,321 @@
+#include "pch.h"
+#include "depth_preprocessing.h"
+
+#include "core/simd.h"
+#include "core/math_simd.h"
+#include "core/threading.h"
+#include "core/log.h"
+
+#include <chrono>
+
+
+#define DEPTH_PREPROCESSING_ROWS_PER_JOB 16
+
+void depth_preprocessor::convertToPaddedMeters(const uint16* depth, uint32 width, uint32 height, float depthScale, uint32 border)
+{
+	// Every row is padded to a multiple of 8 pixels plus the border on both sides, so that full vectors can be read around every pixel.
+	uint32 newPaddedWidth = alignTo(width, 8) + 2 * border;
+	uint32 paddedHeight = height + 2 * border;
+
+	if (newPaddedWidth != paddedWidth || this->border != border || paddedDepth.size() != newPaddedWidth * paddedHeight)
+	{
+		paddedWidth = newPaddedWidth;
+		this->border = border;
+		paddedDepth.assign(paddedWidth * paddedHeight, 0.f);
+		cachedUnprojectTable = 0;
+	}
+
+	const __m256 scale = _mm256_set1_ps(depthScale);
+
+	for (uint32 y = 0; y < height; ++y)
+	{
+		const uint16* in = depth + y * width;
+		float* out = paddedDepth.data() + (y + border) * paddedWidth + border;
+
+		uint32 x = 0;
+		for (; x + 8 <= width; x += 8)
+		{
+			__m256i d = _mm256_cvtepu16_epi32(_mm_loadu_si128((const __m128i*)(in + x)));
+			_mm256_storeu_ps(out + x, _mm256_mul_ps(_mm256_cvtepi32_ps(d), scale));
+		}
+		for (; x < width; ++x)
+		{
+			out[x] = in[x] * depthScale;
+		}
+	}
+}
+
+void depth_preprocessor::bilateralFilter(const uint16* depth, uint32 width, uint32 height, float depthScale, const depth_preprocessing_settings& settings, uint16* outDepth)
+{
+	CPU_PROFILE_BLOCK("Bilateral depth filter");
+
+	convertToPaddedMeters(depth, width, height, depthScale, DEPTH_PREPROCESSING_MAX_RADIUS);
+
+	const int32 radius = (int32)min(settings.radius, (uint32)DEPTH_PREPROCESSING_MAX_RADIUS);
+	const int32 kernelSize = 2 * radius + 1;
+
+	float spatialWeights[(2 * DEPTH_PREPROCESSING_MAX_RADIUS + 1) * (2 * DEPTH_PREPROCESSING_MAX_RADIUS + 1)];
+	float totalSpatialWeight = 0.f;
+	const float spatialFactor = -1.f / (2.f * settings.spatialSigma * settings.spatialSigma);
+	for (int32 dy = -radius; dy <= radius; ++dy)
+	{
+		for (int32 dx = -radius; dx <= radius; ++dx)
+		{
+			float w = expf((dx * dx + dy * dy) * spatialFactor);
+			spatialWeights[(dy + radius) * kernelSize + (dx + radius)] = w;
+			totalSpatialWeight += w;
+		}
+	}
+
+	// Tukey kernel: (1 - (diff / (3 sigma))^2)^2, zero beyond 3 sigma.
+	const float rangeSigma3 = 3.f * settings.rangeSigma;
+	const float invRangeSq = 1.f / (rangeSigma3 * rangeSigma3);
+
+	const float holeThreshold = settings.fillHoles ? settings.minHoleSupport * totalSpatialWeight : FLT_MAX;
+	const bool fillHoles = settings.fillHoles;
+	const float invDepthScale = 1.f / depthScale;
+
+	const float* padded = paddedDepth.data();
+	const uint32 stride = paddedWidth;
+	const uint32 border = this->border;
+
+	thread_job_context context;
+
+	for (uint32 startY = 0; startY < height; startY += DEPTH_PREPROCESSING_ROWS_PER_JOB)
+	{
+		context.addWork([=, &spatialWeights]()
+		{
+			uint32 endY = min(startY + DEPTH_PREPROCESSING_ROWS_PER_JOB, height);
+
+			for (uint32 y = startY; y < endY; ++y)
+			{
+				for (uint32 x = 0; x < width; x += 8)
+				{
+					const float* c = padded + (y + border) * stride + x + border;
+
+					w8_float center(c);
+					auto centerValid = center > 0.f;
+
+					w8_float reference = center;
+					if (fillHoles && anyFalse(centerValid))
+					{
+						// Holes are filled from the closest surface in the window, so that they do not blur foreground and background.
+						w8_float nearest = FLT_MAX;
+						for (int32 dy = -radius; dy <= radius; ++dy)
+						{
+							for (int32 dx = -radius; dx <= radius; ++dx)
+							{
+								w8_float n(c + dy * (int32)stride + dx);
+								nearest = minimum(nearest, ifThen(n > 0.f, n, w8_float(FLT_MAX)));
+							}
+						}
+						reference = ifThen(centerValid, center, nearest);
+					}
+
+					w8_float sumW = w8_float::zero();
+					w8_float sumWD = w8_float::zero();
+
+					const float* weights = spatialWeights;
+					for (int32 dy = -radius; dy <= radius; ++dy)
+					{
+						for (int32 dx = -radius; dx <= radius; ++dx)
+						{
+							w8_float n(c + dy * (int32)stride + dx);
+							w8_float diff = n - reference;
+							w8_float t = maximum(1.f - diff * diff * invRangeSq, w8_float::zero());
+							w8_float w = ifThen(n > 0.f, (*weights++) * t * t, w8_float::zero());
+
+							sumW += w;
+							sumWD = fmadd(w, n, sumWD);
+						}
+					}
+
+					// A valid center always has at least its own weight of 1.
+					w8_float filtered = sumWD / maximum(sumW, 1e-6f);
+					filtered = ifThen(centerValid, filtered, ifThen(sumW >= holeThreshold, filtered, w8_float::zero()));
+
+					w8_float raw = minimum(filtered * invDepthScale, 65535.f);
+					__m256i q = _mm256_cvtps_epi32(raw.f);
+					__m128i packed = _mm_packus_epi32(_mm256_castsi256_si128(q), _mm256_extracti128_si256(q, 1));
+
+					uint16* out = outDepth + y * width + x;
+					if (x + 8 <= width)
+					{
+						_mm_storeu_si128((__m128i*)out, packed);
+					}
+					else
+					{
+						uint16 tmp[8];
+						_mm_storeu_si128((__m128i*)tmp, packed);
+						memcpy(out, tmp, (width - x) * sizeof(uint16));
+					}
+				}
+			}
+		});
+	}
+
+	context.waitForWorkCompletion();
+}
+
+void depth_preprocessor::computeNormals(const uint16* depth, const rgbd_camera_sensor& sensor, float depthScale, const depth_preprocessing_settings& settings, vec3* outNormals)
+{
+	CPU_PROFILE_BLOCK("Depth normals");
+
+	const uint32 width = sensor.width;
+	const uint32 height = sensor.height;
+
+	convertToPaddedMeters(depth, width, height, depthScale, DEPTH_PREPROCESSING_MAX_RADIUS);
+
+	if (cachedUnprojectTable != sensor.unprojectTable || unprojectX.size() != paddedDepth.size())
+	{
+		unprojectX.assign(paddedDepth.size(), 0.f);
+		unprojectY.assign(paddedDepth.size(), 0.f);
+
+		for (uint32 y = 0; y < height; ++y)
+		{
+			for (uint32 x = 0; x < width; ++x)
+			{
+				vec2 u = sensor.unprojectTable[y * width + x];
+				uint32 index = (y + border) * paddedWidth + x + border;
+				unprojectX[index] = u.x;
+				unprojectY[index] = u.y;
+			}
+		}
+
+		cachedUnprojectTable = sensor.unprojectTable;
+	}
+
+	const float* padded = paddedDepth.data();
+	const float* tableX = unprojectX.data();
+	const float* tableY = unprojectY.data();
+	const uint32 stride = paddedWidth;
+	const uint32 border = this->border;
+	const float maxDifference = settings.maxNormalDepthDifference;
+
+	thread_job_context context;
+
+	for (uint32 startY = 0; startY < height; startY += DEPTH_PREPROCESSING_ROWS_PER_JOB)
+	{
+		context.addWork([=]()
+		{
+			uint32 endY = min(startY + DEPTH_PREPROCESSING_ROWS_PER_JOB, height);
+
+			auto position = [](const float* d, const float* ux, const float* uy, int32 offset)
+			{
+				w8_float depth(d + offset);
+				return w8_vec3(w8_float(ux + offset) * depth, w8_float(uy + offset) * depth, -depth);
+			};
+
+			for (uint32 y = startY; y < endY; ++y)
+			{
+				for (uint32 x = 0; x < width; x += 8)
+				{
+					uint32 index = (y + border) * stride + x + border;
+					const float* d = padded + index;
+					const float* ux = tableX + index;
+					const float* uy = tableY + index;
+
+					w8_float center(d);
+					w8_float left(d - 1);
+					w8_float right(d + 1);
+					w8_float up(d - stride);
+					w8_float down(d + stride);
+
+					auto valid = (center > 0.f) & (left > 0.f) & (right > 0.f) & (up > 0.f) & (down > 0.f)
+						& (abs(left - center) < maxDifference) & (abs(right - center) < maxDifference)
+						& (abs(up - center) < maxDifference) & (abs(down - center) < maxDifference);
+
+					w8_vec3 horizontal = position(d, ux, uy, 1) - position(d, ux, uy, -1);
+					w8_vec3 vertical = position(d, ux, uy, -(int32)stride) - position(d, ux, uy, stride);
+					w8_vec3 n = cross(horizontal, vertical);
+
+					w8_float lengthSq = dot(n, n);
+					w8_float invLength = ifThen(valid, 1.f / sqrt(maximum(lengthSq, 1e-20f)), w8_float::zero());
+
+					// The camera sits at the origin, so a normal facing it points against the position.
+					w8_float facing = dot(n, position(d, ux, uy, 0));
+					invLength = ifThen(facing > 0.f, -invLength, invLength);
+
+					float nx[8], ny[8], nz[8];
+					(n.x * invLength).store(nx);
+					(n.y * invLength).store(ny);
+					(n.z * invLength).store(nz);
+
+					vec3* out = outNormals + y * width + x;
+					uint32 count = min(width - x, 8u);
+					for (uint32 i = 0; i < count; ++i)
+					{
+						out[i] = vec3(nx[i], ny[i], nz[i]);
+					}
+				}
+			}
+		});
+	}
+
+	context.waitForWorkCompletion();
+}
+
+void benchmarkDepthPreprocessing(const fs::path& recordingPath)
+{
+	rgbd_camera camera;
+	if (!camera.initializeRecording(recordingPath, false, false))
+	{
+		return;
+	}
+
+	uint32 width = camera.depthSensor.width;
+	uint32 height = camera.depthSensor.height;
+	uint32 numPixels = width * height;
+
+	std::vector<uint16> raw(numPixels);
+	std::vector<uint16> filtered(numPixels);
+	std::vector<vec3> normals(numPixels);
+
+	depth_preprocessor preprocessor;
+	depth_preprocessing_settings settings;
+
+	double filterMS = 0.0;
+	double normalsMS = 0.0;
+	uint64 numValidBefore = 0;
+	uint64 numValidAfter = 0;
+	uint32 numFrames = 0;
+
+	rgbd_frame frame;
+	while (camera.getFrame(frame, 0))
+	{
+		// Copy out of the memory mapped file first, so that page faults are not timed.
+		memcpy(raw.data(), frame.depth, numPixels * sizeof(uint16));
+		camera.releaseFrame(frame);
+
+		auto filterStart = std::chrono::high_resolution_clock::now();
+		preprocessor.bilateralFilter(raw.data(), width, height, camera.depthScale, settings, filtered.data());
+		auto normalsStart = std::chrono::high_resolution_clock::now();
+		preprocessor.computeNormals(filtered.data(), camera.depthSensor, camera.depthScale, settings, normals.data());
+		auto end = std::chrono::high_resolution_clock::now();
+
+		filterMS += std::chrono::duration<double, std::milli>(normalsStart - filterStart).count();
+		normalsMS += std::chrono::duration<double, std::milli>(end - normalsStart).count();
+
+		for (uint32 i = 0; i < numPixels; ++i)
+		{
+			numValidBefore += raw[i] != 0;
+			numValidAfter += filtered[i] != 0;
+		}
+
+		++numFrames;
+	}
+
+	if (!numFrames)
+	{
+		LOG_ERROR("Recording '%ws' contains no frames", recordingPath.c_str());
+		return;
+	}
+
+	filterMS /= numFrames;
+	normalsMS /= numFrames;
+
+	LOG_MESSAGE("Depth preprocessing benchmark (%ux%u, %u frames, radius %u): Bilateral filter %.3fms, normals %.3fms",
+		width, height, numFrames, settings.radius, filterMS, normalsMS);
+	LOG_MESSAGE("Depth preprocessing benchmark: %.1f%% valid pixels before, %.1f%% after hole filling",
+		100.0 * numValidBefore / ((double)numPixels * numFrames), 100.0 * numValidAfter / ((double)numPixels * numFrames));
+}
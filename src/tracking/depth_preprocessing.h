@@ -0,0 +1,52 @@
+#pragma once
+
+#include "rgbd_camera.h"
+
+#define DEPTH_PREPROCESSING_MAX_RADIUS 3
+
+struct depth_preprocessing_settings
+{
+	uint32 radius = 2; // The kernel covers (2 * radius + 1)^2 pixels. At most DEPTH_PREPROCESSING_MAX_RADIUS.
+	float spatialSigma = 1.5f; // Pixels.
+
+	// Neighbors, whose depth differs by more than three times this from the center, do not contribute. This keeps depth edges sharp.
+	float rangeSigma = 0.01f; // Meters.
+
+	// Invalid pixels are filled from the valid neighbors on the closest surface in the kernel, if these cover at least the given fraction
+	// of the kernel's spatial weight.
+	bool fillHoles = true;
+	float minHoleSupport = 0.3f;
+
+	// Normals are only computed, if the neighbors are not further than this from the center (in meters), i.e. not across depth edges.
+	float maxNormalDepthDifference = 0.05f;
+};
+
+/*
+	CPU preprocessing of raw depth frames: an edge preserving bilateral filter (with a Tukey range kernel, which is cheap to evaluate and
+	drops neighbors across edges entirely), hole filling and normal estimation from the unproject table.
+	Both passes process blocks of rows on the job system, 8 pixels at a time with AVX2. The input is converted once into a padded buffer in
+	meters, so that the kernel loops need no bounds checks.
+*/
+struct depth_preprocessor
+{
+	// Input and output have the same layout as rgbd_frame::depth. They must not overlap.
+	void bilateralFilter(const uint16* depth, uint32 width, uint32 height, float depthScale, const depth_preprocessing_settings& settings, uint16* outDepth);
+
+	// Normals in the sensor's space (see rgbd_camera_sensor::unprojectTable), facing the camera. Zero for invalid pixels and pixels on edges.
+	void computeNormals(const uint16* depth, const rgbd_camera_sensor& sensor, float depthScale, const depth_preprocessing_settings& settings, vec3* outNormals);
+
+private:
+	void convertToPaddedMeters(const uint16* depth, uint32 width, uint32 height, float depthScale, uint32 border);
+
+	std::vector<float> paddedDepth; // Meters. Invalid pixels and the border are 0.
+	uint32 paddedWidth = 0;
+	uint32 border = 0;
+
+	// Unproject table as separate x and y arrays, for vector loads.
+	std::vector<float> unprojectX;
+	std::vector<float> unprojectY;
+	const vec2* cachedUnprojectTable = 0;
+};
+
+// Filters and computes normals for every frame of a recording and logs the timings.
+void benchmarkDepthPreprocessing(const fs::path& recordingPath);
@@ -0,0 +1,462 @@
+#include "pch.h"
+#include "depth_registration.h"
+
+#include "core/simd.h"
+#include "core/threading.h"
+#include "core/cpu_profiling.h"
+#include "core/log.h"
+
+#include "camera.hlsli"
+
+#include <chrono>
+
+
+#define DEPTH_REGISTRATION_ROWS_PER_JOB 16
+#define DEPTH_REGISTRATION_BAND_HEIGHT 32 // Color rows per splat job.
+#define DEPTH_REGISTRATION_MAX_QUAD_SIZE 32 // Quads with larger projections (e.g. behind the color sensor's lens) are not splatted.
+
+static const uint16 emptyDepth = 0xFFFF;
+
+void depth_registration::initialize(const rgbd_camera_sensor& depthSensor, const rgbd_camera_sensor& colorSensor)
+{
+	depthWidth = depthSensor.width;
+	depthHeight = depthSensor.height;
+	colorWidth = colorSensor.width;
+	colorHeight = colorSensor.height;
+
+	colorIntrinsics = colorSensor.intrinsics;
+	colorDistortion = colorSensor.distortion;
+
+	depthToColor = createViewMatrix(colorSensor.position, colorSensor.rotation) * createModelMatrix(depthSensor.position, depthSensor.rotation);
+
+	uint32 numPixels = depthWidth * depthHeight;
+	rayX.resize(numPixels);
+	rayY.resize(numPixels);
+	for (uint32 i = 0; i < numPixels; ++i)
+	{
+		rayX[i] = depthSensor.unprojectTable[i].x;
+		rayY[i] = depthSensor.unprojectTable[i].y;
+	}
+
+	colorU.resize(numPixels);
+	colorV.resize(numPixels);
+	colorDepth.resize(numPixels);
+
+	rowMinV.resize(depthHeight);
+	rowMaxV.resize(depthHeight);
+}
+
+// Same as project() in camera.hlsli, for 8 points at once. Expects the points in the CV-system (y down, z forward).
+static void projectW8(w8_float x, w8_float y, w8_float z, const camera_intrinsics& intr, const camera_distortion& dis, w8_float& outU, w8_float& outV)
+{
+	w8_float invZ = w8_float(1.f) / z;
+	w8_float xp = x * invZ;
+	w8_float yp = y * invZ;
+
+	w8_float xp2 = xp * xp;
+	w8_float yp2 = yp * yp;
+	w8_float xyp = xp * yp;
+	w8_float rs = xp2 + yp2;
+
+	w8_float rss = rs * rs;
+	w8_float rsc = rss * rs;
+	w8_float a = w8_float(1.f) + w8_float(dis.k1) * rs + w8_float(dis.k2) * rss + w8_float(dis.k3) * rsc;
+	w8_float b = w8_float(1.f) + w8_float(dis.k4) * rs + w8_float(dis.k5) * rss + w8_float(dis.k6) * rsc;
+	w8_float bi = ifThen(abs(b) > w8_float(1e-5f), w8_float(1.f) / b, w8_float(1.f));
+	w8_float d = a * bi;
+
+	w8_float xpd = xp * d;
+	w8_float ypd = yp * d;
+
+	w8_float rs2xp2 = rs + w8_float(2.f) * xp2;
+	w8_float rs2yp2 = rs + w8_float(2.f) * yp2;
+
+	xpd += rs2xp2 * w8_float(dis.p2) + w8_float(2.f) * xyp * w8_float(dis.p1);
+	ypd += rs2yp2 * w8_float(dis.p1) + w8_float(2.f) * xyp * w8_float(dis.p2);
+
+	outU = xpd * w8_float(intr.fx) + w8_float(intr.cx);
+	outV = ypd * w8_float(intr.fy) + w8_float(intr.cy);
+}
+
+void depth_registration::transformToColor(const uint16* depth, float depthScale)
+{
+	CPU_PROFILE_BLOCK("Transform depth to color");
+
+	const uint32 width = depthWidth;
+	const uint32 height = depthHeight;
+	const mat4 m = depthToColor;
+	const camera_intrinsics intr = colorIntrinsics;
+	const camera_distortion dis = colorDistortion;
+
+	const float* rx = rayX.data();
+	const float* ry = rayY.data();
+	float* outU = colorU.data();
+	float* outV = colorV.data();
+	float* outDepth = colorDepth.data();
+	float* minV = rowMinV.data();
+	float* maxV = rowMaxV.data();
+
+	thread_job_context context;
+
+	for (uint32 startY = 0; startY < height; startY += DEPTH_REGISTRATION_ROWS_PER_JOB)
+	{
+		context.addWork([=]()
+		{
+			uint32 endY = min(startY + DEPTH_REGISTRATION_ROWS_PER_JOB, height);
+			const w8_float scale(depthScale);
+			const w8_float zero = w8_float::zero();
+
+			for (uint32 y = startY; y < endY; ++y)
+			{
+				const uint32 row = y * width;
+
+				uint32 x = 0;
+				for (; x + 8 <= width; x += 8)
+				{
+					uint32 i = row + x;
+
+					__m256i di = _mm256_cvtepu16_epi32(_mm_loadu_si128((const __m128i*)(depth + i)));
+					w8_float d = w8_float(_mm256_cvtepi32_ps(di)) * scale;
+
+					w8_float ux(rx + i);
+					w8_float uy(ry + i);
+
+					// Depth sensor space (z = -d), transformed into color sensor space.
+					w8_float px = ux * d;
+					w8_float py = uy * d;
+					w8_float pz = -d;
+
+					w8_float cx = w8_float(m.m00) * px + w8_float(m.m01) * py + w8_float(m.m02) * pz + w8_float(m.m03);
+					w8_float cy = w8_float(m.m10) * px + w8_float(m.m11) * py + w8_float(m.m12) * pz + w8_float(m.m13);
+					w8_float cz = w8_float(m.m20) * px + w8_float(m.m21) * py + w8_float(m.m22) * pz + w8_float(m.m23);
+
+					// To the CV-system.
+					cy = -cy;
+					cz = -cz;
+
+					// NaN rays fail the comparisons.
+					auto valid = (d > zero) & (cz > w8_float(1e-3f)) & (ux == ux);
+					cz = ifThen(valid, cz, w8_float(1.f));
+
+					w8_float u, v;
+					projectW8(cx, cy, cz, intr, dis, u, v);
+
+					u.store(outU + i);
+					v.store(outV + i);
+					ifThen(valid, cz, zero).store(outDepth + i);
+				}
+				for (; x < width; ++x)
+				{
+					uint32 i = row + x;
+
+					float d = depth[i] * depthScale;
+					vec3 c = transformPosition(m, vec3(rx[i], ry[i], -1.f) * d);
+
+					bool valid = d > 0.f && -c.z > 1e-3f && !isnan(rx[i]);
+					vec2 uv = valid ? project(c, intr, dis) : vec2(0.f, 0.f);
+
+					outU[i] = uv.x;
+					outV[i] = uv.y;
+					outDepth[i] = valid ? -c.z : 0.f;
+				}
+
+				float rowMin = FLT_MAX;
+				float rowMax = -FLT_MAX;
+				for (uint32 i = row; i < row + width; ++i)
+				{
+					if (outDepth[i] > 0.f)
+					{
+						rowMin = min(rowMin, outV[i]);
+						rowMax = max(rowMax, outV[i]);
+					}
+				}
+				minV[y] = rowMin;
+				maxV[y] = rowMax;
+			}
+		});
+	}
+
+	context.waitForWorkCompletion();
+}
+
+void depth_registration::splat(float depthScale, uint16* outDepth, const depth_registration_settings& settings)
+{
+	CPU_PROFILE_BLOCK("Splat depth into color");
+
+	const uint32 dw = depthWidth;
+	const uint32 dh = depthHeight;
+	const int32 cw = (int32)colorWidth;
+	const int32 ch = (int32)colorHeight;
+
+	const float* us = colorU.data();
+	const float* vs = colorV.data();
+	const float* zs = colorDepth.data();
+	const float* minV = rowMinV.data();
+	const float* maxV = rowMaxV.data();
+
+	const float invDepthScale = 1.f / depthScale;
+	const float maxRelativeDifference = settings.maxRelativeDepthDifference;
+
+	auto quantize = [invDepthScale](float z)
+	{
+		return (uint16)clamp(z * invDepthScale + 0.5f, 1.f, (float)(emptyDepth - 1));
+	};
+
+	thread_job_context context;
+
+	for (int32 bandStart = 0; bandStart < ch; bandStart += DEPTH_REGISTRATION_BAND_HEIGHT)
+	{
+		context.addWork([=]()
+		{
+			const int32 bandEnd = min(bandStart + DEPTH_REGISTRATION_BAND_HEIGHT, ch);
+
+			for (int32 y = bandStart; y < bandEnd; ++y)
+			{
+				std::fill(outDepth + y * cw, outDepth + (y + 1) * cw, emptyDepth);
+			}
+
+			auto write = [=](int32 x, int32 y, uint16 z)
+			{
+				uint16& target = outDepth[y * cw + x];
+				target = min(target, z);
+			};
+
+			// Nearest pixels are rounded, so rows half a pixel outside of the band still count.
+			const float bandMinV = bandStart - 0.5f;
+			const float bandMaxV = bandEnd - 0.5f;
+
+			for (uint32 y = 0; y < dh; ++y)
+			{
+				const bool hasNextRow = y + 1 < dh;
+				float rowMin = hasNextRow ? min(minV[y], minV[y + 1]) : minV[y];
+				float rowMax = hasNextRow ? max(maxV[y], maxV[y + 1]) : maxV[y];
+				if (rowMax < bandMinV || rowMin >= bandMaxV)
+				{
+					continue;
+				}
+
+				for (uint32 x = 0; x < dw; ++x)
+				{
+					uint32 i = y * dw + x;
+					float z = zs[i];
+					if (z <= 0.f)
+					{
+						continue;
+					}
+
+					// Nearest color pixel. Compared as floats first, since points far outside of the frame do not fit into integers.
+					float u = us[i];
+					float v = vs[i];
+					if (u >= -0.5f && u < cw - 0.5f && v >= bandMinV && v < bandMaxV)
+					{
+						write((int32)(u + 0.5f), (int32)(v + 0.5f), quantize(z));
+					}
+
+					// Quad to the right and below. Covers all color pixel centers within its bounds.
+					if (x + 1 >= dw || !hasNextRow)
+					{
+						continue;
+					}
+
+					uint32 i1 = i + 1;
+					uint32 i2 = i + dw;
+					uint32 i3 = i + dw + 1;
+
+					float z1 = zs[i1], z2 = zs[i2], z3 = zs[i3];
+					float zMin = min(min(z, z1), min(z2, z3));
+					float zMax = max(max(z, z1), max(z2, z3));
+					if (zMin <= 0.f || zMax - zMin > maxRelativeDifference * zMin)
+					{
+						continue;
+					}
+
+					float quadMinU = min(min(us[i], us[i1]), min(us[i2], us[i3]));
+					float quadMaxU = max(max(us[i], us[i1]), max(us[i2], us[i3]));
+					float quadMinV = min(min(vs[i], vs[i1]), min(vs[i2], vs[i3]));
+					float quadMaxV = max(max(vs[i], vs[i1]), max(vs[i2], vs[i3]));
+
+					if (quadMaxU - quadMinU > DEPTH_REGISTRATION_MAX_QUAD_SIZE || quadMaxV - quadMinV > DEPTH_REGISTRATION_MAX_QUAD_SIZE)
+					{
+						continue;
+					}
+
+					if (quadMaxU < 0.f || quadMinU > cw - 1 || quadMaxV < bandStart || quadMinV > bandEnd - 1)
+					{
+						continue;
+					}
+
+					int32 startX = max((int32)ceil(quadMinU), 0);
+					int32 endX = min((int32)floor(quadMaxU), cw - 1);
+					int32 startY = max((int32)ceil(quadMinV), bandStart);
+					int32 endY = min((int32)floor(quadMaxV), bandEnd - 1);
+
+					uint16 quadZ = quantize((z + z1 + z2 + z3) * 0.25f);
+					for (int32 cy = startY; cy <= endY; ++cy)
+					{
+						for (int32 cx = startX; cx <= endX; ++cx)
+						{
+							write(cx, cy, quadZ);
+						}
+					}
+				}
+			}
+
+			for (int32 i = bandStart * cw; i < bandEnd * cw; ++i)
+			{
+				outDepth[i] = (outDepth[i] == emptyDepth) ? 0 : outDepth[i];
+			}
+		});
+	}
+
+	context.waitForWorkCompletion();
+}
+
+void depth_registration::registerDepthToColor(const uint16* depth, float depthScale, uint16* outDepth, const depth_registration_settings& settings)
+{
+	CPU_PROFILE_BLOCK("Register depth to color");
+
+	transformToColor(depth, depthScale);
+	splat(depthScale, outDepth, settings);
+}
+
+static float coverage(const std::vector<uint16>& depth)
+{
+	uint64 numValid = 0;
+	for (uint16 d : depth)
+	{
+		numValid += d != 0;
+	}
+	return (float)numValid / depth.size();
+}
+
+void benchmarkDepthRegistration(const fs::path& recordingPath)
+{
+	rgbd_camera camera;
+	if (!camera.initializeRecording(recordingPath, false, false))
+	{
+		return;
+	}
+
+	if (camera.alignDepthToColor || !camera.colorSensor.active)
+	{
+		LOG_ERROR("Recording '%ws' must contain color and unaligned depth", recordingPath.c_str());
+		return;
+	}
+
+	depth_registration registration;
+	registration.initialize(camera.depthSensor, camera.colorSensor);
+
+	std::vector<uint16> raw(camera.depthSensor.width * camera.depthSensor.height);
+	std::vector<uint16> registered(camera.colorSensor.width * camera.colorSensor.height);
+
+	double totalMS = 0.0;
+	double maxMS = 0.0;
+	double totalCoverage = 0.0;
+	uint32 numFrames = 0;
+
+	rgbd_frame frame;
+	while (camera.getFrame(frame, 0))
+	{
+		// Copy out of the memory mapped file first, so that page faults are not timed.
+		memcpy(raw.data(), frame.depth, raw.size() * sizeof(uint16));
+		camera.releaseFrame(frame);
+
+		auto start = std::chrono::high_resolution_clock::now();
+		registration.registerDepthToColor(raw.data(), camera.depthScale, registered.data());
+		double ms = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - start).count();
+
+		totalMS += ms;
+		maxMS = max(maxMS, ms);
+		totalCoverage += coverage(registered);
+		++numFrames;
+	}
+
+	if (!numFrames)
+	{
+		LOG_ERROR("Recording '%ws' contains no frames", recordingPath.c_str());
+		return;
+	}
+
+	LOG_MESSAGE("Depth registration benchmark (%ux%u depth to %ux%u color, %u frames): %.3fms mean, %.3fms max, %.1f%% of color pixels covered",
+		camera.depthSensor.width, camera.depthSensor.height, camera.colorSensor.width, camera.colorSensor.height, numFrames,
+		totalMS / numFrames, maxMS, 100.0 * totalCoverage / numFrames);
+}
+
+void benchmarkDepthRegistration(rgbd_camera_type cameraType, uint32 deviceIndex, uint32 numFrames)
+{
+	rgbd_camera camera;
+	if (!camera.initializeAs(cameraType, deviceIndex, false) || !camera.colorSensor.active)
+	{
+		LOG_ERROR("Could not open %s camera %u with color", rgbdCameraTypeNames[cameraType], deviceIndex);
+		return;
+	}
+
+	depth_registration registration;
+	registration.initialize(camera.depthSensor, camera.colorSensor);
+
+	uint32 numColorPixels = camera.colorSensor.width * camera.colorSensor.height;
+	std::vector<uint16> ours(numColorPixels);
+	std::vector<uint16> sdk(numColorPixels);
+
+	double oursMS = 0.0;
+	double sdkMS = 0.0;
+	double oursCoverage = 0.0;
+	double sdkCoverage = 0.0;
+	double sumDifference = 0.0;
+	uint64 numBothValid = 0;
+	uint64 numAgreeing = 0;
+	uint32 numMeasured = 0;
+
+	while (numMeasured < numFrames)
+	{
+		rgbd_frame frame;
+		if (!camera.getFrame(frame, 100))
+		{
+			continue;
+		}
+
+		if (!frame.depth)
+		{
+			camera.releaseFrame(frame);
+			continue;
+		}
+
+		auto t0 = std::chrono::high_resolution_clock::now();
+		registration.registerDepthToColor(frame.depth, camera.depthScale, ours.data());
+		auto t1 = std::chrono::high_resolution_clock::now();
+		bool sdkSuccess = camera.alignDepthToColorWithSDK(frame, sdk.data());
+		auto t2 = std::chrono::high_resolution_clock::now();
+
+		camera.releaseFrame(frame);
+
+		if (!sdkSuccess)
+		{
+			LOG_ERROR("The %s SDK does not support aligning single depth images", rgbdCameraTypeNames[cameraType]);
+			return;
+		}
+
+		oursMS += std::chrono::duration<double, std::milli>(t1 - t0).count();
+		sdkMS += std::chrono::duration<double, std::milli>(t2 - t1).count();
+		oursCoverage += coverage(ours);
+		sdkCoverage += coverage(sdk);
+
+		for (uint32 i = 0; i < numColorPixels; ++i)
+		{
+			if (ours[i] && sdk[i])
+			{
+				int32 difference = abs((int32)ours[i] - (int32)sdk[i]);
+				sumDifference += difference;
+				numAgreeing += difference <= sdk[i] / 100; // Within 1%.
+				++numBothValid;
+			}
+		}
+
+		++numMeasured;
+	}
+
+	LOG_MESSAGE("Depth registration benchmark (%s, %u frames): Ours %.3fms (%.1f%% covered), SDK %.3fms (%.1f%% covered)",
+		rgbdCameraTypeNames[cameraType], numMeasured, oursMS / numMeasured, 100.0 * oursCoverage / numMeasured,
+		sdkMS / numMeasured, 100.0 * sdkCoverage / numMeasured);
+	LOG_MESSAGE("Depth registration benchmark: Mean difference where both are valid %.2fmm, %.1f%% within 1%%",
+		numBothValid ? sumDifference / numBothValid * camera.depthScale * 1000.0 : 0.0, numBothValid ? 100.0 * numAgreeing / numBothValid : 0.0);
+}
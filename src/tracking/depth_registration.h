@@ -0,0 +1,61 @@
+#pragma once
+
+#include "rgbd_camera.h"
+
+struct depth_registration_settings
+{
+	// Neighboring depth pixels, whose depth differs by more than this fraction, are not connected, so that no surface is stretched across
+	// depth edges. These pixels only cover the color pixel closest to their center.
+	float maxRelativeDepthDifference = 0.05f;
+};
+
+/*
+	Reprojects depth frames into the color sensor, from the sensors' calibration (position, rotation, intrinsics and distortion). This
+	replaces the vendor SDK alignment (rgbd_camera's alignDepthToColor), and works for recordings as well.
+	The first pass transforms all depth pixels into the color sensor, 8 at a time with AVX2. The second pass splats them: Each quad of four
+	connected depth pixels covers the color pixels inside its projected bounds, and every depth pixel covers its nearest color pixel, so
+	that there are no gaps, no matter whether the color sensor has a higher resolution than the depth sensor or not. Overlaps are resolved
+	with a z-buffer, keeping the closest surface.
+	Both passes run on the job system. The splat pass splits the color frame into bands of rows, each job only writes its own band, and
+	skips depth rows, whose projection does not touch the band.
+*/
+struct depth_registration
+{
+	// Both sensors must stay valid, and the depth sensor's unproject table must be set.
+	void initialize(const rgbd_camera_sensor& depthSensor, const rgbd_camera_sensor& colorSensor);
+
+	// Output has the color sensor's resolution and the same depth scale as the input. 0 where no depth was projected.
+	void registerDepthToColor(const uint16* depth, float depthScale, uint16* outDepth,
+		const depth_registration_settings& settings = {});
+
+	uint32 depthWidth = 0, depthHeight = 0;
+	uint32 colorWidth = 0, colorHeight = 0;
+
+private:
+	void transformToColor(const uint16* depth, float depthScale);
+	void splat(float depthScale, uint16* outDepth, const depth_registration_settings& settings);
+
+	camera_intrinsics colorIntrinsics;
+	camera_distortion colorDistortion;
+	mat4 depthToColor;
+
+	// Rays of the depth sensor, as separate x and y arrays for vector loads.
+	std::vector<float> rayX;
+	std::vector<float> rayY;
+
+	// Per depth pixel: Position in the color frame (in pixels) and depth along the color sensor's view direction (meters, 0 if invalid).
+	std::vector<float> colorU;
+	std::vector<float> colorV;
+	std::vector<float> colorDepth;
+
+	// Per depth row: Range of color rows, which its valid pixels project to.
+	std::vector<float> rowMinV;
+	std::vector<float> rowMaxV;
+};
+
+// Registers all frames of a recording (which must have been recorded without alignment) and logs the timings and coverage.
+void benchmarkDepthRegistration(const fs::path& recordingPath);
+
+// Registers frames of a live camera (opened without alignment) with both this kernel and the vendor SDK, and logs the timings and the
+// agreement of the two. Only the Azure SDK exposes its alignment for single images.
+void benchmarkDepthRegistration(rgbd_camera_type cameraType, uint32 deviceIndex, uint32 numFrames = 100);
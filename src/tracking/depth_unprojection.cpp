@@ -0,0 +1,412 @@
+#include "pch.h"
+#include "depth_unprojection.h"
+
+#include "core/simd.h"
+#include "core/threading.h"
+#include "core/cpu_profiling.h"
+#include "core/log.h"
+
+#include <chrono>
+
+
+#define DEPTH_UNPROJECTION_ROWS_PER_JOB 32
+
+static const uint16 invalidHalf = 0x7E00; // Quiet NaN.
+
+static bool isValidRay(vec2 r)
+{
+	return !isnan(r.x) && !isnan(r.y);
+}
+
+void compact_unproject_table::initialize(const rgbd_camera_sensor& sensor, float maxSeparableError)
+{
+	width = sensor.width;
+	height = sensor.height;
+
+	const vec2* table = sensor.unprojectTable;
+
+	std::vector<double> sumX(width, 0.0);
+	std::vector<double> sumY(height, 0.0);
+	std::vector<uint32> countX(width, 0);
+	std::vector<uint32> countY(height, 0);
+
+	bool allValid = true;
+
+	for (uint32 y = 0; y < height; ++y)
+	{
+		for (uint32 x = 0; x < width; ++x)
+		{
+			vec2 r = table[y * width + x];
+			if (!isValidRay(r))
+			{
+				allValid = false;
+				continue;
+			}
+
+			sumX[x] += r.x;
+			sumY[y] += r.y;
+			++countX[x];
+			++countY[y];
+		}
+	}
+
+	columnX.resize(width);
+	rowY.resize(height);
+	for (uint32 x = 0; x < width; ++x)
+	{
+		columnX[x] = countX[x] ? (float)(sumX[x] / countX[x]) : 0.f;
+	}
+	for (uint32 y = 0; y < height; ++y)
+	{
+		rowY[y] = countY[y] ? (float)(sumY[y] / countY[y]) : 0.f;
+	}
+
+	float maxCorrection = 0.f;
+	for (uint32 y = 0; y < height; ++y)
+	{
+		for (uint32 x = 0; x < width; ++x)
+		{
+			vec2 r = table[y * width + x];
+			if (isValidRay(r))
+			{
+				maxCorrection = max(maxCorrection, max(abs(r.x - columnX[x]), abs(r.y - rowY[y])));
+			}
+		}
+	}
+
+	correctionsX.clear();
+	correctionsY.clear();
+
+	// Invalid pixels can only be represented with corrections.
+	if (allValid && maxCorrection <= maxSeparableError)
+	{
+		maxError = maxCorrection;
+		return;
+	}
+
+	uint32 numPixels = width * height;
+	correctionsX.resize(numPixels);
+	correctionsY.resize(numPixels);
+
+	maxError = 0.f;
+	for (uint32 y = 0; y < height; ++y)
+	{
+		for (uint32 x = 0; x < width; ++x)
+		{
+			uint32 index = y * width + x;
+			vec2 r = table[index];
+			if (!isValidRay(r))
+			{
+				correctionsX[index] = invalidHalf;
+				correctionsY[index] = invalidHalf;
+				continue;
+			}
+
+			correctionsX[index] = half(r.x - columnX[x]).h;
+			correctionsY[index] = half(r.y - rowY[y]).h;
+
+			vec2 c = getRay(x, y);
+			maxError = max(maxError, max(abs(c.x - r.x), abs(c.y - r.y)));
+		}
+	}
+}
+
+vec2 compact_unproject_table::getRay(uint32 x, uint32 y) const
+{
+	vec2 r(columnX[x], rowY[y]);
+	if (!separable())
+	{
+		uint32 index = y * width + x;
+		half cx(correctionsX[index]);
+		half cy(correctionsY[index]);
+		r.x += (float)cx;
+		r.y += (float)cy;
+	}
+	return r;
+}
+
+uint64 compact_unproject_table::sizeInBytes() const
+{
+	return (columnX.size() + rowY.size()) * sizeof(float) + (correctionsX.size() + correctionsY.size()) * sizeof(uint16);
+}
+
+static void prepareOutput(depth_point_cloud& out, uint32 width, uint32 height)
+{
+	uint32 numPixels = width * height;
+	out.x.resize(numPixels);
+	out.y.resize(numPixels);
+	out.z.resize(numPixels);
+	out.width = width;
+	out.height = height;
+}
+
+static w8_float loadDepth(const uint16* depth, w8_float depthScale)
+{
+	__m256i d = _mm256_cvtepu16_epi32(_mm_loadu_si128((const __m128i*)depth));
+	return w8_float(_mm256_cvtepi32_ps(d)) * depthScale;
+}
+
+static void storePoints(float* outX, float* outY, float* outZ, w8_float d, w8_float ux, w8_float uy)
+{
+	// Pixels without a ray have NaN in the table. These fail the comparison as well.
+	auto valid = (d > w8_float::zero()) & (ux == ux) & (uy == uy);
+
+	ifThen(valid, ux * d, w8_float::zero()).store(outX);
+	ifThen(valid, uy * d, w8_float::zero()).store(outY);
+	ifThen(valid, -d, w8_float::zero()).store(outZ);
+}
+
+static void storePoint(float* outX, float* outY, float* outZ, float d, vec2 u)
+{
+	bool valid = d > 0.f && isValidRay(u);
+	*outX = valid ? u.x * d : 0.f;
+	*outY = valid ? u.y * d : 0.f;
+	*outZ = valid ? -d : 0.f;
+}
+
+void unprojectDepth(const uint16* depth, const compact_unproject_table& table, float depthScale, depth_point_cloud& out)
+{
+	CPU_PROFILE_BLOCK("Unproject depth (compact table)");
+
+	const uint32 width = table.width;
+	const uint32 height = table.height;
+	prepareOutput(out, width, height);
+
+	const float* columnX = table.columnX.data();
+	const float* rowY = table.rowY.data();
+	const uint16* correctionsX = table.correctionsX.data();
+	const uint16* correctionsY = table.correctionsY.data();
+	const bool separable = table.separable();
+
+	float* outX = out.x.data();
+	float* outY = out.y.data();
+	float* outZ = out.z.data();
+
+	thread_job_context context;
+
+	for (uint32 startY = 0; startY < height; startY += DEPTH_UNPROJECTION_ROWS_PER_JOB)
+	{
+		context.addWork([=, &table]()
+		{
+			uint32 endY = min(startY + DEPTH_UNPROJECTION_ROWS_PER_JOB, height);
+			const w8_float scale(depthScale);
+
+			for (uint32 y = startY; y < endY; ++y)
+			{
+				const uint32 row = y * width;
+				const w8_float rayY(rowY[y]);
+
+				uint32 x = 0;
+				for (; x + 8 <= width; x += 8)
+				{
+					uint32 i = row + x;
+
+					w8_float d = loadDepth(depth + i, scale);
+					w8_float ux(columnX + x);
+					w8_float uy = rayY;
+
+					if (!separable)
+					{
+						ux += _mm256_cvtph_ps(_mm_loadu_si128((const __m128i*)(correctionsX + i)));
+						uy += _mm256_cvtph_ps(_mm_loadu_si128((const __m128i*)(correctionsY + i)));
+					}
+
+					storePoints(outX + i, outY + i, outZ + i, d, ux, uy);
+				}
+				for (; x < width; ++x)
+				{
+					uint32 i = row + x;
+					storePoint(outX + i, outY + i, outZ + i, depth[i] * depthScale, table.getRay(x, y));
+				}
+			}
+		});
+	}
+
+	context.waitForWorkCompletion();
+}
+
+void unprojectDepth(const uint16* depth, const rgbd_camera_sensor& sensor, float depthScale, depth_point_cloud& out)
+{
+	CPU_PROFILE_BLOCK("Unproject depth (full table)");
+
+	const uint32 width = sensor.width;
+	const uint32 height = sensor.height;
+	prepareOutput(out, width, height);
+
+	const vec2* table = sensor.unprojectTable;
+
+	float* outX = out.x.data();
+	float* outY = out.y.data();
+	float* outZ = out.z.data();
+
+	thread_job_context context;
+
+	for (uint32 startY = 0; startY < height; startY += DEPTH_UNPROJECTION_ROWS_PER_JOB)
+	{
+		context.addWork([=]()
+		{
+			uint32 endY = min(startY + DEPTH_UNPROJECTION_ROWS_PER_JOB, height);
+			const w8_float scale(depthScale);
+
+			for (uint32 y = startY; y < endY; ++y)
+			{
+				const uint32 row = y * width;
+
+				uint32 x = 0;
+				for (; x + 8 <= width; x += 8)
+				{
+					uint32 i = row + x;
+
+					w8_float d = loadDepth(depth + i, scale);
+
+					// Deinterleave (x0 y0 x1 y1 ...) into x and y. The shuffle works within 128 bit lanes, so the permute restores the order.
+					__m256 a = _mm256_loadu_ps(&table[i].x);
+					__m256 b = _mm256_loadu_ps(&table[i + 4].x);
+					__m256 xs = _mm256_shuffle_ps(a, b, _MM_SHUFFLE(2, 0, 2, 0));
+					__m256 ys = _mm256_shuffle_ps(a, b, _MM_SHUFFLE(3, 1, 3, 1));
+					w8_float ux = _mm256_castpd_ps(_mm256_permute4x64_pd(_mm256_castps_pd(xs), _MM_SHUFFLE(3, 1, 2, 0)));
+					w8_float uy = _mm256_castpd_ps(_mm256_permute4x64_pd(_mm256_castps_pd(ys), _MM_SHUFFLE(3, 1, 2, 0)));
+
+					storePoints(outX + i, outY + i, outZ + i, d, ux, uy);
+				}
+				for (; x < width; ++x)
+				{
+					uint32 i = row + x;
+					storePoint(outX + i, outY + i, outZ + i, depth[i] * depthScale, table[i]);
+				}
+			}
+		});
+	}
+
+	context.waitForWorkCompletion();
+}
+
+// Per pixel loop over the array of structures table, like the existing consumers.
+static void unprojectDepthScalar(const uint16* depth, const rgbd_camera_sensor& sensor, float depthScale, std::vector<vec3>& out)
+{
+	uint32 numPixels = sensor.width * sensor.height;
+	out.resize(numPixels);
+
+	for (uint32 i = 0; i < numPixels; ++i)
+	{
+		vec2 u = sensor.unprojectTable[i];
+		float d = depth[i] * depthScale;
+		out[i] = (d > 0.f && isValidRay(u)) ? vec3(u, -1.f) * d : vec3(0.f, 0.f, 0.f);
+	}
+}
+
+static void benchmarkSensor(const char* name, const rgbd_camera_sensor& sensor, float depthScale, const std::vector<std::vector<uint16>>& frames)
+{
+	const uint32 numRuns = 20;
+
+	uint32 numPixels = sensor.width * sensor.height;
+
+	auto startTable = std::chrono::high_resolution_clock::now();
+	compact_unproject_table table;
+	table.initialize(sensor);
+	double tableMS = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - startTable).count();
+
+	std::vector<vec3> scalarPoints;
+	depth_point_cloud fullPoints;
+	depth_point_cloud compactPoints;
+
+	double scalarMS = 0.0;
+	double fullMS = 0.0;
+	double compactMS = 0.0;
+	float maxPointError = 0.f;
+
+	for (uint32 run = 0; run < numRuns; ++run)
+	{
+		for (const std::vector<uint16>& depth : frames)
+		{
+			auto t0 = std::chrono::high_resolution_clock::now();
+			unprojectDepthScalar(depth.data(), sensor, depthScale, scalarPoints);
+			auto t1 = std::chrono::high_resolution_clock::now();
+			unprojectDepth(depth.data(), sensor, depthScale, fullPoints);
+			auto t2 = std::chrono::high_resolution_clock::now();
+			unprojectDepth(depth.data(), table, depthScale, compactPoints);
+			auto t3 = std::chrono::high_resolution_clock::now();
+
+			scalarMS += std::chrono::duration<double, std::milli>(t1 - t0).count();
+			fullMS += std::chrono::duration<double, std::milli>(t2 - t1).count();
+			compactMS += std::chrono::duration<double, std::milli>(t3 - t2).count();
+		}
+	}
+
+	for (uint32 i = 0; i < numPixels; ++i)
+	{
+		vec3 a = scalarPoints[i];
+		maxPointError = max(maxPointError, max(abs(a.x - compactPoints.x[i]), max(abs(a.y - compactPoints.y[i]), abs(a.z - compactPoints.z[i]))));
+	}
+
+	uint32 numMeasurements = numRuns * (uint32)frames.size();
+	scalarMS /= numMeasurements;
+	fullMS /= numMeasurements;
+	compactMS /= numMeasurements;
+
+	// Bytes read per frame: Depth plus table. The point cloud written is the same for all variants.
+	double depthMB = numPixels * sizeof(uint16) / (1024.0 * 1024.0);
+	double fullTableMB = numPixels * sizeof(vec2) / (1024.0 * 1024.0);
+	double compactTableMB = table.sizeInBytes() / (1024.0 * 1024.0);
+
+	LOG_MESSAGE("Unprojection benchmark, %s sensor (%ux%u): Full table %.1fMB, compact table %.3fMB (%s, built in %.1fms, max ray error %g, max point error %.3fmm)",
+		name, sensor.width, sensor.height, fullTableMB, compactTableMB, table.separable() ? "separable" : "with corrections", tableMS,
+		table.maxError, maxPointError * 1000.f);
+	LOG_MESSAGE("Unprojection benchmark, %s sensor: Scalar %.3fms (%.1f MPixels/s), SIMD full table %.3fms (%.1f MPixels/s, %.1f GB/s read), SIMD compact table %.3fms (%.1f MPixels/s, %.1f GB/s read)",
+		name,
+		scalarMS, numPixels / (scalarMS * 1000.0),
+		fullMS, numPixels / (fullMS * 1000.0), (depthMB + fullTableMB) / 1024.0 / (fullMS * 0.001),
+		compactMS, numPixels / (compactMS * 1000.0), (depthMB + compactTableMB) / 1024.0 / (compactMS * 0.001));
+}
+
+void benchmarkDepthUnprojection(const fs::path& recordingPath)
+{
+	rgbd_camera camera;
+	if (!camera.initializeRecording(recordingPath, false, false))
+	{
+		return;
+	}
+
+	const uint32 maxNumFrames = 10;
+
+	uint32 numDepthPixels = camera.depthSensor.width * camera.depthSensor.height;
+	std::vector<std::vector<uint16>> depthFrames;
+
+	rgbd_frame frame;
+	while (depthFrames.size() < maxNumFrames && camera.getFrame(frame, 0))
+	{
+		// Copy out of the memory mapped file first, so that page faults are not timed.
+		depthFrames.emplace_back(frame.depth, frame.depth + numDepthPixels);
+		camera.releaseFrame(frame);
+	}
+
+	if (depthFrames.empty())
+	{
+		LOG_ERROR("Recording '%ws' contains no frames", recordingPath.c_str());
+		return;
+	}
+
+	benchmarkSensor("depth", camera.depthSensor, camera.depthScale, depthFrames);
+
+	if (camera.colorSensor.active && camera.colorSensor.unprojectTable)
+	{
+		// Slanted plane between 0.5m and 3.5m with a few holes, at the color sensor's resolution.
+		uint32 width = camera.colorSensor.width;
+		uint32 height = camera.colorSensor.height;
+
+		std::vector<std::vector<uint16>> colorFrames(1);
+		std::vector<uint16>& depth = colorFrames[0];
+		depth.resize(width * height);
+		for (uint32 y = 0; y < height; ++y)
+		{
+			for (uint32 x = 0; x < width; ++x)
+			{
+				float meters = 0.5f + 3.f * (float)x / width;
+				bool hole = ((x / 37) + (y / 23)) % 11 == 0;
+				depth[y * width + x] = hole ? 0 : (uint16)(meters / camera.depthScale);
+			}
+		}
+
+		benchmarkSensor("color", camera.colorSensor, camera.depthScale, colorFrames);
+	}
+}
@@ -0,0 +1,55 @@
+#pragma once
+
+#include "rgbd_camera.h"
+
+/*
+	Compact alternative to rgbd_camera_sensor::unprojectTable, which stores 8 bytes per pixel (about 66MB for a 4K color sensor).
+	The ray of a pixel is split into a separable part, one x per column and one y per row (the mean over the column or row, i.e. the
+	pinhole part of the camera model), and a per pixel correction for the lens distortion. The corrections are small, so storing them as
+	halfs loses far less precision than storing the rays themselves as halfs would (about 1e-5 instead of 2.5e-4 for rays of length 0.5,
+	which is 0.04mm instead of 1mm at 4m). This halves the table to 4 bytes per pixel.
+	If the distortion is negligible (all corrections below the threshold), the corrections are dropped entirely, and only width + height
+	floats remain.
+*/
+struct compact_unproject_table
+{
+	// The sensor's full unproject table must be set. Pixels without a ray (NaN in the full table) are kept invalid.
+	void initialize(const rgbd_camera_sensor& sensor, float maxSeparableError = 1e-5f);
+
+	vec2 getRay(uint32 x, uint32 y) const; // Same as the full table, up to the error below.
+	uint64 sizeInBytes() const;
+	bool separable() const { return correctionsX.empty(); }
+
+	uint32 width = 0;
+	uint32 height = 0;
+
+	std::vector<float> columnX;
+	std::vector<float> rowY;
+
+	// Halfs, as separate x and y arrays for vector loads. Empty, if the table is separable.
+	std::vector<uint16> correctionsX;
+	std::vector<uint16> correctionsY;
+
+	float maxError = 0.f; // Largest difference to the full table over all valid pixels.
+};
+
+// Structure of arrays, one point per pixel in the sensor's space. Invalid pixels (no depth or no ray) are (0, 0, 0).
+struct depth_point_cloud
+{
+	std::vector<float> x;
+	std::vector<float> y;
+	std::vector<float> z;
+
+	uint32 width = 0;
+	uint32 height = 0;
+};
+
+// Unprojects a depth frame 8 pixels at a time with AVX2, in blocks of rows on the job system.
+void unprojectDepth(const uint16* depth, const compact_unproject_table& table, float depthScale, depth_point_cloud& out);
+
+// Same from the sensor's full table, for reference.
+void unprojectDepth(const uint16* depth, const rgbd_camera_sensor& sensor, float depthScale, depth_point_cloud& out);
+
+// Compares table size, unprojection throughput and accuracy of the compact and the full table, for the depth sensor (with the
+// recording's frames) and the color sensor (with a synthetic depth image). Logs the results.
+void benchmarkDepthUnprojection(const fs::path& recordingPath);
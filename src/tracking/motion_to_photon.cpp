@@ -0,0 +1,254 @@
+#include "pch.h"
+#include "motion_to_photon.h"
+
+#include "core/cpu_profiling.h"
+#include "core/log.h"
+
+#include <chrono>
+
+
+motion_to_photon_latency motionToPhotonLatency;
+
+int64 getLatencyTimeInMicroseconds()
+{
+	return (int64)std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+void latency_histogram::add(int64 microseconds)
+{
+	microseconds = max(microseconds, (int64)0);
+
+	uint32 bucket = (uint32)min(microseconds / LATENCY_HISTOGRAM_BUCKET_SIZE_IN_MICROSECONDS, (int64)LATENCY_HISTOGRAM_NUM_BUCKETS - 1);
+	++buckets[bucket];
+	++count;
+	sum += microseconds;
+	maximum = max(maximum, microseconds);
+}
+
+void latency_histogram::reset()
+{
+	*this = latency_histogram();
+}
+
+float latency_histogram::mean() const
+{
+	return count ? (float)((double)sum / count * 0.001) : 0.f;
+}
+
+float latency_histogram::percentile(float p) const
+{
+	uint64 target = (uint64)ceil(p * count);
+	uint64 cumulative = 0;
+	for (uint32 i = 0; i < LATENCY_HISTOGRAM_NUM_BUCKETS - 1; ++i)
+	{
+		cumulative += buckets[i];
+		if (cumulative >= target && cumulative > 0)
+		{
+			return (i + 0.5f) * LATENCY_HISTOGRAM_BUCKET_SIZE_IN_MICROSECONDS * 0.001f;
+		}
+	}
+	return maximum * 0.001f;
+}
+
+void motion_to_photon_latency::poseApplied(const pose_timing& timing)
+{
+	// The GPU tracker applies new poses every frame, even if no new camera frame arrived. Only the first pose per camera frame counts.
+	if (!timing.frameID || timing.frameID == latestPose.frameID)
+	{
+		return;
+	}
+
+	if (timing.deviceTime)
+	{
+		int64 offset = timing.receiveTime - timing.deviceTime;
+		minCameraTransportOffset = min(minCameraTransportOffset, offset);
+		histograms[latency_stage_camera_transport].add(offset - minCameraTransportOffset);
+	}
+
+	histograms[latency_stage_queue].add(timing.pickupTime - timing.receiveTime);
+	histograms[latency_stage_tracking].add(timing.applyTime - timing.pickupTime);
+
+	latestPose = timing;
+	latestSendTime = 0;
+	latestPoseSent = false;
+	latestPosePresented = false;
+}
+
+void motion_to_photon_latency::posesSent()
+{
+	if (latestPoseSent || !latestPose.frameID)
+	{
+		return;
+	}
+
+	latestSendTime = getLatencyTimeInMicroseconds();
+	histograms[latency_stage_network_send].add(latestSendTime - latestPose.applyTime);
+	latestPoseSent = true;
+}
+
+void motion_to_photon_latency::remotePoseReceived(uint32 frameID, uint32 ageInMicroseconds)
+{
+	if (!ageInMicroseconds || frameID == remoteFrameID)
+	{
+		return;
+	}
+
+	remoteFrameID = frameID;
+	remoteAge = ageInMicroseconds;
+	remoteReceiveTime = getLatencyTimeInMicroseconds();
+	remotePosePresented = false;
+}
+
+void motion_to_photon_latency::framePresented()
+{
+	int64 now = getLatencyTimeInMicroseconds();
+
+	if (!latestPosePresented && latestPose.frameID)
+	{
+		int64 total = now - latestPose.receiveTime;
+
+		histograms[latency_stage_display].add(now - latestPose.applyTime);
+		histograms[latency_stage_total].add(total);
+
+		if (tracing)
+		{
+			trace.push_back({ latestPose, latestSendTime, now, total, false });
+		}
+
+		latestPosePresented = true;
+	}
+
+	if (!remotePosePresented)
+	{
+		int64 total = remoteAge + (now - remoteReceiveTime);
+
+		histograms[latency_stage_display].add(now - remoteReceiveTime);
+		histograms[latency_stage_total].add(total);
+
+		if (tracing)
+		{
+			pose_timing pose;
+			pose.frameID = remoteFrameID;
+			trace.push_back({ pose, 0, now, total, true });
+		}
+
+		remotePosePresented = true;
+	}
+}
+
+uint32 motion_to_photon_latency::getLatestPoseAge() const
+{
+	if (!latestPose.frameID)
+	{
+		return 0;
+	}
+	return (uint32)max(getLatencyTimeInMicroseconds() - latestPose.receiveTime, (int64)1);
+}
+
+void motion_to_photon_latency::reportStats() const
+{
+	static const char* meanLabels[] =
+	{
+		"Latency camera transport mean (ms)",
+		"Latency queue mean (ms)",
+		"Latency tracking mean (ms)",
+		"Latency network send mean (ms)",
+		"Latency display mean (ms)",
+		"Latency total mean (ms)",
+	};
+
+	static const char* percentileLabels[] =
+	{
+		"Latency camera transport 95% (ms)",
+		"Latency queue 95% (ms)",
+		"Latency tracking 95% (ms)",
+		"Latency network send 95% (ms)",
+		"Latency display 95% (ms)",
+		"Latency total 95% (ms)",
+	};
+
+	static_assert(arraysize(meanLabels) == latency_stage_count, "");
+	static_assert(arraysize(percentileLabels) == latency_stage_count, "");
+
+	for (uint32 i = 0; i < latency_stage_count; ++i)
+	{
+		if (histograms[i].count)
+		{
+			CPU_PROFILE_STAT(meanLabels[i], histograms[i].mean());
+			CPU_PROFILE_STAT(percentileLabels[i], histograms[i].percentile(0.95f));
+		}
+	}
+}
+
+bool motion_to_photon_latency::saveHistograms(const fs::path& path) const
+{
+	FILE* file = _wfopen(path.c_str(), L"w");
+	if (!file)
+	{
+		LOG_ERROR("Could not open file '%ws' for writing", path.c_str());
+		return false;
+	}
+
+	fprintf(file, "bucket_start_ms");
+	for (uint32 s = 0; s < latency_stage_count; ++s)
+	{
+		fprintf(file, ",%s", latencyStageNames[s]);
+	}
+	fprintf(file, "\n");
+
+	for (uint32 i = 0; i < LATENCY_HISTOGRAM_NUM_BUCKETS; ++i)
+	{
+		fprintf(file, "%.1f", i * LATENCY_HISTOGRAM_BUCKET_SIZE_IN_MICROSECONDS * 0.001f);
+		for (uint32 s = 0; s < latency_stage_count; ++s)
+		{
+			fprintf(file, ",%u", histograms[s].buckets[i]);
+		}
+		fprintf(file, "\n");
+	}
+
+	fclose(file);
+	return true;
+}
+
+bool motion_to_photon_latency::saveTrace(const fs::path& path) const
+{
+	FILE* file = _wfopen(path.c_str(), L"w");
+	if (!file)
+	{
+		LOG_ERROR("Could not open file '%ws' for writing", path.c_str());
+		return false;
+	}
+
+	// Microseconds. Host timestamps are relative to the first record.
+	fprintf(file, "frame_id,remote,device_time,receive,pickup,apply,send,present,total\n");
+
+	int64 base = 0;
+	for (const latency_trace_record& r : trace)
+	{
+		int64 first = r.remote ? r.presentTime - r.total : r.pose.receiveTime;
+		base = base ? min(base, first) : first;
+	}
+
+	auto relative = [base](int64 t) { return t ? t - base : (int64)-1; };
+
+	for (const latency_trace_record& r : trace)
+	{
+		fprintf(file, "%llu,%u,%lld,%lld,%lld,%lld,%lld,%lld,%lld\n",
+			r.pose.frameID, (uint32)r.remote, r.pose.deviceTime,
+			relative(r.pose.receiveTime), relative(r.pose.pickupTime), relative(r.pose.applyTime), relative(r.sendTime),
+			relative(r.presentTime), r.total);
+	}
+
+	fclose(file);
+	return true;
+}
+
+void motion_to_photon_latency::reset()
+{
+	for (uint32 i = 0; i < latency_stage_count; ++i)
+	{
+		histograms[i].reset();
+	}
+	trace.clear();
+	minCameraTransportOffset = INT64_MAX;
+}
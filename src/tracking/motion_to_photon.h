@@ -0,0 +1,114 @@
+#pragma once
+
+#define LATENCY_HISTOGRAM_BUCKET_SIZE_IN_MICROSECONDS 1000
+#define LATENCY_HISTOGRAM_NUM_BUCKETS 250 // The last bucket also counts everything above.
+
+#define LATENCY_EXTENSION "csv"
+
+// Host clock, which all host side timestamps are taken with. Steady, so it can be compared across threads.
+int64 getLatencyTimeInMicroseconds();
+
+enum latency_stage
+{
+	latency_stage_camera_transport,		// Camera exposure to host receive. Relative to the smallest offset seen so far, since the clocks differ.
+	latency_stage_queue,				// Host receive until the tracker picks up the frame.
+	latency_stage_tracking,				// Pickup until the new pose is applied, including the GPU read back NUM_BUFFERED_FRAMES later.
+	latency_stage_network_send,			// Pose applied until the server sends it to the clients.
+	latency_stage_display,				// Pose applied (or received from the server) until the projector images are presented.
+	latency_stage_total,				// Host receive until presented. On clients, this includes the age of the pose when the server sent it.
+
+	latency_stage_count,
+};
+
+static const char* latencyStageNames[] =
+{
+	"Camera transport",
+	"Queue",
+	"Tracking",
+	"Network send",
+	"Display",
+	"Total",
+};
+
+struct latency_histogram
+{
+	void add(int64 microseconds);
+	void reset();
+
+	// In milliseconds.
+	float mean() const;
+	float percentile(float p) const;
+
+	uint32 buckets[LATENCY_HISTOGRAM_NUM_BUCKETS] = {};
+	uint64 count = 0;
+	int64 sum = 0;
+	int64 maximum = 0;
+};
+
+// Timestamps of the camera frame, which a tracked pose was computed from.
+struct pose_timing
+{
+	uint64 frameID = 0;
+	int64 deviceTime = 0; // Camera clock. Only differences between frames of the same camera are meaningful.
+
+	// Host clock.
+	int64 receiveTime = 0;
+	int64 pickupTime = 0;
+	int64 applyTime = 0;
+};
+
+struct latency_trace_record
+{
+	pose_timing pose;
+	int64 sendTime; // 0 if not sent.
+	int64 presentTime;
+	int64 total;
+	bool remote; // Pose received from the server. Only presentTime and total are known.
+};
+
+/*
+	Follows camera frames from exposure to projector presentation. Every camera frame carries its device and host receive timestamps, the
+	tracker stamps when it picks the frame up and applies the resulting pose, the network server sends the age of the pose along with it,
+	and the projector manager reports when it presented images using the newest pose. Each stage is counted once per camera frame.
+	Presentation is when the images are handed to the swap chain. Scan out and the projector's internal processing come on top, and the
+	network transit time is not included on clients, since the clocks of the machines are not synchronized.
+	All functions must be called from the main thread.
+*/
+struct motion_to_photon_latency
+{
+	void poseApplied(const pose_timing& timing);
+	void posesSent();
+	void remotePoseReceived(uint32 frameID, uint32 ageInMicroseconds);
+	void framePresented();
+
+	// For sending along with the poses. The age is 0 if no pose has been applied yet.
+	uint32 getLatestPoseFrameID() const { return (uint32)latestPose.frameID; }
+	uint32 getLatestPoseAge() const;
+
+	// Mean and 95th percentile of each stage.
+	void reportStats() const;
+
+	bool saveHistograms(const fs::path& path) const;
+	bool saveTrace(const fs::path& path) const;
+	void reset();
+
+	latency_histogram histograms[latency_stage_count];
+
+	bool tracing = false;
+	std::vector<latency_trace_record> trace;
+
+private:
+	pose_timing latestPose;
+	int64 latestSendTime = 0;
+	bool latestPoseSent = true;
+	bool latestPosePresented = true;
+
+	int64 minCameraTransportOffset = INT64_MAX;
+
+	uint32 remoteFrameID = 0;
+	uint32 remoteAge = 0;
+	int64 remoteReceiveTime = 0;
+	bool remotePosePresented = true;
+};
+
+extern motion_to_photon_latency motionToPhotonLatency;
@@ -0,0 +1,373 @@
+#include "pch.h"
+#include "pose_filter.h"
+
+#include "core/random.h"
+#include "core/log.h"
+
+#include <algorithm>
+
+
+// Initial velocity uncertainty. Large, so the first measurements quickly determine the velocity.
+static const float initialRotationVelocitySigma = 2.f; // rad/s.
+static const float initialTranslationVelocitySigma = 1.f; // m/s.
+
+// Measurements right after initialization are not counted in evaluations, because the filter has not picked up the velocity yet.
+static const uint32 numEvaluationWarmupSamples = 10;
+
+
+static void applyTwist(const vec6& twist, quat& rotation, vec3& position)
+{
+	rotation_translation delta = lieExp(twist);
+	quat deltaRotation = mat3ToQuaternion(delta.rotation);
+
+	position = deltaRotation * position + delta.translation;
+	rotation = normalize(deltaRotation * rotation);
+}
+
+// Twist, which moves pose a to pose b.
+static vec6 relativeTwist(quat rotationA, vec3 positionA, quat rotationB, vec3 positionB)
+{
+	quat rotation = rotationB * conjugate(rotationA);
+	vec3 translation = positionB - rotation * positionA;
+	return lieLog({ quaternionToMat3(rotation), translation });
+}
+
+static float angleBetween(quat a, quat b)
+{
+	return 2.f * acos(min(abs(dot(a.v4, b.v4)), 1.f));
+}
+
+void pose_filter::initialize(const trs& measurement, double time, const pose_filter_settings& settings)
+{
+	rotation = measurement.rotation;
+	position = measurement.position;
+	scale = measurement.scale;
+	velocity = vec6(0.f, 0.f, 0.f, 0.f, 0.f, 0.f);
+
+	for (uint32 i = 0; i < 6; ++i)
+	{
+		float measurementSigma = (i < 3) ? settings.rotationMeasurementNoise : settings.translationMeasurementNoise;
+		float velocitySigma = (i < 3) ? initialRotationVelocitySigma : initialTranslationVelocitySigma;
+
+		p00[i] = measurementSigma * measurementSigma;
+		p01[i] = 0.f;
+		p11[i] = velocitySigma * velocitySigma;
+	}
+
+	lastTime = time;
+	initialized = true;
+}
+
+void pose_filter::update(const mat4& measurement, double time, const pose_filter_settings& settings)
+{
+	trs z = mat4ToTRS(measurement);
+
+	double dt = time - lastTime;
+	if (!initialized || dt <= 0.0 || dt > settings.maxTimeBetweenMeasurements)
+	{
+		initialize(z, time, settings);
+		return;
+	}
+
+	float t = (float)dt;
+	float t2 = t * t;
+
+	// Predict. The process noise is a white acceleration over the time step.
+	applyTwist(velocity * t, rotation, position);
+
+	for (uint32 i = 0; i < 6; ++i)
+	{
+		float sigma = (i < 3) ? settings.rotationAccelerationNoise : settings.translationAccelerationNoise;
+		float q = sigma * sigma;
+
+		p00[i] += t * (2.f * p01[i] + t * p11[i]) + 0.25f * q * t2 * t2;
+		p01[i] += t * p11[i] + 0.5f * q * t2 * t;
+		p11[i] += q * t2;
+	}
+
+	// Correct with the measurement's deviation from the prediction.
+	vec6 innovation = relativeTwist(rotation, position, z.rotation, z.position);
+
+	vec6 poseCorrection, velocityCorrection;
+	for (uint32 i = 0; i < 6; ++i)
+	{
+		float sigma = (i < 3) ? settings.rotationMeasurementNoise : settings.translationMeasurementNoise;
+
+		float s = p00[i] + sigma * sigma;
+		float k0 = p00[i] / s;
+		float k1 = p01[i] / s;
+
+		poseCorrection.m[i] = k0 * innovation.m[i];
+		velocityCorrection.m[i] = k1 * innovation.m[i];
+
+		p11[i] -= k1 * p01[i];
+		p00[i] *= 1.f - k0;
+		p01[i] *= 1.f - k0;
+	}
+
+	applyTwist(poseCorrection, rotation, position);
+	velocity = velocity + velocityCorrection;
+
+	scale = z.scale;
+	lastTime = time;
+}
+
+mat4 pose_filter::predict(double time) const
+{
+	assert(initialized);
+
+	quat r = rotation;
+	vec3 p = position;
+
+	float dt = (float)max(time - lastTime, 0.0);
+	applyTwist(velocity * dt, r, p);
+
+	return createModelMatrix(p, r, scale);
+}
+
+static bool interpolateTrajectory(const std::vector<pose_sample>& samples, double time, pose_sample& result)
+{
+	if (samples.empty() || time < samples.front().time || time > samples.back().time)
+	{
+		return false;
+	}
+
+	auto it = std::lower_bound(samples.begin(), samples.end(), time, [](const pose_sample& s, double t) { return s.time < t; });
+	if (it == samples.begin())
+	{
+		result = *it;
+		return true;
+	}
+
+	const pose_sample& b = *it;
+	const pose_sample& a = *(it - 1);
+
+	float t = (float)((time - a.time) / (b.time - a.time));
+	result.time = time;
+	result.position = lerp(a.position, b.position, t);
+	result.rotation = slerp(a.rotation, b.rotation, t);
+	return true;
+}
+
+// outputs[i] is the pose shown at outputs[i].time.
+static pose_filter_evaluation evaluateOutputs(const std::vector<pose_sample>& outputs, const std::vector<pose_sample>& reference)
+{
+	pose_filter_evaluation result = {};
+
+	uint32 numErrors = 0;
+	uint32 numJitters = 0;
+
+	for (uint32 i = numEvaluationWarmupSamples; i < (uint32)outputs.size(); ++i)
+	{
+		const pose_sample& o = outputs[i];
+
+		pose_sample r;
+		if (interpolateTrajectory(reference, o.time, r))
+		{
+			result.positionError += length(o.position - r.position) * 1000.f;
+			result.rotationError += rad2deg(angleBetween(o.rotation, r.rotation));
+			++numErrors;
+		}
+
+		if (i >= numEvaluationWarmupSamples + 2)
+		{
+			const pose_sample& o1 = outputs[i - 1];
+			const pose_sample& o2 = outputs[i - 2];
+
+			result.positionJitter += length(o.position - 2.f * o1.position + o2.position) * 1000.f;
+
+			quat delta0 = o.rotation * conjugate(o1.rotation);
+			quat delta1 = o1.rotation * conjugate(o2.rotation);
+			result.rotationJitter += rad2deg(angleBetween(delta0, delta1));
+			++numJitters;
+		}
+	}
+
+	if (numErrors)
+	{
+		result.positionError /= numErrors;
+		result.rotationError /= numErrors;
+	}
+	if (numJitters)
+	{
+		result.positionJitter /= numJitters;
+		result.rotationJitter /= numJitters;
+	}
+
+	return result;
+}
+
+pose_filter_evaluation evaluatePoseFilter(const std::vector<pose_sample>& measurements, const std::vector<pose_sample>& reference,
+	const pose_filter_settings& settings, float horizonInSeconds)
+{
+	std::vector<pose_sample> outputs(measurements.size());
+
+	pose_filter filter;
+	for (uint32 i = 0; i < (uint32)measurements.size(); ++i)
+	{
+		const pose_sample& m = measurements[i];
+		filter.update(createModelMatrix(m.position, m.rotation), m.time, settings);
+
+		trs predicted = mat4ToTRS(filter.predict(m.time + horizonInSeconds));
+		outputs[i] = { m.time + horizonInSeconds, predicted.position, predicted.rotation };
+	}
+
+	return evaluateOutputs(outputs, reference);
+}
+
+pose_filter_evaluation evaluateUnfilteredPoses(const std::vector<pose_sample>& measurements, const std::vector<pose_sample>& reference, float horizonInSeconds)
+{
+	std::vector<pose_sample> outputs = measurements;
+	for (pose_sample& o : outputs)
+	{
+		o.time += horizonInSeconds;
+	}
+
+	return evaluateOutputs(outputs, reference);
+}
+
+pose_filter_evaluation evaluateExponentialSmoothing(const std::vector<pose_sample>& measurements, const std::vector<pose_sample>& reference,
+	float smoothing, float horizonInSeconds)
+{
+	std::vector<pose_sample> outputs(measurements.size());
+
+	quat rotation;
+	vec3 position;
+	for (uint32 i = 0; i < (uint32)measurements.size(); ++i)
+	{
+		const pose_sample& m = measurements[i];
+		if (i == 0)
+		{
+			rotation = m.rotation;
+			position = m.position;
+		}
+		else
+		{
+			// Same as the depth tracker's simple smoothing mode: Only a fraction of each frame's update is applied.
+			vec6 delta = relativeTwist(rotation, position, m.rotation, m.position);
+			applyTwist(delta * (1.f - smoothing), rotation, position);
+		}
+
+		outputs[i] = { m.time + horizonInSeconds, position, rotation };
+	}
+
+	return evaluateOutputs(outputs, reference);
+}
+
+bool savePoseTrajectory(const fs::path& path, const std::vector<pose_sample>& samples)
+{
+	FILE* file = _wfopen(path.c_str(), L"w");
+	if (!file)
+	{
+		LOG_ERROR("Could not open file '%ws' for writing", path.c_str());
+		return false;
+	}
+
+	fprintf(file, "time,px,py,pz,qx,qy,qz,qw\n");
+	for (const pose_sample& s : samples)
+	{
+		fprintf(file, "%.6f,%f,%f,%f,%f,%f,%f,%f\n", s.time,
+			s.position.x, s.position.y, s.position.z,
+			s.rotation.x, s.rotation.y, s.rotation.z, s.rotation.w);
+	}
+
+	fclose(file);
+	return true;
+}
+
+bool loadPoseTrajectory(const fs::path& path, std::vector<pose_sample>& samples)
+{
+	FILE* file = _wfopen(path.c_str(), L"r");
+	if (!file)
+	{
+		LOG_ERROR("Could not open trajectory '%ws'", path.c_str());
+		return false;
+	}
+
+	samples.clear();
+
+	char line[512];
+	fgets(line, sizeof(line), file); // Header.
+
+	while (fgets(line, sizeof(line), file))
+	{
+		pose_sample s;
+		if (sscanf(line, "%lf,%f,%f,%f,%f,%f,%f,%f", &s.time,
+			&s.position.x, &s.position.y, &s.position.z,
+			&s.rotation.x, &s.rotation.y, &s.rotation.z, &s.rotation.w) == 8)
+		{
+			samples.push_back(s);
+		}
+	}
+
+	fclose(file);
+
+	if (samples.empty())
+	{
+		LOG_ERROR("Trajectory '%ws' contains no samples", path.c_str());
+		return false;
+	}
+
+	return true;
+}
+
+static void logEvaluation(const char* name, const pose_filter_evaluation& e)
+{
+	LOG_MESSAGE("Pose filter benchmark: %-24s error %6.2fmm / %6.3f deg, jitter %6.3fmm / %6.4f deg",
+		name, e.positionError, e.rotationError, e.positionJitter, e.rotationJitter);
+}
+
+void benchmarkPoseFilter(const fs::path& trajectoryPath, float horizonInSeconds)
+{
+	std::vector<pose_sample> measurements;
+	std::vector<pose_sample> reference;
+
+	if (!trajectoryPath.empty())
+	{
+		if (!loadPoseTrajectory(trajectoryPath, measurements))
+		{
+			return;
+		}
+
+		// The recorded poses are the best estimate of the true motion there is. The error is then dominated by lag.
+		reference = measurements;
+	}
+	else
+	{
+		// An object moved by hand in front of the camera, tracked at 30 Hz with ICP-like noise.
+		const uint32 numSamples = 600;
+		const float positionNoise = 0.002f;
+		const float rotationNoise = deg2rad(0.3f);
+
+		random_number_generator rng = { 512 };
+
+		measurements.resize(numSamples);
+		reference.resize(numSamples);
+
+		for (uint32 i = 0; i < numSamples; ++i)
+		{
+			float t = i / 30.f;
+
+			pose_sample& r = reference[i];
+			r.time = t;
+			r.position = vec3(0.3f * sin(0.9f * t), 0.15f * sin(1.7f * t), -1.5f + 0.1f * sin(0.5f * t));
+			r.rotation = quat(normalize(vec3(0.2f, 1.f, 0.1f)), deg2rad(60.f) * sin(1.1f * t));
+
+			// Uniform noise with the given standard deviation.
+			vec3 axis = rng.randomVec3Between(-1.f, 1.f);
+			axis = (dot(axis, axis) > 1e-6f) ? normalize(axis) : vec3(0.f, 1.f, 0.f);
+
+			pose_sample& m = measurements[i];
+			m.time = t;
+			m.position = r.position + rng.randomVec3Between(-1.f, 1.f) * (sqrt(3.f) * positionNoise);
+			m.rotation = normalize(quat(axis, rng.randomFloatBetween(-1.f, 1.f) * sqrt(3.f) * rotationNoise) * r.rotation);
+		}
+	}
+
+	LOG_MESSAGE("Pose filter benchmark (%u samples over %.1fs, display %.0fms after measurement)",
+		(uint32)measurements.size(), measurements.back().time - measurements.front().time, horizonInSeconds * 1000.f);
+
+	logEvaluation("Unfiltered", evaluateUnfilteredPoses(measurements, reference, horizonInSeconds));
+	logEvaluation("Exponential (0.7)", evaluateExponentialSmoothing(measurements, reference, 0.7f, horizonInSeconds));
+	logEvaluation("Kalman, predicted", evaluatePoseFilter(measurements, reference, pose_filter_settings(), horizonInSeconds));
+}
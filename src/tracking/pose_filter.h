@@ -0,0 +1,94 @@
+#pragma once
+
+#include "tracking_math.h"
+
+#define POSE_TRAJECTORY_EXTENSION "csv"
+
+struct pose_sample
+{
+	double time; // Seconds.
+	vec3 position;
+	quat rotation;
+};
+
+struct pose_filter_settings
+{
+	// Standard deviation of the acceleration, which the constant velocity model does not explain. Higher values follow sudden changes of
+	// motion quicker, lower values smooth more.
+	float rotationAccelerationNoise = 30.f; // rad/s^2.
+	float translationAccelerationNoise = 4.f; // m/s^2.
+
+	// Standard deviation of the tracker's per-frame noise.
+	float rotationMeasurementNoise = deg2rad(0.3f); // rad.
+	float translationMeasurementNoise = 0.002f; // m.
+
+	// The filter restarts from the next measurement, if tracking was interrupted for longer than this.
+	float maxTimeBetweenMeasurements = 0.3f; // s.
+};
+
+/*
+	Constant velocity Kalman filter on SE(3).
+	The state is a pose and a velocity twist, which is applied from the left via lieExp (see tracking_math.h). Errors live in the
+	6-dimensional tangent space, and each of the 6 axes is filtered independently with a 2x2 covariance of pose error and velocity.
+	New measurements are compared to the predicted pose via lieLog.
+
+	Unlike the exponential smoothing of the depth tracker, the filter can extrapolate the pose into the future. Predicting by the latency
+	between camera exposure and projector display cancels the lag, which the projected content would otherwise have behind a moving object.
+	Scale is not filtered. The predicted pose uses the scale of the last measurement.
+*/
+struct pose_filter
+{
+	void reset() { initialized = false; }
+
+	void update(const mat4& measurement, double time, const pose_filter_settings& settings);
+
+	// Extrapolates the filtered pose to the given time with the current velocity.
+	mat4 predict(double time) const;
+
+	bool isInitialized() const { return initialized; }
+
+private:
+	void initialize(const trs& measurement, double time, const pose_filter_settings& settings);
+
+	quat rotation;
+	vec3 position;
+	vec3 scale;
+	vec6 velocity; // Per second.
+
+	// Per axis covariance [p00 p01; p01 p11] of pose error and velocity. Axes 0-2 are rotation, 3-5 translation.
+	float p00[6];
+	float p01[6];
+	float p11[6];
+
+	double lastTime;
+	bool initialized = false;
+};
+
+struct pose_filter_evaluation
+{
+	// Between the output pose and the reference at the time the output is displayed.
+	float positionError; // mm.
+	float rotationError; // deg.
+
+	// Mean change of frame-to-frame motion of the output, i.e. how shaky it looks.
+	float positionJitter; // mm.
+	float rotationJitter; // deg.
+};
+
+// The output for measurement i is assumed to be displayed at measurements[i].time + horizon. The reference is interpolated at that time.
+// For recorded trajectories, the measurements are their own reference.
+pose_filter_evaluation evaluatePoseFilter(const std::vector<pose_sample>& measurements, const std::vector<pose_sample>& reference,
+	const pose_filter_settings& settings, float horizonInSeconds);
+
+// Same error measures, but for the unfiltered measurements and for the depth tracker's simple exponential smoothing (higher is smoother).
+pose_filter_evaluation evaluateUnfilteredPoses(const std::vector<pose_sample>& measurements, const std::vector<pose_sample>& reference, float horizonInSeconds);
+pose_filter_evaluation evaluateExponentialSmoothing(const std::vector<pose_sample>& measurements, const std::vector<pose_sample>& reference,
+	float smoothing, float horizonInSeconds);
+
+// One sample per line: time, position xyz, rotation xyzw.
+bool savePoseTrajectory(const fs::path& path, const std::vector<pose_sample>& samples);
+bool loadPoseTrajectory(const fs::path& path, std::vector<pose_sample>& samples);
+
+// Compares lag and jitter of the filter against the unfiltered poses and exponential smoothing. Uses a trajectory recorded by the depth
+// tracker, or a synthetic noisy trajectory if the path is empty.
+void benchmarkPoseFilter(const fs::path& trajectoryPath, float horizonInSeconds = 0.06f);
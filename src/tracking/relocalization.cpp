@@ -0,0 +1,606 @@
+#include "pch.h"
+#include "relocalization.h"
+#include "synthetic_depth_camera.h"
+
+#include "geometry/mesh.h"
+
+#include "core/random.h"
+#include "core/threading.h"
+#include "core/cpu_profiling.h"
+#include "core/log.h"
+
+#include <algorithm>
+#include <unordered_map>
+#include <chrono>
+
+
+#define PPF_REFERENCES_PER_JOB 32
+#define PPF_INVALID_KEY 0xFFFFFFFF
+
+// 13 bits per axis (+-4096 steps), so that a key and a 25 bit pixel index fit into 64 bits. This covers depth images with up to 32M pixels.
+#define PPF_VOXEL_AXIS_BITS 13
+#define PPF_SAMPLE_INDEX_BITS (64 - 3 * PPF_VOXEL_AXIS_BITS)
+
+static uint64 voxelKey(vec3 p, float invStep)
+{
+	const int32 halfRange = 1 << (PPF_VOXEL_AXIS_BITS - 1);
+	auto axis = [invStep, halfRange](float v) { return (uint64)(clamp((int32)floor(v * invStep), -halfRange, halfRange - 1) + halfRange); };
+	return (axis(p.x) << (2 * PPF_VOXEL_AXIS_BITS)) | (axis(p.y) << PPF_VOXEL_AXIS_BITS) | axis(p.z);
+}
+
+static uint32 featureKey(const ppf_model& model, vec3 p1, vec3 n1, vec3 p2, vec3 n2)
+{
+	vec3 d = p2 - p1;
+	float distance = length(d);
+
+	uint32 distanceBin = (uint32)(distance / model.distanceStep);
+	if (distance < 1e-6f || distanceBin >= model.numDistanceBins)
+	{
+		return PPF_INVALID_KEY;
+	}
+
+	d *= 1.f / distance;
+
+	auto angleBin = [&model](float cosAngle)
+	{
+		float angle = acos(clamp(cosAngle, -1.f, 1.f));
+		return min((uint32)(angle / model.angleStep), model.numAngleBins - 1);
+	};
+
+	uint32 a1 = angleBin(dot(n1, d));
+	uint32 a2 = angleBin(dot(n2, d));
+	uint32 a3 = angleBin(dot(n1, n2));
+
+	return ((distanceBin * model.numAngleBins + a1) * model.numAngleBins + a2) * model.numAngleBins + a3;
+}
+
+// Rotates the normal onto the x-axis. The angle of the second point of a pair around the x-axis is then the pair's alpha.
+static quat alignNormalToX(vec3 n)
+{
+	return rotateFromTo(n, vec3(1.f, 0.f, 0.f));
+}
+
+static float pairAlpha(const mat3& alignToX, vec3 p1, vec3 p2)
+{
+	vec3 q = alignToX * (p2 - p1);
+	return atan2(q.z, q.y);
+}
+
+bool ppf_model::initialize(const cpu_triangle_mesh& mesh, vec3 scale, const ppf_settings& settings)
+{
+	CPU_PROFILE_BLOCK("Build PPF model");
+
+	if (mesh.triangles.empty())
+	{
+		LOG_ERROR("Cannot build point pair features of an empty mesh");
+		return false;
+	}
+
+	this->scale = scale;
+	meshHandle = mesh.handle;
+
+	vec3 minCorner(FLT_MAX, FLT_MAX, FLT_MAX);
+	vec3 maxCorner(-FLT_MAX, -FLT_MAX, -FLT_MAX);
+	for (const vec3& p : mesh.positions)
+	{
+		minCorner = minimum(minCorner, p * scale);
+		maxCorner = maximum(maxCorner, p * scale);
+	}
+
+	diameter = length(maxCorner - minCorner);
+	distanceStep = diameter * settings.distanceStepFraction;
+	angleStep = settings.angleStep;
+	numDistanceBins = (uint32)ceil(1.f / settings.distanceStepFraction) + 1;
+	numAngleBins = (uint32)ceil(M_PI / angleStep);
+	numAlphaBins = (uint32)ceil(2.f * M_PI / angleStep);
+
+	if (distanceStep <= 0.f)
+	{
+		LOG_ERROR("Cannot build point pair features of a degenerate mesh");
+		return false;
+	}
+
+
+	// Sample the surface densely, then keep one sample per grid cell of the sampling distance.
+	bool hasNormals = mesh.normals.size() == mesh.positions.size();
+	vec3 invScale = vec3(1.f, 1.f, 1.f) / scale;
+	float invStep = 1.f / distanceStep;
+	float areaPerSample = distanceStep * distanceStep * 0.1f;
+
+	random_number_generator rng = { 61923 };
+	std::unordered_map<uint64, uint32> occupiedCells;
+
+	points.clear();
+	normals.clear();
+
+	for (const indexed_triangle32& tri : mesh.triangles)
+	{
+		vec3 a = mesh.positions[tri.a] * scale;
+		vec3 b = mesh.positions[tri.b] * scale;
+		vec3 c = mesh.positions[tri.c] * scale;
+
+		vec3 faceNormal = cross(b - a, c - a);
+		float area = 0.5f * length(faceNormal);
+		if (area == 0.f)
+		{
+			continue;
+		}
+		faceNormal = normalize(faceNormal);
+
+		float expected = area / areaPerSample;
+		uint32 numSamples = (uint32)expected + (rng.randomFloat01() < expected - floor(expected) ? 1 : 0);
+
+		for (uint32 i = 0; i < numSamples; ++i)
+		{
+			float u = rng.randomFloat01();
+			float v = rng.randomFloat01();
+			if (u + v > 1.f)
+			{
+				u = 1.f - u;
+				v = 1.f - v;
+			}
+
+			vec3 p = a + u * (b - a) + v * (c - a);
+
+			if (!occupiedCells.emplace(voxelKey(p, invStep), (uint32)points.size()).second)
+			{
+				continue;
+			}
+
+			vec3 n = faceNormal;
+			if (hasNormals)
+			{
+				vec3 interpolated = (1.f - u - v) * mesh.normals[tri.a] + u * mesh.normals[tri.b] + v * mesh.normals[tri.c];
+				interpolated *= invScale;
+				if (squaredLength(interpolated) > 1e-12f)
+				{
+					n = normalize(interpolated);
+				}
+			}
+
+			points.push_back(p);
+			normals.push_back(n);
+		}
+	}
+
+	uint32 numPoints = (uint32)points.size();
+
+
+	// Features of all ordered pairs, computed in parallel. The table is then filled with a counting sort over the keys.
+	std::vector<uint32> keys((uint64)numPoints * numPoints);
+	std::vector<float> alphas((uint64)numPoints * numPoints);
+
+	thread_job_context context;
+	for (uint32 startI = 0; startI < numPoints; startI += 64)
+	{
+		context.addWork([this, startI, numPoints, &keys, &alphas]()
+		{
+			uint32 endI = min(startI + 64, numPoints);
+			for (uint32 i = startI; i < endI; ++i)
+			{
+				mat3 alignToX = quaternionToMat3(alignNormalToX(normals[i]));
+				for (uint32 j = 0; j < numPoints; ++j)
+				{
+					uint64 index = (uint64)i * numPoints + j;
+					keys[index] = (i == j) ? PPF_INVALID_KEY : featureKey(*this, points[i], normals[i], points[j], normals[j]);
+					alphas[index] = pairAlpha(alignToX, points[i], points[j]);
+				}
+			}
+		});
+	}
+	context.waitForWorkCompletion();
+
+	uint32 numKeys = numDistanceBins * numAngleBins * numAngleBins * numAngleBins;
+	tableOffsets.assign(numKeys + 1, 0);
+
+	for (uint32 key : keys)
+	{
+		if (key != PPF_INVALID_KEY)
+		{
+			++tableOffsets[key + 1];
+		}
+	}
+	for (uint32 k = 0; k < numKeys; ++k)
+	{
+		tableOffsets[k + 1] += tableOffsets[k];
+	}
+
+	entries.resize(tableOffsets[numKeys]);
+
+	std::vector<uint32> cursor(tableOffsets.begin(), tableOffsets.end() - 1);
+	for (uint32 i = 0; i < numPoints; ++i)
+	{
+		for (uint32 j = 0; j < numPoints; ++j)
+		{
+			uint64 index = (uint64)i * numPoints + j;
+			if (keys[index] != PPF_INVALID_KEY)
+			{
+				entries[cursor[keys[index]]++] = { i, alphas[index] };
+			}
+		}
+	}
+
+	LOG_MESSAGE("Built point pair features: %u points, %u pairs, diameter %.3fm", numPoints, (uint32)entries.size(), diameter);
+
+	return numPoints >= 2;
+}
+
+void ppf_relocalizer::sampleScene(const cpu_icp_frame& frame, float step, vec3 searchCenter, float searchRadius)
+{
+	const rgbd_camera_sensor& sensor = *frame.sensor;
+	uint32 numPixels = sensor.width * sensor.height;
+	assert((uint64)numPixels <= (1ull << PPF_SAMPLE_INDEX_BITS));
+
+	pixelNormals.resize(numPixels);
+
+	depth_preprocessing_settings normalSettings;
+	normalSettings.maxNormalDepthDifference = step;
+	preprocessor.computeNormals(frame.depth, sensor, frame.depthScale, normalSettings, pixelNormals.data());
+
+	float invStep = 1.f / step;
+	float squaredSearchRadius = searchRadius * searchRadius;
+
+	// Sorting by voxel brings the pixels of each voxel together. The first one of each is kept.
+	sampleKeys.clear();
+	for (uint32 i = 0; i < numPixels; ++i)
+	{
+		if (!frame.depth[i] || (pixelNormals[i].x == 0.f && pixelNormals[i].y == 0.f && pixelNormals[i].z == 0.f))
+		{
+			continue;
+		}
+
+		float d = frame.depth[i] * frame.depthScale;
+		vec2 u = sensor.unprojectTable[i];
+		vec3 p(u.x * d, u.y * d, -d);
+
+		if (searchRadius > 0.f && squaredLength(p - searchCenter) > squaredSearchRadius)
+		{
+			continue;
+		}
+
+		sampleKeys.push_back((voxelKey(p, invStep) << PPF_SAMPLE_INDEX_BITS) | i);
+	}
+
+	std::sort(sampleKeys.begin(), sampleKeys.end());
+
+	scenePoints.clear();
+	sceneNormals.clear();
+
+	uint64 lastVoxel = -1;
+	for (uint64 key : sampleKeys)
+	{
+		uint64 voxel = key >> PPF_SAMPLE_INDEX_BITS;
+		if (voxel == lastVoxel)
+		{
+			continue;
+		}
+		lastVoxel = voxel;
+
+		uint32 i = (uint32)(key & ((1ull << PPF_SAMPLE_INDEX_BITS) - 1));
+		float d = frame.depth[i] * frame.depthScale;
+		vec2 u = sensor.unprojectTable[i];
+
+		scenePoints.push_back(vec3(u.x * d, u.y * d, -d));
+		sceneNormals.push_back(pixelNormals[i]);
+	}
+
+	numScenePoints = (uint32)scenePoints.size();
+}
+
+static int32 gridCoordinate(float v, float invCellSize)
+{
+	return (int32)floor(v * invCellSize);
+}
+
+static uint32 gridBucket(int32 x, int32 y, int32 z, uint32 numBuckets)
+{
+	return ((uint32)x * 73856093u ^ (uint32)y * 19349663u ^ (uint32)z * 83492791u) & (numBuckets - 1);
+}
+
+struct ppf_reference_vote
+{
+	uint32 sceneIndex;
+	uint32 modelIndex;
+	uint32 alphaBin;
+	uint32 numVotes;
+};
+
+struct ppf_cluster
+{
+	quat rotation;
+	vec3 position;
+	uint32 numVotes;
+};
+
+uint32 ppf_relocalizer::findCandidates(const ppf_model& model, const cpu_icp_pyramid& pyramid, vec3 searchCenter, float searchRadius,
+	const ppf_settings& settings, ppf_candidate* outCandidates)
+{
+	CPU_PROFILE_BLOCK("PPF relocalization");
+
+	uint32 level = min(settings.sceneLevel, pyramid.numLevels - 1);
+	sampleScene(pyramid.getLevel(level), model.distanceStep, searchCenter, searchRadius);
+
+	if (numScenePoints < 2)
+	{
+		return 0;
+	}
+
+
+	// Hashed grid with cells of the model's diameter. Neighbors of a point are in its own and the 26 surrounding cells.
+	uint32 numBuckets = 1024;
+	while (numBuckets < numScenePoints)
+	{
+		numBuckets *= 2;
+	}
+
+	const float invCellSize = 1.f / model.diameter;
+
+	std::vector<uint32> pointBuckets(numScenePoints);
+	gridOffsets.assign(numBuckets + 1, 0);
+	for (uint32 i = 0; i < numScenePoints; ++i)
+	{
+		vec3 p = scenePoints[i];
+		pointBuckets[i] = gridBucket(gridCoordinate(p.x, invCellSize), gridCoordinate(p.y, invCellSize), gridCoordinate(p.z, invCellSize), numBuckets);
+		++gridOffsets[pointBuckets[i] + 1];
+	}
+	for (uint32 b = 0; b < numBuckets; ++b)
+	{
+		gridOffsets[b + 1] += gridOffsets[b];
+	}
+	gridPoints.resize(numScenePoints);
+	{
+		std::vector<uint32> cursor(gridOffsets.begin(), gridOffsets.end() - 1);
+		for (uint32 i = 0; i < numScenePoints; ++i)
+		{
+			gridPoints[cursor[pointBuckets[i]]++] = i;
+		}
+	}
+
+
+	// Each reference point votes in its own accumulator. Jobs only share read-only data.
+	uint32 stride = max(settings.sceneReferenceStride, 1u);
+	uint32 numReferences = (numScenePoints + stride - 1) / stride;
+	std::vector<ppf_reference_vote> votes(numReferences);
+
+	const uint32 numModelPoints = (uint32)model.points.size();
+	const uint32 numAlphaBins = model.numAlphaBins;
+	const float alphaBinSize = 2.f * M_PI / numAlphaBins;
+	const float squaredDiameter = model.diameter * model.diameter;
+
+	thread_job_context context;
+	for (uint32 startReference = 0; startReference < numReferences; startReference += PPF_REFERENCES_PER_JOB)
+	{
+		context.addWork([&, startReference]()
+		{
+			std::vector<uint16> accumulator(numModelPoints * numAlphaBins);
+
+			uint32 endReference = min(startReference + PPF_REFERENCES_PER_JOB, numReferences);
+			for (uint32 r = startReference; r < endReference; ++r)
+			{
+				uint32 s = r * stride;
+				vec3 sp = scenePoints[s];
+				vec3 sn = sceneNormals[s];
+				mat3 alignToX = quaternionToMat3(alignNormalToX(sn));
+
+				memset(accumulator.data(), 0, accumulator.size() * sizeof(uint16));
+
+				int32 cx = gridCoordinate(sp.x, invCellSize);
+				int32 cy = gridCoordinate(sp.y, invCellSize);
+				int32 cz = gridCoordinate(sp.z, invCellSize);
+
+				// Several cells can hash to the same bucket. Each bucket must only be visited once.
+				uint32 buckets[27];
+				uint32 numVisitedBuckets = 0;
+				for (int32 z = -1; z <= 1; ++z)
+				{
+					for (int32 y = -1; y <= 1; ++y)
+					{
+						for (int32 x = -1; x <= 1; ++x)
+						{
+							uint32 bucket = gridBucket(cx + x, cy + y, cz + z, numBuckets);
+							bool visited = false;
+							for (uint32 b = 0; b < numVisitedBuckets; ++b)
+							{
+								visited |= buckets[b] == bucket;
+							}
+							if (!visited)
+							{
+								buckets[numVisitedBuckets++] = bucket;
+							}
+						}
+					}
+				}
+
+				for (uint32 b = 0; b < numVisitedBuckets; ++b)
+				{
+					for (uint32 k = gridOffsets[buckets[b]], end = gridOffsets[buckets[b] + 1]; k < end; ++k)
+					{
+						uint32 i = gridPoints[k];
+						if (i == s || squaredLength(scenePoints[i] - sp) > squaredDiameter)
+						{
+							continue;
+						}
+
+						uint32 key = featureKey(model, sp, sn, scenePoints[i], sceneNormals[i]);
+						if (key == PPF_INVALID_KEY)
+						{
+							continue;
+						}
+
+						uint32 first = model.tableOffsets[key];
+						uint32 last = model.tableOffsets[key + 1];
+						if (first == last)
+						{
+							continue;
+						}
+
+						float sceneAlpha = pairAlpha(alignToX, sp, scenePoints[i]);
+
+						for (uint32 e = first; e < last; ++e)
+						{
+							const ppf_model::entry& entry = model.entries[e];
+
+							float alpha = sceneAlpha - entry.alpha;
+							if (alpha < -M_PI) { alpha += 2.f * M_PI; }
+							if (alpha >= M_PI) { alpha -= 2.f * M_PI; }
+
+							uint32 alphaBin = min((uint32)((alpha + M_PI) / alphaBinSize), numAlphaBins - 1);
+							uint16& count = accumulator[entry.referenceIndex * numAlphaBins + alphaBin];
+							count += (count != 0xFFFF);
+						}
+					}
+				}
+
+				uint32 best = 0;
+				for (uint32 a = 1; a < (uint32)accumulator.size(); ++a)
+				{
+					if (accumulator[a] > accumulator[best])
+					{
+						best = a;
+					}
+				}
+
+				votes[r] = { s, best / numAlphaBins, best % numAlphaBins, accumulator[best] };
+			}
+		});
+	}
+	context.waitForWorkCompletion();
+
+
+	// Cluster the hypotheses of all reference points, strongest first.
+	std::sort(votes.begin(), votes.end(), [](const ppf_reference_vote& a, const ppf_reference_vote& b) { return a.numVotes > b.numVotes; });
+
+	const float clusterDistance = settings.clusterDistanceFraction * model.diameter;
+	const float cosHalfClusterAngle = cos(0.5f * settings.clusterAngle);
+
+	std::vector<ppf_cluster> clusters;
+	for (const ppf_reference_vote& vote : votes)
+	{
+		if (!vote.numVotes)
+		{
+			break;
+		}
+
+		// The pose, which maps the model reference point and its neighbor onto the scene pair.
+		vec3 sp = scenePoints[vote.sceneIndex];
+		vec3 mp = model.points[vote.modelIndex];
+		float alpha = -M_PI + (vote.alphaBin + 0.5f) * alphaBinSize;
+
+		quat rotation = conjugate(alignNormalToX(sceneNormals[vote.sceneIndex])) * quat(vec3(1.f, 0.f, 0.f), alpha) * alignNormalToX(model.normals[vote.modelIndex]);
+		vec3 position = sp - rotation * mp;
+
+		bool merged = false;
+		for (ppf_cluster& cluster : clusters)
+		{
+			if (length(cluster.position - position) < clusterDistance && abs(dot(cluster.rotation.v4, rotation.v4)) > cosHalfClusterAngle)
+			{
+				cluster.numVotes += vote.numVotes;
+				merged = true;
+				break;
+			}
+		}
+
+		if (!merged)
+		{
+			clusters.push_back({ rotation, position, vote.numVotes });
+		}
+	}
+
+	std::sort(clusters.begin(), clusters.end(), [](const ppf_cluster& a, const ppf_cluster& b) { return a.numVotes > b.numVotes; });
+
+	uint32 numCandidates = min((uint32)clusters.size(), min(settings.maxNumCandidates, (uint32)PPF_MAX_NUM_CANDIDATES));
+	for (uint32 i = 0; i < numCandidates; ++i)
+	{
+		outCandidates[i] = { createModelMatrix(clusters[i].position, clusters[i].rotation, model.scale), clusters[i].numVotes };
+	}
+
+	return numCandidates;
+}
+
+void benchmarkPPFRelocalization(const cpu_triangle_mesh& mesh)
+{
+	const uint32 numTrials = 20;
+
+	synthetic_depth_camera camera;
+
+	ppf_settings settings;
+	ppf_model model;
+
+	auto buildStart = std::chrono::high_resolution_clock::now();
+	if (!model.initialize(mesh, vec3(1.f, 1.f, 1.f), settings))
+	{
+		return;
+	}
+	auto buildEnd = std::chrono::high_resolution_clock::now();
+	double buildMS = std::chrono::duration<double, std::milli>(buildEnd - buildStart).count();
+
+	ppf_relocalizer relocalizer;
+	cpu_icp_pyramid pyramid;
+	cpu_icp icp;
+
+	cpu_icp_tracking_settings trackingSettings;
+	trackingSettings.thresholds = camera.defaultThresholds();
+
+	random_number_generator rng = { 5173 };
+
+	double searchMS = 0.0;
+	double refineMS = 0.0;
+	uint64 numScenePoints = 0;
+	pose_error_stats successes; // Trials which ended up close to the ground truth.
+
+	for (uint32 trial = 0; trial < numTrials; ++trial)
+	{
+		mat4 groundTruth;
+		float radius;
+		if (!camera.placeInView(mesh, rng.randomRotation(), groundTruth, radius))
+		{
+			return;
+		}
+		groundTruth = createModelMatrix(vec3(rng.randomFloatBetween(-1.f, 1.f), rng.randomFloatBetween(-1.f, 1.f), 0.f) * radius, quat::identity) * groundTruth;
+
+		cpu_icp_frame frame = camera.capture(mesh, groundTruth);
+		pyramid.build(frame.depth, camera.sensor, camera.depthScale, CPU_ICP_MAX_NUM_PYRAMID_LEVELS);
+
+		auto searchStart = std::chrono::high_resolution_clock::now();
+
+		ppf_candidate candidates[PPF_MAX_NUM_CANDIDATES];
+		uint32 numCandidates = relocalizer.findCandidates(model, pyramid, vec3(0.f, 0.f, 0.f), 0.f, settings, candidates);
+
+		auto refineStart = std::chrono::high_resolution_clock::now();
+
+		cpu_icp_tracking_result best = {};
+		for (uint32 i = 0; i < numCandidates; ++i)
+		{
+			cpu_icp_tracking_result result = icp.track(pyramid, mesh, candidates[i].modelView, trackingSettings);
+			if (result.valid && (!best.valid || result.numCorrespondences > best.numCorrespondences))
+			{
+				best = result;
+			}
+		}
+
+		auto end = std::chrono::high_resolution_clock::now();
+
+		searchMS += std::chrono::duration<double, std::milli>(refineStart - searchStart).count();
+		refineMS += std::chrono::duration<double, std::milli>(end - refineStart).count();
+		numScenePoints += relocalizer.numScenePoints;
+
+		if (best.valid)
+		{
+			auto [positionError, angleError] = poseError(best.modelView, groundTruth);
+			if (positionError < model.distanceStep && angleError < 5.f)
+			{
+				successes.add(positionError, angleError);
+			}
+		}
+	}
+
+	LOG_MESSAGE("PPF relocalization benchmark (%u triangles): Model with %u points and %u pairs built in %.1fms",
+		(uint32)mesh.triangles.size(), (uint32)model.points.size(), (uint32)model.entries.size(), buildMS);
+	LOG_MESSAGE("PPF relocalization benchmark (%u trials): %u relocalized, %.0f scene points, search %.1fms, ICP refinement of the candidates %.1fms",
+		numTrials, successes.count, (double)numScenePoints / numTrials, searchMS / numTrials, refineMS / numTrials);
+	if (successes.count)
+	{
+		LOG_MESSAGE("PPF relocalization benchmark: Mean error after refinement %.2fmm/%.3f deg",
+			successes.meanPositionError() * 1000.f, successes.meanAngleError());
+	}
+}
@@ -0,0 +1,104 @@
+#pragma once
+
+#include "cpu_icp.h"
+#include "depth_preprocessing.h"
+#include "core/asset.h"
+
+struct cpu_triangle_mesh;
+
+#define PPF_MAX_NUM_CANDIDATES 16
+
+struct ppf_settings
+{
+	// Sampling distance of model and scene, and bin size of the pair distance. Relative to the model's diameter.
+	float distanceStepFraction = 0.05f;
+
+	// Bin size of the angles of the features and of the rotation around the normal.
+	float angleStep = deg2rad(12.f);
+
+	// Every n-th scene point is used as a reference point and votes with all its neighbors.
+	uint32 sceneReferenceStride = 5;
+
+	// Pyramid level of the depth frame, which the scene points are sampled from.
+	uint32 sceneLevel = 1;
+
+	// Votes of poses closer than this are summed up.
+	float clusterDistanceFraction = 0.1f; // Relative to the model's diameter.
+	float clusterAngle = deg2rad(15.f);
+
+	uint32 maxNumCandidates = 5;
+};
+
+struct ppf_candidate
+{
+	mat4 modelView;
+	uint32 numVotes;
+};
+
+/*
+	Point pair features (Drost et al., "Model Globally, Match Locally: Efficient and Robust 3D Object Recognition", 2010).
+
+	The feature of two oriented points is their distance and the three angles between their normals and the line connecting them. It does
+	not change under rigid motion. The model precomputes the features of all pairs of points sampled from its surface and stores them in a
+	hash table, keyed by the quantized feature.
+	A scene pair, which matches a model pair, fixes the pose up to the rotation around the reference point's normal. Each scene reference
+	point therefore votes for (model point, rotation angle) in a small 2D accumulator, and the peak gives one pose hypothesis. Hypotheses of
+	all reference points are clustered, and the clusters with the most votes are returned as candidates. These are rough (about one
+	sampling step and one angle step), so they are handed to the ICP for refinement and verification.
+*/
+struct ppf_model
+{
+	// The scale is applied to the mesh before sampling, since features depend on metric distances.
+	bool initialize(const cpu_triangle_mesh& mesh, vec3 scale, const ppf_settings& settings);
+
+	std::vector<vec3> points;
+	std::vector<vec3> normals;
+
+	vec3 scale;
+	float diameter;
+	float distanceStep;
+	float angleStep;
+	uint32 numDistanceBins;
+	uint32 numAngleBins; // For the feature angles in [0, pi].
+	uint32 numAlphaBins; // For the rotation around the normal in [-pi, pi].
+
+	struct entry
+	{
+		uint32 referenceIndex;
+		float alpha; // Angle of the second point around the reference normal.
+	};
+
+	// Entries of feature key k are entries[tableOffsets[k]] to entries[tableOffsets[k + 1]].
+	std::vector<uint32> tableOffsets;
+	std::vector<entry> entries;
+
+	asset_handle meshHandle;
+};
+
+struct ppf_relocalizer
+{
+	// Scene points are taken from the frame's depth sensor space, and only within the search radius around the center, if the radius is
+	// positive. The candidates are model views (including the model's scale), sorted by votes. Returns the number of candidates.
+	uint32 findCandidates(const ppf_model& model, const cpu_icp_pyramid& pyramid, vec3 searchCenter, float searchRadius,
+		const ppf_settings& settings, ppf_candidate* outCandidates);
+
+	uint32 numScenePoints = 0; // Of the last search.
+
+private:
+	void sampleScene(const cpu_icp_frame& frame, float step, vec3 searchCenter, float searchRadius);
+
+	depth_preprocessor preprocessor;
+	std::vector<vec3> pixelNormals;
+
+	std::vector<vec3> scenePoints;
+	std::vector<vec3> sceneNormals;
+	std::vector<uint64> sampleKeys;
+
+	// Scene points sorted into a hashed grid with cells of the model's diameter, for finding the neighbors of each reference point.
+	std::vector<uint32> gridOffsets;
+	std::vector<uint32> gridPoints;
+};
+
+// Renders the mesh at random orientations, searches it in the whole synthetic frame and refines the best candidates with the CPU ICP.
+// Logs the success rate, the time to find the candidates and the remaining pose error.
+void benchmarkPPFRelocalization(const cpu_triangle_mesh& mesh);
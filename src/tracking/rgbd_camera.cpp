@@ -1,11 +1,15 @@
 #include "pch.h"
 #include "rgbd_camera.h"
+#include "rgbd_recording.h"
+#include "motion_to_photon.h"
 #include "core/log.h"
 
 #include <azure-kinect/k4a.h>
 #include <realsense/rs.h>
 #include <realsense/h/rs_pipeline.h>
 
+#include <chrono>
+
 
 static rs2_context* rsContext;
 
@@ -133,7 +137,11 @@ void rgbd_camera::operator=(rgbd_camera&& o) noexcept
     realsense = o.realsense;
     o.realsense = {};
 
+    recording = std::move(o.recording);
+    o.recording = {};
+
     alignDepthToColor = o.alignDepthToColor;
+    depthScale = o.depthScale;
     
     depthSensor = o.depthSensor;
     colorSensor = o.colorSensor;
@@ -361,10 +369,10 @@ bool rgbd_camera::initializeAzure(uint32 deviceIndex, bool alignDepthToColor)
             createUnprojectTable(calibration, colorSensor.unprojectTable, false);
 
 
+            azure.alignTransform = k4a_transformation_create(&calibration);
+
             if (alignDepthToColor)
             {
-                azure.alignTransform = k4a_transformation_create(&calibration);
-
                 delete[] depthSensor.unprojectTable;
 
                 colorSensor.position = vec3(0.f, 0.f, 0.f);
@@ -558,6 +566,102 @@ bool rgbd_camera::initializeRealsense(uint32 deviceIndex, bool alignDepthToColor
     return false;
 }
 
+static bool readRecordingSensor(const uint8* base, uint64 fileSize, const rgbd_recording_sensor& in, rgbd_camera_sensor& out)
+{
+    out.active = in.active;
+    out.width = in.width;
+    out.height = in.height;
+    out.rotation = in.rotation;
+    out.position = in.position;
+    out.intrinsics = in.intrinsics;
+    out.distortion = in.distortion;
+    out.unprojectTable = 0;
+
+    if (!in.active)
+    {
+        return true;
+    }
+
+    uint64 tableSize = (uint64)in.width * in.height * sizeof(vec2);
+    if (in.unprojectTableOffset + tableSize > fileSize)
+    {
+        return false;
+    }
+
+    // The tables are small, so they are copied. This keeps ownership the same as for the live cameras.
+    out.unprojectTable = new vec2[in.width * in.height];
+    memcpy(out.unprojectTable, base + in.unprojectTableOffset, tableSize);
+    return true;
+}
+
+bool rgbd_camera::initializeRecording(const fs::path& path, bool realTimePlayback, bool loop)
+{
+    shutdown();
+
+    recording.file = CreateFileW(path.c_str(), GENERIC_READ, FILE_SHARE_READ, 0, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL | FILE_FLAG_SEQUENTIAL_SCAN, 0);
+    if (recording.file == INVALID_HANDLE_VALUE)
+    {
+        LOG_ERROR("Could not open recording '%ws'", path.c_str());
+        return false;
+    }
+
+    LARGE_INTEGER fileSize;
+    GetFileSizeEx(recording.file, &fileSize);
+
+    recording.mapping = CreateFileMappingW(recording.file, 0, PAGE_READONLY, 0, 0, 0);
+    if (recording.mapping)
+    {
+        recording.base = (const uint8*)MapViewOfFile(recording.mapping, FILE_MAP_READ, 0, 0, 0);
+    }
+
+    const rgbd_recording_header* header = (const rgbd_recording_header*)recording.base;
+
+    bool valid = recording.base
+        && (uint64)fileSize.QuadPart >= sizeof(rgbd_recording_header)
+        && header->magic == RGBD_RECORDING_MAGIC
+        && header->version == RGBD_RECORDING_VERSION
+        && header->numFrames > 0
+        && header->firstFrameOffset + header->numFrames * header->frameStride <= (uint64)fileSize.QuadPart;
+
+    valid = valid && readRecordingSensor(recording.base, fileSize.QuadPart, header->depthSensor, depthSensor);
+    valid = valid && readRecordingSensor(recording.base, fileSize.QuadPart, header->colorSensor, colorSensor);
+
+    if (!valid)
+    {
+        LOG_ERROR("File '%ws' is not a valid RGB-D recording", path.c_str());
+
+        // Shutdown only cleans up the type it was initialized as.
+        info.type = rgbd_camera_type_recording;
+        alignDepthToColor = false;
+        shutdown();
+        return false;
+    }
+
+    alignDepthToColor = header->alignDepthToColor;
+    if (alignDepthToColor && colorSensor.active)
+    {
+        // Same sharing as for the live cameras, see shutdown.
+        delete[] depthSensor.unprojectTable;
+        depthSensor.unprojectTable = colorSensor.unprojectTable;
+    }
+
+    depthScale = header->depthScale;
+
+    recording.path = path;
+    recording.header = header;
+    recording.nextFrame = 0;
+    recording.realTimePlayback = realTimePlayback;
+    recording.loop = loop;
+    recording.playbackStartInMicroseconds = -1;
+
+    info.deviceIndex = 0;
+    info.type = rgbd_camera_type_recording;
+    info.serialNumber = "";
+    info.description = "Recording (" + path.filename().string() + ", " + std::to_string(header->numFrames) + " frames)";
+
+    return true;
+}
+
 bool rgbd_camera::initializeAs(rgbd_camera_type type, uint32 deviceIndex, bool alignDepthToColor)
 {
     switch (type)
@@ -566,6 +670,12 @@ bool rgbd_camera::initializeAs(rgbd_camera_type type, uint32 deviceIndex, bool a
             return initializeAzure(deviceIndex, alignDepthToColor);
         case rgbd_camera_type_realsense:
             return initializeRealsense(deviceIndex, alignDepthToColor);
+        case rgbd_camera_type_recording:
+        {
+            // Reopens the last recording. The alignment is fixed by the file.
+            fs::path path = recording.path;
+            return !path.empty() && initializeRecording(path, recording.realTimePlayback, recording.loop);
+        }
         default:
             return false;
     }
@@ -578,9 +688,10 @@ void rgbd_camera::shutdown()
         k4a_device_close(azure.deviceHandle);
         azure.deviceHandle = 0;
 
-        if (alignDepthToColor)
+        if (azure.alignTransform)
         {
             k4a_transformation_destroy(azure.alignTransform);
+            azure.alignTransform = 0;
         }
     }
     else if (info.type == rgbd_camera_type_realsense && realsense.device)
@@ -600,6 +711,26 @@ void rgbd_camera::shutdown()
         }
         realsense.device = 0;
     }
+    else if (info.type == rgbd_camera_type_recording)
+    {
+        if (recording.base)
+        {
+            UnmapViewOfFile(recording.base);
+        }
+        if (recording.mapping)
+        {
+            CloseHandle(recording.mapping);
+        }
+        if (recording.file != INVALID_HANDLE_VALUE)
+        {
+            CloseHandle(recording.file);
+        }
+
+        recording.base = 0;
+        recording.mapping = 0;
+        recording.file = INVALID_HANDLE_VALUE;
+        recording.header = 0;
+    }
 
     if (depthSensor.unprojectTable)
     {
@@ -625,9 +756,12 @@ bool rgbd_camera::getFrame(rgbd_frame& result, int32 timeOutInMilliseconds)
 
         if (k4a_device_get_capture(azure.deviceHandle, &captureHandle, timeOutInMilliseconds) == K4A_WAIT_RESULT_SUCCEEDED)
         {
+            result.hostTimestampInMicroseconds = getLatencyTimeInMicroseconds();
+
             if (depthSensor.active)
             {
                 result.azureDepthHandle = k4a_capture_get_depth_image(captureHandle);
+                result.deviceTimestampInMicroseconds = k4a_image_get_device_timestamp_usec(result.azureDepthHandle);
 
                 if (alignDepthToColor)
                 {
@@ -672,6 +806,8 @@ bool rgbd_camera::getFrame(rgbd_frame& result, int32 timeOutInMilliseconds)
 
         if (newFrames)
         {
+            result.hostTimestampInMicroseconds = getLatencyTimeInMicroseconds();
+
             if (alignDepthToColor)
             {
                 rs2_process_frame(realsense.align, frames, &e);
@@ -693,6 +829,7 @@ bool rgbd_camera::getFrame(rgbd_frame& result, int32 timeOutInMilliseconds)
                 {
                     result.realsenseDepthHandle = frame;
                     result.depth = (uint16*)rs2_get_frame_data(frame, &e);
+                    result.deviceTimestampInMicroseconds = (uint64)(rs2_get_frame_timestamp(frame, &e) * 1000.0);
                 }
                 else
                 {
@@ -707,10 +844,81 @@ bool rgbd_camera::getFrame(rgbd_frame& result, int32 timeOutInMilliseconds)
             return true;
         }
     }
+    else if (info.type == rgbd_camera_type_recording && recording.header)
+    {
+        const rgbd_recording_header* header = recording.header;
+
+        if (recording.nextFrame >= header->numFrames)
+        {
+            if (!recording.loop)
+            {
+                return false;
+            }
+            recording.nextFrame = 0;
+            recording.playbackStartInMicroseconds = -1;
+        }
+
+        const uint8* chunk = recording.base + header->firstFrameOffset + recording.nextFrame * header->frameStride;
+        const rgbd_recording_frame_header* frameHeader = (const rgbd_recording_frame_header*)chunk;
+
+        if (recording.realTimePlayback)
+        {
+            auto now = []() { return (int64)std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now().time_since_epoch()).count(); };
+
+            const rgbd_recording_frame_header* firstFrameHeader = (const rgbd_recording_frame_header*)(recording.base + header->firstFrameOffset);
+            int64 due = (int64)(frameHeader->timestampInMicroseconds - firstFrameHeader->timestampInMicroseconds);
+
+            if (recording.playbackStartInMicroseconds < 0)
+            {
+                recording.playbackStartInMicroseconds = now() - due;
+            }
+
+            int64 wait = due - (now() - recording.playbackStartInMicroseconds);
+            if (wait > 0)
+            {
+                if (wait > (int64)timeOutInMilliseconds * 1000)
+                {
+                    return false;
+                }
+                Sleep((DWORD)((wait + 999) / 1000));
+            }
+        }
+
+        result.depth = depthSensor.active ? (uint16*)(chunk + header->depthOffsetInFrame) : 0;
+        result.deviceTimestampInMicroseconds = frameHeader->timestampInMicroseconds;
+        result.hostTimestampInMicroseconds = getLatencyTimeInMicroseconds();
+        result.color = colorSensor.active ? (color_bgra*)(chunk + header->colorOffsetInFrame) : 0;
+
+        ++recording.nextFrame;
+
+        return true;
+    }
 
     return false;
 }
 
+bool rgbd_camera::alignDepthToColorWithSDK(const rgbd_frame& frame, uint16* outDepth)
+{
+    if (info.type != rgbd_camera_type_azure || alignDepthToColor || !azure.alignTransform || !frame.azureDepthHandle)
+    {
+        return false;
+    }
+
+    uint32 stride = colorSensor.width * sizeof(uint16);
+
+    k4a_image_t alignedDepth;
+    if (k4a_image_create_from_buffer(K4A_IMAGE_FORMAT_DEPTH16, colorSensor.width, colorSensor.height, stride,
+        (uint8_t*)outDepth, stride * colorSensor.height, 0, 0, &alignedDepth) != K4A_RESULT_SUCCEEDED)
+    {
+        return false;
+    }
+
+    bool success = k4a_transformation_depth_image_to_color_camera(azure.alignTransform, frame.azureDepthHandle, alignedDepth) == K4A_RESULT_SUCCEEDED;
+    k4a_image_release(alignedDepth);
+
+    return success;
+}
+
 void rgbd_camera::releaseFrame(rgbd_frame& frame)
 {
     if (info.type == rgbd_camera_type_azure)
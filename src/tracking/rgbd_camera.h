@@ -8,6 +8,7 @@ enum rgbd_camera_type
 	rgbd_camera_type_uninitialized,
 	rgbd_camera_type_azure,
 	rgbd_camera_type_realsense,
+	rgbd_camera_type_recording,
 };
 
 static const char* rgbdCameraTypeNames[] =
@@ -15,6 +16,7 @@ static const char* rgbdCameraTypeNames[] =
 	"Uninitialized",
 	"Azure",
 	"Realsense",
+	"Recording",
 };
 
 struct rgbd_camera_info
@@ -35,6 +37,9 @@ struct rgbd_frame
 	uint16* depth = 0;
 	color_bgra* color = 0;
 
+	uint64 deviceTimestampInMicroseconds = 0; // Camera clock at exposure. For recordings, the recorded timestamp.
+	int64 hostTimestampInMicroseconds = 0; // Host clock (see getLatencyTimeInMicroseconds), when the frame was received.
+
 private:
 	struct _k4a_image_t* azureDepthHandle = 0;
 	struct _k4a_image_t* azureColorHandle = 0;
@@ -83,7 +88,7 @@ struct azure_handle
 {
 	struct _k4a_device_t* deviceHandle = 0;
 
-	struct _k4a_transformation_t* alignTransform;
+	struct _k4a_transformation_t* alignTransform = 0; // Created whenever the color sensor is active, see alignDepthToColorWithSDK.
 };
 
 struct realsense_handle
@@ -102,6 +107,22 @@ struct realsense_handle
 	float laserPowerMax = 1.f;
 };
 
+struct recording_handle
+{
+	fs::path path;
+
+	HANDLE file = INVALID_HANDLE_VALUE;
+	HANDLE mapping = 0;
+	const uint8* base = 0;
+
+	const struct rgbd_recording_header* header = 0;
+	uint32 nextFrame = 0;
+
+	bool realTimePlayback = true; // If false, frames are returned as fast as they are requested.
+	bool loop = true;
+	int64 playbackStartInMicroseconds = -1;
+};
+
 struct rgbd_camera
 {
 	rgbd_camera() = default;
@@ -115,6 +136,9 @@ struct rgbd_camera
 	bool initializeAs(rgbd_camera_type type, uint32 deviceIndex = 0, bool alignDepthToColor = true);
 	bool initializeAzure(uint32 deviceIndex = 0, bool alignDepthToColor = true);
 	bool initializeRealsense(uint32 deviceIndex = 0, bool alignDepthToColor = true);
+
+	// Replays a file written by rgbd_recorder. Frames point directly into the memory mapped file and must not be written to.
+	bool initializeRecording(const fs::path& path, bool realTimePlayback = true, bool loop = true);
 	void shutdown();
 
 	bool isInitialized() { return info.type != rgbd_camera_type_uninitialized; }
@@ -122,10 +146,15 @@ struct rgbd_camera
 	bool getFrame(rgbd_frame& result, int32 timeOutInMilliseconds = 0); // 0: Return immediately.
 	void releaseFrame(rgbd_frame& frame);
 
+	// Aligns the depth of an unaligned frame to the color sensor with the vendor SDK. Only for comparison with depth_registration.
+	// outDepth has the color sensor's resolution. Returns false, if the camera does not support this (only Azure does).
+	bool alignDepthToColorWithSDK(const rgbd_frame& frame, uint16* outDepth);
+
 	void toggleIRProjector();
 
 	azure_handle azure;
 	realsense_handle realsense;
+	recording_handle recording;
 
 	rgbd_camera_info info;
 
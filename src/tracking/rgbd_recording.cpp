@@ -0,0 +1,145 @@
+#include "pch.h"
+#include "rgbd_recording.h"
+#include "core/memory.h"
+#include "core/log.h"
+
+
+static rgbd_recording_sensor getRecordingSensor(const rgbd_camera_sensor& sensor)
+{
+	rgbd_recording_sensor result = {};
+	result.active = sensor.active;
+	result.width = sensor.width;
+	result.height = sensor.height;
+	result.rotation = sensor.rotation;
+	result.position = sensor.position;
+	result.intrinsics = sensor.intrinsics;
+	result.distortion = sensor.distortion;
+	return result;
+}
+
+static bool writePadding(FILE* file, uint64 alignment)
+{
+	static const uint8 zeros[RGBD_RECORDING_CHUNK_ALIGNMENT] = {};
+
+	uint64 offset = (uint64)_ftelli64(file);
+	uint64 padding = alignTo(offset, alignment) - offset;
+	return fwrite(zeros, 1, padding, file) == padding;
+}
+
+bool rgbd_recorder::begin(const fs::path& path, const rgbd_camera& camera)
+{
+	end();
+
+	if (camera.info.type == rgbd_camera_type_uninitialized || !camera.depthSensor.active)
+	{
+		LOG_ERROR("Cannot record camera without an active depth sensor");
+		return false;
+	}
+
+	file = _wfopen(path.c_str(), L"wb");
+	if (!file)
+	{
+		LOG_ERROR("Could not open file '%ws' for recording", path.c_str());
+		return false;
+	}
+
+	header = {};
+	header.magic = RGBD_RECORDING_MAGIC;
+	header.version = RGBD_RECORDING_VERSION;
+	header.depthSensor = getRecordingSensor(camera.depthSensor);
+	header.colorSensor = getRecordingSensor(camera.colorSensor);
+	header.depthScale = camera.depthScale;
+	header.alignDepthToColor = camera.alignDepthToColor;
+
+	uint64 depthTableSize = (uint64)camera.depthSensor.width * camera.depthSensor.height * sizeof(vec2);
+	uint64 colorTableSize = (uint64)camera.colorSensor.width * camera.colorSensor.height * sizeof(vec2);
+	uint64 depthImageSize = (uint64)camera.depthSensor.width * camera.depthSensor.height * sizeof(uint16);
+	uint64 colorImageSize = header.colorSensor.active ? (uint64)camera.colorSensor.width * camera.colorSensor.height * sizeof(color_bgra) : 0;
+
+	header.depthSensor.unprojectTableOffset = alignTo((uint64)sizeof(rgbd_recording_header), (uint64)RGBD_RECORDING_CHUNK_ALIGNMENT);
+	header.colorSensor.unprojectTableOffset = header.colorSensor.active ? alignTo(header.depthSensor.unprojectTableOffset + depthTableSize, (uint64)RGBD_RECORDING_CHUNK_ALIGNMENT) : 0;
+
+	uint64 tablesEnd = header.colorSensor.active ? header.colorSensor.unprojectTableOffset + colorTableSize : header.depthSensor.unprojectTableOffset + depthTableSize;
+
+	header.firstFrameOffset = alignTo(tablesEnd, (uint64)RGBD_RECORDING_CHUNK_ALIGNMENT);
+	header.depthOffsetInFrame = 64;
+	header.colorOffsetInFrame = header.colorSensor.active ? alignTo(header.depthOffsetInFrame + depthImageSize, (uint64)64) : 0;
+	header.frameStride = alignTo(header.colorSensor.active ? header.colorOffsetInFrame + colorImageSize : header.depthOffsetInFrame + depthImageSize, (uint64)RGBD_RECORDING_CHUNK_ALIGNMENT);
+
+	bool success = fwrite(&header, sizeof(header), 1, file) == 1;
+
+	success &= writePadding(file, RGBD_RECORDING_CHUNK_ALIGNMENT);
+	success &= fwrite(camera.depthSensor.unprojectTable, 1, depthTableSize, file) == depthTableSize;
+
+	if (header.colorSensor.active)
+	{
+		success &= writePadding(file, RGBD_RECORDING_CHUNK_ALIGNMENT);
+		success &= fwrite(camera.colorSensor.unprojectTable, 1, colorTableSize, file) == colorTableSize;
+	}
+
+	success &= writePadding(file, RGBD_RECORDING_CHUNK_ALIGNMENT);
+
+	if (!success)
+	{
+		LOG_ERROR("Failed to write header of recording '%ws'", path.c_str());
+		fclose(file);
+		file = 0;
+		return false;
+	}
+
+	chunk.assign(header.frameStride, 0);
+
+	LOG_MESSAGE("Started recording to '%ws'", path.c_str());
+
+	return true;
+}
+
+bool rgbd_recorder::addFrame(const uint16* depth, const color_bgra* color, uint64 timestampInMicroseconds)
+{
+	if (!file || !depth)
+	{
+		return false;
+	}
+
+	// Assemble the chunk in memory, so that each frame is a single write.
+	rgbd_recording_frame_header frameHeader = { timestampInMicroseconds };
+	memcpy(chunk.data(), &frameHeader, sizeof(frameHeader));
+
+	memcpy(chunk.data() + header.depthOffsetInFrame, depth, (uint64)header.depthSensor.width * header.depthSensor.height * sizeof(uint16));
+
+	if (header.colorSensor.active)
+	{
+		uint64 colorImageSize = (uint64)header.colorSensor.width * header.colorSensor.height * sizeof(color_bgra);
+		if (color)
+		{
+			memcpy(chunk.data() + header.colorOffsetInFrame, color, colorImageSize);
+		}
+		else
+		{
+			memset(chunk.data() + header.colorOffsetInFrame, 0, colorImageSize);
+		}
+	}
+
+	if (fwrite(chunk.data(), 1, chunk.size(), file) != chunk.size())
+	{
+		LOG_ERROR("Failed to write frame to recording, stopping");
+		end();
+		return false;
+	}
+
+	++header.numFrames;
+	return true;
+}
+
+void rgbd_recorder::end()
+{
+	if (file)
+	{
+		_fseeki64(file, 0, SEEK_SET);
+		fwrite(&header, sizeof(header), 1, file);
+		fclose(file);
+		file = 0;
+
+		LOG_MESSAGE("Finished recording with %u frames", header.numFrames);
+	}
+}
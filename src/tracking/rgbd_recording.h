@@ -0,0 +1,79 @@
+#pragma once
+
+#include "rgbd_camera.h"
+
+/*
+	File layout of RGB-D recordings:
+
+	rgbd_recording_header
+	Depth unproject table		(aligned to RGBD_RECORDING_CHUNK_ALIGNMENT)
+	Color unproject table		(aligned to RGBD_RECORDING_CHUNK_ALIGNMENT, only if color is recorded)
+	Frame chunks				(each RGBD_RECORDING_CHUNK_ALIGNMENT aligned and frameStride bytes long)
+
+	A frame chunk starts with an rgbd_recording_frame_header, followed by the depth and color images at fixed offsets.
+	All offsets are page aligned, so that the whole file can be memory mapped and frames handed out without copying.
+*/
+
+#define RGBD_RECORDING_MAGIC 0x44424752 // 'RGBD'.
+#define RGBD_RECORDING_VERSION 1
+#define RGBD_RECORDING_CHUNK_ALIGNMENT 4096
+#define RGBD_RECORDING_EXTENSION "rgbd"
+
+struct rgbd_recording_sensor
+{
+	uint32 active;
+	uint32 width;
+	uint32 height;
+
+	quat rotation;
+	vec3 position;
+
+	camera_intrinsics intrinsics;
+	camera_distortion distortion;
+
+	uint64 unprojectTableOffset;
+};
+
+struct rgbd_recording_header
+{
+	uint32 magic;
+	uint32 version;
+
+	rgbd_recording_sensor depthSensor;
+	rgbd_recording_sensor colorSensor;
+
+	float depthScale;
+	uint32 alignDepthToColor;
+
+	uint32 numFrames; // Written when the recording is finished.
+	uint64 firstFrameOffset;
+	uint64 frameStride;
+	uint64 depthOffsetInFrame;
+	uint64 colorOffsetInFrame;
+};
+
+struct rgbd_recording_frame_header
+{
+	uint64 timestampInMicroseconds;
+};
+
+
+// Records frames of a running camera. Frames are written sequentially as they come in.
+struct rgbd_recorder
+{
+	rgbd_recorder() = default;
+	rgbd_recorder(const rgbd_recorder&) = delete;
+	~rgbd_recorder() { end(); }
+
+	bool begin(const fs::path& path, const rgbd_camera& camera);
+	bool addFrame(const uint16* depth, const color_bgra* color, uint64 timestampInMicroseconds); // Color may be null.
+	void end(); // Finalizes the file. Called automatically on destruction.
+
+	bool isRecording() const { return file != 0; }
+	uint32 getNumFrames() const { return header.numFrames; }
+
+private:
+	FILE* file = 0;
+	rgbd_recording_header header;
+	std::vector<uint8> chunk;
+};
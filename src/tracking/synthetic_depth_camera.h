@@ -0,0 +1,190 @@
+#pragma once
+
+#include "cpu_icp.h"
+#include "geometry/mesh.h"
+#include "rendering/software_rasterizer.h"
+#include "core/log.h"
+
+#include <chrono>
+
+// Shared by the CPU tracking benchmarks.
+
+// Position (meters) and angle (degrees) between two poses.
+static std::pair<float, float> poseError(const mat4& a, const mat4& b)
+{
+	trs ta = mat4ToTRS(a);
+	trs tb = mat4ToTRS(b);
+	float angle = 2.f * acos(min(abs(dot(ta.rotation.v4, tb.rotation.v4)), 1.f));
+	return { length(ta.position - tb.position), rad2deg(angle) };
+}
+
+static vec3 getMeshCenter(const cpu_triangle_mesh& mesh)
+{
+	vec3 center(0.f, 0.f, 0.f);
+	for (const vec3& p : mesh.positions)
+	{
+		center += p;
+	}
+	return center * (1.f / max((uint32)mesh.positions.size(), 1u));
+}
+
+static float getMeshRadius(const cpu_triangle_mesh& mesh)
+{
+	vec3 center = getMeshCenter(mesh);
+
+	float radius = 0.f;
+	for (const vec3& p : mesh.positions)
+	{
+		radius = max(radius, length(p - center));
+	}
+	return radius;
+}
+
+// Depth camera for the benchmarks, roughly the Azure Kinect's narrow field of view depth mode, without distortion.
+struct synthetic_depth_camera
+{
+	rgbd_camera_sensor sensor = {};
+	std::vector<vec2> unprojectTable;
+
+	image<vec4> rendered;
+	std::vector<uint16> depth;
+	const float depthScale = 0.001f;
+
+	synthetic_depth_camera()
+	{
+		sensor.active = true;
+		sensor.width = 640;
+		sensor.height = 576;
+		sensor.rotation = quat::identity;
+		sensor.position = vec3(0.f, 0.f, 0.f);
+		sensor.intrinsics = { 504.f, 504.f, 320.f, 288.f };
+		memset(&sensor.distortion, 0, sizeof(sensor.distortion));
+
+		unprojectTable.resize(sensor.width * sensor.height);
+		for (uint32 y = 0, i = 0; y < sensor.height; ++y)
+		{
+			for (uint32 x = 0; x < sensor.width; ++x, ++i)
+			{
+				// Pixel centers, like the software rasterizer samples them. Otherwise the unprojected ground truth is off by half a pixel.
+				unprojectTable[i] = vec2((x + 0.5f - sensor.intrinsics.cx) / sensor.intrinsics.fx, -(y + 0.5f - sensor.intrinsics.cy) / sensor.intrinsics.fy);
+			}
+		}
+		sensor.unprojectTable = unprojectTable.data();
+
+		rendered.resize(sensor.width, sensor.height);
+		depth.resize(sensor.width * sensor.height);
+	}
+
+	// Renders the model and quantizes its depth like a real sensor.
+	cpu_icp_frame capture(const cpu_triangle_mesh& mesh, const mat4& modelView)
+	{
+		rasterizeViewNormalAndDepth(mesh, modelView, sensor.intrinsics, sensor.distortion, cpuICPNearPlane, rendered);
+
+		for (uint32 i = 0; i < sensor.width * sensor.height; ++i)
+		{
+			depth[i] = (uint16)min(rendered.data[i].w / depthScale + 0.5f, 65535.f);
+		}
+
+		return { depth.data(), &sensor, depthScale };
+	}
+
+	// Object pose in front of the camera, so that the object covers about half the image height.
+	bool placeInView(const cpu_triangle_mesh& mesh, quat rotation, mat4& outModelView, float& outRadius)
+	{
+		vec3 center = getMeshCenter(mesh);
+		float radius = getMeshRadius(mesh);
+
+		if (radius == 0.f)
+		{
+			LOG_ERROR("Mesh for CPU ICP benchmark is empty");
+			return false;
+		}
+
+		float distance = max(4.f * radius * sensor.intrinsics.fy / sensor.height, cpuICPNearPlane + 2.f * radius);
+		outModelView = createModelMatrix(vec3(0.f, 0.f, -distance), rotation) * createModelMatrix(-center, quat::identity);
+		outRadius = radius;
+		return true;
+	}
+
+	create_correspondences_ps_cb defaultThresholds() const
+	{
+		// Defaults of the depth tracker.
+		create_correspondences_ps_cb settings;
+		settings.depthScale = depthScale;
+		settings.squaredPositionThreshold = 0.03f * 0.03f;
+		settings.cosAngleThreshold = cos(deg2rad(45.f));
+		settings.correspondenceMode = tracking_correspondence_mode_camera_to_render;
+		return settings;
+	}
+};
+
+// Position (meters) and angle (degrees) error statistics over a number of poses.
+struct pose_error_stats
+{
+	uint32 count = 0;
+	float totalPositionError = 0.f, maxPositionError = 0.f;
+	float totalAngleError = 0.f, maxAngleError = 0.f;
+
+	void add(float positionError, float angleError)
+	{
+		++count;
+		totalPositionError += positionError;
+		totalAngleError += angleError;
+		maxPositionError = max(maxPositionError, positionError);
+		maxAngleError = max(maxAngleError, angleError);
+	}
+
+	float meanPositionError() const { return count ? totalPositionError / count : 0.f; }
+	float meanAngleError() const { return count ? totalAngleError / count : 0.f; }
+};
+
+struct tracking_benchmark_stats
+{
+	uint32 numFrames = 0;
+	uint32 numLost = 0;
+	uint32 totalIterations = 0, maxIterations = 0;
+	double totalMS = 0.0;
+	pose_error_stats error;
+
+	double averageMS() const { return numFrames ? totalMS / numFrames : 0.0; }
+	float averageIterations() const { return numFrames ? (float)totalIterations / numFrames : 0.f; }
+};
+
+// Tracks the object along the ground truth trajectory, starting at its first pose. captureFrame(frameIndex) prepares the sensor input of a
+// frame and is not timed. trackFrame(pose) tracks from the previous estimate and returns a cpu_icp_tracking_result. Frames without a valid
+// result keep the previous pose, and the error is measured against the ground truth for every frame.
+template <typename capture_frame_func, typename track_frame_func>
+static tracking_benchmark_stats runTrackingBenchmark(const std::vector<mat4>& trajectory, const capture_frame_func& captureFrame, const track_frame_func& trackFrame)
+{
+	tracking_benchmark_stats stats;
+	stats.numFrames = (uint32)trajectory.size();
+
+	mat4 pose = trajectory[0];
+
+	for (uint32 i = 0; i < stats.numFrames; ++i)
+	{
+		captureFrame(i);
+
+		auto start = std::chrono::high_resolution_clock::now();
+		cpu_icp_tracking_result result = trackFrame(pose);
+		auto end = std::chrono::high_resolution_clock::now();
+
+		stats.totalMS += std::chrono::duration<double, std::milli>(end - start).count();
+		stats.totalIterations += result.numIterations;
+		stats.maxIterations = max(stats.maxIterations, result.numIterations);
+
+		if (result.valid)
+		{
+			pose = result.modelView;
+		}
+		else
+		{
+			++stats.numLost;
+		}
+
+		auto [positionError, angleError] = poseError(pose, trajectory[i]);
+		stats.error.add(positionError, angleError);
+	}
+
+	return stats;
+}
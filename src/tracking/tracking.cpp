@@ -9,9 +9,16 @@
 #include "rendering/render_utils.h"
 #include "rendering/render_resources.h"
 #include "core/imgui.h"
+#include "editor/file_dialog.h"
+#include "geometry/mesh.h"
+#include "core/threading.h"
+#include "core/log.h"
 
+#include "tracking_math.h"
 #include "tracking_rs.hlsli"
 
+#include <chrono>
+
 static const DXGI_FORMAT trackingDepthFormat = DXGI_FORMAT_R16_UINT;
 static const DXGI_FORMAT trackingColorFormat = DXGI_FORMAT_B8G8R8A8_UNORM_SRGB;
 
@@ -143,6 +150,8 @@ static void initializePipelines()
 depth_tracker::depth_tracker(game_scene& scene)
 	: scene(scene)
 {
+	frameArena.initialize(0, MB(64));
+
 	initializePipelines();
 
 	initialize(rgbd_camera_type_realsense, 0);
@@ -163,6 +172,44 @@ void depth_tracker::initialize(rgbd_camera_type cameraType, uint32 deviceIndex)
 		return;
 	}
 
+	initializeCameraResources();
+}
+
+void depth_tracker::initializeFromRecording(const fs::path& path)
+{
+	if (!camera.initializeRecording(path))
+	{
+		return;
+	}
+
+	initializeCameraResources();
+}
+
+void depth_tracker::addSecondaryCamera(rgbd_camera_type cameraType, uint32 deviceIndex, const fs::path& recordingPath)
+{
+	ref<secondary_depth_camera> secondary = make_ref<secondary_depth_camera>();
+
+	bool success = recordingPath.empty()
+		? secondary->camera.initializeAs(cameraType, deviceIndex, false)
+		: secondary->camera.initializeRecording(recordingPath);
+
+	if (!success || !secondary->camera.depthSensor.active)
+	{
+		LOG_ERROR("Could not add secondary depth camera");
+		return;
+	}
+
+	secondaryCameras.push_back(secondary);
+}
+
+void depth_tracker::initializeCameraResources()
+{
+	// The per-object buffers depend on the depth resolution and are recreated on the next update.
+	for (auto [entityHandle, trackingComponent, rasterComponent, transform] : getTrackedObjectGroup().each())
+	{
+		trackingComponent.trackingData = nullptr;
+	}
+
 	cameraDepthTexture = createTexture(0, camera.depthSensor.width, camera.depthSensor.height, trackingDepthFormat, false, false, false, D3D12_RESOURCE_STATE_GENERIC_READ);
 	uint32 requiredSize = (uint32)GetRequiredIntermediateSize(cameraDepthTexture->resource.Get(), 0, 1);
 	depthUploadBuffer = createUploadBuffer(requiredSize, 1, 0);
@@ -172,8 +219,6 @@ void depth_tracker::initialize(rgbd_camera_type cameraType, uint32 deviceIndex)
 		cameraColorTexture = createTexture(0, camera.colorSensor.width, camera.colorSensor.height, trackingColorFormat, false, false, false, D3D12_RESOURCE_STATE_GENERIC_READ);
 		uint32 requiredSize = (uint32)GetRequiredIntermediateSize(cameraColorTexture->resource.Get(), 0, 1);
 		colorUploadBuffer = createUploadBuffer(requiredSize, 1, 0);
-
-		colorFrameCopy = new color_bgra[camera.colorSensor.width * camera.colorSensor.height];
 	}
 
 	cameraUnprojectTableTexture = createTexture(camera.depthSensor.unprojectTable, camera.depthSensor.width, camera.depthSensor.height, DXGI_FORMAT_R32G32_FLOAT);
@@ -211,383 +256,490 @@ void depth_tracker::initializeTrackingData(ref<tracking_data>& data)
 	SET_NAME(data->ataReadbackBuffer->resource, "ATA readback");
 }
 
-struct vec6
-{
-	float m[6];
-
-	vec6() {}
-	vec6(tracking_atb v)
-	{
-		memcpy(m, v.m, sizeof(float) * 6);
-	}
-	vec6(float a, float b, float c, float d, float e, float f)
-	{
-		m[0] = a; m[1] = b; m[2] = c; m[3] = d; m[4] = e; m[5] = f;
-	}
-};
-
-static vec6 operator*(const tracking_ata& m, const vec6& v)
+static rotation_translation smoothDeltaTransform(vec6 delta, float t)
 {
-	vec6 result;
-	result.m[0] = m.m[ata_m00] * v.m[0] + m.m[ata_m01] * v.m[1] + m.m[ata_m02] * v.m[2] + m.m[ata_m03] * v.m[3] + m.m[ata_m04] * v.m[4] + m.m[ata_m05] * v.m[5];
-	result.m[1] = m.m[ata_m01] * v.m[0] + m.m[ata_m11] * v.m[1] + m.m[ata_m12] * v.m[2] + m.m[ata_m13] * v.m[3] + m.m[ata_m14] * v.m[4] + m.m[ata_m15] * v.m[5];
-	result.m[2] = m.m[ata_m02] * v.m[0] + m.m[ata_m12] * v.m[1] + m.m[ata_m22] * v.m[2] + m.m[ata_m23] * v.m[3] + m.m[ata_m24] * v.m[4] + m.m[ata_m25] * v.m[5];
-	result.m[3] = m.m[ata_m03] * v.m[0] + m.m[ata_m13] * v.m[1] + m.m[ata_m23] * v.m[2] + m.m[ata_m33] * v.m[3] + m.m[ata_m34] * v.m[4] + m.m[ata_m35] * v.m[5];
-	result.m[4] = m.m[ata_m04] * v.m[0] + m.m[ata_m14] * v.m[1] + m.m[ata_m24] * v.m[2] + m.m[ata_m34] * v.m[3] + m.m[ata_m44] * v.m[4] + m.m[ata_m45] * v.m[5];
-	result.m[5] = m.m[ata_m05] * v.m[0] + m.m[ata_m15] * v.m[1] + m.m[ata_m25] * v.m[2] + m.m[ata_m35] * v.m[3] + m.m[ata_m45] * v.m[4] + m.m[ata_m55] * v.m[5];
-	return result;
+	return lieExp(delta * t);
 }
 
-static vec6 operator+(const vec6& a, const vec6& b)
+static rotation_translation smoothDeltaTransform(rotation_translation delta, float t)
 {
-	vec6 result;
-	for (uint32 i = 0; i < 6; ++i)
+	if (t == 1.f)
 	{
-		result.m[i] = a.m[i] + b.m[i];
+		return delta;
 	}
-	return result;
-}
 
-static vec6 operator-(const vec6& a, const vec6& b)
-{
-	vec6 result;
-	for (uint32 i = 0; i < 6; ++i)
-	{
-		result.m[i] = a.m[i] - b.m[i];
-	}
-	return result;
+	// https://www.geometrictools.com/Documentation/InterpolationRigidMotions.pdf
+	return lieExp(lieLog(delta) * t);
 }
 
-static vec6 operator*(const vec6& a, float b)
+static rotation_translation eulerUpdate(vec6 x, float smoothing)
 {
-	vec6 result;
-	for (uint32 i = 0; i < 6; ++i)
-	{
-		result.m[i] = a.m[i] * b;
-	}
-	return result;
-}
+	float alpha = x.m[0];
+	float beta = x.m[1];
+	float gamma = x.m[2];
 
-static float dot(const vec6& a, const vec6& b)
-{
-	float result = 0.f;
-	for (uint32 i = 0; i < 6; ++i)
-	{
-		result += a.m[i] * b.m[i];
-	}
-	return result;
-}
+	float sinAlpha = sin(alpha);
+	float cosAlpha = cos(alpha);
+	float sinBeta = sin(beta);
+	float cosBeta = cos(beta);
+	float sinGamma = sin(gamma);
+	float cosGamma = cos(gamma);
 
-inline std::ostream& operator<<(std::ostream& s, const tracking_ata& m)
-{
-	s << "[" << m.m[ata_m00] << ", " << m.m[ata_m01] << ", " << m.m[ata_m02] << ", " << m.m[ata_m03] << ", " << m.m[ata_m04] << ", " << m.m[ata_m05] << "]\n";
-	s << "[" << m.m[ata_m01] << ", " << m.m[ata_m11] << ", " << m.m[ata_m12] << ", " << m.m[ata_m13] << ", " << m.m[ata_m14] << ", " << m.m[ata_m15] << "]\n";
-	s << "[" << m.m[ata_m02] << ", " << m.m[ata_m12] << ", " << m.m[ata_m22] << ", " << m.m[ata_m23] << ", " << m.m[ata_m24] << ", " << m.m[ata_m25] << "]\n";
-	s << "[" << m.m[ata_m03] << ", " << m.m[ata_m13] << ", " << m.m[ata_m23] << ", " << m.m[ata_m33] << ", " << m.m[ata_m34] << ", " << m.m[ata_m35] << "]\n";
-	s << "[" << m.m[ata_m04] << ", " << m.m[ata_m14] << ", " << m.m[ata_m24] << ", " << m.m[ata_m34] << ", " << m.m[ata_m44] << ", " << m.m[ata_m45] << "]\n";
-	s << "[" << m.m[ata_m05] << ", " << m.m[ata_m15] << ", " << m.m[ata_m25] << ", " << m.m[ata_m35] << ", " << m.m[ata_m45] << ", " << m.m[ata_m55] << "]";
-	return s;
-}
+	rotation_translation rt;
 
-inline std::ostream& operator<<(std::ostream& s, tracking_atb v)
-{
-	s << "[" << v.m[0] << ", " << v.m[1] << ", " << v.m[2] << ", " << v.m[3] << ", " << v.m[4] << ", " << v.m[5] << "]";
-	return s;
+	rt.rotation.m00 = cosGamma * cosBeta;
+	rt.rotation.m01 = -sinGamma * cosAlpha + cosGamma * sinBeta * sinAlpha;
+	rt.rotation.m02 = sinGamma * sinAlpha + cosGamma * sinBeta * cosAlpha;
+	rt.rotation.m10 = sinGamma * cosBeta;
+	rt.rotation.m11 = cosGamma * cosAlpha + sinGamma * sinBeta * sinAlpha;
+	rt.rotation.m12 = -cosGamma * sinAlpha + sinGamma * sinBeta * cosAlpha;
+	rt.rotation.m20 = -sinBeta;
+	rt.rotation.m21 = cosBeta * sinAlpha;
+	rt.rotation.m22 = cosBeta * cosAlpha;
+
+	rt.translation.x = x.m[3];
+	rt.translation.y = x.m[4];
+	rt.translation.z = x.m[5];
+
+	return smoothDeltaTransform(rt, 1.f - smoothing);
 }
 
-inline std::ostream& operator<<(std::ostream& s, vec6 v)
+static rotation_translation lieUpdate(vec6 x, float smoothing)
 {
-	s << "[" << v.m[0] << ", " << v.m[1] << ", " << v.m[2] << ", " << v.m[3] << ", " << v.m[4] << ", " << v.m[5] << "]";
-	return s;
+	return smoothDeltaTransform(x, 1.f - smoothing);
 }
 
-struct rotation_translation
+
+
+struct tracking_solve_job
 {
-	mat3 rotation;
-	vec3 translation;
+	entt::entity entityHandle;
+	tracking_data* data;
+	mat4 measurement;
+	bool active; // Tracking ran for this object. Otherwise an invalid result does not mean it is lost.
+	bool valid;
 };
 
-static rotation_translation lieExp(vec6 lie)
+void depth_tracker::processLastTrackingJobs()
 {
-	vec3 u(lie.m[3], lie.m[4], lie.m[5]);
-	vec3 w(lie.m[0], lie.m[1], lie.m[2]);
+	CPU_PROFILE_BLOCK("Process last tracking results");
+
+	auto group = getTrackedObjectGroup();
+	uint32 numObjects = (uint32)group.size();
 
-	float theta_2 = dot(w, w);
+	tracking_solve_job* jobs = frameArena.allocate<tracking_solve_job>(numObjects);
+	uint32 numJobs = 0;
 
-	float a, b, c;
-	if (theta_2 < 1e-6f)
+	for (auto [entityHandle, trackingComponent, rasterComponent, transform] : group.each())
 	{
-		// Use Tailor expansion.
-		a = 1.f + theta_2 * (-1.f / 6.f + theta_2 * (1.f / 120.f - theta_2 / 5040.f));
-		b = 0.5f + theta_2 * (-1.f / 24.f + theta_2 * (1.f / 720.f - theta_2 / 40320.f));
-		c = 1.f / 6.f + theta_2 * (-1.f / 120.f + theta_2 * (1.f / 5040.f - theta_2 / 362880.f));
+		if (trackingComponent.trackingData)
+		{
+			tracking_data* data = trackingComponent.trackingData.get();
+			bool active = !disableTracking && tracking && data->tracking;
+			jobs[numJobs++] = { entityHandle, data, mat4::identity, active, false };
+		}
 	}
-	else
+
+	// Each solve only touches its object's tracking data, so the objects are processed in parallel.
+	thread_job_context context;
+	for (uint32 i = 0; i < numJobs; ++i)
 	{
-		float theta = sqrt(theta_2);
-		a = sin(theta) / theta;
-		b = (1.f - cos(theta)) / theta_2;
-		c = (1.f - a) / theta_2;
+		tracking_solve_job* job = jobs + i;
+		context.addWork([this, job]()
+		{
+			job->valid = solveLastTrackingJob(*job->data, job->measurement);
+		});
 	}
+	context.waitForWorkCompletion();
+
+	// Results are committed in group order, independent of which job finished first.
+	// Rotations and positions are only needed if we track the camera.
+	quat* rotations = frameArena.allocate<quat>(numJobs);
+	vec3* positions = frameArena.allocate<vec3>(numJobs);
+	uint32 pushIndex = 0;
+
+	// The results belong to the frame, which was uploaded NUM_BUFFERED_FRAMES ago.
+	const pose_timing& jobTiming = gpuJobTimings[dxContext.bufferedFrameID];
+
+	bool anyApplied = false;
+	for (uint32 i = 0; i < numJobs; ++i)
+	{
+		tracking_solve_job& job = jobs[i];
+		if (job.active)
+		{
+			job.data->numFramesLost = job.valid ? 0 : job.data->numFramesLost + 1;
+		}
 
-	mat3 w_x = getSkewMatrix(w);
-	mat3 w_x_2 = w_x * w_x;
+		if (job.valid)
+		{
+			scene_entity entity = { job.entityHandle, scene };
+			mat4 m = getWorldMatrix() * filterTrackedPose(entity, *job.data, job.measurement, jobTiming);
+			applyTrackedMatrix(entity, m, rotations, positions, pushIndex);
+			anyApplied = true;
+		}
+	}
 
-	mat3 R = mat3::identity + a * w_x + b * w_x_2;
-	vec3 t = (mat3::identity + b * w_x + c * w_x_2) * u;
+	applyTrackedCamera(rotations, positions, pushIndex);
 
-	return { R, t };
+	if (anyApplied)
+	{
+		pose_timing timing = jobTiming;
+		timing.applyTime = getLatencyTimeInMicroseconds();
+		motionToPhotonLatency.poseApplied(timing);
+	}
 }
 
-static vec6 lieLog(rotation_translation Rt)
+// Reads back the GPU result of the job issued NUM_BUFFERED_FRAMES ago and computes the new pose relative to the depth camera.
+// Runs on the job system.
+bool depth_tracker::solveLastTrackingJob(tracking_data& trackingData, mat4& measurement)
 {
-	float theta = acos(0.5f * (trace(Rt.rotation) - 1.f));
-	float theta_2 = theta * theta;
+	tracking_indirect* mappedIndirect = (tracking_indirect*)mapBuffer(trackingData.icpDispatchReadbackBuffer, true, map_range{ dxContext.bufferedFrameID, 1 });
+	tracking_indirect indirect = mappedIndirect[dxContext.bufferedFrameID];
+	unmapBuffer(trackingData.icpDispatchReadbackBuffer, false);
+
+	//std::cout << indirect.counter << " " << indirect.initialICP.ThreadGroupCountX << " " << indirect.reduce0.ThreadGroupCountX << " " << indirect.reduce1.ThreadGroupCountX << '\n';
+	bool correspondencesValid = indirect.initialICP.ThreadGroupCountX > 0;
+	trackingData.numCorrespondences = indirect.counter;
 
-	float a, b;
-	if (theta_2 < 1e-6f)
+	if (disableTracking || !tracking || !correspondencesValid || !trackingData.tracking)
 	{
-		a = 1.f + theta_2 * (-1.f / 6.f + theta_2 * (1.f / 120.f - theta_2 / 5040.f));
-		b = 0.5f + theta_2 * (-1.f / 24.f + theta_2 * (1.f / 720.f - theta_2 / 40320.f));
+		return false;
 	}
-	else
+
+	// Due to the flip-flop reduction (below), we have to figure out in which buffer the final result has been written.
+	uint32 ataBufferIndex = 0;
+	if (indirect.reduce1.ThreadGroupCountX == 0) { ataBufferIndex = 1; }
+	if (indirect.reduce0.ThreadGroupCountX == 0) { ataBufferIndex = 0; }
+
+	tracking_ata_atb* mapped = (tracking_ata_atb*)mapBuffer(trackingData.ataReadbackBuffer, true, map_range{ 2 * dxContext.bufferedFrameID, 2 });
+	tracking_ata ata = mapped[2 * dxContext.bufferedFrameID + ataBufferIndex].ata;
+	tracking_atb atb = mapped[2 * dxContext.bufferedFrameID + ataBufferIndex].atb;
+	unmapBuffer(trackingData.ataReadbackBuffer, false);
+
+	vec6 x = solve(ata, atb);
+
+	float s = smoothing;
+
+	if (oldSmoothingMode || predictivePoseFilter)
 	{
-		a = sin(theta) / theta;
-		b = (1.f - cos(theta)) / theta_2;
+		s = 0.f;
 	}
-	
-	mat3 w_x = (0.5f / a) * (Rt.rotation - transpose(Rt.rotation));
-	vec3 w(w_x.m21, w_x.m02, w_x.m10);
-	mat3 w_x_2 = w_x * w_x;
-	mat3 V_inv = mat3::identity - 0.5f * w_x;
-	if (theta_2 > 0.f)
+
+	rotation_translation delta;
+	if (rotationRepresentation == tracking_rotation_representation_euler)
 	{
-		V_inv += 1.f / theta_2 * (1.f - 0.5f * a / b) * w_x_2;
+		delta = eulerUpdate(x, s);
+	}
+	else
+	{
+		assert(rotationRepresentation == tracking_rotation_representation_lie);
+		delta = lieUpdate(x, s);
 	}
 
-	vec3 u = V_inv * Rt.translation;
-
-	return vec6(w.x, w.y, w.z, u.x, u.y, u.z);
-}
 
-static rotation_translation smoothDeltaTransform(vec6 delta, float t)
-{
-	return lieExp(delta * t);
-}
+	quat rotation = mat3ToQuaternion(delta.rotation);
+	vec3 translation = delta.translation;
 
-static rotation_translation smoothDeltaTransform(rotation_translation delta, float t)
-{
-	if (t == 1.f)
+	if (oldSmoothingMode && !predictivePoseFilter)
 	{
-		return delta;
+		float weightRotation = 1.f - exp(-hRotation * length(quat::identity.v4 - rotation.v4));
+		float weightTranslation = 1.f - exp(-hTranslation * length(translation));
+		float weight = max(weightRotation, weightTranslation);
+
+		translation *= weight;
+		rotation = slerp(quat::identity, rotation, weight);
 	}
 
-	// https://www.geometrictools.com/Documentation/InterpolationRigidMotions.pdf
-	return lieExp(lieLog(delta) * t);
-}
 
-static vec6 solve(const tracking_ata& A, const tracking_atb& b, uint32 maxNumIterations = 20)
-{
-	vec6 x;
-	memset(&x, 0, sizeof(x));
 
-	vec6 r = b - A * x;
-	vec6 p = r;
+	if (correspondenceMode == tracking_correspondence_mode_camera_to_render)
+	{
+		rotation = conjugate(rotation);
+		translation = -(rotation * translation);
+	}
+
+	//mat4 model = getTrackingMatrix(transform);
+	mat4 model = trackingData.startTrackingMatrix[dxContext.bufferedFrameID];
 
-	float rdotr = dot(r, r);
+	measurement = createModelMatrix(translation, rotation) * model;
 
-	uint32 k;
-	for (k = 0; k < maxNumIterations; ++k)
+	return true;
+}
+
+// Measurement and result are relative to the depth camera. The timing is the one of the frame, which the measurement was computed from.
+mat4 depth_tracker::filterTrackedPose(scene_entity entity, tracking_data& data, const mat4& measurement, const pose_timing& timing)
+{
+	if (!predictivePoseFilter)
 	{
-		vec6 Ap = A * p;
-		float alpha = rdotr / dot(p, Ap);
-		x = x + p * alpha;
-		r = r - Ap * alpha;
+		return measurement;
+	}
 
-		float oldrdotr = rdotr;
-		rdotr = dot(r, r);
-		if (rdotr < 1e-5f)
-		{
-			break;
-		}
+	// Sensor time, so that neither the processing time nor its variation end up in the velocity. The host receive time is only a fallback
+	// for cameras without timestamps. The prediction horizon is measured from this time.
+	int64 timeInMicroseconds = timing.deviceTime ? timing.deviceTime : timing.receiveTime;
+	double time = timeInMicroseconds * 1e-6;
 
-		float beta = rdotr / oldrdotr;
-		p = r + p * beta;
+	if (recordingTrajectory && entity.handle == *getTrackedObjectGroup().begin())
+	{
+		trs t = mat4ToTRS(measurement);
+		recordedTrajectory.push_back({ time, t.position, t.rotation });
 	}
 
-	return x;
+	data.poseFilter.update(measurement, time, poseFilterSettings);
+	return data.poseFilter.predict(time + predictionHorizonInMS * 0.001);
 }
 
-static rotation_translation eulerUpdate(vec6 x, float smoothing)
+void depth_tracker::applyTrackedMatrix(scene_entity entity, const mat4& m, quat* rotations, vec3* positions, uint32& pushIndex)
 {
-	float alpha = x.m[0];
-	float beta = x.m[1];
-	float gamma = x.m[2];
+	transform_component& transform = entity.getComponent<transform_component>();
 
-	float sinAlpha = sin(alpha);
-	float cosAlpha = cos(alpha);
-	float sinBeta = sin(beta);
-	float cosBeta = cos(beta);
-	float sinGamma = sin(gamma);
-	float cosGamma = cos(gamma);
+	if (mode == tracking_mode_track_object)
+	{
+		trs t = mat4ToTRS(m);
 
-	rotation_translation rt;
+		transform.position = t.position;
+		transform.rotation = t.rotation;
+	}
+	else
+	{
+		mat4 objectInCameraSpace = createViewMatrix(globalCameraPosition, globalCameraRotation) * m; // Transforms object space point to camera space.
+		mat4 f = trsToMat4(transform) * invert(objectInCameraSpace); // Transforms camera space point to world space.
+		trs t = mat4ToTRS(f);
 
-	rt.rotation.m00 = cosGamma * cosBeta;
-	rt.rotation.m01 = -sinGamma * cosAlpha + cosGamma * sinBeta * sinAlpha;
-	rt.rotation.m02 = sinGamma * sinAlpha + cosGamma * sinBeta * cosAlpha;
-	rt.rotation.m10 = sinGamma * cosBeta;
-	rt.rotation.m11 = cosGamma * cosAlpha + sinGamma * sinBeta * sinAlpha;
-	rt.rotation.m12 = -cosGamma * sinAlpha + sinGamma * sinBeta * cosAlpha;
-	rt.rotation.m20 = -sinBeta;
-	rt.rotation.m21 = cosBeta * sinAlpha;
-	rt.rotation.m22 = cosBeta * cosAlpha;
+		rotations[pushIndex] = t.rotation;
+		positions[pushIndex] = t.position;
+		++pushIndex;
+	}
+}
 
-	rt.translation.x = x.m[3];
-	rt.translation.y = x.m[4];
-	rt.translation.z = x.m[5];
+void depth_tracker::applyTrackedCamera(const quat* rotations, const vec3* positions, uint32 numTrackedObjects)
+{
+	if (mode == tracking_mode_track_camera)
+	{
+		if (numTrackedObjects != 0)
+		{
+			quat rotation = nlerp(rotations, 0, numTrackedObjects);
+			vec3 position = nlerp(positions, 0, numTrackedObjects);
 
-	return smoothDeltaTransform(rt, 1.f - smoothing);
+			globalCameraRotation = rotation;
+			globalCameraPosition = position;
+		}
+	}
 }
 
-static rotation_translation lieUpdate(vec6 x, float smoothing)
+static bool loadCPUMesh(tracking_data& data, const raster_component& raster)
 {
-	return smoothDeltaTransform(x, 1.f - smoothing);
+	if (!data.cpuMesh || !(data.cpuMesh->handle == raster.mesh->handle))
+	{
+		data.cpuMesh = loadCPUTriangleMeshFromHandle(raster.mesh->handle);
+	}
+	return data.cpuMesh != 0;
 }
 
+cpu_icp_tracking_settings depth_tracker::getCPUTrackingSettings()
+{
+	cpu_icp_tracking_settings settings;
+	settings.thresholds.depthScale = camera.depthScale;
+	settings.thresholds.squaredPositionThreshold = positionThreshold * positionThreshold;
+	settings.thresholds.cosAngleThreshold = cos(angleThreshold);
+	settings.thresholds.correspondenceMode = correspondenceMode;
+	settings.minNumCorrespondences = minNumCorrespondences;
+	settings.maxNumIterationsPerLevel = cpuTrackingMaxNumIterationsPerLevel;
+	settings.maxNumSampledCorrespondences = cpuTrackingMaxNumSampledCorrespondences;
+	return settings;
+}
 
-
-void depth_tracker::processLastTrackingJobs()
+void depth_tracker::trackOnCPU(const uint16* depth)
 {
+	CPU_PROFILE_BLOCK("CPU tracking");
+
 	auto group = getTrackedObjectGroup();
 
-	// Allocate memory in case we need to track the camera.
 	uint32 numObjects = (uint32)group.size();
-	void* mem = alloca(sizeof(quat) * numObjects + sizeof(vec3) * numObjects);
-	quat* rotations = (quat*)mem;
-	vec3* positions = (vec3*)(rotations + numObjects);
+	quat* rotations = frameArena.allocate<quat>(numObjects);
+	vec3* positions = frameArena.allocate<vec3>(numObjects);
 
 	uint32 pushIndex = 0;
+	bool anyApplied = false;
+
+	if (cpuDepthFilter)
+	{
+		uint32 numPixels = camera.depthSensor.width * camera.depthSensor.height;
+		filteredDepth.resize(numPixels);
+		depthPreprocessor.bilateralFilter(depth, camera.depthSensor.width, camera.depthSensor.height, camera.depthScale, depthFilterSettings, filteredDepth.data());
+		depth = filteredDepth.data();
+	}
+
+	cpuDepthPyramid.build(depth, camera.depthSensor, camera.depthScale, cpuTrackingNumLevels);
+
+	// The secondary cameras are not synchronized with the main camera. Their latest frames are used.
+	cpu_icp_view* views = frameArena.allocate<cpu_icp_view>(1 + (uint32)secondaryCameras.size());
+	views[0] = { &cpuDepthPyramid, mat4::identity };
+	uint32 numViews = 1;
 
+	for (auto& secondary : secondaryCameras)
+	{
+		rgbd_frame_ref frame = secondary->camera.getLatestFrame();
+		if (!frame || !frame.depth)
+		{
+			continue;
+		}
 
+		secondary->pyramid.build(frame.depth, secondary->camera.depthSensor, secondary->camera.depthScale, cpuTrackingNumLevels);
+
+		quat rotation = eulerToQuat(vec3(deg2rad(secondary->rotation.x), deg2rad(secondary->rotation.y), deg2rad(secondary->rotation.z)));
+		views[numViews++] = { &secondary->pyramid, createViewMatrix(secondary->position, rotation) };
+	}
+
+	cpu_icp_tracking_settings settings = getCPUTrackingSettings();
 
 	for (auto [entityHandle, trackingComponent, rasterComponent, transform] : group.each())
 	{
 		scene_entity entity = { entityHandle, scene };
-
-		tracking_component& trackingComponent = entity.getComponent<tracking_component>();
 		ref<tracking_data>& trackingData = trackingComponent.trackingData;
 
-		if (!trackingData)
+		if (!trackingData || !rasterComponent.mesh)
 		{
-			return;
+			continue;
 		}
 
-		CPU_PROFILE_BLOCK("Process last tracking result");
-
-
-		tracking_indirect* mappedIndirect = (tracking_indirect*)mapBuffer(trackingData->icpDispatchReadbackBuffer, true, map_range{ dxContext.bufferedFrameID, 1 });
-		tracking_indirect indirect = mappedIndirect[dxContext.bufferedFrameID];
-		unmapBuffer(trackingData->icpDispatchReadbackBuffer, false);
+		if (!loadCPUMesh(*trackingData, rasterComponent))
+		{
+			continue;
+		}
 
-		//std::cout << indirect.counter << " " << indirect.initialICP.ThreadGroupCountX << " " << indirect.reduce0.ThreadGroupCountX << " " << indirect.reduce1.ThreadGroupCountX << '\n';
-		bool correspondencesValid = indirect.initialICP.ThreadGroupCountX > 0;
-		trackingData->numCorrespondences = indirect.counter;
+		cpu_icp_tracking_result result = cpuICP.track(views, numViews, *trackingData->cpuMesh, getTrackingMatrix(transform), settings);
 
+		trackingData->numCorrespondences = result.numCorrespondences;
+		if (trackingData->tracking)
+		{
+			trackingData->numFramesLost = result.valid ? 0 : trackingData->numFramesLost + 1;
+		}
 
-		if (!disableTracking && tracking && correspondencesValid && trackingData->tracking)
+		if (result.valid && trackingData->tracking)
 		{
-			// Due to the flip-flop reduction (below), we have to figure out in which buffer the final result has been written.
-			uint32 ataBufferIndex = 0;
-			if (indirect.reduce1.ThreadGroupCountX == 0) { ataBufferIndex = 1; }
-			if (indirect.reduce0.ThreadGroupCountX == 0) { ataBufferIndex = 0; }
+			mat4 m = getWorldMatrix() * filterTrackedPose(entity, *trackingData, result.modelView, latestFrameTiming);
+			applyTrackedMatrix(entity, m, rotations, positions, pushIndex);
+			anyApplied = true;
+		}
+	}
 
-			tracking_ata_atb* mapped = (tracking_ata_atb*)mapBuffer(trackingData->ataReadbackBuffer, true, map_range{ 2 * dxContext.bufferedFrameID, 2 });
-			tracking_ata ata = mapped[2 * dxContext.bufferedFrameID + ataBufferIndex].ata;
-			tracking_atb atb = mapped[2 * dxContext.bufferedFrameID + ataBufferIndex].atb;
-			unmapBuffer(trackingData->ataReadbackBuffer, false);
+	applyTrackedCamera(rotations, positions, pushIndex);
 
-			vec6 x = solve(ata, atb);
+	if (anyApplied)
+	{
+		pose_timing timing = latestFrameTiming;
+		timing.applyTime = getLatencyTimeInMicroseconds();
+		motionToPhotonLatency.poseApplied(timing);
+	}
+}
 
-			float s = smoothing;
+// Starts building the model in the background, if there is none for the mesh and scale yet. Returns the model, once it is ready. The first
+// relocalization must not stall a frame with the O(points^2) pair table. This is a thread of its own and not a job, since the main thread
+// helps out with queued jobs while it waits for its own, and could pick up the whole build.
+const ppf_model_build* depth_tracker::requestPPFModel(tracking_data& data, asset_handle meshHandle, vec3 scale)
+{
+	ref<ppf_model_build>& build = data.ppfModelBuild;
 
-			if (oldSmoothingMode)
-			{
-				s = 0.f;
-			}
+	bool outdated = !build || !(build->meshHandle == meshHandle) || !(build->scale == scale);
 
-			rotation_translation delta;
-			if (rotationRepresentation == tracking_rotation_representation_euler)
-			{
-				delta = eulerUpdate(x, s);
-			}
-			else
-			{
-				assert(rotationRepresentation == tracking_rotation_representation_lie);
-				delta = lieUpdate(x, s);
-			}
+	// While the object is being scaled, only one build runs at a time.
+	if (outdated && (!build || build->finished))
+	{
+		build = make_ref<ppf_model_build>();
+		build->meshHandle = meshHandle;
+		build->scale = scale;
+
+		ref<ppf_model_build> job = build;
+		ppf_settings settings = ppfSettings;
+		std::thread thread([job, settings]()
+		{
+			job->mesh = loadCPUTriangleMeshFromHandle(job->meshHandle);
+			job->valid = job->mesh && job->model.initialize(*job->mesh, job->scale, settings);
+			job->finished = true;
+		});
+		thread.detach();
+	}
 
+	if (outdated || !build->finished || !build->valid)
+	{
+		return 0;
+	}
+	return build.get();
+}
 
-			quat rotation = mat3ToQuaternion(delta.rotation);
-			vec3 translation = delta.translation;
+void depth_tracker::relocalizeLostObjects(const uint16* depth, bool pyramidIsCurrent)
+{
+	CPU_PROFILE_BLOCK("Relocalize lost objects");
 
-			if (oldSmoothingMode)
-			{
-				float weightRotation = 1.f - exp(-hRotation * length(quat::identity.v4 - rotation.v4));
-				float weightTranslation = 1.f - exp(-hTranslation * length(translation));
-				float weight = max(weightRotation, weightTranslation);
+	cpu_icp_tracking_settings settings = getCPUTrackingSettings();
 
-				translation *= weight;
-				rotation = slerp(quat::identity, rotation, weight);
-			}
+	for (auto [entityHandle, trackingComponent, rasterComponent, transform] : getTrackedObjectGroup().each())
+	{
+		tracking_data* data = trackingComponent.trackingData.get();
+		if (!data || !data->tracking || !rasterComponent.mesh || !rasterComponent.mesh->handle)
+		{
+			continue;
+		}
 
+		// Requested every frame, so that the model is ready by the time the object is lost.
+		const ppf_model_build* model = requestPPFModel(*data, rasterComponent.mesh->handle, transform.scale);
 
+		// Retry only every few frames, so that an object, which is out of view, does not cost a search in every frame.
+		bool lost = data->numFramesLost >= framesUntilRelocalization && (data->numFramesLost % framesUntilRelocalization) == 0;
+		if (!lost && !relocalizeNow)
+		{
+			continue;
+		}
 
-			if (correspondenceMode == tracking_correspondence_mode_camera_to_render)
-			{
-				rotation = conjugate(rotation);
-				translation = -(rotation * translation);
-			}
+		if (!model)
+		{
+			continue; // Still building.
+		}
 
-			transform_component& transform = entity.getComponent<transform_component>();
+		if (!pyramidIsCurrent)
+		{
+			cpuDepthPyramid.build(depth, camera.depthSensor, camera.depthScale, cpuTrackingNumLevels);
+			pyramidIsCurrent = true;
+		}
 
-			//mat4 model = getTrackingMatrix(transform);
-			mat4 model = trackingData->startTrackingMatrix[dxContext.bufferedFrameID];
+		auto start = std::chrono::high_resolution_clock::now();
 
-			mat4 m = getWorldMatrix() * createModelMatrix(translation, rotation) * model;
+		// The object is searched around its last known position.
+		mat4 lastModelView = getTrackingMatrix(transform);
+		vec3 searchCenter = transformPosition(lastModelView, vec3(0.f, 0.f, 0.f));
 
-			if (mode == tracking_mode_track_object)
-			{
-				trs t = mat4ToTRS(m);
+		ppf_candidate candidates[PPF_MAX_NUM_CANDIDATES];
+		uint32 numCandidates = relocalizer.findCandidates(model->model, cpuDepthPyramid, searchCenter, relocalizationSearchRadius, ppfSettings, candidates);
 
-				transform.position = t.position;
-				transform.rotation = t.rotation;
-			}
-			else
+		// The candidates are rough. Each one is refined with the ICP, and the one which explains the most depth pixels wins.
+		cpu_icp_view view = { &cpuDepthPyramid, mat4::identity };
+		cpu_icp_tracking_result best = {};
+		for (uint32 i = 0; i < numCandidates; ++i)
+		{
+			cpu_icp_tracking_result result = cpuICP.track(&view, 1, *model->mesh, candidates[i].modelView, settings);
+			if (result.valid && (!best.valid || result.numCorrespondences > best.numCorrespondences))
 			{
-				mat4 objectInCameraSpace = createViewMatrix(globalCameraPosition, globalCameraRotation) * m; // Transforms object space point to camera space.
-				mat4 f = trsToMat4(transform) * invert(objectInCameraSpace); // Transforms camera space point to world space.
-				trs t = mat4ToTRS(f);
-				
-				rotations[pushIndex] = t.rotation;
-				positions[pushIndex] = t.position;
-				++pushIndex;
+				best = result;
 			}
 		}
-	}
 
-	if (mode == tracking_mode_track_camera)
-	{
-		uint32 numTrackedObjects = pushIndex;
-		if (numTrackedObjects != 0)
+		lastRelocalizationTimeInMS = std::chrono::duration<float, std::milli>(std::chrono::high_resolution_clock::now() - start).count();
+
+		if (best.valid)
 		{
-			quat rotation = nlerp(rotations, 0, numTrackedObjects);
-			vec3 position = nlerp(positions, 0, numTrackedObjects);
+			LOG_MESSAGE("Relocalized object after %u lost frames (%u candidates, %.1fms)", data->numFramesLost, numCandidates, lastRelocalizationTimeInMS);
 
-			globalCameraRotation = rotation;
-			globalCameraPosition = position;
+			scene_entity entity = { entityHandle, scene };
+			data->poseFilter.reset();
+			data->numFramesLost = 0;
+
+			uint32 pushIndex = 0;
+			applyTrackedMatrix(entity, getWorldMatrix() * best.modelView, 0, 0, pushIndex);
 		}
 	}
+
+	relocalizeNow = false;
 }
 
 void depth_tracker::depthPrepass(dx_command_list* cl, const raster_component& rasterComponent, const transform_component& transform)
@@ -785,6 +937,8 @@ void depth_tracker::update()
 	globalCameraPosition = dummyPosRot.position;
 	globalCameraRotation = dummyPosRot.rotation;
 
+	frameArena.reset();
+
 	if (camera.isInitialized())
 	{
 		dx_command_list* cl = dxContext.getFreeRenderCommandList();
@@ -794,9 +948,23 @@ void depth_tracker::update()
 
 
 			// Upload new frame if available.
-			rgbd_frame frame;
-			if (camera.getFrame(frame, 0))
+			rgbd_frame_ref frame = camera.getLatestFrame();
+			if (frame && frame.frameID != lastProcessedFrameID)
 			{
+				lastProcessedFrameID = frame.frameID;
+
+				latestFrameTiming.frameID = frame.frameID;
+				latestFrameTiming.deviceTime = (int64)frame.deviceTimestampInMicroseconds;
+				latestFrameTiming.receiveTime = frame.hostTimestampInMicroseconds;
+				latestFrameTiming.pickupTime = getLatencyTimeInMicroseconds();
+
+				if (recorder.isRecording())
+				{
+					CPU_PROFILE_BLOCK("Record frame");
+
+					recorder.addFrame(frame.depth, frame.color, (uint64)frame.hostTimestampInMicroseconds);
+				}
+
 				if (camera.depthSensor.active)
 				{
 					PROFILE_ALL(cl, "Upload depth image");
@@ -813,6 +981,17 @@ void depth_tracker::update()
 					cl->transitionBarrier(cameraDepthTexture, D3D12_RESOURCE_STATE_COPY_DEST, D3D12_RESOURCE_STATE_GENERIC_READ);
 				}
 
+				if (camera.depthSensor.active && cpuTracking && tracking && !disableTracking)
+				{
+					trackOnCPU(frame.depth);
+				}
+
+				if (camera.depthSensor.active && (relocalization || relocalizeNow) && mode == tracking_mode_track_object && tracking && !disableTracking)
+				{
+					// CPU tracking has already built the pyramid of this frame, possibly from filtered depth.
+					relocalizeLostObjects(frame.depth, cpuTracking);
+				}
+
 				if (camera.colorSensor.active)
 				{
 					PROFILE_ALL(cl, "Upload color image");
@@ -827,16 +1006,9 @@ void depth_tracker::update()
 					cl->transitionBarrier(cameraColorTexture, D3D12_RESOURCE_STATE_GENERIC_READ, D3D12_RESOURCE_STATE_COPY_DEST);
 					UpdateSubresources<1>(cl->commandList.Get(), cameraColorTexture->resource.Get(), colorUploadBuffer->resource.Get(), 0, 0, 1, &subresource);
 					cl->transitionBarrier(cameraColorTexture, D3D12_RESOURCE_STATE_COPY_DEST, D3D12_RESOURCE_STATE_GENERIC_READ);
-
-
-					if (storeColorFrameCopy)
-					{
-						memcpy(colorFrameCopy, frame.color, camera.colorSensor.width * camera.colorSensor.height * sizeof(color_bgra));
-					}
 				}
-
-				camera.releaseFrame(frame);
 			}
+			frame.release();
 
 
 			auto group = getTrackedObjectGroup();
@@ -850,32 +1022,38 @@ void depth_tracker::update()
 				}
 			}
 
-			processLastTrackingJobs();
+			if (!cpuTracking)
+			{
+				processLastTrackingJobs();
 
+				// The jobs issued below track the frame, which is currently uploaded. Their results are read back NUM_BUFFERED_FRAMES later.
+				gpuJobTimings[dxContext.bufferedFrameID] = latestFrameTiming;
 
-			cl->transitionBarrier(renderedColorTexture, D3D12_RESOURCE_STATE_COMMON, D3D12_RESOURCE_STATE_RENDER_TARGET);
 
-			cl->clearRTV(renderedColorTexture, 0.f, 0.f, 0.f, 1.f);
-			cl->clearDepth(renderedDepthTexture);
+				cl->transitionBarrier(renderedColorTexture, D3D12_RESOURCE_STATE_COMMON, D3D12_RESOURCE_STATE_RENDER_TARGET);
 
-			cl->setPrimitiveTopology(D3D_PRIMITIVE_TOPOLOGY_TRIANGLELIST);
+				cl->clearRTV(renderedColorTexture, 0.f, 0.f, 0.f, 1.f);
+				cl->clearDepth(renderedDepthTexture);
 
-			for (auto [entityHandle, trackingComponent, rasterComponent, transform] : group.each())
-			{
-				depthPrepass(cl, rasterComponent, transform);
-			}
+				cl->setPrimitiveTopology(D3D_PRIMITIVE_TOPOLOGY_TRIANGLELIST);
 
-			for (auto [entityHandle, trackingComponent, rasterComponent, transform] : group.each())
-			{
-				createCorrespondences(cl, trackingComponent, rasterComponent, transform);
-			}
+				for (auto [entityHandle, trackingComponent, rasterComponent, transform] : group.each())
+				{
+					depthPrepass(cl, rasterComponent, transform);
+				}
 
-			for (auto [entityHandle, trackingComponent, rasterComponent, transform] : group.each())
-			{
-				accumulateCorrespondences(cl, trackingComponent);
-			}
+				for (auto [entityHandle, trackingComponent, rasterComponent, transform] : group.each())
+				{
+					createCorrespondences(cl, trackingComponent, rasterComponent, transform);
+				}
+
+				for (auto [entityHandle, trackingComponent, rasterComponent, transform] : group.each())
+				{
+					accumulateCorrespondences(cl, trackingComponent);
+				}
 
-			cl->transitionBarrier(renderedColorTexture, D3D12_RESOURCE_STATE_RENDER_TARGET, D3D12_RESOURCE_STATE_COMMON);
+				cl->transitionBarrier(renderedColorTexture, D3D12_RESOURCE_STATE_RENDER_TARGET, D3D12_RESOURCE_STATE_COMMON);
+			}
 		}
 		dxContext.executeCommandList(cl);
 
@@ -952,6 +1130,21 @@ void depth_tracker::drawSettings()
 	ImGui::Separator();
 #endif
 
+	if (ImGui::BeginProperties())
+	{
+		if (ImGui::PropertyButton("Play recording", ICON_FA_FOLDER_OPEN))
+		{
+			fs::path path = openFileDialog("RGB-D recordings", RGBD_RECORDING_EXTENSION);
+			if (!path.empty())
+			{
+				recorder.end();
+				initializeFromRecording(path);
+			}
+		}
+
+		ImGui::EndProperties();
+	}
+
 	if (camera.isInitialized())
 	{
 		if (ImGui::BeginProperties())
@@ -961,6 +1154,26 @@ void depth_tracker::drawSettings()
 			{
 				initialize(camera.info.type, camera.info.deviceIndex);
 			}
+
+			if (!recorder.isRecording())
+			{
+				if (ImGui::PropertyButton("Record", ICON_FA_CIRCLE))
+				{
+					fs::path path = saveFileDialog("RGB-D recordings", RGBD_RECORDING_EXTENSION);
+					if (!path.empty())
+					{
+						recorder.begin(path, camera);
+					}
+				}
+			}
+			else
+			{
+				ImGui::PropertyValue("Recorded frames", "%u", recorder.getNumFrames());
+				if (ImGui::PropertyButton("Stop recording", ICON_FA_STOP))
+				{
+					recorder.end();
+				}
+			}
 			ImGui::PropertySeparator();
 
 			ImGui::PropertyCheckbox("Visualize depth", showDepth);
@@ -974,22 +1187,93 @@ void depth_tracker::drawSettings()
 
 			ImGui::PropertyDropdown("Mode", trackingModeNames, 2, (uint32&)mode);
 
+			ImGui::PropertyCheckbox("Track on CPU (coarse to fine)", cpuTracking);
+			if (cpuTracking)
+			{
+				ImGui::PropertySlider("Pyramid levels", cpuTrackingNumLevels, 1, CPU_ICP_MAX_NUM_PYRAMID_LEVELS);
+				ImGui::PropertySlider("Max iterations per level", cpuTrackingMaxNumIterationsPerLevel, 1, 20);
+				ImGui::PropertySlider("Sampled correspondences (0: all)", cpuTrackingMaxNumSampledCorrespondences, 0, 50000);
+
+				ImGui::PropertyCheckbox("Filter depth", cpuDepthFilter);
+				if (cpuDepthFilter)
+				{
+					ImGui::PropertySlider("Filter radius", depthFilterSettings.radius, 1, DEPTH_PREPROCESSING_MAX_RADIUS);
+					ImGui::PropertySlider("Spatial sigma", depthFilterSettings.spatialSigma, 0.5f, 5.f, "%.2fpx");
+					ImGui::PropertySlider("Range sigma", depthFilterSettings.rangeSigma, 0.001f, 0.05f, "%.3fm");
+					ImGui::PropertyCheckbox("Fill holes", depthFilterSettings.fillHoles);
+					if (depthFilterSettings.fillHoles)
+					{
+						ImGui::PropertySlider("Min hole support", depthFilterSettings.minHoleSupport, 0.05f, 1.f);
+					}
+				}
+			}
+
 
 			ImGui::PropertySlider("Position threshold", positionThreshold, 0.f, 0.5f);
 			ImGui::PropertySliderAngle("Normal angle threshold", angleThreshold, 0.f, 90.f);
 
-			ImGui::PropertyCheckbox("Old smoothing mode", oldSmoothingMode);
-			if (oldSmoothingMode)
+			ImGui::PropertyCheckbox("Predictive pose filter", predictivePoseFilter);
+			if (predictivePoseFilter)
 			{
-				ImGui::PropertyDrag("Rotation smoothing", hRotation);
-				ImGui::PropertyDrag("Translation smoothing", hTranslation);
+				ImGui::PropertySlider("Prediction horizon", predictionHorizonInMS, 0.f, 200.f, "%.0fms");
+				ImGui::PropertyDrag("Rotation acceleration noise", poseFilterSettings.rotationAccelerationNoise, 0.1f);
+				ImGui::PropertyDrag("Translation acceleration noise", poseFilterSettings.translationAccelerationNoise, 0.01f);
+				ImGui::PropertySliderAngle("Rotation measurement noise", poseFilterSettings.rotationMeasurementNoise, 0.f, 5.f, "%.2f deg");
+				ImGui::PropertySlider("Translation measurement noise", poseFilterSettings.translationMeasurementNoise, 0.f, 0.02f, "%.4fm");
+
+				if (!recordingTrajectory)
+				{
+					if (ImGui::PropertyButton("Record trajectory", ICON_FA_CIRCLE))
+					{
+						recordedTrajectory.clear();
+						recordingTrajectory = true;
+					}
+				}
+				else
+				{
+					ImGui::PropertyValue("Recorded poses", "%u", (uint32)recordedTrajectory.size());
+					if (ImGui::PropertyButton("Stop and save trajectory", ICON_FA_STOP))
+					{
+						recordingTrajectory = false;
+						fs::path path = saveFileDialog("Pose trajectories", POSE_TRAJECTORY_EXTENSION);
+						if (!path.empty())
+						{
+							savePoseTrajectory(path, recordedTrajectory);
+						}
+						recordedTrajectory.clear();
+					}
+				}
 			}
 			else
 			{
-				ImGui::PropertySlider("Smoothing (higher is smoother)", smoothing);
+				ImGui::PropertyCheckbox("Old smoothing mode", oldSmoothingMode);
+				if (oldSmoothingMode)
+				{
+					ImGui::PropertyDrag("Rotation smoothing", hRotation);
+					ImGui::PropertyDrag("Translation smoothing", hTranslation);
+				}
+				else
+				{
+					ImGui::PropertySlider("Smoothing (higher is smoother)", smoothing);
+				}
 			}
 			ImGui::PropertyInput("Min number of correspondences", minNumCorrespondences);
 
+			if (mode == tracking_mode_track_object)
+			{
+				ImGui::PropertyCheckbox("Relocalize lost objects", relocalization);
+				if (relocalization)
+				{
+					ImGui::PropertySlider("Frames until relocalization", framesUntilRelocalization, 1, 60);
+					ImGui::PropertySlider("Relocalization search radius", relocalizationSearchRadius, 0.1f, 2.f, "%.2fm");
+				}
+				if (ImGui::PropertyButton("Relocalize all objects", ICON_FA_SEARCH))
+				{
+					relocalizeNow = true;
+				}
+				ImGui::PropertyValue("Last relocalization", "%.1fms (%u scene points)", lastRelocalizationTimeInMS, relocalizer.numScenePoints);
+			}
+
 
 			ImGui::PropertyDropdown("Correspondence mode", trackingCorrespondenceModeNames, 2, (uint32&)correspondenceMode);
 			ImGui::PropertyDropdown("Rotation representation", rotationRepresentationNames, 2, (uint32&)rotationRepresentation);
@@ -997,6 +1281,106 @@ void depth_tracker::drawSettings()
 			ImGui::EndProperties();
 		}
 
+		if (ImGui::BeginTree("Secondary depth cameras"))
+		{
+			if (ImGui::BeginProperties())
+			{
+				if (!cpuTracking)
+				{
+					ImGui::PropertyValue("Note", "Only fused by the CPU tracking. The GPU tracking ignores these cameras.");
+				}
+
+				for (uint32 i = 0; i < (uint32)secondaryCameras.size(); ++i)
+				{
+					secondary_depth_camera& secondary = *secondaryCameras[i];
+
+					ImGui::PushID(i);
+					ImGui::PropertyValue("Camera", secondary.camera.info.description.c_str());
+					ImGui::PropertyDrag("Position", secondary.position, 0.01f);
+					ImGui::PropertyDrag("Rotation", secondary.rotation, 0.1f);
+					if (ImGui::PropertyButton("Remove", ICON_FA_TRASH_ALT))
+					{
+						secondaryCameras.erase(secondaryCameras.begin() + i);
+						--i;
+					}
+					ImGui::PropertySeparator();
+					ImGui::PopID();
+				}
+
+				if (ImGui::PropertyButton("Refresh", ICON_FA_REDO_ALT))
+				{
+					rgbd_camera::enumerate();
+				}
+
+				for (const rgbd_camera_info& info : rgbd_camera::allConnectedRGBDCameras)
+				{
+					bool inUse = (info.type == camera.info.type && info.deviceIndex == camera.info.deviceIndex);
+					for (auto& secondary : secondaryCameras)
+					{
+						inUse |= (info.type == secondary->camera.info.type && info.deviceIndex == secondary->camera.info.deviceIndex);
+					}
+
+					if (!inUse && ImGui::PropertyButton(info.description.c_str(), ICON_FA_PLUS))
+					{
+						addSecondaryCamera(info.type, info.deviceIndex);
+					}
+				}
+
+				if (ImGui::PropertyButton("Add recording", ICON_FA_FOLDER_OPEN))
+				{
+					fs::path path = openFileDialog("RGB-D recordings", RGBD_RECORDING_EXTENSION);
+					if (!path.empty())
+					{
+						addSecondaryCamera(rgbd_camera_type_recording, 0, path);
+					}
+				}
+
+				ImGui::EndProperties();
+			}
+
+			ImGui::EndTree();
+		}
+
+		if (ImGui::BeginTree("Motion-to-photon latency"))
+		{
+			if (ImGui::BeginProperties())
+			{
+				for (uint32 i = 0; i < latency_stage_count; ++i)
+				{
+					const latency_histogram& h = motionToPhotonLatency.histograms[i];
+					ImGui::PropertyValue(latencyStageNames[i], "%.1fms mean, %.1fms 95%%, %.1fms max", h.mean(), h.percentile(0.95f), h.maximum * 0.001f);
+				}
+
+				ImGui::PropertyCheckbox("Record trace", motionToPhotonLatency.tracing);
+				ImGui::PropertyValue("Trace records", "%u", (uint32)motionToPhotonLatency.trace.size());
+
+				if (ImGui::PropertyButton("Save histograms", ICON_FA_SAVE))
+				{
+					fs::path path = saveFileDialog("Latency histograms", LATENCY_EXTENSION);
+					if (!path.empty())
+					{
+						motionToPhotonLatency.saveHistograms(path);
+					}
+				}
+				if (ImGui::PropertyButton("Save trace", ICON_FA_SAVE))
+				{
+					fs::path path = saveFileDialog("Latency traces", LATENCY_EXTENSION);
+					if (!path.empty())
+					{
+						motionToPhotonLatency.saveTrace(path);
+					}
+				}
+				if (ImGui::PropertyButton("Reset", ICON_FA_TRASH_ALT))
+				{
+					motionToPhotonLatency.reset();
+				}
+
+				ImGui::EndProperties();
+			}
+
+			ImGui::EndTree();
+		}
+
 		ImGui::Image(renderedColorTexture);
 
 		if (camera.colorSensor.active && ImGui::BeginTree("Color image"))
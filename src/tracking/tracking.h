@@ -1,11 +1,35 @@
 #pragma once
 
-#include "rgbd_camera.h"
+#include "async_rgbd_camera.h"
+#include "cpu_icp.h"
+#include "rgbd_recording.h"
+#include "pose_filter.h"
+#include "depth_preprocessing.h"
+#include "relocalization.h"
+#include "motion_to_photon.h"
 #include "dx/dx_texture.h"
 #include "dx/dx_buffer.h"
 #include "rendering/render_pass.h"
 #include "scene/scene.h"
+#include "core/memory.h"
 
+#include <atomic>
+
+
+// Point pair feature model of a tracked object, built on a background thread. The thread holds a reference, so an outdated build may finish
+// after it has been replaced.
+struct ppf_model_build
+{
+	asset_handle meshHandle;
+	vec3 scale;
+
+	// Only valid once finished.
+	ref<cpu_triangle_mesh> mesh;
+	ppf_model model;
+	bool valid = false;
+
+	std::atomic<bool> finished = false;
+};
 
 struct tracking_data
 {
@@ -23,6 +47,25 @@ struct tracking_data
 	uint32 numCorrespondences = 0;
 
 	mat4 startTrackingMatrix[NUM_BUFFERED_FRAMES];
+
+	ref<cpu_triangle_mesh> cpuMesh; // Only loaded for CPU tracking. Relocalization has its own in ppfModelBuild.
+
+	uint32 numFramesLost = 0; // Consecutive frames, in which the tracking failed.
+	ref<ppf_model_build> ppfModelBuild; // Only built for relocalization, as soon as the object is tracked.
+
+	pose_filter poseFilter;
+};
+
+// Additional depth camera, whose correspondences are fused into the CPU tracking of the main camera.
+struct secondary_depth_camera
+{
+	async_rgbd_camera camera;
+
+	// Pose of this camera's depth sensor relative to the main camera's depth sensor.
+	vec3 position = vec3(0.f, 0.f, 0.f);
+	vec3 rotation = vec3(0.f, 0.f, 0.f); // Euler angles in degrees.
+
+	cpu_icp_pyramid pyramid;
 };
 
 struct tracking_component
@@ -68,10 +111,9 @@ struct depth_tracker
 	quat globalCameraRotation = quat::identity;
 
 
-	bool storeColorFrameCopy = false;
-	color_bgra* colorFrameCopy = 0;
-
-	rgbd_camera camera;
+	// Polled on its own thread. Other consumers (e.g. calibration) can grab the latest frame directly from the camera.
+	async_rgbd_camera camera;
+	rgbd_recorder recorder;
 
 	bool disableTracking = false;
 
@@ -79,6 +121,27 @@ struct depth_tracker
 	tracking_rotation_representation rotationRepresentation = tracking_rotation_representation_lie;
 	tracking_mode mode = tracking_mode_track_object;
 
+	// Tracks on the CPU, coarse to fine with several iterations per camera frame. The pose is updated as soon as the frame arrives.
+	bool cpuTracking = false;
+	uint32 cpuTrackingNumLevels = 3;
+	uint32 cpuTrackingMaxNumIterationsPerLevel = 5;
+	uint32 cpuTrackingMaxNumSampledCorrespondences = 0; // Normal-space sampling. 0 reduces all correspondences.
+
+	// Bilateral filtering and hole filling of the main camera's depth before CPU tracking.
+	bool cpuDepthFilter = false;
+	depth_preprocessing_settings depthFilterSettings;
+
+	// Searches objects, which have been lost for a number of frames, in the main camera's depth and snaps them back. Object tracking only.
+	bool relocalization = false;
+	uint32 framesUntilRelocalization = 10;
+	float relocalizationSearchRadius = 0.5f; // Around the last known position.
+	ppf_settings ppfSettings;
+
+	// Filters the tracked poses and predicts them to the time they are displayed. Replaces the smoothing modes below.
+	bool predictivePoseFilter = false;
+	float predictionHorizonInMS = 60.f; // Latency from camera exposure to projector display.
+	pose_filter_settings poseFilterSettings;
+
 	scene_entity dummyTrackerEntity;
 
 private:
@@ -87,11 +150,23 @@ private:
 
 
 	void initialize(rgbd_camera_type cameraType, uint32 deviceIndex);
+	void initializeFromRecording(const fs::path& path);
+	void initializeCameraResources();
 	void initializeDummy();
+	void addSecondaryCamera(rgbd_camera_type cameraType, uint32 deviceIndex, const fs::path& recordingPath = {});
 	
 	void initializeTrackingData(ref<tracking_data>& data);
 
 	void processLastTrackingJobs();
+	bool solveLastTrackingJob(tracking_data& trackingData, mat4& measurement);
+	void trackOnCPU(const uint16* depth);
+	void relocalizeLostObjects(const uint16* depth, bool pyramidIsCurrent);
+	const ppf_model_build* requestPPFModel(tracking_data& data, asset_handle meshHandle, vec3 scale);
+	cpu_icp_tracking_settings getCPUTrackingSettings();
+
+	mat4 filterTrackedPose(scene_entity entity, tracking_data& data, const mat4& measurement, const pose_timing& timing);
+	void applyTrackedMatrix(scene_entity entity, const mat4& m, quat* rotations, vec3* positions, uint32& pushIndex);
+	void applyTrackedCamera(const quat* rotations, const vec3* positions, uint32 numTrackedObjects);
 
 	auto getTrackedObjectGroup() { return scene.group(entt::get<tracking_component, raster_component, transform_component>); }
 	
@@ -105,6 +180,27 @@ private:
 	ref<dx_buffer> depthUploadBuffer;
 	ref<dx_buffer> colorUploadBuffer;
 
+	cpu_multi_view_icp cpuICP;
+	cpu_icp_pyramid cpuDepthPyramid;
+	depth_preprocessor depthPreprocessor;
+	std::vector<uint16> filteredDepth;
+
+	ppf_relocalizer relocalizer;
+	bool relocalizeNow = false; // Relocalizes all objects in the next frame, whether lost or not.
+	float lastRelocalizationTimeInMS = 0.f;
+
+	std::vector<ref<secondary_depth_camera>> secondaryCameras; // Only used by CPU tracking.
+
+	uint64 lastProcessedFrameID = 0;
+
+	pose_timing latestFrameTiming; // Of the frame, which was last uploaded and tracked.
+	pose_timing gpuJobTimings[NUM_BUFFERED_FRAMES]; // Of the frames, which the GPU tracking jobs in flight were issued for.
+
+	memory_arena frameArena; // Scratch memory, which lives until the next update.
+
+	bool recordingTrajectory = false;
+	std::vector<pose_sample> recordedTrajectory; // Unfiltered poses of the first tracked object, for evaluating the pose filter.
+
 	ref<dx_texture> renderedColorTexture; // For debug window only.
 	ref<dx_texture> renderedDepthTexture;
 
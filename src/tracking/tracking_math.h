@@ -0,0 +1,199 @@
+#pragma once
+
+#include "core/math.h"
+
+#include "tracking_rs.hlsli"
+
+// Math shared by the GPU and CPU ICP paths: the 6-vector of a linearized rigid motion, the SE(3) exponential and logarithm maps and
+// the solver for the 6x6 normal equations.
+
+struct vec6
+{
+	float m[6];
+
+	vec6() {}
+	vec6(tracking_atb v)
+	{
+		memcpy(m, v.m, sizeof(float) * 6);
+	}
+	vec6(float a, float b, float c, float d, float e, float f)
+	{
+		m[0] = a; m[1] = b; m[2] = c; m[3] = d; m[4] = e; m[5] = f;
+	}
+};
+
+static vec6 operator*(const tracking_ata& m, const vec6& v)
+{
+	vec6 result;
+	result.m[0] = m.m[ata_m00] * v.m[0] + m.m[ata_m01] * v.m[1] + m.m[ata_m02] * v.m[2] + m.m[ata_m03] * v.m[3] + m.m[ata_m04] * v.m[4] + m.m[ata_m05] * v.m[5];
+	result.m[1] = m.m[ata_m01] * v.m[0] + m.m[ata_m11] * v.m[1] + m.m[ata_m12] * v.m[2] + m.m[ata_m13] * v.m[3] + m.m[ata_m14] * v.m[4] + m.m[ata_m15] * v.m[5];
+	result.m[2] = m.m[ata_m02] * v.m[0] + m.m[ata_m12] * v.m[1] + m.m[ata_m22] * v.m[2] + m.m[ata_m23] * v.m[3] + m.m[ata_m24] * v.m[4] + m.m[ata_m25] * v.m[5];
+	result.m[3] = m.m[ata_m03] * v.m[0] + m.m[ata_m13] * v.m[1] + m.m[ata_m23] * v.m[2] + m.m[ata_m33] * v.m[3] + m.m[ata_m34] * v.m[4] + m.m[ata_m35] * v.m[5];
+	result.m[4] = m.m[ata_m04] * v.m[0] + m.m[ata_m14] * v.m[1] + m.m[ata_m24] * v.m[2] + m.m[ata_m34] * v.m[3] + m.m[ata_m44] * v.m[4] + m.m[ata_m45] * v.m[5];
+	result.m[5] = m.m[ata_m05] * v.m[0] + m.m[ata_m15] * v.m[1] + m.m[ata_m25] * v.m[2] + m.m[ata_m35] * v.m[3] + m.m[ata_m45] * v.m[4] + m.m[ata_m55] * v.m[5];
+	return result;
+}
+
+static vec6 operator+(const vec6& a, const vec6& b)
+{
+	vec6 result;
+	for (uint32 i = 0; i < 6; ++i)
+	{
+		result.m[i] = a.m[i] + b.m[i];
+	}
+	return result;
+}
+
+static vec6 operator-(const vec6& a, const vec6& b)
+{
+	vec6 result;
+	for (uint32 i = 0; i < 6; ++i)
+	{
+		result.m[i] = a.m[i] - b.m[i];
+	}
+	return result;
+}
+
+static vec6 operator*(const vec6& a, float b)
+{
+	vec6 result;
+	for (uint32 i = 0; i < 6; ++i)
+	{
+		result.m[i] = a.m[i] * b;
+	}
+	return result;
+}
+
+static float dot(const vec6& a, const vec6& b)
+{
+	float result = 0.f;
+	for (uint32 i = 0; i < 6; ++i)
+	{
+		result += a.m[i] * b.m[i];
+	}
+	return result;
+}
+
+inline std::ostream& operator<<(std::ostream& s, const tracking_ata& m)
+{
+	s << "[" << m.m[ata_m00] << ", " << m.m[ata_m01] << ", " << m.m[ata_m02] << ", " << m.m[ata_m03] << ", " << m.m[ata_m04] << ", " << m.m[ata_m05] << "]\n";
+	s << "[" << m.m[ata_m01] << ", " << m.m[ata_m11] << ", " << m.m[ata_m12] << ", " << m.m[ata_m13] << ", " << m.m[ata_m14] << ", " << m.m[ata_m15] << "]\n";
+	s << "[" << m.m[ata_m02] << ", " << m.m[ata_m12] << ", " << m.m[ata_m22] << ", " << m.m[ata_m23] << ", " << m.m[ata_m24] << ", " << m.m[ata_m25] << "]\n";
+	s << "[" << m.m[ata_m03] << ", " << m.m[ata_m13] << ", " << m.m[ata_m23] << ", " << m.m[ata_m33] << ", " << m.m[ata_m34] << ", " << m.m[ata_m35] << "]\n";
+	s << "[" << m.m[ata_m04] << ", " << m.m[ata_m14] << ", " << m.m[ata_m24] << ", " << m.m[ata_m34] << ", " << m.m[ata_m44] << ", " << m.m[ata_m45] << "]\n";
+	s << "[" << m.m[ata_m05] << ", " << m.m[ata_m15] << ", " << m.m[ata_m25] << ", " << m.m[ata_m35] << ", " << m.m[ata_m45] << ", " << m.m[ata_m55] << "]";
+	return s;
+}
+
+inline std::ostream& operator<<(std::ostream& s, tracking_atb v)
+{
+	s << "[" << v.m[0] << ", " << v.m[1] << ", " << v.m[2] << ", " << v.m[3] << ", " << v.m[4] << ", " << v.m[5] << "]";
+	return s;
+}
+
+inline std::ostream& operator<<(std::ostream& s, vec6 v)
+{
+	s << "[" << v.m[0] << ", " << v.m[1] << ", " << v.m[2] << ", " << v.m[3] << ", " << v.m[4] << ", " << v.m[5] << "]";
+	return s;
+}
+
+struct rotation_translation
+{
+	mat3 rotation;
+	vec3 translation;
+};
+
+static rotation_translation lieExp(vec6 lie)
+{
+	vec3 u(lie.m[3], lie.m[4], lie.m[5]);
+	vec3 w(lie.m[0], lie.m[1], lie.m[2]);
+
+	float theta_2 = dot(w, w);
+
+	float a, b, c;
+	if (theta_2 < 1e-6f)
+	{
+		// Use Tailor expansion.
+		a = 1.f + theta_2 * (-1.f / 6.f + theta_2 * (1.f / 120.f - theta_2 / 5040.f));
+		b = 0.5f + theta_2 * (-1.f / 24.f + theta_2 * (1.f / 720.f - theta_2 / 40320.f));
+		c = 1.f / 6.f + theta_2 * (-1.f / 120.f + theta_2 * (1.f / 5040.f - theta_2 / 362880.f));
+	}
+	else
+	{
+		float theta = sqrt(theta_2);
+		a = sin(theta) / theta;
+		b = (1.f - cos(theta)) / theta_2;
+		c = (1.f - a) / theta_2;
+	}
+
+	mat3 w_x = getSkewMatrix(w);
+	mat3 w_x_2 = w_x * w_x;
+
+	mat3 R = mat3::identity + a * w_x + b * w_x_2;
+	vec3 t = (mat3::identity + b * w_x + c * w_x_2) * u;
+
+	return { R, t };
+}
+
+static vec6 lieLog(rotation_translation Rt)
+{
+	float theta = acos(clamp(0.5f * (trace(Rt.rotation) - 1.f), -1.f, 1.f)); // Rounding can push the trace slightly out of range.
+	float theta_2 = theta * theta;
+
+	float a, b;
+	if (theta_2 < 1e-6f)
+	{
+		a = 1.f + theta_2 * (-1.f / 6.f + theta_2 * (1.f / 120.f - theta_2 / 5040.f));
+		b = 0.5f + theta_2 * (-1.f / 24.f + theta_2 * (1.f / 720.f - theta_2 / 40320.f));
+	}
+	else
+	{
+		a = sin(theta) / theta;
+		b = (1.f - cos(theta)) / theta_2;
+	}
+	
+	mat3 w_x = (0.5f / a) * (Rt.rotation - transpose(Rt.rotation));
+	vec3 w(w_x.m21, w_x.m02, w_x.m10);
+	mat3 w_x_2 = w_x * w_x;
+	mat3 V_inv = mat3::identity - 0.5f * w_x;
+	if (theta_2 > 0.f)
+	{
+		V_inv += 1.f / theta_2 * (1.f - 0.5f * a / b) * w_x_2;
+	}
+
+	vec3 u = V_inv * Rt.translation;
+
+	return vec6(w.x, w.y, w.z, u.x, u.y, u.z);
+}
+
+static vec6 solve(const tracking_ata& A, const tracking_atb& b, uint32 maxNumIterations = 20)
+{
+	vec6 x;
+	memset(&x, 0, sizeof(x));
+
+	vec6 r = b - A * x;
+	vec6 p = r;
+
+	float rdotr = dot(r, r);
+
+	uint32 k;
+	for (k = 0; k < maxNumIterations; ++k)
+	{
+		vec6 Ap = A * p;
+		float alpha = rdotr / dot(p, Ap);
+		x = x + p * alpha;
+		r = r - Ap * alpha;
+
+		float oldrdotr = rdotr;
+		rdotr = dot(r, r);
+		if (rdotr < 1e-5f)
+		{
+			break;
+		}
+
+		float beta = rdotr / oldrdotr;
+		p = r + p * beta;
+	}
+
+	return x;
+}